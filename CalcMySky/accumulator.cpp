@@ -0,0 +1,276 @@
+#include "accumulator.hpp"
+
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <QOpenGLContext>
+#include <QFile>
+
+#include "data.hpp"
+#include "util.hpp"
+#include "report.hpp"
+#include "texsave.hpp"
+#include "scheduler.hpp"
+#include "../common/timing.hpp"
+
+namespace
+{
+
+std::vector<GLsizei> scatteringTextureSizes()
+{
+    return {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]};
+}
+
+// The region is copied, so the accumulation can go on while it's being written in background
+void saveHostDataRegion(std::vector<glm::vec4> const& data, const std::string_view name, std::string const& path,
+                        std::vector<GLsizei> const& sizes, const glm::ivec3 regionOffset, const glm::ivec3 regionSize,
+                        const TextureElementType elementType)
+{
+    if(opts.dbgNoSaveTextures)
+    {
+        std::cerr << indentOutput() << "Would save " << name << ", but only shaders are to be saved.\n";
+        return;
+    }
+
+    StageTimer timer("save texture");
+    std::cerr << indentOutput() << "Saving " << name << " to \"" << path << "\"... ";
+
+    const size_t width=atmo.scatTexWidth(), height=atmo.scatTexHeight();
+    std::vector<glm::vec4> region;
+    region.reserve(size_t(regionSize.x)*regionSize.y*regionSize.z);
+    for(int z=0; z<regionSize.z; ++z)
+    {
+        for(int y=0; y<regionSize.y; ++y)
+        {
+            const auto rowBegin=data.begin()+((regionOffset.z+z)*height+regionOffset.y+y)*width+regionOffset.x;
+            region.insert(region.end(), rowBegin, rowBegin+regionSize.x);
+        }
+    }
+    const auto header=textureFileHeader(std::vector<uint16_t>(sizes.begin(), sizes.end()), elementType);
+    const size_t byteSize=header.size()*sizeof header[0] + region.size()*4*textureElementSize(elementType);
+
+    runInBackground("writing "+std::string(name)+" to \""+path+"\"", [path, header, elementType, region=std::move(region)]
+    {
+        QFile out(QString::fromStdString(path));
+        if(!out.open(QFile::WriteOnly))
+            throw std::runtime_error("failed to open file: "+out.errorString().toStdString());
+        out.write(reinterpret_cast<const char*>(header.data()), header.size()*sizeof header[0]);
+        if(elementType==TextureElementType::Float16)
+        {
+            const auto halves=toHalfPrecision(&region[0][0], region.size()*4, path);
+            out.write(reinterpret_cast<const char*>(halves.data()), halves.size()*sizeof halves[0]);
+        }
+        else
+        {
+            out.write(reinterpret_cast<const char*>(region.data()), region.size()*sizeof region[0]);
+        }
+        out.close();
+        if(out.error())
+            throw std::runtime_error("failed to write file: "+out.errorString().toStdString());
+    });
+    reportBytesWritten(byteSize);
+    std::cerr << "queued\n";
+}
+
+}
+
+ScatteringAccumulator::ScatteringAccumulator()
+{
+    if(opts.hostAccumulatorTileLayers)
+    {
+        data_.resize(size_t(atmo.scatTexWidth())*atmo.scatTexHeight()*atmo.scatTexDepth());
+        return;
+    }
+
+    gl.glGenTextures(1, &texture_);
+    gl.glBindTexture(GL_TEXTURE_3D,texture_);
+    gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+    gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+    gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+    gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
+    setupTexture(texture_, atmo.scatTexWidth(),atmo.scatTexHeight(),atmo.scatTexDepth());
+}
+
+ScatteringAccumulator::~ScatteringAccumulator()
+{
+    // Accumulators still alive at exit outlive the context, which has freed the texture then
+    if(texture_ && QOpenGLContext::currentContext())
+        gl.glDeleteTextures(1, &texture_);
+}
+
+GLuint ScatteringAccumulator::textureForSampling(const GLuint scratchTexture) const
+{
+    if(texture_) return texture_;
+
+    gl.glBindTexture(GL_TEXTURE_3D,scratchTexture);
+    gl.glTexSubImage3D(GL_TEXTURE_3D,0,0,0,0,atmo.scatTexWidth(),atmo.scatTexHeight(),atmo.scatTexDepth(),
+                       GL_RGBA,GL_FLOAT,data_.data());
+    gl.glBindTexture(GL_TEXTURE_3D,0);
+    if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
+    {
+        std::cerr << "GL error while uploading accumulator data: " << openglErrorString(err) << "\n";
+        throw MustQuit{};
+    }
+    return scratchTexture;
+}
+
+void ScatteringAccumulator::addTexture(const GLuint sourceTexture, glm::mat4 const& weights, const bool blend,
+                                       const std::string_view whatIsBeingDone)
+{
+    if(opts.dbgNoSaveTextures) return; // don't take time to do useless computations
+
+    if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
+    {
+        std::cerr << "FAILED on entry to ScatteringAccumulator::addTexture(): " << openglErrorString(err) << "\n";
+        throw MustQuit{};
+    }
+
+    std::cerr << indentOutput() << whatIsBeingDone << "... ";
+    const auto time0=std::chrono::steady_clock::now();
+
+    const GLsizei width=atmo.scatTexWidth(), height=atmo.scatTexHeight(), depth=atmo.scatTexDepth();
+    const size_t texelsPerLayer=size_t(width)*height;
+    const GLsizei layersPerTile=std::min(GLsizei(opts.hostAccumulatorTileLayers), depth);
+    const size_t layerByteSize=texelsPerLayer*sizeof(glm::vec4);
+
+    // While one tile is being added, the next one is being read back into the other buffer
+    GLuint pbos[2];
+    GLsync fences[2]={};
+    gl.glGenBuffers(2, pbos);
+    for(const auto pbo : pbos)
+    {
+        gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        gl.glBufferData(GL_PIXEL_PACK_BUFFER, layersPerTile*layerByteSize, nullptr, GL_STREAM_READ);
+    }
+    const auto startReadback=[&](const GLsizei firstLayer, const unsigned bufferIndex)
+    {
+        gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[bufferIndex]);
+        readTextureLayers(sourceTexture, glm::ivec3(0,0,firstLayer), {width,height}, std::min(layersPerTile, depth-firstLayer));
+        gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fences[bufferIndex]=gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        gl.glFlush();
+    };
+
+    startReadback(0, 0);
+    for(GLsizei firstLayer=0, tileIndex=0; firstLayer<depth; firstLayer+=layersPerTile, ++tileIndex)
+    {
+        const unsigned bufferIndex=tileIndex%2;
+        if(firstLayer+layersPerTile<depth)
+            startReadback(firstLayer+layersPerTile, 1-bufferIndex);
+
+        std::ostringstream ss;
+        ss << firstLayer << " of " << depth << " layers done";
+        std::cerr << ss.str();
+
+        constexpr GLuint64 pollTimeout=100'000'000; // ns
+        GLenum status;
+        while((status=gl.glClientWaitSync(fences[bufferIndex], 0, pollTimeout))==GL_TIMEOUT_EXPIRED);
+        gl.glDeleteSync(fences[bufferIndex]);
+        if(status==GL_WAIT_FAILED)
+        {
+            std::cerr << "FAILED to wait for readback to complete: " << openglErrorString(gl.glGetError()) << "\n";
+            throw MustQuit{};
+        }
+
+        const auto layerCount=std::min(layersPerTile, depth-firstLayer);
+        const size_t texelCount=layerCount*texelsPerLayer;
+        gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[bufferIndex]);
+        const auto source=static_cast<const glm::vec4*>(gl.glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, texelCount*sizeof(glm::vec4),
+                                                                            GL_MAP_READ_BIT));
+        if(!source)
+        {
+            std::cerr << "FAILED to map pixel buffer: " << openglErrorString(gl.glGetError()) << "\n";
+            throw MustQuit{};
+        }
+        const auto dest=data_.data()+firstLayer*texelsPerLayer;
+        if(blend)
+        {
+            for(size_t i=0; i<texelCount; ++i)
+                dest[i] += weights*source[i];
+        }
+        else
+        {
+            for(size_t i=0; i<texelCount; ++i)
+                dest[i] = weights*source[i];
+        }
+        gl.glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        // Clear previous status and reset cursor position
+        const auto statusWidth=ss.tellp();
+        std::cerr << std::string(statusWidth, '\b') << std::string(statusWidth, ' ')
+                  << std::string(statusWidth, '\b');
+    }
+    gl.glDeleteBuffers(2, pbos);
+    if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
+    {
+        std::cerr << "FAILED: " << openglErrorString(err) << "\n";
+        throw MustQuit{};
+    }
+    reportBytesReadBack(depth*layerByteSize);
+    const auto time1=std::chrono::steady_clock::now();
+    std::cerr << "done in " << formatDeltaTime(time0, time1) << "\n";
+}
+
+void ScatteringAccumulator::save(const std::string_view name, std::string const& path) const
+{
+    if(texture_)
+    {
+        saveTexture(GL_TEXTURE_3D, texture_, name, path, scatteringTextureSizes());
+        return;
+    }
+    saveHostDataRegion(data_, name, path, scatteringTextureSizes(), glm::ivec3(0),
+                       glm::ivec3(atmo.scatTexWidth(), atmo.scatTexHeight(), atmo.scatTexDepth()), TextureElementType::Float32);
+}
+
+void ScatteringAccumulator::saveForRendering(const std::string_view name, std::string const& path,
+                                             const TextureElementType elementType) const
+{
+    if(texture_)
+    {
+        saveScatteringTexture(texture_, name, path, elementType);
+        return;
+    }
+    const auto region=precomputedScatteringTextureRegion();
+    saveHostDataRegion(data_, name, path, region.sizes, region.offset, region.size, elementType);
+}
+
+void ScatteringAccumulator::load(const std::string_view name, std::string const& path)
+{
+    if(texture_)
+    {
+        loadTexture(GL_TEXTURE_3D, texture_, name, path, scatteringTextureSizes());
+        return;
+    }
+
+    std::cerr << indentOutput() << "Loading " << name << " from \"" << path << "\"... ";
+    QFile in(QString::fromStdString(path));
+    if(!in.open(QFile::ReadOnly))
+    {
+        std::cerr << "failed to open file: " << in.errorString().toStdString() << "\n";
+        throw MustQuit{};
+    }
+    for(const uint16_t expectedSize : scatteringTextureSizes())
+    {
+        uint16_t s;
+        if(in.read(reinterpret_cast<char*>(&s), sizeof s) != sizeof s)
+        {
+            std::cerr << "failed to read header: " << in.errorString().toStdString() << "\n";
+            throw MustQuit{};
+        }
+        if(s!=expectedSize)
+        {
+            std::cerr << "unexpected texture size in the header: " << s << " instead of " << expectedSize << "\n";
+            throw MustQuit{};
+        }
+    }
+    const qint64 sizeToRead=data_.size()*sizeof data_[0];
+    if(in.read(reinterpret_cast<char*>(data_.data()), sizeToRead) != sizeToRead)
+    {
+        std::cerr << "failed to read texture data: " << (in.error() ? in.errorString().toStdString() : "file is too short") << "\n";
+        throw MustQuit{};
+    }
+    std::cerr << "done\n";
+}
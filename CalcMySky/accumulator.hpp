@@ -0,0 +1,41 @@
+#ifndef INCLUDE_ONCE_34836658_DD01_4C6E_A66A_173EE45E640B
+#define INCLUDE_ONCE_34836658_DD01_4C6E_A66A_173EE45E640B
+
+#include <string>
+#include <vector>
+#include <string_view>
+#include <glm/glm.hpp>
+#include <QOpenGLFunctions_3_3_Core>
+#include "../common/texture-file.hpp"
+
+/* Accumulator of a 4D scattering texture, summing the scattering orders or the wavelength sets. Normally it's a
+ * 3D texture blended into by rendering. With opts.hostAccumulatorTileLayers nonzero it's kept in host memory
+ * instead, and the source texture is read back and added to it in tiles of that many altitude layers. None of
+ * the integrals sample the accumulators, so then the only 4D textures resident in VRAM are delta scattering
+ * and scattering density.
+ */
+class ScatteringAccumulator
+{
+    GLuint texture_=0;
+    std::vector<glm::vec4> data_;
+public:
+    ScatteringAccumulator();
+    ~ScatteringAccumulator();
+    ScatteringAccumulator(ScatteringAccumulator const&)=delete;
+    ScatteringAccumulator& operator=(ScatteringAccumulator const&)=delete;
+
+    bool inHostMemory() const { return !texture_; }
+    // Only valid if the accumulator isn't in host memory
+    GLuint texture() const { return texture_; }
+    // Returns the texture with the accumulated data. If they are in host memory, they are uploaded into scratchTexture.
+    GLuint textureForSampling(GLuint scratchTexture) const;
+    // Host memory version of blending: sets the accumulator to weights*source, or adds it if blend is true
+    void addTexture(GLuint sourceTexture, glm::mat4 const& weights, bool blend, std::string_view whatIsBeingDone);
+
+    void save(std::string_view name, std::string const& path) const;
+    // Saves only the part that covers the precomputed domain of altitudes and Sun zenith angles
+    void saveForRendering(std::string_view name, std::string const& path, TextureElementType elementType) const;
+    void load(std::string_view name, std::string const& path);
+};
+
+#endif
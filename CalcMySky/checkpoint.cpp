@@ -0,0 +1,265 @@
+#include "checkpoint.hpp"
+
+#include <map>
+#include <iostream>
+#include <filesystem>
+#include <QCryptographicHash>
+#include <QTextStream>
+#include <QSaveFile>
+#include <QFile>
+
+#include "data.hpp"
+#include "util.hpp"
+#include "texsave.hpp"
+#include "report.hpp"
+#include "scheduler.hpp"
+#include "inputhashes.hpp"
+
+namespace
+{
+
+constexpr char hashKey[]="atmosphere hash";
+constexpr char wavelengthSetsDoneKey[]="wavelength sets done";
+constexpr char scatteringOrdersDoneKey[]="scattering orders done";
+constexpr char slotKey[]="slot";
+constexpr char accumulatorsKey[]="single scattering accumulators";
+constexpr char deltaEnergiesKey[]="delta scattering energies";
+
+// Checkpoints are written alternately into two slots, so that a crash while a checkpoint is
+// being saved leaves the previous one intact. The progress file is replaced atomically at the end.
+unsigned lastSlot=1;
+
+std::string checkpointDir() { return atmo.textureOutputDir+"/checkpoint"+opts.wavelengthSetRangeSuffix(); }
+std::string slotDir(const unsigned slot) { return checkpointDir()+"/"+std::to_string(slot); }
+std::string progressFilePath() { return checkpointDir()+"/progress.txt"; }
+
+std::vector<GLsizei> scatteringTextureSizes()
+{
+    return {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]};
+}
+
+// XXX: keep in sync with the options hashed by computeInputHashes(), every option that changes the results must be here
+QString atmosphereHash()
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(atmo.descriptionFileText.toUtf8());
+    // Saving as radiance and the range of wavelength sets change the contents of the accumulators, so they must match too
+    hash.addData(opts.saveResultAsRadiance ? "radiance" : "luminance");
+    hash.addData(QString("wlsets %1-%2").arg(opts.firstWavelengthSet).arg(opts.lastWavelengthSet).toUtf8());
+    hash.addData(QString("convergence %1 %2").arg(opts.convergenceTolerance, 0, 'g', 17).arg(int(opts.extrapolateTail)).toUtf8());
+    hash.addData(QString("transmittance %1 %2").arg(int(opts.cumulativeTransmittance)).arg(opts.numberDensityLUTSize).toUtf8());
+    hash.addData(QString("phase functions %1 %2").arg(opts.phaseFunctionLUTSize).arg(int(opts.prefilterPhaseFunctions)).toUtf8());
+    hash.addData(QString("storage precision %1").arg(int(opts.storagePrecision)).toUtf8());
+    hash.addData(QString("preview %1").arg(int(opts.preview)).toUtf8());
+    // Doesn't change the results, but the groups of sets computed together must start where the checkpoint was saved
+    hash.addData(QString("wlsets per pass %1").arg(opts.wavelengthSetsPerPass).toUtf8());
+    return hash.result().toHex();
+}
+
+std::map<QString, QString> readProgress()
+{
+    std::map<QString, QString> progress;
+    QFile file(QString::fromStdString(progressFilePath()));
+    if(!file.exists())
+        return progress;
+    if(!file.open(QFile::ReadOnly))
+    {
+        std::cerr << "Failed to open checkpoint progress file \"" << progressFilePath() << "\": " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    QTextStream in(&file);
+    for(QString line; in.readLineInto(&line);)
+    {
+        const auto colonPos=line.indexOf(':');
+        if(colonPos<0) continue;
+        progress[line.left(colonPos).trimmed()]=line.mid(colonPos+1).trimmed();
+    }
+    return progress;
+}
+
+unsigned getUInt(std::map<QString, QString> const& progress, const char* key)
+{
+    bool ok=false;
+    unsigned value=0;
+    if(const auto it=progress.find(key); it!=progress.end())
+        value=it->second.toUInt(&ok);
+    if(!ok)
+    {
+        std::cerr << "Bad or missing \"" << key << "\" entry in checkpoint progress file \"" << progressFilePath() << "\"\n";
+        throw MustQuit{};
+    }
+    return value;
+}
+
+}
+
+void saveCheckpoint(CheckpointState const& state, std::vector<TaskHandle> const& outputsOfDoneSets)
+{
+    if(opts.dbgNoSaveTextures || opts.noCheckpoints) return;
+
+    StageTimer timer("checkpoint");
+    for(const auto& task : outputsOfDoneSets)
+        waitForTask(task);
+    std::cerr << indentOutput() << "Saving checkpoint:\n";
+    OutputIndentIncrease incr;
+
+    const unsigned slot = 1-lastSlot;
+    const auto dir=slotDir(slot);
+    createDirs(dir);
+
+    saveTexture(GL_TEXTURE_2D,textures[TEX_IRRADIANCE],"irradiance texture",
+                dir+"/irradiance.f32", {atmo.irradianceTexW, atmo.irradianceTexH});
+    multipleScatteringAccumulator->save("multiple scattering accumulator texture", dir+"/multiple-scattering.f32");
+    if(state.scatteringOrdersDone)
+    {
+        // Inputs for the next scattering order
+        saveTexture(GL_TEXTURE_2D,textures[TEX_DELTA_IRRADIANCE],"delta irradiance texture",
+                    dir+"/delta-irradiance.f32", {atmo.irradianceTexW, atmo.irradianceTexH});
+        saveTexture(GL_TEXTURE_3D,textures[TEX_DELTA_SCATTERING],"delta scattering texture",
+                    dir+"/delta-scattering.f32", scatteringTextureSizes());
+    }
+    QStringList accumulatorNames;
+    for(const auto& [name, accumulator] : singleScatteringAccumulators)
+    {
+        accumulator->save("single scattering accumulator texture", dir+"/single-scattering-"+name.toStdString()+".f32");
+        accumulatorNames << name;
+    }
+
+    // The progress file must only refer to textures that are completely written, including those of the
+    // completed wavelength sets that may still be computed and written in background
+    waitForBackgroundTasks();
+    finishTextureSaves();
+    saveOutputHashes();
+
+    std::cerr << indentOutput() << "Updating checkpoint progress file... ";
+    QSaveFile file(QString::fromStdString(progressFilePath()));
+    if(!file.open(QFile::WriteOnly))
+    {
+        std::cerr << "failed to open file: " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    QTextStream out(&file);
+    out << hashKey << ": " << atmosphereHash() << "\n";
+    out << wavelengthSetsDoneKey << ": " << state.wavelengthSetsDone << "\n";
+    out << scatteringOrdersDoneKey << ": " << state.scatteringOrdersDone << "\n";
+    out << slotKey << ": " << slot << "\n";
+    out << accumulatorsKey << ": " << accumulatorNames.join(',') << "\n";
+    QStringList energies;
+    if(state.scatteringOrdersDone)
+    {
+        for(const auto& energy : deltaScatteringEnergies)
+            energies << QString("%1 %2 %3 %4").arg(energy[0], 0, 'g', 17).arg(energy[1], 0, 'g', 17)
+                                              .arg(energy[2], 0, 'g', 17).arg(energy[3], 0, 'g', 17);
+    }
+    out << deltaEnergiesKey << ": " << energies.join(',') << "\n";
+    out.flush();
+    if(!file.commit())
+    {
+        std::cerr << "failed to write file: " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    lastSlot=slot;
+    std::cerr << "done\n";
+}
+
+CheckpointState restoreCheckpoint()
+{
+    const auto progress=readProgress();
+    if(progress.empty())
+    {
+        if(opts.resume)
+            std::cerr << "No checkpoint found in \"" << checkpointDir() << "\", starting from the beginning\n";
+        return {};
+    }
+    if(!opts.resume)
+    {
+        std::cerr << "A checkpoint of an unfinished computation exists in \"" << checkpointDir()
+                  << "\". Use --resume to continue it, or remove the directory to start anew.\n";
+        throw MustQuit{};
+    }
+    if(const auto it=progress.find(hashKey); it==progress.end() || it->second!=atmosphereHash())
+    {
+        std::cerr << "Checkpoint in \"" << checkpointDir() << "\" was made for a different atmosphere description or options\n";
+        throw MustQuit{};
+    }
+
+    CheckpointState state;
+    state.wavelengthSetsDone=getUInt(progress, wavelengthSetsDoneKey);
+    state.scatteringOrdersDone=getUInt(progress, scatteringOrdersDoneKey);
+    const auto slot=getUInt(progress, slotKey);
+    if(slot>1 || state.wavelengthSetsDone>atmo.allWavelengths.size() ||
+       state.scatteringOrdersDone>atmo.scatteringOrdersToCompute)
+    {
+        std::cerr << "Inconsistent checkpoint progress file \"" << progressFilePath() << "\"\n";
+        throw MustQuit{};
+    }
+
+    std::cerr << "Restoring checkpoint: " << state.wavelengthSetsDone << " wavelength sets done";
+    if(state.scatteringOrdersDone)
+        std::cerr << ", " << state.scatteringOrdersDone << " scattering orders done in the next one";
+    std::cerr << "\n";
+    OutputIndentIncrease incr;
+
+    const auto dir=slotDir(slot);
+    loadTexture(GL_TEXTURE_2D,textures[TEX_IRRADIANCE],"irradiance texture",
+                dir+"/irradiance.f32", {atmo.irradianceTexW, atmo.irradianceTexH});
+    multipleScatteringAccumulator->load("multiple scattering accumulator texture", dir+"/multiple-scattering.f32");
+    if(state.scatteringOrdersDone)
+    {
+        loadTexture(GL_TEXTURE_2D,textures[TEX_DELTA_IRRADIANCE],"delta irradiance texture",
+                    dir+"/delta-irradiance.f32", {atmo.irradianceTexW, atmo.irradianceTexH});
+        loadTexture(GL_TEXTURE_3D,textures[TEX_DELTA_SCATTERING],"delta scattering texture",
+                    dir+"/delta-scattering.f32", scatteringTextureSizes());
+    }
+    const auto accumulatorsIt=progress.find(accumulatorsKey);
+    if(accumulatorsIt==progress.end())
+    {
+        std::cerr << "Missing \"" << accumulatorsKey << "\" entry in checkpoint progress file \"" << progressFilePath() << "\"\n";
+        throw MustQuit{};
+    }
+    for(const auto& name : accumulatorsIt->second.split(','))
+    {
+        if(name.isEmpty()) continue;
+        auto& accumulator=singleScatteringAccumulators[name];
+        accumulator=std::make_unique<ScatteringAccumulator>();
+        accumulator->load("single scattering accumulator texture", dir+"/single-scattering-"+name.toStdString()+".f32");
+    }
+
+    deltaScatteringEnergies.clear();
+    if(state.scatteringOrdersDone)
+    {
+        const auto energiesIt=progress.find(deltaEnergiesKey);
+        if(energiesIt==progress.end())
+        {
+            std::cerr << "Missing \"" << deltaEnergiesKey << "\" entry in checkpoint progress file \"" << progressFilePath() << "\"\n";
+            throw MustQuit{};
+        }
+        for(const auto& energyStr : energiesIt->second.split(','))
+        {
+            if(energyStr.isEmpty()) continue;
+            const auto components=energyStr.split(' ');
+            glm::dvec4 energy;
+            bool ok=components.size()==4;
+            for(int i=0; ok && i<4; ++i)
+                energy[i]=components[i].toDouble(&ok);
+            if(!ok)
+            {
+                std::cerr << "Bad \"" << deltaEnergiesKey << "\" entry in checkpoint progress file \"" << progressFilePath() << "\"\n";
+                throw MustQuit{};
+            }
+            deltaScatteringEnergies.push_back(energy);
+        }
+    }
+    lastSlot=slot;
+    return state;
+}
+
+void removeCheckpoint()
+{
+    namespace fs=std::filesystem;
+    if(std::error_code err; fs::remove_all(fs::u8path(checkpointDir()), err)==static_cast<std::uintmax_t>(-1))
+    {
+        std::cerr << "Warning: failed to remove checkpoint directory \"" << checkpointDir() << "\": "
+                  << QString::fromLocal8Bit(err.message().c_str()) << "\n";
+    }
+}
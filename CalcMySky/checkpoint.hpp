@@ -0,0 +1,20 @@
+#ifndef INCLUDE_ONCE_E48FB212_7FF7_4A2C_80BD_ED5402ACCB53
+#define INCLUDE_ONCE_E48FB212_7FF7_4A2C_80BD_ED5402ACCB53
+
+#include "scheduler.hpp"
+
+struct CheckpointState
+{
+    unsigned wavelengthSetsDone=0;
+    // Scattering orders done in the wavelength set following the completed ones
+    unsigned scatteringOrdersDone=0;
+};
+
+/* The tasks in outputsOfDoneSets, writing textures of the completed wavelength sets in background, are waited
+ * for before anything is saved, so that a failure of one of them leaves the previous checkpoint in place.
+ */
+void saveCheckpoint(CheckpointState const& state, std::vector<TaskHandle> const& outputsOfDoneSets={});
+CheckpointState restoreCheckpoint();
+void removeCheckpoint();
+
+#endif
@@ -1,5 +1,6 @@
 #include "cmdline.hpp"
 
+#include <string>
 #include <iomanip>
 #include <optional>
 #include <iostream>
@@ -21,6 +22,10 @@
 namespace
 {
 
+constexpr char shadersOnlyOptionName[]="shaders-only";
+constexpr char estimateOptionName[]="estimate";
+constexpr char phaseFunctionLUTOptionName[]="phase-function-lut";
+
 QStringList wordWrap(QString const& longLine, const int maxWidth)
 {
     const auto words=longLine.split(' ');
@@ -158,27 +163,121 @@ void showHelp(std::ostream& s, QList<QCommandLineOption> const& options, QString
 
 }
 
-void handleCmdLine()
+namespace
+{
+
+// The options are also parsed by noOpenGLRequested(), before QApplication is created
+struct CommandLine
 {
     QCommandLineParser parser;
     // QCommandLineParser::addHelpOption() results in ugly help wrapped at 79 columns, so not using it.
-    const QCommandLineOption helpOpt({"h","help"}, "Display this help and exit");
+    const QCommandLineOption helpOpt{{"h","help"}, "Display this help and exit"};
     // We do it a bit differently from QCommandLineParser, so not using addVersionOption()
-    const QCommandLineOption versionOpt({"v","version"}, "Display version and exit");
-    const QCommandLineOption textureOutputDirOpt("out-dir","Directory for the textures computed","output directory",".");
-    const QCommandLineOption saveResultAsRadianceOpt("radiance","Save result as radiance instead of XYZW components");
-    const QCommandLineOption dbgNoSaveTexturesOpt("no-save-tex","Don't save textures, only save shaders and other fast-to-compute data; don't run the long 4D "
-                                                                "textures computations (for debugging)");
-    const QCommandLineOption dbgNoEDSTexturesOpt("no-eds-tex","Don't compute/save eclipsed double scattering textures (for debugging)");
-    const QCommandLineOption dbgSaveGroundIrradianceOpt("save-irradiance","Save intermediate ground irradiance textures (for debugging)");
-    const QCommandLineOption dbgSaveScatDensityOrder2FromGroundOpt("save-scat-density2-from-ground","Save order 2 scattering density from ground (for debugging)");
-    const QCommandLineOption dbgSaveScatDensityOpt("save-scat-density","Save scattering density textures (for debugging)");
-    const QCommandLineOption dbgSaveDeltaScatteringOpt("save-delta-scattering","Save delta scattering textures for each order (for debugging)");
-    const QCommandLineOption dbgSaveAccumScatteringOpt("save-accum-scattering","Save accumulated multiple scattering textures for each order (for debugging)");
-    const QList options{
+    const QCommandLineOption versionOpt{{"v","version"}, "Display version and exit"};
+    const QCommandLineOption textureOutputDirOpt{"out-dir","Directory for the textures computed","output directory","."};
+    const QCommandLineOption saveResultAsRadianceOpt{"radiance","Save result as radiance instead of XYZW components"};
+    const QCommandLineOption wavelengthSetsOpt{"wlsets","Compute only wavelength sets from A to B inclusive, counting from 0, and save partial "
+                                                        "XYZW accumulator textures to be summed by calcmysky-merge","A-B"};
+    const QCommandLineOption layersPerDrawOpt{"layers-per-draw","Number of 3D texture layers to render in a single draw call (default: 0, "
+                                                                "meaning as many as take about 0.2 s, judging by the first layer)","N"};
+    const QCommandLineOption wavelengthSetsPerPassOpt{"wlsets-per-pass","Compute the scattering orders from 3 on for N consecutive wavelength "
+                                                                     "sets at once, computing the geometry of the scattering density "
+                                                                     "integral once for all of them. The intermediate textures are kept "
+                                                                     "for each of the N sets. Checkpoints are only saved between the groups "
+                                                                     "of sets, and --radiance isn't supported (default: 1, at most "
+                                                                     +QString::number(MAX_WAVELENGTH_SETS_PER_PASS)+")","N"};
+    const QCommandLineOption hostAccumulatorsOpt{"host-accumulators","Keep the scattering accumulators in host memory instead of VRAM, "
+                                                                 "adding each scattering order to them in tiles of N altitude layers "
+                                                                 "read back at a time. This saves VRAM, but the intermediate 4D "
+                                                                 "textures are still whole, so the scattering texture must fit in "
+                                                                 "GL_MAX_3D_TEXTURE_SIZE (default: 0, meaning accumulate in VRAM)","N"};
+    const QCommandLineOption storagePrecisionOpt{"storage-precision","Precision of the saved textures and of the 4D intermediate textures "
+                                                                   "in bits per component, 16 or 32. Accumulators and transmittance are "
+                                                                   "kept in 32 bits (default: 32)","BITS"};
+    const QCommandLineOption saveQueueMemoryLimitOpt{"save-queue-limit","Maximum memory in MiB held by textures waiting to be written to "
+                                                                         "files in background (default: 2048)","MiB"};
+    const QCommandLineOption backgroundThreadsOpt{"cpu-threads","Number of threads doing CPU-side work like interpolation of eclipsed "
+                                                                 "double scattering and writing of files in background (default: 0, "
+                                                                 "meaning the number of CPU cores)","N"};
+    const QCommandLineOption convergenceToleranceOpt{"convergence-tolerance","Stop computing scattering orders of a wavelength set when the "
+                                                                          "contribution of the last order relative to the sum of all the "
+                                                                          "multiple scattering orders drops below TOL (default: 0, meaning "
+                                                                          "always compute all the orders)","TOL"};
+    const QCommandLineOption extrapolateTailOpt{"extrapolate-tail","On convergence, add a geometric series estimate of the scattering "
+                                                                   "orders not computed"};
+    const QCommandLineOption reportOpt{"report","Write a JSON report with GPU and wall time, bytes read back and written per stage, "
+                                                "wavelength set and scattering order","run.json"};
+    const QCommandLineOption resumeOpt{"resume","Resume an interrupted computation from the checkpoint saved in the output directory"};
+    const QCommandLineOption noCheckpointsOpt{"no-checkpoints","Don't save checkpoints after each scattering order and wavelength set"};
+    const QCommandLineOption recomputeAllOpt{"recompute-all","Recompute all the textures, even those in the output directory whose "
+                                                              "inputs haven't changed since they were saved"};
+    const QCommandLineOption noProgramBinaryCacheOpt{"no-program-cache","Don't load or save linked shader program binaries in the on-disk cache"};
+    const QCommandLineOption shadersOnlyOpt{shadersOnlyOptionName,"Only save the shaders for ShowMySky, without an OpenGL context unless the "
+                                                                  "--phase-function-lut tables are to be saved too. The shaders are validated "
+                                                                  "by glslangValidator if it's installed"};
+    const QCommandLineOption estimateOpt{estimateOptionName,"Only print the estimated time, VRAM, host memory and disk space needed for "
+                                                            "the computation, without an OpenGL context"};
+    const QCommandLineOption calibrationOpt{"calibration","Take the throughputs of the kernels for --estimate from the report (see --report) "
+                                                          "of a previous run on the target device","run.json"};
+    const QCommandLineOption tuneOpt{"tune-integration","Instead of computing the textures, find the smallest integration point counts "
+                                                         "whose results on reduced textures differ from those with 4 times the configured "
+                                                         "counts by at most TOL relatively, and print them. Also print the counts "
+                                                         "each radial integration rule needs to be as accurate as the configured one. Multiple scattering is "
+                                                         "represented by its order 2 in the tuning","TOL"};
+    const QCommandLineOption tunedOutputOpt{"tuned-output","Write a copy of the atmosphere description with the counts found by "
+                                                           "--tune-integration","file.atmo"};
+    const QCommandLineOption previewOpt{"preview","Compute scattering orders from 2 on approximately, assuming isotropic scattering for them, "
+                                                  "and skip eclipsed double scattering. Transmittance and single scattering are exact. "
+                                                  "The error of the approximation is estimated on reduced textures and printed at the end"};
+    const QCommandLineOption cumulativeTransmittanceOpt{"cumulative-transmittance","Compute transmittance from prefix sums of column densities "
+                                                                               "along the lines of the rays instead of integrating along each ray"};
+    const QCommandLineOption dbgCheckCumulativeTransmittanceOpt{"check-cumulative-transmittance","Compare the column densities of "
+                                                                "--cumulative-transmittance with brute-force integration (for debugging)"};
+    const QCommandLineOption densityLUTOpt{"density-lut","Tabulate the number densities of the species at N altitudes and sample the "
+                                                         "tables in the computations instead of evaluating the density functions. "
+                                                         "The error of interpolation is printed. Saved shaders keep the functions","N"};
+    const QCommandLineOption phaseFunctionLUTOpt{phaseFunctionLUTOptionName,"Tabulate the phase functions at N scattering angles for each wavelength "
+                                                                   "set and sample the tables both in the computations and in the saved "
+                                                                   "shaders","N"};
+    const QCommandLineOption prefilterPhaseFunctionsOpt{"prefilter-phase-functions","Average the phase functions over the angles covered "
+                                                                                    "by each entry of --phase-function-lut tables"};
+    const QCommandLineOption dbgNoSaveTexturesOpt{"no-save-tex","Don't save textures, only save shaders and other fast-to-compute data; don't run the long 4D "
+                                                                "textures computations (for debugging)"};
+    const QCommandLineOption dbgNoEDSTexturesOpt{"no-eds-tex","Don't compute/save eclipsed double scattering textures (for debugging)"};
+    const QCommandLineOption dbgSaveGroundIrradianceOpt{"save-irradiance","Save intermediate ground irradiance textures (for debugging)"};
+    const QCommandLineOption dbgSaveScatDensityOrder2FromGroundOpt{"save-scat-density2-from-ground","Save order 2 scattering density from ground (for debugging)"};
+    const QCommandLineOption dbgSaveScatDensityOpt{"save-scat-density","Save scattering density textures (for debugging)"};
+    const QCommandLineOption dbgSaveDeltaScatteringOpt{"save-delta-scattering","Save delta scattering textures for each order (for debugging)"};
+    const QCommandLineOption dbgSaveAccumScatteringOpt{"save-accum-scattering","Save accumulated multiple scattering textures for each order (for debugging)"};
+    const QList<QCommandLineOption> options{
                         helpOpt,
                         versionOpt,
                         textureOutputDirOpt,
+                        wavelengthSetsOpt,
+                        layersPerDrawOpt,
+                        wavelengthSetsPerPassOpt,
+                        hostAccumulatorsOpt,
+                        storagePrecisionOpt,
+                        saveQueueMemoryLimitOpt,
+                        backgroundThreadsOpt,
+                        convergenceToleranceOpt,
+                        extrapolateTailOpt,
+                        reportOpt,
+                        resumeOpt,
+                        noCheckpointsOpt,
+                        recomputeAllOpt,
+                        shadersOnlyOpt,
+                        estimateOpt,
+                        calibrationOpt,
+                        tuneOpt,
+                        tunedOutputOpt,
+                        previewOpt,
+                        cumulativeTransmittanceOpt,
+                        dbgCheckCumulativeTransmittanceOpt,
+                        densityLUTOpt,
+                        phaseFunctionLUTOpt,
+                        prefilterPhaseFunctionsOpt,
+                        noProgramBinaryCacheOpt,
                         dbgNoSaveTexturesOpt,
                         dbgNoEDSTexturesOpt,
                         saveResultAsRadianceOpt,
@@ -188,10 +287,21 @@ void handleCmdLine()
                         dbgSaveDeltaScatteringOpt,
                         dbgSaveAccumScatteringOpt,
                        };
-    parser.addOptions(options);
-    const std::pair<QString, QString> positionalArgument("atmosphere-description.atmo",
-                                                         "Atmosphere description file");
-    parser.addPositionalArgument("atmo-descr", positionalArgument.second, positionalArgument.first);
+    const std::pair<QString, QString> positionalArgument{"atmosphere-description.atmo",
+                                                         "Atmosphere description file"};
+
+    CommandLine()
+    {
+        parser.addOptions(options);
+        parser.addPositionalArgument("atmo-descr", positionalArgument.second, positionalArgument.first);
+    }
+    void handle();
+};
+
+}
+
+void CommandLine::handle()
+{
     parser.process(*qApp);
 
     if(parser.isSet(helpOpt))
@@ -206,6 +316,219 @@ void handleCmdLine()
     }
     if(parser.isSet(textureOutputDirOpt))
         atmo.textureOutputDir=parser.value(textureOutputDirOpt).toStdString();
+    if(parser.isSet(layersPerDrawOpt))
+    {
+        bool ok=false;
+        opts.layersPerDraw=parser.value(layersPerDrawOpt).toUInt(&ok);
+        if(!ok)
+        {
+            std::cerr << "Bad number of layers per draw: " << parser.value(layersPerDrawOpt) << "\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(hostAccumulatorsOpt))
+    {
+        bool ok=false;
+        opts.hostAccumulatorTileLayers=parser.value(hostAccumulatorsOpt).toUInt(&ok);
+        if(!ok)
+        {
+            std::cerr << "Bad number of layers per accumulator tile: " << parser.value(hostAccumulatorsOpt) << "\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(storagePrecisionOpt))
+    {
+        bool ok=false;
+        const auto bits=parser.value(storagePrecisionOpt).toUInt(&ok);
+        if(!ok || (bits!=16 && bits!=32))
+        {
+            std::cerr << "Bad storage precision: " << parser.value(storagePrecisionOpt) << ", must be 16 or 32\n";
+            throw MustQuit{};
+        }
+        opts.storagePrecision=TextureElementType(bits);
+    }
+    if(parser.isSet(saveQueueMemoryLimitOpt))
+    {
+        bool ok=false;
+        opts.saveQueueMemoryLimitMiB=parser.value(saveQueueMemoryLimitOpt).toUInt(&ok);
+        if(!ok)
+        {
+            std::cerr << "Bad save queue memory limit: " << parser.value(saveQueueMemoryLimitOpt) << "\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(backgroundThreadsOpt))
+    {
+        bool ok=false;
+        opts.backgroundThreads=parser.value(backgroundThreadsOpt).toUInt(&ok);
+        if(!ok)
+        {
+            std::cerr << "Bad number of CPU threads: " << parser.value(backgroundThreadsOpt) << "\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(convergenceToleranceOpt))
+    {
+        bool ok=false;
+        opts.convergenceTolerance=parser.value(convergenceToleranceOpt).toDouble(&ok);
+        if(!ok || !(opts.convergenceTolerance>=0))
+        {
+            std::cerr << "Bad convergence tolerance: " << parser.value(convergenceToleranceOpt) << "\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(extrapolateTailOpt))
+    {
+        if(opts.convergenceTolerance==0)
+        {
+            std::cerr << "Option --" << extrapolateTailOpt.names()[0] << " requires --" << convergenceToleranceOpt.names()[0] << "\n";
+            throw MustQuit{};
+        }
+        opts.extrapolateTail=true;
+    }
+    if(parser.isSet(reportOpt))
+        opts.reportPath=parser.value(reportOpt);
+    if(parser.isSet(resumeOpt))
+        opts.resume=true;
+    if(parser.isSet(shadersOnlyOpt))
+    {
+        for(const auto& opt : {&reportOpt, &resumeOpt})
+        {
+            if(parser.isSet(*opt))
+            {
+                std::cerr << "Option --" << shadersOnlyOpt.names()[0] << " can't be combined with --" << opt->names()[0] << "\n";
+                throw MustQuit{};
+            }
+        }
+        opts.shadersOnly=true;
+    }
+    if(parser.isSet(estimateOpt))
+    {
+        if(parser.isSet(shadersOnlyOpt))
+        {
+            std::cerr << "Option --" << estimateOpt.names()[0] << " can't be combined with --" << shadersOnlyOpt.names()[0] << "\n";
+            throw MustQuit{};
+        }
+        opts.estimateOnly=true;
+    }
+    if(parser.isSet(calibrationOpt))
+    {
+        if(!parser.isSet(estimateOpt))
+        {
+            std::cerr << "Option --" << calibrationOpt.names()[0] << " requires --" << estimateOpt.names()[0] << "\n";
+            throw MustQuit{};
+        }
+        opts.calibrationReportPath=parser.value(calibrationOpt);
+    }
+    if(parser.isSet(tuneOpt))
+    {
+        for(const auto& opt : {&shadersOnlyOpt, &estimateOpt, &reportOpt, &resumeOpt})
+        {
+            if(parser.isSet(*opt))
+            {
+                std::cerr << "Option --" << tuneOpt.names()[0] << " can't be combined with --" << opt->names()[0] << "\n";
+                throw MustQuit{};
+            }
+        }
+        bool ok=false;
+        opts.tuningTolerance=parser.value(tuneOpt).toDouble(&ok);
+        if(!ok || !(opts.tuningTolerance>0))
+        {
+            std::cerr << "Bad tuning tolerance: " << parser.value(tuneOpt) << "\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(tunedOutputOpt))
+    {
+        if(!parser.isSet(tuneOpt))
+        {
+            std::cerr << "Option --" << tunedOutputOpt.names()[0] << " requires --" << tuneOpt.names()[0] << "\n";
+            throw MustQuit{};
+        }
+        opts.tunedDescriptionPath=parser.value(tunedOutputOpt);
+    }
+    if(parser.isSet(previewOpt))
+    {
+        for(const auto& opt : {&shadersOnlyOpt, &tuneOpt, &resumeOpt, &convergenceToleranceOpt})
+        {
+            if(parser.isSet(*opt))
+            {
+                std::cerr << "Option --" << previewOpt.names()[0] << " can't be combined with --" << opt->names()[0] << "\n";
+                throw MustQuit{};
+            }
+        }
+        opts.preview=true;
+        // A preview takes seconds, so there's nothing to resume, and ShowMySky must not look for the textures not computed
+        opts.noCheckpoints=true;
+        opts.dbgNoEDSTextures=true;
+    }
+    if(parser.isSet(cumulativeTransmittanceOpt))
+        opts.cumulativeTransmittance=true;
+    if(parser.isSet(dbgCheckCumulativeTransmittanceOpt))
+    {
+        if(!parser.isSet(cumulativeTransmittanceOpt))
+        {
+            std::cerr << "Option --" << dbgCheckCumulativeTransmittanceOpt.names()[0] << " requires --" << cumulativeTransmittanceOpt.names()[0] << "\n";
+            throw MustQuit{};
+        }
+        opts.dbgCheckCumulativeTransmittance=true;
+    }
+    if(parser.isSet(densityLUTOpt))
+    {
+        bool ok=false;
+        opts.numberDensityLUTSize=parser.value(densityLUTOpt).toUInt(&ok);
+        if(!ok || opts.numberDensityLUTSize<2)
+        {
+            std::cerr << "Bad density LUT size: " << parser.value(densityLUTOpt) << "\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(phaseFunctionLUTOpt))
+    {
+        bool ok=false;
+        opts.phaseFunctionLUTSize=parser.value(phaseFunctionLUTOpt).toUInt(&ok);
+        if(!ok || opts.phaseFunctionLUTSize<2)
+        {
+            std::cerr << "Bad phase function LUT size: " << parser.value(phaseFunctionLUTOpt) << "\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(prefilterPhaseFunctionsOpt))
+    {
+        if(!parser.isSet(phaseFunctionLUTOpt))
+        {
+            std::cerr << "Option --" << prefilterPhaseFunctionsOpt.names()[0] << " requires --" << phaseFunctionLUTOpt.names()[0] << "\n";
+            throw MustQuit{};
+        }
+        opts.prefilterPhaseFunctions=true;
+    }
+    if(parser.isSet(noCheckpointsOpt))
+        opts.noCheckpoints=true;
+    if(parser.isSet(wavelengthSetsPerPassOpt))
+    {
+        bool ok=false;
+        opts.wavelengthSetsPerPass=parser.value(wavelengthSetsPerPassOpt).toUInt(&ok);
+        if(!ok || opts.wavelengthSetsPerPass<1 || opts.wavelengthSetsPerPass>MAX_WAVELENGTH_SETS_PER_PASS)
+        {
+            std::cerr << "Bad number of wavelength sets per pass: " << parser.value(wavelengthSetsPerPassOpt) << "\n";
+            throw MustQuit{};
+        }
+        // Radiance is saved from the accumulator of each wavelength set, which the sets of a group would share,
+        // and neither the preview nor the tuning computes the scattering density of the higher orders
+        for(const auto& opt : {&saveResultAsRadianceOpt, &previewOpt, &tuneOpt})
+        {
+            if(opts.wavelengthSetsPerPass>1 && parser.isSet(*opt))
+            {
+                std::cerr << "Option --" << wavelengthSetsPerPassOpt.names()[0] << " with more than one set can't be combined with --"
+                          << opt->names()[0] << "\n";
+                throw MustQuit{};
+            }
+        }
+    }
+    if(parser.isSet(recomputeAllOpt))
+        opts.recomputeAll=true;
+    if(parser.isSet(noProgramBinaryCacheOpt))
+        opts.noProgramBinaryCache=true;
     if(parser.isSet(dbgNoSaveTexturesOpt))
         opts.dbgNoSaveTextures=true;
     if(parser.isSet(dbgNoEDSTexturesOpt))
@@ -237,4 +560,42 @@ void handleCmdLine()
 
     const auto atmoDescrFileName=posArgs[0];
     atmo.parse(atmoDescrFileName);
+
+    opts.lastWavelengthSet=atmo.allWavelengths.size()-1;
+    if(parser.isSet(wavelengthSetsOpt))
+    {
+        const auto value=parser.value(wavelengthSetsOpt);
+        const auto match=QRegularExpression("^([0-9]+)(?:-([0-9]+))?$").match(value);
+        if(!match.hasMatch())
+        {
+            std::cerr << "Bad format of wavelength sets range \"" << value << "\", expected A-B\n";
+            throw MustQuit{};
+        }
+        opts.firstWavelengthSet=match.captured(1).toUInt();
+        opts.lastWavelengthSet=match.captured(2).isEmpty() ? opts.firstWavelengthSet : match.captured(2).toUInt();
+        if(opts.firstWavelengthSet>opts.lastWavelengthSet || opts.lastWavelengthSet>=atmo.allWavelengths.size())
+        {
+            std::cerr << "Bad wavelength sets range " << value << ": valid sets are from 0 to " << atmo.allWavelengths.size()-1 << "\n";
+            throw MustQuit{};
+        }
+    }
+}
+
+void handleCmdLine()
+{
+    CommandLine().handle();
+}
+
+bool noOpenGLRequested(const int argc, char** argv)
+{
+    CommandLine cmdLine;
+    QStringList args;
+    for(int i=0; i<argc; ++i)
+        args << QString::fromLocal8Bit(argv[i]);
+    // Errors are ignored here: they are reported when the command line is handled after the application is created
+    cmdLine.parser.parse(args);
+    if(cmdLine.parser.isSet(cmdLine.estimateOpt))
+        return true;
+    // The phase functions are tabulated by the GPU even in the shaders-only mode
+    return cmdLine.parser.isSet(cmdLine.shadersOnlyOpt) && !cmdLine.parser.isSet(cmdLine.phaseFunctionLUTOpt);
 }
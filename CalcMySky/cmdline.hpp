@@ -2,5 +2,7 @@
 #define INCLUDE_ONCE_7040200F_F1EB_4F3A_8413_F6B29C2D16A4
 
 void handleCmdLine();
+// Used to decide whether a GUI application object is needed, before the command line is parsed
+bool noOpenGLRequested(int argc, char** argv);
 
 #endif
@@ -0,0 +1,38 @@
+#ifndef INCLUDE_ONCE_3809C800_BCE4_4A24_BC52_8FCC0F0F2A98
+#define INCLUDE_ONCE_3809C800_BCE4_4A24_BC52_8FCC0F0F2A98
+
+#include <memory>
+#include <vector>
+#include <utility>
+#include <QString>
+#include <QOpenGLShaderProgram>
+#include "../common/AtmosphereParameters.hpp"
+
+/* Stages of the computation, defined in main.cpp, that the tuning mode runs on their own. Each of them works
+ * on the textures and the virtual sources of the current wavelength set.
+ */
+
+// Texels of the 4D scattering textures outside of the precomputed domain of altitudes and SZAs are only
+// needed as inputs to the next scattering orders, so passes whose outputs are only saved can skip them.
+// The other passes can't: the scattering density at a point integrates the delta scattering over all the
+// view directions, and the delta scattering integrates the density along the whole view ray, through the
+// altitudes and SZAs outside of the domain.
+enum class TexelDomain
+{
+    All,
+    Precomputed,
+};
+
+void setupWavelengthSetSources(unsigned texIndex);
+void setupSourcesAsAfterScatteringOrder2(unsigned texIndex);
+void renderTransmittance();
+void computeDirectGroundIrradiance(unsigned texIndex);
+void setupSingleScatteringSources(unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer);
+void renderSingleScattering(unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer);
+void computeScatteringDensityOrder2(unsigned texIndex, bool saveSingleScattering=true);
+void computeMultipleScatteringFromDensity(unsigned scatteringOrder, unsigned texIndex, TexelDomain domain=TexelDomain::All);
+std::shared_ptr<QOpenGLShaderProgram> compileEclipsedDoubleScatteringComputationProgram(std::vector<std::pair<QString, QString>>* sourcesToSave=nullptr);
+float unitRangeTexCoordToCosSZA(float texCoord);
+float unitRangeTexCoordToCameraAltitude(float texCoord);
+
+#endif
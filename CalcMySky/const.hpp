@@ -8,15 +8,26 @@ constexpr char DENSITIES_SHADER_FILENAME[]="densities.frag";
 constexpr char PHASE_FUNCTIONS_SHADER_FILENAME[]="phase-functions.frag";
 constexpr char TOTAL_SCATTERING_COEFFICIENT_SHADER_FILENAME[]="total-scattering-coefficient.frag";
 constexpr char COMPUTE_TRANSMITTANCE_SHADER_FILENAME[]="compute-transmittance-functions.frag";
+constexpr char RADIAL_QUADRATURE_SHADER_FILENAME[]="radial-quadrature.frag";
+constexpr char COMPUTE_COLUMN_DENSITIES_SHADER_FILENAME[]="compute-column-densities-functions.frag";
+constexpr char COMPUTE_NUMBER_DENSITY_LUT_FILENAME[]="compute-number-density-lut.frag";
+constexpr char COMPUTE_PHASE_FUNCTION_LUT_FILENAME[]="compute-phase-function-lut.frag";
 constexpr char CONSTANTS_HEADER_FILENAME[]="const.h.glsl";
 constexpr char DENSITIES_HEADER_FILENAME[]="densities.h.glsl";
 constexpr char RADIANCE_TO_LUMINANCE_HEADER_FILENAME[]="radiance-to-luminance.h.glsl";
 constexpr char PHASE_FUNCTIONS_HEADER_FILENAME[]="phase-functions.h.glsl";
 constexpr char TOTAL_SCATTERING_COEFFICIENT_HEADER_FILENAME[]="total-scattering-coefficient.h.glsl";
 constexpr char COMPUTE_SCATTERING_DENSITY_FILENAME[]="compute-scattering-density.frag";
+constexpr char COMPUTE_SCATTERING_DENSITY_FOR_WAVELENGTH_SETS_FILENAME[]="compute-scattering-density-wlsets.frag";
 constexpr char COMPUTE_ECLIPSED_DOUBLE_SCATTERING_FILENAME[]="compute-eclipsed-double-scattering.frag";
 constexpr char SINGLE_SCATTERING_ECLIPSED_FILENAME[]="single-scattering-eclipsed.frag";
 constexpr char DOUBLE_SCATTERING_ECLIPSED_FILENAME[]="double-scattering-eclipsed.frag";
 constexpr char COMPUTE_INDIRECT_IRRADIANCE_FILENAME[]="compute-indirect-irradiance.frag";
+// Reserved for the number density LUT, which stays bound for the whole run
+constexpr int NUMBER_DENSITY_LUT_TEXTURE_UNIT=15;
+// Each wavelength set of a pass samples three textures, and they must all fit below the units reserved for the LUTs
+constexpr unsigned MAX_WAVELENGTH_SETS_PER_PASS=4;
+// Followed by "A-B.f32", where A and B are the first and last wavelength sets summed in the partial accumulator
+constexpr char PARTIAL_ACCUMULATOR_SUFFIX[]="-xyzw-wlsets";
 
 #endif
@@ -5,11 +5,14 @@
 #include <map>
 #include <cmath>
 #include <array>
+#include <string>
 #include <vector>
 #include <memory>
 #include <QOpenGLShader>
 #include <glm/glm.hpp>
 #include "const.hpp"
+#include "accumulator.hpp"
+#include "../common/texture-file.hpp"
 #include "../common/AtmosphereParameters.hpp"
 
 inline std::map<QString, QString> virtualSourceFiles;
@@ -20,11 +23,17 @@ enum FBOId
 {
     FBO_FOR_TEXTURE_SAVING,
     FBO_TRANSMITTANCE,
+    FBO_COLUMN_DENSITIES,
+    FBO_NUMBER_DENSITY_LUT,
+    FBO_PHASE_FUNCTION_LUT,
     FBO_IRRADIANCE,
     FBO_DELTA_SCATTERING,
     FBO_SINGLE_SCATTERING,
     FBO_MULTIPLE_SCATTERING,
     FBO_ECLIPSED_DOUBLE_SCATTERING,
+    FBO_SCATTERING_ROW_SUMS,
+    FBO_INCIDENT_RAY_TABLE,
+    FBO_PREVIEW_MULTIPLE_SCATTERING,
 
     FBO_COUNT
 };
@@ -32,22 +41,83 @@ inline GLuint fbos[FBO_COUNT];
 enum TextureId
 {
     TEX_TRANSMITTANCE,
+    TEX_COLUMN_DENSITIES,
+    TEX_CUMULATIVE_COLUMN_DENSITIES,
+    TEX_NUMBER_DENSITY_LUT,
+    TEX_PHASE_FUNCTION_LUT,
     TEX_IRRADIANCE,
     TEX_DELTA_IRRADIANCE,
     TEX_DELTA_SCATTERING,
-    TEX_MULTIPLE_SCATTERING,
     TEX_DELTA_SCATTERING_DENSITY,
     TEX_ECLIPSED_DOUBLE_SCATTERING,
+    TEX_SCATTERING_ROW_SUMS,
+    TEX_INCIDENT_RAY_TABLE,
+    TEX_INCIDENT_RAY_TRANSMITTANCE_TABLE,
+    TEX_PREVIEW_MULTIPLE_SCATTERING,
+    TEX_GAUSS_LEGENDRE_NODES,
 
     TEX_COUNT
 };
 inline GLuint textures[TEX_COUNT];
+// Size of the 2D textures with the incident rays of the scattering density integral for each altitude layer
+inline glm::ivec2 incidentRayTableSize;
+// Column densities don't depend on wavelengths, so they are computed once for all the wavelength sets
+inline bool columnDensitiesComputed=false;
+// The same goes for the incident rays, so their table is shared by the wavelength set slots. Their transmittance isn't.
+inline bool incidentRayTableComputed=false;
+// Once the LUT is baked, number density functions in the compute programs are replaced with lookups in it
+inline bool numberDensityLUTReady=false;
+inline std::unique_ptr<ScatteringAccumulator> multipleScatteringAccumulator;
 // Accumulation of radiance to yield luminance
-inline std::map<QString/*scatterer name*/, GLuint> accumulatedSingleScatteringTextures;
+inline std::map<QString/*scatterer name*/, std::unique_ptr<ScatteringAccumulator>> singleScatteringAccumulators;
+
+inline AtmosphereParameters atmo;
+// Sums of delta scattering texels for each scattering order computed in current wavelength set, starting from order 2
+inline std::vector<glm::dvec4> deltaScatteringEnergies;
+
+/* Textures that a wavelength set needs from one scattering order to the next. With opts.wavelengthSetsPerPass>1 the
+ * orders from 3 on are computed for a group of sets together, so each set of the group has its own copies of them in
+ * a slot, and the slot of the set being worked on is selected into textures[] by selectWavelengthSetSlot().
+ */
+inline constexpr TextureId perWavelengthSetTextures[]={TEX_TRANSMITTANCE, TEX_IRRADIANCE, TEX_DELTA_IRRADIANCE,
+                                                       TEX_DELTA_SCATTERING, TEX_DELTA_SCATTERING_DENSITY,
+                                                       TEX_INCIDENT_RAY_TRANSMITTANCE_TABLE};
+struct WavelengthSetSlot
+{
+    std::array<GLuint, std::size(perWavelengthSetTextures)> textures;
+    // Swapped with the global deltaScatteringEnergies when the slot isn't selected
+    std::vector<glm::dvec4> deltaScatteringEnergies;
+};
+inline std::vector<WavelengthSetSlot> wavelengthSetSlots;
+inline unsigned currentWavelengthSetSlot=0;
 
 struct Options
 {
     bool saveResultAsRadiance=false;
+    bool resume=false;
+    bool noCheckpoints=false;
+    bool recomputeAll=false;
+    bool shadersOnly=false;
+    // Only print the estimated time, memory and disk space of the computation
+    bool estimateOnly=false;
+    // Report of a previous run (--report) to take the kernel throughputs for the estimate from
+    QString calibrationReportPath;
+    // Tune the integration point counts to this relative tolerance instead of computing the textures, 0 to disable
+    double tuningTolerance=0;
+    // Where to write the atmosphere description with the tuned counts, empty if not needed
+    QString tunedDescriptionPath;
+    // Approximate the scattering orders from 2 on instead of computing them, and report the error of the approximation
+    bool preview=false;
+    // Compute column densities for transmittance as differences of prefix sums along the lines of the rays
+    bool cumulativeTransmittance=false;
+    bool dbgCheckCumulativeTransmittance=false;
+    // Number of altitudes at which number densities are tabulated for the compute shaders, 0 to use the density functions directly
+    unsigned numberDensityLUTSize=0;
+    // Number of scattering angles at which phase functions are tabulated for all the shaders, 0 to use the phase functions directly
+    unsigned phaseFunctionLUTSize=0;
+    // Average the phase functions over the angles covered by each LUT texel instead of sampling them at texel centers
+    bool prefilterPhaseFunctions=false;
+    bool noProgramBinaryCache=false;
     bool dbgNoSaveTextures=false;
     bool dbgNoEDSTextures=false;
     bool dbgSaveGroundIrradiance=false;
@@ -55,8 +125,45 @@ struct Options
     bool dbgSaveScatDensity=false;
     bool dbgSaveDeltaScattering=false;
     bool dbgSaveAccumScattering=false;
+    // Stop computing scattering orders when the relative contribution of the last one is below this, 0 to disable
+    double convergenceTolerance=0;
+    // On convergence, add a geometric series estimate of the remaining orders
+    bool extrapolateTail=false;
+    // Where to write the JSON report with per-stage timing and traffic, empty if not needed
+    QString reportPath;
+    // Memory held by textures read back but not yet written to files
+    unsigned saveQueueMemoryLimitMiB=2048;
+    // Number of threads doing CPU-side work in background, 0 meaning the number of CPU cores
+    unsigned backgroundThreads=0;
+    // Number of 3D texture layers rendered by one instanced draw call, 0 meaning choose it from the time of the first layer
+    unsigned layersPerDraw=0;
+    // Number of wavelength sets whose scattering orders from 3 on are computed together, sharing the geometry of the scattering density
+    unsigned wavelengthSetsPerPass=1;
+    // Keep the scattering accumulators in host memory, adding to them this many altitude layers at a time, 0 meaning keep them in VRAM
+    unsigned hostAccumulatorTileLayers=0;
+    // Type of the texels of the textures saved for rendering and of the 4D intermediate textures. Accumulators,
+    // transmittance and checkpoints are always single precision.
+    TextureElementType storagePrecision=TextureElementType::Float32;
+    // Inclusive range of wavelength sets to compute
+    unsigned firstWavelengthSet=0;
+    unsigned lastWavelengthSet=0;
+
+    bool partialWavelengthSetRange() const
+    {
+        return firstWavelengthSet>0 || lastWavelengthSet+1<atmo.allWavelengths.size();
+    }
+    // Distinguishes the files of shards sharing an output directory, empty when all wavelength sets are computed
+    std::string wavelengthSetRangeSuffix() const
+    {
+        if(!partialWavelengthSetRange()) return "";
+        return "-wlsets"+std::to_string(firstWavelengthSet)+"-"+std::to_string(lastWavelengthSet);
+    }
+    // Partial accumulators are summed by calcmysky-merge, so they are saved in single precision
+    TextureElementType accumulatorOutputPrecision() const
+    {
+        return partialWavelengthSetRange() ? TextureElementType::Float32 : storagePrecision;
+    }
 };
 inline Options opts;
-inline AtmosphereParameters atmo;
 
 #endif
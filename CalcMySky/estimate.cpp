@@ -0,0 +1,321 @@
+#include "estimate.hpp"
+
+#include <array>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+
+#include "data.hpp"
+#include "util.hpp"
+#include "shaders.hpp"
+#include "../common/timing.hpp"
+
+namespace
+{
+
+struct KernelInfo
+{
+    const char* stageName; // as passed to StageTimer
+    double defaultThroughput; // work units per second
+};
+// Rough throughputs of a mid-range desktop GPU, used for the kernels that the calibration report doesn't cover
+constexpr KernelInfo kernelInfos[]=
+{
+    {"column densities",           2e9},
+    {"transmittance",              2e9},
+    {"direct ground irradiance",   1e9},
+    {"single scattering",          1e9},
+    {"incident ray table",         1e9},
+    {"scattering density",         5e8},
+    {"indirect irradiance",        5e8},
+    {"multiple scattering",        1e9},
+    {"eclipsed double scattering", 2e8},
+    {"preview multiple scattering",5e8},
+};
+static_assert(std::size(kernelInfos)==size_t(Kernel::Count));
+
+constexpr double fp32TexelSize=4*sizeof(float);
+
+double scatteringTexelCount()
+{
+    return double(atmo.scatTexWidth())*atmo.scatTexHeight()*atmo.scatTexDepth();
+}
+
+// Number of the (SZA, altitude) points of a 4D texture that are in the precomputed domain
+double precomputedSZAAltitudePointCount(const int texSizeBySZA)
+{
+    const auto altRange=atmo.precomputedAltitudeIndexRange();
+    const auto szaRange=atmo.precomputedSZAIndexRange(texSizeBySZA);
+    return double(szaRange[1]-szaRange[0]+1)*(altRange[1]-altRange[0]+1);
+}
+
+double savedTexelCount(glm::ivec4 const& fullSize)
+{
+    return double(fullSize[0])*fullSize[1]*precomputedSZAAltitudePointCount(fullSize[2]);
+}
+
+double kernelRunsPerWavelengthSet(const Kernel kernel)
+{
+    const double scattererCount=atmo.scatterers.size();
+    // Orders 1 and 2 are computed together, interleaving the scatterers
+    const double ordersAfter2 = atmo.scatteringOrdersToCompute>2 ? atmo.scatteringOrdersToCompute-2 : 0;
+    if(opts.preview)
+    {
+        // Orders from 2 on come from a single pass over the scattering texture
+        switch(kernel)
+        {
+        case Kernel::IncidentRayTable:          return 0;
+        case Kernel::ScatteringDensity:         return 0;
+        case Kernel::IndirectIrradiance:        return scattererCount+1;
+        case Kernel::MultipleScattering:        return 1;
+        case Kernel::PreviewMultipleScattering: return 1;
+        default: break;
+        }
+    }
+    switch(kernel)
+    {
+    case Kernel::ColumnDensities:          return 0; // see kernelRuns()
+    case Kernel::Transmittance:            return 1;
+    case Kernel::DirectIrradiance:         return 1;
+    case Kernel::SingleScattering:         return scattererCount;
+    case Kernel::IncidentRayTable:         return 1;
+    case Kernel::ScatteringDensity:        return 1+scattererCount+ordersAfter2; // order 2 has a pass for the ground
+    case Kernel::IndirectIrradiance:       return scattererCount+ordersAfter2;
+    case Kernel::MultipleScattering:       return 1+ordersAfter2;
+    case Kernel::EclipsedDoubleScattering: return opts.dbgNoEDSTextures ? 0 : 1;
+    case Kernel::PreviewMultipleScattering: return 0;
+    case Kernel::Count: break;
+    }
+    return 0;
+}
+
+double kernelRuns(const Kernel kernel, const unsigned wavelengthSetCount)
+{
+    // Column densities don't depend on wavelengths, so they are computed once per run
+    if(kernel==Kernel::ColumnDensities)
+        return columnDensityGroupCount();
+    return wavelengthSetCount*kernelRunsPerWavelengthSet(kernel);
+}
+
+struct Throughputs
+{
+    std::array<double, size_t(Kernel::Count)> values;
+    std::array<bool, size_t(Kernel::Count)> calibrated{};
+    QString device;
+};
+
+Throughputs loadThroughputs()
+{
+    Throughputs throughputs;
+    for(size_t k=0; k<throughputs.values.size(); ++k)
+        throughputs.values[k]=kernelInfos[k].defaultThroughput;
+    if(opts.calibrationReportPath.isEmpty())
+        return throughputs;
+
+    QFile file(opts.calibrationReportPath);
+    if(!file.open(QFile::ReadOnly))
+    {
+        std::cerr << "Failed to open calibration report \"" << opts.calibrationReportPath << "\": " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    QJsonParseError error;
+    const auto doc=QJsonDocument::fromJson(file.readAll(), &error);
+    if(!doc.isObject())
+    {
+        std::cerr << "Failed to parse calibration report \"" << opts.calibrationReportPath << "\": " << error.errorString() << "\n";
+        throw MustQuit{};
+    }
+    const auto report=doc.object();
+    throughputs.device=report["glRenderer"].toString();
+    const auto totals=report["totalsByStageName"].toObject();
+    for(size_t k=0; k<throughputs.values.size(); ++k)
+    {
+        // Time of the nested stages, like saving of the textures, isn't the kernel's
+        const auto stage=totals[kernelInfos[k].stageName].toObject();
+        const auto work=stage["work"].toDouble(), time=stage["selfWallTime"].toDouble();
+        if(work>0 && time>0)
+        {
+            throughputs.values[k]=work/time;
+            throughputs.calibrated[k]=true;
+        }
+    }
+    return throughputs;
+}
+
+std::string formatBytes(const double bytes)
+{
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if(bytes < 1<<20)
+        ss << bytes/(1<<10) << " KiB";
+    else if(bytes < 1<<30)
+        ss << bytes/(1<<20) << " MiB";
+    else
+        ss << bytes/(1<<30) << " GiB";
+    return ss.str();
+}
+
+std::string formatWork(const double work)
+{
+    std::ostringstream ss;
+    ss << std::setprecision(3) << work;
+    return ss.str();
+}
+
+void printFootprint(const char*const title, std::vector<std::pair<std::string, double>> const& items)
+{
+    double total=0;
+    std::cout << "\n" << title << ":\n";
+    for(const auto& [name, bytes] : items)
+    {
+        if(bytes<=0) continue;
+        std::cout << "  " << std::left << std::setw(56) << name << std::right << std::setw(12) << formatBytes(bytes) << "\n";
+        total+=bytes;
+    }
+    std::cout << "  " << std::left << std::setw(56) << "Total" << std::right << std::setw(12) << formatBytes(total) << "\n";
+}
+
+}
+
+double kernelWork(const Kernel kernel)
+{
+    const double scatteringTexels=scatteringTexelCount();
+    const double irradianceTexels=double(atmo.irradianceTexW)*atmo.irradianceTexH;
+    switch(kernel)
+    {
+    case Kernel::ColumnDensities:
+        if(opts.cumulativeTransmittance)
+        {
+            // Each table entry integrates over a few subdivisions of the segment to the previous one
+            const auto tableSize=cumulativeColumnDensityTableSize();
+            return 4.*tableSize.x*tableSize.y;
+        }
+        return double(atmo.transmittanceTexW)*atmo.transmittanceTexH*atmo.numTransmittanceIntegrationPoints;
+    case Kernel::Transmittance:
+        return double(atmo.transmittanceTexW)*atmo.transmittanceTexH*columnDensityGroupCount();
+    case Kernel::DirectIrradiance:
+        return irradianceTexels;
+    case Kernel::SingleScattering:
+        return scatteringTexels*atmo.radialIntegrationPoints;
+    case Kernel::IncidentRayTable:
+        return double(atmo.scatTexDepth())*atmo.angularIntegrationPoints;
+    case Kernel::ScatteringDensity:
+        return scatteringTexels*atmo.angularIntegrationPoints;
+    case Kernel::IndirectIrradiance:
+        // Only the upper hemisphere is integrated over
+        return irradianceTexels*(atmo.angularIntegrationPoints/2);
+    case Kernel::MultipleScattering:
+        return scatteringTexels*atmo.radialIntegrationPoints;
+    case Kernel::EclipsedDoubleScattering:
+    {
+        // For each (SZA, altitude) point 4 view directions per elevation and azimuth pair are
+        // integrated over the whole eclipse integration texture
+        const double directions=4.*atmo.eclipsedDoubleScatteringNumberOfElevationPairsToSample*
+                                   atmo.eclipsedDoubleScatteringNumberOfAzimuthPairsToSample;
+        return precomputedSZAAltitudePointCount(atmo.eclipsedDoubleScatteringTextureSize[2])*directions*
+                    atmo.eclipseAngularIntegrationPoints*atmo.radialIntegrationPoints;
+    }
+    case Kernel::PreviewMultipleScattering:
+        return irradianceTexels*atmo.angularIntegrationPoints*(atmo.radialIntegrationPoints+1);
+    case Kernel::Count: break;
+    }
+    return 0;
+}
+
+void printEstimate()
+{
+    const auto throughputs=loadThroughputs();
+    const unsigned wavelengthSetCount=opts.lastWavelengthSet-opts.firstWavelengthSet+1;
+
+    std::cout << "Estimate for " << wavelengthSetCount << " wavelength set" << (wavelengthSetCount==1 ? "" : "s")
+              << " and " << atmo.scatteringOrdersToCompute << " scattering orders, ";
+    if(opts.calibrationReportPath.isEmpty())
+        std::cout << "using rough default throughputs; pass the --report of a short run on this device to --calibration for accurate times\n";
+    else
+        std::cout << "calibrated by \"" << opts.calibrationReportPath << "\" on " << throughputs.device << "\n";
+    if(opts.convergenceTolerance>0)
+        std::cout << "Convergence tolerance is set, so fewer scattering orders may be computed\n";
+    if(opts.preview)
+        std::cout << "Preview mode: the full computation on reduced textures for the error estimate isn't included\n";
+
+    std::cout << "\n" << std::left << std::setw(28) << "Stage" << std::right << std::setw(8) << "Runs"
+              << std::setw(12) << "Work" << std::setw(16) << "Throughput,/s" << std::setw(14) << "Time" << "\n";
+    double totalTime=0;
+    bool someUncalibrated=false;
+    for(size_t k=0; k<size_t(Kernel::Count); ++k)
+    {
+        const auto kernel=Kernel(k);
+        const auto runs=kernelRuns(kernel, wavelengthSetCount);
+        if(runs==0) continue;
+        const auto work=runs*kernelWork(kernel);
+        const auto time=work/throughputs.values[k];
+        totalTime+=time;
+        const bool uncalibrated = !opts.calibrationReportPath.isEmpty() && !throughputs.calibrated[k];
+        someUncalibrated = someUncalibrated || uncalibrated;
+        std::cout << std::left << std::setw(28) << kernelInfos[k].stageName << std::right << std::setw(8) << runs
+                  << std::setw(12) << formatWork(work)
+                  << std::setw(16) << formatWork(throughputs.values[k])+(uncalibrated ? "*" : "")
+                  << std::setw(14) << formatDuration(time) << "\n";
+    }
+    std::cout << std::left << std::setw(64) << "Total" << std::right << std::setw(14) << formatDuration(totalTime) << "\n";
+    if(someUncalibrated)
+        std::cout << "* Not covered by the calibration report, default throughput is used\n";
+
+    const double scatteringTexels=scatteringTexelCount();
+    const double irradianceTexels=double(atmo.irradianceTexW)*atmo.irradianceTexH;
+    const double storageTexelSize=4*textureElementSize(opts.storagePrecision);
+    const double accumulatorOutputTexelSize=4*textureElementSize(opts.accumulatorOutputPrecision());
+    const auto countScatterers=[](auto predicate)
+    {
+        return double(std::count_if(atmo.scatterers.begin(), atmo.scatterers.end(), predicate));
+    };
+    const auto generalScatterers=countScatterers([](auto const& s){ return s.phaseFunctionType==PhaseFunctionType::General; });
+    const auto achromaticScatterers=countScatterers([](auto const& s){ return s.phaseFunctionType==PhaseFunctionType::Achromatic; });
+    const auto accumulatedScatterers=double(atmo.scatterers.size())-generalScatterers;
+    const double accumulatorBytes=(1+accumulatedScatterers)*scatteringTexels*fp32TexelSize;
+    const double saveQueueBytes=double(opts.saveQueueMemoryLimitMiB)*(1<<20);
+    const double edsBytes=savedTexelCount(atmo.eclipsedDoubleScatteringTextureSize)*fp32TexelSize;
+    const bool hostAccumulators=opts.hostAccumulatorTileLayers>0;
+
+    // The wavelength sets computed together each have their own intermediate textures
+    const double setsPerPass=opts.wavelengthSetsPerPass;
+    printFootprint("VRAM", {
+        {"Transmittance", setsPerPass*atmo.transmittanceTexW*atmo.transmittanceTexH*fp32TexelSize},
+        {"Column densities", double(atmo.transmittanceTexW)*atmo.transmittanceTexH*columnDensityGroupCount()*fp32TexelSize},
+        {"Cumulative column density table", opts.cumulativeTransmittance ? double(cumulativeColumnDensityTableSize().x)*
+                    cumulativeColumnDensityTableSize().y*columnDensityGroupCount()*fp32TexelSize : 0},
+        {"Number density LUT", double(opts.numberDensityLUTSize)*columnDensityGroupCount()*fp32TexelSize},
+        {"Phase function LUT", double(opts.phaseFunctionLUTSize)*atmo.scatterers.size()*fp32TexelSize},
+        {"Irradiance and delta irradiance", setsPerPass*2*irradianceTexels*fp32TexelSize},
+        {"Delta scattering and scattering density", setsPerPass*2*scatteringTexels*storageTexelSize},
+        {"Scattering accumulators", hostAccumulators ? 0 : accumulatorBytes},
+        {"Incident ray tables", (1+setsPerPass)*atmo.scatTexDepth()*atmo.angularIntegrationPoints*fp32TexelSize},
+        // With the mipmaps used to sum its texels
+        {"Eclipsed double scattering integration", 4./3*atmo.eclipseAngularIntegrationPoints*atmo.radialIntegrationPoints*fp32TexelSize},
+        {"Scattering row sums for convergence check", opts.convergenceTolerance>0 ? double(atmo.scatTexHeight())*atmo.scatTexDepth()*fp32TexelSize : 0},
+    });
+    printFootprint("Host memory, at most", {
+        {"Scattering accumulators", hostAccumulators ? accumulatorBytes : 0},
+        {"Textures waiting to be written", saveQueueBytes},
+        {"Eclipsed double scattering slices waiting to be written", opts.dbgNoEDSTextures ? 0 : std::min(saveQueueBytes, edsBytes)},
+    });
+
+    const double perSetTexels=savedTexelCount(atmo.scatteringTextureSize);
+    const double checkpointBytes=2*irradianceTexels*fp32TexelSize + scatteringTexels*fp32TexelSize + accumulatorBytes;
+    printFootprint("Disk", {
+        {"Transmittance", wavelengthSetCount*double(atmo.transmittanceTexW)*atmo.transmittanceTexH*fp32TexelSize},
+        {"Phase function LUTs", wavelengthSetCount*double(opts.phaseFunctionLUTSize)*atmo.scatterers.size()*fp32TexelSize},
+        {"Irradiance", wavelengthSetCount*irradianceTexels*storageTexelSize},
+        {"Single scattering of general-phase-function scatterers", wavelengthSetCount*generalScatterers*perSetTexels*storageTexelSize},
+        {"Multiple scattering radiance", opts.saveResultAsRadiance ? wavelengthSetCount*perSetTexels*storageTexelSize : 0},
+        {"XYZW scattering accumulators", opts.saveResultAsRadiance ? 0 : (1+achromaticScatterers)*perSetTexels*accumulatorOutputTexelSize},
+        {"Eclipsed double scattering", opts.dbgNoEDSTextures ? 0 : wavelengthSetCount*edsBytes/fp32TexelSize*storageTexelSize},
+        // There are two checkpoint slots, the new one is written before the old one is removed
+        {"Checkpoints, removed at the end", opts.noCheckpoints ? 0 : 2*checkpointBytes},
+    });
+}
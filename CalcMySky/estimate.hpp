@@ -0,0 +1,33 @@
+#ifndef INCLUDE_ONCE_A4C8E566_98F7_4B88_A192_8C421FEB7E65
+#define INCLUDE_ONCE_A4C8E566_98F7_4B88_A192_8C421FEB7E65
+
+/* Cost model of the computation, used by --estimate to predict the time, memory and disk space needed
+ * for the atmosphere description without doing any GPU work.
+ *
+ * The work of each kernel is the number of integrand evaluations it does, and its time is the work divided
+ * by the throughput of the kernel. The stages of the computation report the work they do, so that the run
+ * report (--report) of a short run on the device, e.g. with small textures, gives the throughputs to the
+ * estimate via --calibration.
+ */
+enum class Kernel
+{
+    ColumnDensities,
+    Transmittance,
+    DirectIrradiance,
+    SingleScattering,
+    IncidentRayTable,
+    ScatteringDensity,
+    IndirectIrradiance,
+    MultipleScattering,
+    EclipsedDoubleScattering,
+    PreviewMultipleScattering,
+
+    Count
+};
+
+// Work of a single run of the kernel for the current atmosphere description
+double kernelWork(Kernel kernel);
+// Prints the estimate to stdout
+void printEstimate();
+
+#endif
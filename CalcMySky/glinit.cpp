@@ -1,8 +1,10 @@
 #include "glinit.hpp"
 
 #include <iostream>
+#include <algorithm>
 #include "util.hpp"
 #include "data.hpp"
+#include "shaders.hpp"
 
 void initBuffers()
 {
@@ -25,9 +27,37 @@ void initBuffers()
 	gl.glBindVertexArray(0);
 }
 
-void initTexturesAndFramebuffers()
+void initIncidentRayTable()
+{
+    // The rows of the incident ray table wrap around, so that the number of integration points isn't limited by the texture size
+    GLint maxTexSize=-1;
+    gl.glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexSize);
+    const auto rayCount=GLint64(atmo.angularIntegrationPoints)*atmo.scatTexDepth();
+    incidentRayTableSize.x=std::min<GLint64>(rayCount, maxTexSize);
+    incidentRayTableSize.y=(rayCount+incidentRayTableSize.x-1)/incidentRayTableSize.x;
+    const auto setupTable=[](const TextureId tex)
+    {
+        gl.glBindTexture(GL_TEXTURE_2D,textures[tex]);
+        gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+        gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+        setupTexture(tex,incidentRayTableSize.x,incidentRayTableSize.y);
+    };
+    setupTable(TEX_INCIDENT_RAY_TABLE);
+    incidentRayTableComputed=false;
+
+    const auto slotToRestore=currentWavelengthSetSlot;
+    for(unsigned slot=0; slot<wavelengthSetSlots.size(); ++slot)
+    {
+        selectWavelengthSetSlot(slot);
+        setupTable(TEX_INCIDENT_RAY_TRANSMITTANCE_TABLE);
+    }
+    selectWavelengthSetSlot(slotToRestore);
+}
+
+// Sets up the textures listed in perWavelengthSetTextures whose names are currently in textures[],
+// except the incident ray transmittance table, which is set up by initIncidentRayTable()
+void initWavelengthSetTextures()
 {
-    gl.glGenTextures(TEX_COUNT,textures);
     for(const auto tex : {TEX_TRANSMITTANCE,TEX_DELTA_IRRADIANCE})
     {
         gl.glBindTexture(GL_TEXTURE_2D,textures[tex]);
@@ -47,15 +77,129 @@ void initTexturesAndFramebuffers()
         gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
         gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
         gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
-        setupTexture(tex,width,height,depth);
+        setupTexture(tex,width,height,depth,opts.storagePrecision==TextureElementType::Float16 ? GL_RGBA16F : GL_RGBA32F);
+    }
+}
+
+void initWavelengthSetSlots()
+{
+    wavelengthSetSlots.assign(opts.wavelengthSetsPerPass, {});
+    currentWavelengthSetSlot=0;
+    for(unsigned slot=0; slot<wavelengthSetSlots.size(); ++slot)
+    {
+        // The names of the first slot have been generated together with all the other textures
+        if(slot>0)
+        {
+            for(const auto tex : perWavelengthSetTextures)
+                gl.glGenTextures(1,&textures[tex]);
+        }
+        initWavelengthSetTextures();
+        for(unsigned i=0; i<std::size(perWavelengthSetTextures); ++i)
+            wavelengthSetSlots[slot].textures[i]=textures[perWavelengthSetTextures[i]];
+    }
+    for(unsigned i=0; i<std::size(perWavelengthSetTextures); ++i)
+        textures[perWavelengthSetTextures[i]]=wavelengthSetSlots[0].textures[i];
+}
+
+void initPhaseFunctionLUTTexture()
+{
+    gl.glBindTexture(GL_TEXTURE_2D,textures[TEX_PHASE_FUNCTION_LUT]);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+    setupTexture(TEX_PHASE_FUNCTION_LUT,opts.phaseFunctionLUTSize,atmo.scatterers.size());
+}
+
+void initGaussLegendreTexture()
+{
+    const auto counts=gaussLegendreNodeCounts();
+    const auto table=makeGaussLegendreTable();
+    // The nodes stay bound to their unit like the LUTs, see setLUTSamplers()
+    gl.glActiveTexture(GL_TEXTURE0+RADIAL_QUADRATURE_TEXTURE_UNIT);
+    gl.glBindTexture(GL_TEXTURE_2D,textures[TEX_GAUSS_LEGENDRE_NODES]);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+    gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,counts.back(),counts.size(),0,GL_RGBA,GL_FLOAT,table.data());
+    gl.glActiveTexture(GL_TEXTURE0);
+}
+
+void initTexturesAndFramebuffers()
+{
+    gl.glGenTextures(TEX_COUNT,textures);
+    initWavelengthSetSlots();
+    initIncidentRayTable();
+
+    gl.glBindTexture(GL_TEXTURE_3D,textures[TEX_COLUMN_DENSITIES]);
+    gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+    gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+    setupTexture(TEX_COLUMN_DENSITIES,atmo.transmittanceTexW,atmo.transmittanceTexH,columnDensityGroupCount());
+    if(opts.cumulativeTransmittance)
+    {
+        gl.glBindTexture(GL_TEXTURE_3D,textures[TEX_CUMULATIVE_COLUMN_DENSITIES]);
+        gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+        gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+        gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+        gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
+        const auto tableSize=cumulativeColumnDensityTableSize();
+        setupTexture(TEX_CUMULATIVE_COLUMN_DENSITIES,tableSize.x,tableSize.y,columnDensityGroupCount());
+    }
+    columnDensitiesComputed=false;
+    if(opts.numberDensityLUTSize)
+    {
+        gl.glBindTexture(GL_TEXTURE_2D,textures[TEX_NUMBER_DENSITY_LUT]);
+        gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+        gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+        gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+        gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+        setupTexture(TEX_NUMBER_DENSITY_LUT,opts.numberDensityLUTSize,columnDensityGroupCount());
+    }
+    numberDensityLUTReady=false;
+    if(opts.phaseFunctionLUTSize)
+        initPhaseFunctionLUTTexture();
+    if(atmo.radialQuadrature==RadialQuadrature::GaussLegendre)
+        initGaussLegendreTexture();
+
+    if(opts.preview)
+    {
+        gl.glBindTexture(GL_TEXTURE_2D,textures[TEX_PREVIEW_MULTIPLE_SCATTERING]);
+        gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+        gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+        gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+        setupTexture(TEX_PREVIEW_MULTIPLE_SCATTERING,atmo.irradianceTexW,atmo.irradianceTexH);
     }
-    setupTexture(TEX_MULTIPLE_SCATTERING,width,height,depth);
+
+    multipleScatteringAccumulator=std::make_unique<ScatteringAccumulator>();
     // XXX: keep in sync with its use in GLSL computeDoubleScatteringEclipsedDensitySample() and EclipsedDoubleScatteringPrecomputer's constructor
     setupTexture(TEX_ECLIPSED_DOUBLE_SCATTERING, atmo.eclipseAngularIntegrationPoints, atmo.radialIntegrationPoints);
+    if(opts.convergenceTolerance>0)
+        setupTexture(TEX_SCATTERING_ROW_SUMS, atmo.scatTexHeight(), atmo.scatTexDepth());
 
     gl.glGenFramebuffers(FBO_COUNT,fbos);
 }
 
+void selectWavelengthSetSlot(const unsigned slot)
+{
+    if(slot==currentWavelengthSetSlot) return;
+    std::swap(wavelengthSetSlots[currentWavelengthSetSlot].deltaScatteringEnergies, deltaScatteringEnergies);
+    std::swap(wavelengthSetSlots[slot].deltaScatteringEnergies, deltaScatteringEnergies);
+    for(unsigned i=0; i<std::size(perWavelengthSetTextures); ++i)
+        textures[perWavelengthSetTextures[i]]=wavelengthSetSlots[slot].textures[i];
+    currentWavelengthSetSlot=slot;
+}
+
+// Deletes the textures of all the wavelength set slots too
+void deleteTextures()
+{
+    for(unsigned slot=1; slot<wavelengthSetSlots.size(); ++slot)
+        gl.glDeleteTextures(GLsizei(wavelengthSetSlots[slot].textures.size()), wavelengthSetSlots[slot].textures.data());
+    selectWavelengthSetSlot(0);
+    gl.glDeleteTextures(TEX_COUNT, textures);
+    wavelengthSetSlots.clear();
+}
+
+// The intermediate 4D textures aren't split into tiles, only the accumulators can be moved out of VRAM, so each of
+// them must fit in a single 3D texture. Its height packs the dot(view,sun) and SZA dimensions of the 4D texture.
 void checkLimits()
 {
     GLint max3DTexSize=-1;
@@ -63,10 +207,27 @@ void checkLimits()
     if(atmo.scatTexWidth()>max3DTexSize || atmo.scatTexHeight()>max3DTexSize || atmo.scatTexDepth()>max3DTexSize)
     {
         std::cerr << "Scattering texture 3D size of " << atmo.scatTexWidth() << "x" << atmo.scatTexHeight() << "x" << atmo.scatTexDepth() << " is too large: GL_MAX_3D_TEXTURE_SIZE is " << max3DTexSize << "\n";
+        if(atmo.scatTexHeight()>max3DTexSize)
+        {
+            std::cerr << "The height is the product of the dot(view,sun) and SZA sizes, " << atmo.scatteringTextureSize[1] << "x"
+                      << atmo.scatteringTextureSize[2] << ", one of which must be reduced\n";
+        }
         throw MustQuit{};
     }
 }
 
+void initForPhaseFunctionLUT()
+{
+    initBuffers();
+    // Only the LUT gets storage, the other names are generated to keep textures[] consistent
+    gl.glGenTextures(TEX_COUNT,textures);
+    initPhaseFunctionLUTTexture();
+    // The table of the nodes is saved along with the shaders that sample it
+    if(atmo.radialQuadrature==RadialQuadrature::GaussLegendre)
+        initGaussLegendreTexture();
+    gl.glGenFramebuffers(FBO_COUNT,fbos);
+}
+
 void init()
 {
     std::cerr << "OpenGL vendor  : " << gl.glGetString(GL_VENDOR) << "\n";
@@ -76,3 +237,12 @@ void init()
     checkLimits();
 }
 
+void reinitTexturesAndFramebuffers()
+{
+    deleteTextures();
+    gl.glDeleteFramebuffers(FBO_COUNT, fbos);
+    multipleScatteringAccumulator.reset();
+    initTexturesAndFramebuffers();
+    checkLimits();
+}
+
@@ -1,6 +1,18 @@
 #ifndef INCLUDE_ONCE_5041B5F1_BF78_4C88_B28F_A06F80CB073A
 #define INCLUDE_ONCE_5041B5F1_BF78_4C88_B28F_A06F80CB073A
 
+#include <QOpenGLFunctions_3_3_Core>
+
 void init();
+// Initializes only what computePhaseFunctionLUT() and the saving of the Gauss-Legendre nodes need, for the shaders-only mode
+void initForPhaseFunctionLUT();
+// Uploads the nodes of the Gauss-Legendre radial quadrature for the current integration point counts
+void initGaussLegendreTexture();
+// Reallocates the incident ray table for the current number of angular integration points
+void initIncidentRayTable();
+// Makes textures[] refer to the textures of the given wavelength set slot, see perWavelengthSetTextures
+void selectWavelengthSetSlot(unsigned slot);
+// Recreates the textures and framebuffers for the current sizes and options, dropping their contents
+void reinitTexturesAndFramebuffers();
 
 #endif
@@ -0,0 +1,62 @@
+#include "half-precision.hpp"
+
+#include <cmath>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+#include <glm/gtc/packing.hpp>
+
+namespace
+{
+
+std::mutex halfPrecisionErrorsMutex;
+std::map<std::string, HalfPrecisionError> halfPrecisionErrors;
+
+}
+
+std::vector<uint16_t> toHalfPrecision(const float*const data, const size_t count, std::string const& path)
+{
+    constexpr float minNormalHalf=6.103515625e-5f;
+    HalfPrecisionError error;
+    error.count=count;
+    std::vector<uint16_t> halves(count);
+    for(size_t i=0; i<count; ++i)
+    {
+        const float x=data[i];
+        halves[i]=glm::packHalf1x16(x);
+        if(!std::isfinite(x)) continue;
+
+        const float y=glm::unpackHalf1x16(halves[i]);
+        if(std::isinf(y))
+        {
+            ++error.overflowCount;
+        }
+        else if(std::abs(x)<minNormalHalf)
+        {
+            if(x!=0) ++error.underflowCount;
+        }
+        else
+        {
+            const double relError=std::abs(double(y)-x)/std::abs(x);
+            error.maxRelError=std::max(error.maxRelError, relError);
+            error.sumSqRelError+=relError*relError;
+            ++error.normalCount;
+        }
+    }
+
+    std::lock_guard lock(halfPrecisionErrorsMutex);
+    auto& total=halfPrecisionErrors[path];
+    total.count+=error.count;
+    total.normalCount+=error.normalCount;
+    total.maxRelError=std::max(total.maxRelError, error.maxRelError);
+    total.sumSqRelError+=error.sumSqRelError;
+    total.underflowCount+=error.underflowCount;
+    total.overflowCount+=error.overflowCount;
+    return halves;
+}
+
+std::map<std::string, HalfPrecisionError> takeHalfPrecisionErrors()
+{
+    std::lock_guard lock(halfPrecisionErrorsMutex);
+    return std::exchange(halfPrecisionErrors, {});
+}
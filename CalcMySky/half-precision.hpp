@@ -0,0 +1,30 @@
+#ifndef INCLUDE_ONCE_BF4E2DAF_11D0_435B_8F83_165D8C69A295
+#define INCLUDE_ONCE_BF4E2DAF_11D0_435B_8F83_165D8C69A295
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct HalfPrecisionError
+{
+    size_t count=0;
+    // Relative errors are only computed for the values in the normal range of half precision
+    size_t normalCount=0;
+    double maxRelError=0;
+    double sumSqRelError=0;
+    // Nonzero values that became subnormal or zero
+    size_t underflowCount=0;
+    // Finite values that became infinite
+    size_t overflowCount=0;
+};
+
+/* Converts RGBA32F texel components to RGBA16F, adding the rounding errors to the statistics of the file
+ * at path. Can be called from any thread.
+ */
+std::vector<uint16_t> toHalfPrecision(const float* data, size_t count, std::string const& path);
+// Returns the statistics of the files converted since the previous call, by path
+std::map<std::string, HalfPrecisionError> takeHalfPrecisionErrors();
+
+#endif
@@ -0,0 +1,278 @@
+#include "inputhashes.hpp"
+
+#include <map>
+#include <algorithm>
+#include <iostream>
+#include <QCryptographicHash>
+#include <QTextStream>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+
+#include "config.h"
+#include "const.hpp"
+#include "data.hpp"
+#include "util.hpp"
+#include "shaders.hpp"
+
+namespace
+{
+
+// Must be incremented on changes of the C++ code that affect the outputs, so that development builds
+// sharing APP_VERSION don't reuse stale textures
+constexpr int generatorRevision=1;
+
+class Hasher
+{
+    QCryptographicHash hash{QCryptographicHash::Sha1};
+public:
+    explicit Hasher(const char* node)
+    {
+        // The code generating the virtual shaders and driving the kernels may change between versions
+        *this << QString(APP_VERSION) << generatorRevision << QString(node);
+    }
+    Hasher& operator<<(QString const& str)
+    {
+        hash.addData(str.toUtf8());
+        hash.addData("\n", 1);
+        return *this;
+    }
+    template<typename T>
+    Hasher& operator<<(T const& x) { return *this << toString(x); }
+    QString result() const { return hash.result().toHex(); }
+};
+
+struct SavedHash
+{
+    QString inputHash;
+    // Modification time of the output when it was recorded. Another shard or run may overwrite the output,
+    // after which the entries of the other hashes files no longer match it.
+    qint64 modificationTime;
+};
+
+constexpr char hashesFileBaseName[]="input-hashes";
+std::map<QString, SavedHash> savedHashes;
+// Entries from the hashes files of the other shards sharing the output directory
+std::multimap<QString, SavedHash> otherShardsHashes;
+std::map<QString, QString> pendingHashes;
+
+QString hashesFilePath()
+{
+    return QString::fromStdString(atmo.textureOutputDir+"/"+hashesFileBaseName+opts.wavelengthSetRangeSuffix()+".txt");
+}
+
+QString relativePath(std::string const& path)
+{
+    const auto prefix=atmo.textureOutputDir+"/";
+    if(path.compare(0, prefix.size(), prefix)==0)
+        return QString::fromStdString(path.substr(prefix.size()));
+    return QString::fromStdString(path);
+}
+
+qint64 modificationTime(QString const& relPath)
+{
+    const QFileInfo info(QDir(QString::fromStdString(atmo.textureOutputDir)).filePath(relPath));
+    return info.isFile() ? info.lastModified().toMSecsSinceEpoch() : -1;
+}
+
+template<typename Map>
+void readHashesFile(QString const& path, Map& hashes)
+{
+    QFile file(path);
+    if(!file.open(QFile::ReadOnly))
+    {
+        std::cerr << "Failed to open \"" << path << "\": " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    QTextStream in(&file);
+    for(QString line; in.readLineInto(&line);)
+    {
+        const auto colonPos=line.lastIndexOf(':');
+        if(colonPos<0) continue;
+        const auto fields=line.mid(colonPos+1).simplified().split(' ');
+        bool ok=fields.size()==2;
+        const auto time = ok ? fields[1].toLongLong(&ok) : 0;
+        // Entries without a modification time can't be trusted to describe the current file
+        if(!ok) continue;
+        hashes.insert({line.left(colonPos).trimmed(), SavedHash{fields[0], time}});
+    }
+}
+
+void writeHashesFile()
+{
+    QSaveFile file(hashesFilePath());
+    if(!file.open(QFile::WriteOnly))
+    {
+        std::cerr << "Failed to open \"" << hashesFilePath() << "\" for writing: " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    QTextStream out(&file);
+    for(const auto& [path, hash] : savedHashes)
+        out << path << ": " << hash.inputHash << " " << hash.modificationTime << "\n";
+    out.flush();
+    if(!file.commit())
+    {
+        std::cerr << "Failed to write \"" << hashesFilePath() << "\": " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+}
+
+bool hashesAreTracked()
+{
+    return !opts.dbgNoSaveTextures;
+}
+
+}
+
+// XXX: the options that change the results must also be hashed by atmosphereHash() in checkpoint.cpp
+InputHashes computeInputHashes(const unsigned texIndex, glm::mat4 const& radianceToLuminance)
+{
+    const auto wavelengths=atmo.allWavelengths[texIndex];
+
+    // Shader files don't change during the run
+    static const auto transmittanceShaders=shaderFilesHash({"compute-column-densities.frag", "compute-column-density-segments.frag",
+                                                              COMPUTE_NUMBER_DENSITY_LUT_FILENAME,
+                                                              "compute-column-densities-from-cumulative.frag", "compute-transmittance.frag"}).toHex();
+    static const auto eclipsedDoubleScatteringShaders=shaderFilesHash({COMPUTE_ECLIPSED_DOUBLE_SCATTERING_FILENAME,
+                                                                         COMPUTE_PHASE_FUNCTION_LUT_FILENAME}).toHex();
+    static const auto scatteringShaders=shaderFilesHash({"compute-direct-irradiance.frag",
+                                                         "compute-single-scattering.frag",
+                                                         "copy-scattering-texture.frag",
+                                                         "compute-incident-ray-table.frag",
+                                                         COMPUTE_SCATTERING_DENSITY_FILENAME,
+                                                         COMPUTE_SCATTERING_DENSITY_FOR_WAVELENGTH_SETS_FILENAME,
+                                                         COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
+                                                         "compute-multiple-scattering.frag",
+                                                         "compute-preview-multiple-scattering.frag",
+                                                         "compute-preview-scattering-density.frag",
+                                                         "merge-smooth-single-scattering-texture.frag",
+                                                         "sum-scattering-texture-rows.frag",
+                                                         COMPUTE_PHASE_FUNCTION_LUT_FILENAME,
+                                                         "compute-eclipsed-single-scattering.frag",
+                                                         "render.frag"}).toHex();
+
+    InputHashes hashes;
+    {
+        Hasher hash("transmittance");
+        hash << QString(transmittanceShaders) << wavelengths << atmo.earthRadius << atmo.atmosphereHeight
+             << atmo.transmittanceTexW << atmo.transmittanceTexH << atmo.numTransmittanceIntegrationPoints
+             << int(opts.cumulativeTransmittance) << int(opts.numberDensityLUTSize)
+             << int(atmo.radialQuadrature) << atmo.radialQuadratureScaleHeight;
+        for(const auto& scatterer : atmo.scatterers)
+            hash << scatterer.name << scatterer.numberDensity << scatterer.crossSection(wavelengths);
+        for(const auto& absorber : atmo.absorbers)
+            hash << absorber.name << absorber.numberDensity << absorber.crossSection(wavelengths);
+        hashes.transmittance=hash.result();
+    }
+
+    const auto wlI=atmo.wavelengthsIndex(wavelengths);
+    const auto hashPhaseFunctions=[](Hasher& hash)
+    {
+        for(const auto& scatterer : atmo.scatterers)
+            hash << scatterer.name << scatterer.phaseFunction << int(scatterer.phaseFunctionType);
+        hash << int(opts.phaseFunctionLUTSize) << int(opts.prefilterPhaseFunctions);
+    };
+    const auto hashPrecomputedDomain=[](Hasher& hash, const int texSizeBySZA)
+    {
+        hash << glm::vec2(atmo.precomputedAltitudeIndexRange()) << glm::vec2(atmo.precomputedSZAIndexRange(texSizeBySZA));
+    };
+    {
+        Hasher hash("eclipsed double scattering");
+        hash << QString(eclipsedDoubleScatteringShaders) << hashes.transmittance
+             << glm::vec4(atmo.eclipsedDoubleScatteringTextureSize)
+             << int(atmo.eclipsedDoubleScatteringNumberOfAzimuthPairsToSample)
+             << int(atmo.eclipsedDoubleScatteringNumberOfElevationPairsToSample)
+             << atmo.eclipseAngularIntegrationPoints << atmo.radialIntegrationPoints
+             << atmo.earthSunDistance << atmo.earthMoonDistance
+             << atmo.groundAlbedo[wlI] << atmo.solarIrradianceAtTOA[wlI] << int(opts.storagePrecision);
+        hashPhaseFunctions(hash);
+        hashPrecomputedDomain(hash, atmo.eclipsedDoubleScatteringTextureSize[2]);
+        hashes.eclipsedDoubleScattering=hash.result();
+    }
+    {
+        Hasher hash("scattering");
+        hash << QString(scatteringShaders) << hashes.transmittance
+             << atmo.irradianceTexW << atmo.irradianceTexH
+             << glm::vec4(atmo.scatteringTextureSize) << glm::vec2(atmo.eclipsedSingleScatteringTextureSize)
+             << atmo.radialIntegrationPoints << atmo.angularIntegrationPoints << atmo.eclipseAngularIntegrationPoints
+             << int(atmo.scatteringOrdersToCompute) << atmo.earthSunDistance
+             << atmo.groundAlbedo[wlI] << atmo.solarIrradianceAtTOA[wlI] << radianceToLuminance
+             << QString(opts.saveResultAsRadiance ? "radiance" : "luminance")
+             << opts.convergenceTolerance << int(opts.extrapolateTail) << int(opts.storagePrecision)
+             << int(opts.preview);
+        hashPhaseFunctions(hash);
+        hashPrecomputedDomain(hash, atmo.scatteringTextureSize[2]);
+        hashes.scattering=hash.result();
+    }
+    return hashes;
+}
+
+QString radialQuadratureInputHash()
+{
+    Hasher hash("radial quadrature");
+    hash << int(atmo.radialQuadrature) << atmo.numTransmittanceIntegrationPoints << atmo.radialIntegrationPoints;
+    return hash.result();
+}
+
+void loadOutputHashes()
+{
+    savedHashes.clear();
+    otherShardsHashes.clear();
+    pendingHashes.clear();
+    if(!hashesAreTracked()) return;
+
+    const QDir dir(QString::fromStdString(atmo.textureOutputDir));
+    const auto ownPath=hashesFilePath();
+    for(const auto& fileName : dir.entryList({QString(hashesFileBaseName)+"*.txt"}, QDir::Files))
+    {
+        const auto path=dir.filePath(fileName);
+        if(QFileInfo(path)==QFileInfo(ownPath))
+            readHashesFile(path, savedHashes);
+        else
+            readHashesFile(path, otherShardsHashes);
+    }
+}
+
+bool outputIsUpToDate(std::string const& path, QString const& inputHash)
+{
+    if(opts.recomputeAll || !hashesAreTracked()) return false;
+    const auto relPath=relativePath(path);
+    const auto time=modificationTime(relPath);
+    if(time<0) return false;
+    const auto matches=[&](SavedHash const& hash) { return hash.inputHash==inputHash && hash.modificationTime==time; };
+    if(const auto it=savedHashes.find(relPath); it!=savedHashes.end() && matches(it->second))
+        return true;
+    const auto [begin, end]=otherShardsHashes.equal_range(relPath);
+    return std::any_of(begin, end, [&](auto const& entry) { return matches(entry.second); });
+}
+
+void forgetOutputs(std::vector<std::string> const& paths)
+{
+    if(!hashesAreTracked()) return;
+    bool changed=false;
+    for(const auto& path : paths)
+    {
+        const auto relPath=relativePath(path);
+        pendingHashes.erase(relPath);
+        changed = savedHashes.erase(relPath) || changed;
+    }
+    if(changed)
+        writeHashesFile();
+}
+
+void recordOutput(std::string const& path, QString const& inputHash)
+{
+    if(!hashesAreTracked()) return;
+    pendingHashes[relativePath(path)]=inputHash;
+}
+
+void saveOutputHashes()
+{
+    if(pendingHashes.empty()) return;
+    for(const auto& [path, hash] : pendingHashes)
+        savedHashes[path]=SavedHash{hash, modificationTime(path)};
+    pendingHashes.clear();
+    writeHashesFile();
+}
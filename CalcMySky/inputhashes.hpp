@@ -0,0 +1,36 @@
+#ifndef INCLUDE_ONCE_589688AF_7565_40A3_92B1_48EFCE43D975
+#define INCLUDE_ONCE_589688AF_7565_40A3_92B1_48EFCE43D975
+
+#include <string>
+#include <vector>
+#include <QString>
+#include <glm/glm.hpp>
+
+/* Hashes of the parameters and shader sources that the outputs of a wavelength set depend on, following
+ * the dependencies in doc/data-dependencies.dot.m4. E.g. transmittance doesn't depend on ground albedo
+ * and phase functions, so it needn't be recomputed when only these change.
+ */
+struct InputHashes
+{
+    QString transmittance;
+    QString eclipsedDoubleScattering; // includes the hash of transmittance
+    QString scattering; // irradiance, single and multiple scattering; includes the hash of transmittance
+};
+InputHashes computeInputHashes(unsigned texIndex, glm::mat4 const& radianceToLuminance);
+// Hash of the inputs of the table of Gauss-Legendre nodes, which is shared by all the wavelength sets
+QString radialQuadratureInputHash();
+
+/* The input hashes of the textures saved to the output directory are kept in a file there, one per shard
+ * of wavelength sets, together with the modification times of the textures. An output recorded by
+ * recordOutput() is only written to that file by saveOutputHashes(), which must be called when all the
+ * saves have completed. An output that's going to be overwritten must be forgotten before that, so that
+ * an interrupted write doesn't leave it looking up to date. The files of the other shards are only read,
+ * so that e.g. a full run can reuse the transmittance textures computed by the shards.
+ */
+void loadOutputHashes();
+bool outputIsUpToDate(std::string const& path, QString const& inputHash);
+void forgetOutputs(std::vector<std::string> const& paths);
+void recordOutput(std::string const& path, QString const& inputHash);
+void saveOutputHashes();
+
+#endif
@@ -1,17 +1,25 @@
 #define _USE_MATH_DEFINES // for MSVC to define M_PI etc.
 #include <iostream>
 #include <iterator>
+#include <algorithm>
 #include <sstream>
 #include <complex>
+#include <deque>
 #include <memory>
 #include <random>
+#include <stdexcept>
 #include <chrono>
 #include <cmath>
 #include <map>
 #include <set>
+#include <limits>
+#include <functional>
 
+#include <QCryptographicHash>
 #include <QOffscreenSurface>
+#include <QOpenGLContext>
 #include <QSurfaceFormat>
+#include <QCoreApplication>
 #include <QApplication>
 #include <QRegExp>
 #include <QImage>
@@ -23,6 +31,14 @@
 #include "glinit.hpp"
 #include "cmdline.hpp"
 #include "shaders.hpp"
+#include "checkpoint.hpp"
+#include "texsave.hpp"
+#include "report.hpp"
+#include "scheduler.hpp"
+#include "inputhashes.hpp"
+#include "estimate.hpp"
+#include "computation.hpp"
+#include "tune.hpp"
 #include "../common/EclipsedDoubleScatteringPrecomputer.hpp"
 #include "../common/cie-xyzw-functions.hpp"
 #include "../common/timing.hpp"
@@ -54,14 +70,74 @@ glm::mat4 radianceToLuminance(const unsigned texIndex)
                                       wavelengthToXYZW(atmo.allWavelengths[texIndex][3])) * dlambda;
 }
 
-void saveIrradiance(const unsigned scatteringOrder, const unsigned texIndex)
+// Shards computing a subrange of wavelength sets save partial sums, which are then added up by calcmysky-merge
+std::string accumulatorFileNameSuffix()
+{
+    if(!opts.partialWavelengthSetRange())
+        return "-xyzw.f32";
+    return PARTIAL_ACCUMULATOR_SUFFIX+std::to_string(opts.firstWavelengthSet)+"-"+std::to_string(opts.lastWavelengthSet)+".f32";
+}
+
+std::string transmittanceTexturePath(const unsigned texIndex)
+{
+    return atmo.textureOutputDir+"/transmittance-wlset"+std::to_string(texIndex)+".f32";
+}
+
+std::string irradianceTexturePath(const unsigned texIndex)
+{
+    return atmo.textureOutputDir+"/irradiance-wlset"+std::to_string(texIndex)+".f32";
+}
+
+std::string phaseFunctionTexturePath(const unsigned texIndex)
+{
+    return atmo.textureOutputDir+"/phase-functions-wlset"+std::to_string(texIndex)+".f32";
+}
+
+std::string eclipsedDoubleScatteringTexturePath(const unsigned texIndex)
+{
+    return atmo.textureOutputDir+"/eclipsed-double-scattering-wlset"+std::to_string(texIndex)+".f32";
+}
+
+// Outputs of the scattering computations that belong to a single wavelength set
+std::vector<std::string> scatteringOutputs(const unsigned texIndex)
 {
-    if(scatteringOrder==atmo.scatteringOrdersToCompute)
+    std::vector<std::string> paths{irradianceTexturePath(texIndex)};
+    for(const auto& scatterer : atmo.scatterers)
+    {
+        if(scatterer.phaseFunctionType==PhaseFunctionType::General)
+            paths.push_back(atmo.textureOutputDir+"/single-scattering/"+std::to_string(texIndex)+"/"+scatterer.name.toStdString()+".f32");
+    }
+    if(opts.saveResultAsRadiance)
+        paths.push_back(atmo.textureOutputDir+"/multiple-scattering-wlset"+std::to_string(texIndex)+".f32");
+    return paths;
+}
+
+// Outputs of the scattering computations accumulated over all the wavelength sets
+std::vector<std::string> scatteringAccumulatorOutputs()
+{
+    std::vector<std::string> paths;
+    for(const auto& scatterer : atmo.scatterers)
     {
-        saveTexture(GL_TEXTURE_2D,textures[TEX_IRRADIANCE],"irradiance texture",
-                    atmo.textureOutputDir+"/irradiance-wlset"+std::to_string(texIndex)+".f32",
-                    {atmo.irradianceTexW, atmo.irradianceTexH});
+        if(scatterer.phaseFunctionType==PhaseFunctionType::Achromatic)
+            paths.push_back(atmo.textureOutputDir+"/single-scattering/"+scatterer.name.toStdString()+accumulatorFileNameSuffix());
     }
+    if(!opts.saveResultAsRadiance)
+        paths.push_back(atmo.textureOutputDir+"/multiple-scattering"+accumulatorFileNameSuffix());
+    return paths;
+}
+
+void saveFinalIrradiance(const unsigned texIndex)
+{
+    saveTexture(GL_TEXTURE_2D,textures[TEX_IRRADIANCE],"irradiance texture",
+                irradianceTexturePath(texIndex),
+                {atmo.irradianceTexW, atmo.irradianceTexH}, opts.storagePrecision);
+}
+
+void saveIrradiance(const unsigned scatteringOrder, const unsigned texIndex)
+{
+    // The preview saves it after its last pass
+    if(scatteringOrder==atmo.scatteringOrdersToCompute && !opts.preview)
+        saveFinalIrradiance(texIndex);
 
     if(!opts.dbgSaveGroundIrradiance) return;
 
@@ -83,7 +159,14 @@ void saveScatteringDensity(const unsigned scatteringOrder, const unsigned texInd
                 {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]});
 }
 
-void render3DTexLayers(QOpenGLShaderProgram& program, const std::string_view whatIsBeingDone)
+// The accumulators are only saved for rendering, except for debugging
+TexelDomain accumulatorDomain()
+{
+    return opts.dbgSaveAccumScattering ? TexelDomain::All : TexelDomain::Precomputed;
+}
+
+void render3DTexLayers(QOpenGLShaderProgram& program, const std::string_view whatIsBeingDone,
+                       const TexelDomain domain=TexelDomain::All)
 {
     if(opts.dbgNoSaveTextures) return; // don't take time to do useless computations
 
@@ -94,15 +177,61 @@ void render3DTexLayers(QOpenGLShaderProgram& program, const std::string_view wha
     }
 
     std::cerr << indentOutput() << whatIsBeingDone << "... ";
-    for(GLsizei layer=0; layer<atmo.scatTexDepth(); ++layer)
+    const auto time0=std::chrono::steady_clock::now();
+
+    GLsizei beginLayer=0, endLayer=atmo.scatTexDepth();
+    if(domain==TexelDomain::Precomputed)
+    {
+        const auto region=precomputedScatteringTextureRegion();
+        beginLayer=region.offset.z;
+        endLayer=region.offset.z+region.size.z;
+        gl.glEnable(GL_SCISSOR_TEST);
+        gl.glScissor(0, region.offset.y, atmo.scatTexWidth(), region.size.y);
+    }
+    const GLsizei layerCount=endLayer-beginLayer;
+
+    // Submit all the draws at once, so that the GPU doesn't wait for us between them, and
+    // track the progress by fences instead.
+    constexpr GLuint64 pollTimeout=100'000'000; // ns
+    std::vector<std::pair<GLsizei/*first layer*/, GLsync>> fences;
+    const auto submitDraw=[&program,&fences](const GLsizei firstLayer, const GLsizei layers)
+    {
+        program.setUniformValue("firstLayer",firstLayer);
+        renderQuad(layers);
+        fences.emplace_back(firstLayer, gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    };
+    GLsizei nextLayer=beginLayer;
+    GLsizei layersPerDraw=std::min(GLsizei(opts.layersPerDraw), layerCount);
+    if(!layersPerDraw && layerCount>0)
+    {
+        // The cost of a layer depends on the kernel and the integration point counts, and no GL limit bounds the duration
+        // of a draw, so it's measured on the first layer. The draws are kept well below the 2 s default of the Windows GPU watchdog.
+        constexpr std::chrono::milliseconds maxAutoDrawTime{200};
+        const auto drawStart=std::chrono::steady_clock::now();
+        submitDraw(nextLayer++, 1);
+        while(gl.glClientWaitSync(fences.back().second, GL_SYNC_FLUSH_COMMANDS_BIT, pollTimeout)==GL_TIMEOUT_EXPIRED);
+        const auto layerTime=std::max(std::chrono::steady_clock::now()-drawStart, std::chrono::steady_clock::duration(1));
+        layersPerDraw=std::clamp<GLsizei>(maxAutoDrawTime/layerTime, 1, layerCount);
+    }
+    for(; nextLayer<endLayer; nextLayer+=layersPerDraw)
+        submitDraw(nextLayer, std::min(layersPerDraw, endLayer-nextLayer));
+    gl.glFlush();
+    gl.glDisable(GL_SCISSOR_TEST);
+
+    for(const auto& [firstLayer, fence] : fences)
     {
         std::ostringstream ss;
-        ss << layer << " of " << atmo.scatTexDepth() << " layers done";
+        ss << firstLayer-beginLayer << " of " << layerCount << " layers done";
         std::cerr << ss.str();
 
-        program.setUniformValue("layer",layer);
-        renderQuad();
-        gl.glFinish();
+        GLenum status;
+        while((status=gl.glClientWaitSync(fence, 0, pollTimeout))==GL_TIMEOUT_EXPIRED);
+        gl.glDeleteSync(fence);
+        if(status==GL_WAIT_FAILED)
+        {
+            std::cerr << "FAILED to wait for rendering to complete: " << openglErrorString(gl.glGetError()) << "\n";
+            throw MustQuit{};
+        }
 
         // Clear previous status and reset cursor position
         const auto statusWidth=ss.tellp();
@@ -114,14 +243,176 @@ void render3DTexLayers(QOpenGLShaderProgram& program, const std::string_view wha
         std::cerr << "FAILED: " << openglErrorString(err) << "\n";
         throw MustQuit{};
     }
+    const auto time1=std::chrono::steady_clock::now();
+    std::cerr << "done in " << formatDeltaTime(time0, time1) << "\n";
+}
+
+void computeColumnDensitiesByIntegration()
+{
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_COLUMN_DENSITIES]);
+    gl.glViewport(0, 0, atmo.transmittanceTexW, atmo.transmittanceTexH);
+    for(unsigned group=0; group<columnDensityGroupCount(); ++group)
+    {
+        virtualSourceFiles[COMPUTE_COLUMN_DENSITIES_SHADER_FILENAME]=makeColumnDensitiesComputeFunctionsSrc(group);
+        const auto program=compileShaderProgram("compute-column-densities.frag", "column densities computation shader program");
+
+        gl.glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_COLUMN_DENSITIES],0,group);
+        checkFramebufferStatus("framebuffer for column densities texture");
+
+        program->bind();
+        renderQuad();
+        reportWork(kernelWork(Kernel::ColumnDensities));
+    }
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
+/* Integrates the densities over the short segments between the entries of the cumulative column density table,
+ * sums them up along the rows of the table on the CPU, and then takes the column density of each texel of the
+ * transmittance texture as a difference of two interpolated entries. See cumulative-column-densities.frag.
+ */
+void computeColumnDensitiesFromCumulativeTable()
+{
+    const auto tableSize=cumulativeColumnDensityTableSize();
+    const auto groupCount=columnDensityGroupCount();
+
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_COLUMN_DENSITIES]);
+    gl.glViewport(0, 0, tableSize.x, tableSize.y);
+    for(unsigned group=0; group<groupCount; ++group)
+    {
+        virtualSourceFiles[COMPUTE_COLUMN_DENSITIES_SHADER_FILENAME]=makeColumnDensitiesComputeFunctionsSrc(group);
+        const auto program=compileShaderProgram("compute-column-density-segments.frag",
+                                                "column density segments computation shader program");
+
+        gl.glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_CUMULATIVE_COLUMN_DENSITIES],0,group);
+        checkFramebufferStatus("framebuffer for cumulative column densities table");
+
+        program->bind();
+        program->setUniformValue("tableSize", GLfloat(tableSize.x), GLfloat(tableSize.y));
+        renderQuad();
+        reportWork(kernelWork(Kernel::ColumnDensities));
+    }
+
+    auto table=readTexture(GL_TEXTURE_3D, textures[TEX_CUMULATIVE_COLUMN_DENSITIES], size_t(tableSize.x)*tableSize.y*groupCount);
+    reportBytesReadBack(table.size()*sizeof table[0]);
+    for(size_t row=0; row<size_t(tableSize.y)*groupCount; ++row)
+    {
+        const auto rowData=&table[row*tableSize.x];
+        glm::dvec4 sum(0);
+        for(int i=0; i<tableSize.x; ++i)
+        {
+            sum+=glm::dvec4(rowData[i]);
+            rowData[i]=glm::vec4(sum);
+        }
+    }
+    gl.glBindTexture(GL_TEXTURE_3D,textures[TEX_CUMULATIVE_COLUMN_DENSITIES]);
+    gl.glTexSubImage3D(GL_TEXTURE_3D,0,0,0,0,tableSize.x,tableSize.y,groupCount,GL_RGBA,GL_FLOAT,table.data());
+    gl.glBindTexture(GL_TEXTURE_3D,0);
+    if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
+    {
+        std::cerr << "GL error while uploading cumulative column densities: " << openglErrorString(err) << "\n";
+        throw MustQuit{};
+    }
+
+    const auto program=compileShaderProgram("compute-column-densities-from-cumulative.frag",
+                                            "column densities lookup shader program");
+    program->bind();
+    setUniformTexture(*program,GL_TEXTURE_3D,TEX_CUMULATIVE_COLUMN_DENSITIES,0,"cumulativeColumnDensitiesTexture");
+    gl.glViewport(0, 0, atmo.transmittanceTexW, atmo.transmittanceTexH);
+    for(unsigned group=0; group<groupCount; ++group)
+    {
+        gl.glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_COLUMN_DENSITIES],0,group);
+        checkFramebufferStatus("framebuffer for column densities texture");
+        program->setUniformValue("group", int(group));
+        renderQuad();
+    }
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
+void computeColumnDensities()
+{
+    StageTimer timer("column densities");
+    const auto texelCount=size_t(atmo.transmittanceTexW)*atmo.transmittanceTexH*columnDensityGroupCount();
+    std::cerr << indentOutput() << "Computing column densities... ";
+
+    std::vector<glm::vec4> reference;
+    if(opts.dbgCheckCumulativeTransmittance)
+    {
+        computeColumnDensitiesByIntegration();
+        reference=readTexture(GL_TEXTURE_3D, textures[TEX_COLUMN_DENSITIES], texelCount);
+    }
+    if(opts.cumulativeTransmittance)
+        computeColumnDensitiesFromCumulativeTable();
+    else
+        computeColumnDensitiesByIntegration();
+    gl.glFinish();
     std::cerr << "done\n";
+
+    if(!reference.empty())
+    {
+        const auto difference=maxRelativeDifference(readTexture(GL_TEXTURE_3D, textures[TEX_COLUMN_DENSITIES], texelCount), reference);
+        std::cerr << indentOutput() << "Max relative difference of column densities from the cumulative table from "
+                                       "brute-force integration: " << difference << "\n";
+    }
+    columnDensitiesComputed=true;
 }
 
-void computeTransmittance(const unsigned texIndex)
+/* Tabulates the number densities of the species at uniformly spaced altitudes, so that the compute programs
+ * sample them instead of evaluating possibly expensive density functions. The error of linear interpolation
+ * is estimated from the densities midway between the entries.
+ */
+void computeNumberDensityLUT()
 {
-    const auto program=compileShaderProgram("compute-transmittance.frag", "transmittance computation shader program");
+    StageTimer timer("number density LUT");
+    std::cerr << indentOutput() << "Tabulating number densities... ";
+    const auto lutSize=opts.numberDensityLUTSize;
+    const auto groupCount=columnDensityGroupCount();
+
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_NUMBER_DENSITY_LUT]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_NUMBER_DENSITY_LUT],0);
+    checkFramebufferStatus("framebuffer for number density LUT");
+    const auto render=[lutSize,groupCount](const float sampleOffset)
+    {
+        for(unsigned group=0; group<groupCount; ++group)
+        {
+            virtualSourceFiles[COMPUTE_COLUMN_DENSITIES_SHADER_FILENAME]=makeColumnDensitiesComputeFunctionsSrc(group);
+            const auto program=compileShaderProgram(COMPUTE_NUMBER_DENSITY_LUT_FILENAME, "number density LUT computation shader program");
+            program->bind();
+            program->setUniformValue("lutSize", GLfloat(lutSize));
+            program->setUniformValue("sampleOffset", sampleOffset);
+            gl.glViewport(0, group, lutSize, 1);
+            renderQuad();
+        }
+        return readTexture(GL_TEXTURE_2D, textures[TEX_NUMBER_DENSITY_LUT], size_t(lutSize)*groupCount);
+    };
+    const auto midpoints=render(0.5);
+    const auto lut=render(0);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+    reportBytesReadBack((midpoints.size()+lut.size())*sizeof lut[0]);
 
-    std::cerr << indentOutput() << "Computing transmittance... ";
+    std::vector<glm::vec4> interpolated, exact;
+    for(unsigned group=0; group<groupCount; ++group)
+    {
+        for(unsigned i=0; i+1<lutSize; ++i)
+        {
+            const auto entry=&lut[group*lutSize+i];
+            interpolated.push_back((entry[0]+entry[1])/2.f);
+            exact.push_back(midpoints[group*lutSize+i]);
+        }
+    }
+
+    gl.glActiveTexture(GL_TEXTURE0+NUMBER_DENSITY_LUT_TEXTURE_UNIT);
+    gl.glBindTexture(GL_TEXTURE_2D,textures[TEX_NUMBER_DENSITY_LUT]);
+    gl.glActiveTexture(GL_TEXTURE0);
+    numberDensityLUTReady=true;
+    std::cerr << "done; max relative error of interpolation: " << maxRelativeDifference(interpolated, exact) << "\n";
+}
+
+void renderTransmittance()
+{
+    if(!columnDensitiesComputed)
+        computeColumnDensities();
+
+    const auto program=compileShaderProgram("compute-transmittance.frag", "transmittance computation shader program");
 
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_TRANSMITTANCE]);
     assert(fbos[FBO_TRANSMITTANCE]);
@@ -129,21 +420,45 @@ void computeTransmittance(const unsigned texIndex)
     checkFramebufferStatus("framebuffer for transmittance texture");
 
     program->bind();
+    setUniformTexture(*program,GL_TEXTURE_3D,TEX_COLUMN_DENSITIES,0,"columnDensitiesTexture");
     gl.glViewport(0, 0, atmo.transmittanceTexW, atmo.transmittanceTexH);
     renderQuad();
+    reportWork(kernelWork(Kernel::Transmittance));
+
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
 
+void computeTransmittance(const unsigned texIndex)
+{
+    StageTimer timer("transmittance");
+
+    std::cerr << indentOutput() << "Computing transmittance... ";
+    renderTransmittance();
     gl.glFinish();
     std::cerr << "done\n";
 
     saveTexture(GL_TEXTURE_2D,textures[TEX_TRANSMITTANCE],"transmittance texture",
-                atmo.textureOutputDir+"/transmittance-wlset"+std::to_string(texIndex)+".f32",
+                transmittanceTexturePath(texIndex),
                 {atmo.transmittanceTexW, atmo.transmittanceTexH});
+}
 
-    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+void computeOrLoadTransmittance(const unsigned texIndex, QString const& inputHash)
+{
+    const auto path=transmittanceTexturePath(texIndex);
+    if(outputIsUpToDate(path, inputHash))
+    {
+        loadTexture(GL_TEXTURE_2D,textures[TEX_TRANSMITTANCE],"up-to-date transmittance texture",
+                    path, {atmo.transmittanceTexW, atmo.transmittanceTexH});
+        return;
+    }
+    forgetOutputs({path});
+    computeTransmittance(texIndex);
+    recordOutput(path, inputHash);
 }
 
 void computeDirectGroundIrradiance(const unsigned texIndex)
 {
+    StageTimer timer("direct ground irradiance", -1, 1);
     const auto program=compileShaderProgram("compute-direct-irradiance.frag", "direct ground irradiance computation shader program");
 
     std::cerr << indentOutput() << "Computing direct ground irradiance... ";
@@ -163,6 +478,7 @@ void computeDirectGroundIrradiance(const unsigned texIndex)
 
     gl.glFinish();
     std::cerr << "done\n";
+    reportWork(kernelWork(Kernel::DirectIrradiance));
 
     saveIrradiance(1,texIndex);
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
@@ -171,6 +487,22 @@ void computeDirectGroundIrradiance(const unsigned texIndex)
 static constexpr char renderShaderFileName[]="render.frag";
 constexpr char viewDirFuncFileName[]="calc-view-dir.frag";
 constexpr char viewDirStubFunc[]="#version 330\nvec3 calcViewDir() { return vec3(0); }";
+void saveShaderSource(QString const& filePath, QString const& src)
+{
+    std::cerr << indentOutput() << "Saving shader \"" << filePath << "\"... ";
+    runInBackground("saving shader \""+filePath.toStdString()+"\"", [filePath, data=src.toUtf8()]
+    {
+        QFile file(filePath);
+        if(!file.open(QFile::WriteOnly))
+            throw std::runtime_error("failed to open file: "+file.errorString().toStdString());
+        file.write(data);
+        file.close();
+        if(file.error())
+            throw std::runtime_error("failed to write file: "+file.errorString().toStdString());
+    });
+    std::cerr << "queued\n";
+}
+
 void saveZeroOrderScatteringRenderingShader(const unsigned texIndex)
 {
     std::vector<std::pair<QString, QString>> sourcesToSave;
@@ -187,21 +519,7 @@ void saveZeroOrderScatteringRenderingShader(const unsigned texIndex)
 
         const auto filePath=QString("%1/shaders/zero-order-scattering/%2/%3")
                                 .arg(atmo.textureOutputDir.c_str()).arg(texIndex).arg(filename);
-        std::cerr << indentOutput() << "Saving shader \"" << filePath << "\"...";
-        QFile file(filePath);
-        if(!file.open(QFile::WriteOnly))
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        file.write(src.toUtf8());
-        file.flush();
-        if(file.error())
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        std::cerr << "done\n";
+        saveShaderSource(filePath, src);
     }
 }
 
@@ -221,21 +539,7 @@ void saveEclipsedZeroOrderScatteringRenderingShader(const unsigned texIndex)
 
         const auto filePath=QString("%1/shaders/eclipsed-zero-order-scattering/%2/%3")
                                 .arg(atmo.textureOutputDir.c_str()).arg(texIndex).arg(filename);
-        std::cerr << indentOutput() << "Saving shader \"" << filePath << "\"...";
-        QFile file(filePath);
-        if(!file.open(QFile::WriteOnly))
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        file.write(src.toUtf8());
-        file.flush();
-        if(file.error())
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        std::cerr << "done\n";
+        saveShaderSource(filePath, src);
     }
 }
 
@@ -254,21 +558,7 @@ void saveMultipleScatteringRenderingShader(const unsigned texIndex)
 
         const auto filePath = opts.saveResultAsRadiance ? QString("%1/shaders/multiple-scattering/%2/%3").arg(atmo.textureOutputDir.c_str()).arg(texIndex).arg(filename)
                                                         : QString("%1/shaders/multiple-scattering/%2").arg(atmo.textureOutputDir.c_str()).arg(filename);
-        std::cerr << indentOutput() << "Saving shader \"" << filePath << "\"...";
-        QFile file(filePath);
-        if(!file.open(QFile::WriteOnly))
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        file.write(src.toUtf8());
-        file.flush();
-        if(file.error())
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        std::cerr << "done\n";
+        saveShaderSource(filePath, src);
     }
 }
 
@@ -299,21 +589,7 @@ void saveSingleScatteringRenderingShader(const unsigned texIndex, AtmospherePara
         const auto filePath = scatterer.phaseFunctionType==PhaseFunctionType::General || renderMode==SSRM_ON_THE_FLY ?
            QString("%1/shaders/single-scattering/%2/%3/%4/%5").arg(atmo.textureOutputDir.c_str()).arg(toString(renderMode)).arg(texIndex).arg(scatterer.name).arg(filename) :
            QString("%1/shaders/single-scattering/%2/%3/%4").arg(atmo.textureOutputDir.c_str()).arg(toString(renderMode)).arg(scatterer.name).arg(filename);
-        std::cerr << indentOutput() << "Saving shader \"" << filePath << "\"...";
-        QFile file(filePath);
-        if(!file.open(QFile::WriteOnly))
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        file.write(src.toUtf8());
-        file.flush();
-        if(file.error())
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        std::cerr << "done\n";
+        saveShaderSource(filePath, src);
     }
 }
 
@@ -342,21 +618,7 @@ void saveEclipsedSingleScatteringRenderingShader(const unsigned texIndex, Atmosp
         const auto filePath = scatterer.phaseFunctionType==PhaseFunctionType::General || renderMode==SSRM_ON_THE_FLY ?
             QString("%1/shaders/single-scattering-eclipsed/%2/%3/%4/%5").arg(atmo.textureOutputDir.c_str()).arg(toString(renderMode)).arg(texIndex).arg(scatterer.name).arg(filename) :
             QString("%1/shaders/single-scattering-eclipsed/%2/%3/%4").arg(atmo.textureOutputDir.c_str()).arg(toString(renderMode)).arg(scatterer.name).arg(filename);
-        std::cerr << indentOutput() << "Saving shader \"" << filePath << "\"...";
-        QFile file(filePath);
-        if(!file.open(QFile::WriteOnly))
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        file.write(src.toUtf8());
-        file.flush();
-        if(file.error())
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        std::cerr << "done\n";
+        saveShaderSource(filePath, src);
     }
 }
 
@@ -382,21 +644,7 @@ void saveEclipsedSingleScatteringComputationShader(const unsigned texIndex, Atmo
                                     .arg(texIndex)
                                     .arg(scatterer.name)
                                     .arg(filename);
-        std::cerr << indentOutput() << "Saving shader \"" << filePath << "\"...";
-        QFile file(filePath);
-        if(!file.open(QFile::WriteOnly))
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        file.write(src.toUtf8());
-        file.flush();
-        if(file.error())
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        std::cerr << "done\n";
+        saveShaderSource(filePath, src);
     }
 }
 
@@ -418,64 +666,71 @@ void saveEclipsedDoubleScatteringRenderingShader(const unsigned texIndex)
         const auto filePath = QString("%1/shaders/double-scattering-eclipsed/precomputed/%2/%3").arg(atmo.textureOutputDir.c_str())
                                                                                                 .arg(texIndex)
                                                                                                 .arg(filename);
-        std::cerr << indentOutput() << "Saving shader \"" << filePath << "\"...";
-        QFile file(filePath);
-        if(!file.open(QFile::WriteOnly))
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        file.write(src.toUtf8());
-        file.flush();
-        if(file.error())
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        std::cerr << "done\n";
+        saveShaderSource(filePath, src);
     }
 }
 
 void accumulateSingleScattering(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
 {
-    gl.glBlendFunc(GL_ONE, GL_ONE);
-    gl.glEnable(GL_BLEND);
-    auto& targetTexture=accumulatedSingleScatteringTextures[scatterer.name];
-    if(!targetTexture)
-    {
-        gl.glGenTextures(1, &targetTexture);
-        gl.glBindTexture(GL_TEXTURE_3D,targetTexture);
-        gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-        gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
-        gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
-        gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
-        setupTexture(targetTexture, atmo.scatTexWidth(),atmo.scatTexHeight(),atmo.scatTexDepth());
-        gl.glDisable(GL_BLEND);
-    }
-    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_SINGLE_SCATTERING]);
-    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, targetTexture,0);
-    checkFramebufferStatus("framebuffer for accumulation of single scattering radiance");
+    StageTimer timer("accumulate single scattering");
+    auto& accumulator=singleScatteringAccumulators[scatterer.name];
+    const bool blend=bool(accumulator);
+    if(!accumulator)
+        accumulator=std::make_unique<ScatteringAccumulator>();
 
-    const auto program=compileShaderProgram("copy-scattering-texture.frag",
-                                            "scattering texture copy-blend shader program",
-                                            UseGeomShader{});
-    program->bind();
-    setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"tex");
-    program->setUniformValue("radianceToLuminance", toQMatrix(radianceToLuminance(texIndex)));
-    render3DTexLayers(*program, "Blending single scattering layers into accumulator texture");
+    if(accumulator->inHostMemory())
+    {
+        accumulator->addTexture(textures[TEX_DELTA_SCATTERING], radianceToLuminance(texIndex), blend,
+                                "Adding single scattering layers to accumulator in host memory");
+    }
+    else
+    {
+        gl.glBlendFunc(GL_ONE, GL_ONE);
+        if(blend)
+            gl.glEnable(GL_BLEND);
+        else
+            gl.glDisable(GL_BLEND);
+        gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_SINGLE_SCATTERING]);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, accumulator->texture(),0);
+        checkFramebufferStatus("framebuffer for accumulation of single scattering radiance");
+
+        const auto program=compileShaderProgram("copy-scattering-texture.frag",
+                                                "scattering texture copy-blend shader program",
+                                                UseGeomShader{});
+        program->bind();
+        setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"tex");
+        program->setUniformValue("radianceToLuminance", toQMatrix(radianceToLuminance(texIndex)));
+        render3DTexLayers(*program, "Blending single scattering layers into accumulator texture", accumulatorDomain());
 
-    gl.glDisable(GL_BLEND);
-    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+        gl.glDisable(GL_BLEND);
+        gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+    }
 
-    if(texIndex+1==atmo.allWavelengths.size() && scatterer.phaseFunctionType!=PhaseFunctionType::Smooth)
+    if(texIndex==opts.lastWavelengthSet && scatterer.phaseFunctionType!=PhaseFunctionType::Smooth)
     {
-        saveTexture(GL_TEXTURE_3D,targetTexture, "single scattering texture",
-                    atmo.textureOutputDir+"/single-scattering/"+scatterer.name.toStdString()+"-xyzw.f32",
-                    {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]});
+        accumulator->saveForRendering("single scattering texture",
+                                      atmo.textureOutputDir+"/single-scattering/"+scatterer.name.toStdString()+accumulatorFileNameSuffix(),
+                                      opts.accumulatorOutputPrecision());
     }
 }
 
-void computeSingleScattering(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
+void setupSingleScatteringSources(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
+{
+    virtualSourceFiles[DENSITIES_SHADER_FILENAME]=makeScattererDensityFunctionsSrc()+
+                    "float scattererDensity(float alt) { return scattererNumberDensity_"+scatterer.name+"(alt); }\n"+
+                    "vec4 scatteringCrossSection() { return "+toString(scatterer.crossSection(atmo.allWavelengths[texIndex]))+"; }\n";
+}
+
+void saveSingleScatteringShaders(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
+{
+    saveSingleScatteringRenderingShader(texIndex, scatterer, SSRM_ON_THE_FLY);
+    saveSingleScatteringRenderingShader(texIndex, scatterer, SSRM_PRECOMPUTED);
+    saveEclipsedSingleScatteringRenderingShader(texIndex, scatterer, SSRM_ON_THE_FLY);
+    saveEclipsedSingleScatteringRenderingShader(texIndex, scatterer, SSRM_PRECOMPUTED);
+    saveEclipsedSingleScatteringComputationShader(texIndex, scatterer);
+}
+
+void renderSingleScattering(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
 {
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_DELTA_SCATTERING]);
     gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, textures[TEX_DELTA_SCATTERING],0);
@@ -483,10 +738,7 @@ void computeSingleScattering(const unsigned texIndex, AtmosphereParameters::Scat
 
     gl.glViewport(0, 0, atmo.scatTexWidth(), atmo.scatTexHeight());
 
-    const auto src=makeScattererDensityFunctionsSrc()+
-                    "float scattererDensity(float alt) { return scattererNumberDensity_"+scatterer.name+"(alt); }\n"+
-                    "vec4 scatteringCrossSection() { return "+toString(scatterer.crossSection(atmo.allWavelengths[texIndex]))+"; }\n";
-    virtualSourceFiles[DENSITIES_SHADER_FILENAME]=src;
+    setupSingleScatteringSources(texIndex, scatterer);
     const auto program=compileShaderProgram("compute-single-scattering.frag",
                                             "single scattering computation shader program",
                                             UseGeomShader{});
@@ -494,15 +746,22 @@ void computeSingleScattering(const unsigned texIndex, AtmosphereParameters::Scat
     setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE,0,"transmittanceTexture");
 
     render3DTexLayers(*program, "Computing single scattering layers");
+    reportWork(kernelWork(Kernel::SingleScattering));
 
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
+void computeSingleScattering(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
+{
+    StageTimer timer("single scattering", -1, 1);
+    renderSingleScattering(texIndex, scatterer);
 
     switch(scatterer.phaseFunctionType)
     {
     case PhaseFunctionType::General:
-        saveTexture(GL_TEXTURE_3D,textures[TEX_DELTA_SCATTERING], "single scattering texture",
-                    atmo.textureOutputDir+"/single-scattering/"+std::to_string(texIndex)+"/"+scatterer.name.toStdString()+".f32",
-                    {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]});
+        saveScatteringTexture(textures[TEX_DELTA_SCATTERING], "single scattering texture",
+                              atmo.textureOutputDir+"/single-scattering/"+std::to_string(texIndex)+"/"+scatterer.name.toStdString()+".f32",
+                              opts.storagePrecision);
         break;
     case PhaseFunctionType::Achromatic:
     case PhaseFunctionType::Smooth:
@@ -510,24 +769,54 @@ void computeSingleScattering(const unsigned texIndex, AtmosphereParameters::Scat
         break;
     }
 
-    saveSingleScatteringRenderingShader(texIndex, scatterer, SSRM_ON_THE_FLY);
-    saveSingleScatteringRenderingShader(texIndex, scatterer, SSRM_PRECOMPUTED);
-    saveEclipsedSingleScatteringRenderingShader(texIndex, scatterer, SSRM_ON_THE_FLY);
-    saveEclipsedSingleScatteringRenderingShader(texIndex, scatterer, SSRM_PRECOMPUTED);
-    saveEclipsedSingleScatteringComputationShader(texIndex, scatterer);
+    saveSingleScatteringShaders(texIndex, scatterer);
 }
 
-void computeIndirectIrradianceOrder1(unsigned texIndex, unsigned scattererIndex);
-void computeScatteringDensityOrder2(const unsigned texIndex)
+// The incident rays of the scattering density integral only depend on altitude, so instead of recomputing them
+// for each texel of the scattering texture, scattering order and scatterer, they are computed once per layer.
+void computeIncidentRayTable()
 {
-    constexpr unsigned scatteringOrder=2;
+    StageTimer timer("incident ray table");
+    const auto program=compileShaderProgram("compute-incident-ray-table.frag", "incident ray table computation shader program");
 
-    virtualSourceFiles[DENSITIES_SHADER_FILENAME]=makeScattererDensityFunctionsSrc();
-    std::unique_ptr<QOpenGLShaderProgram> program;
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_INCIDENT_RAY_TABLE]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_INCIDENT_RAY_TABLE],0);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,textures[TEX_INCIDENT_RAY_TRANSMITTANCE_TABLE],0);
+    checkFramebufferStatus("framebuffer for incident ray table");
+    // The rays are shared by the wavelength sets, only their transmittance has to be rewritten for each set
+    setDrawBuffers({incidentRayTableComputed ? GL_NONE : GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1});
+
+    program->bind();
+    setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE,0,"transmittanceTexture");
+    program->setUniformValue("tableWidth", incidentRayTableSize.x);
+
+    gl.glViewport(0, 0, incidentRayTableSize.x, incidentRayTableSize.y);
+    renderQuad();
+    reportWork(kernelWork(Kernel::IncidentRayTable));
+    incidentRayTableComputed=true;
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
+void setIncidentRayTableUniforms(QOpenGLShaderProgram& program)
+{
+    setUniformTexture(program,GL_TEXTURE_2D,TEX_INCIDENT_RAY_TABLE,3,"incidentRayTable");
+    setUniformTexture(program,GL_TEXTURE_2D,TEX_INCIDENT_RAY_TRANSMITTANCE_TABLE,4,"incidentRayTransmittanceTable");
+}
+
+void computeIndirectIrradianceOrder1(unsigned texIndex, unsigned scattererIndex);
+// Without saving, single scattering is only rendered into the texture, and is lost after the next scatterer
+void computeScatteringDensityOrder2(const unsigned texIndex, const bool saveSingleScattering)
+{
+    constexpr unsigned scatteringOrder=2;
+    StageTimer timer("scattering density", -1, scatteringOrder);
+
+    virtualSourceFiles[DENSITIES_SHADER_FILENAME]=makeScattererDensityFunctionsSrc();
+    std::shared_ptr<QOpenGLShaderProgram> program;
     {
         // Make a stub for current phase function. It's not used for ground radiance, but we need it to avoid linking errors.
         virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc()+
             "vec4 currentPhaseFunction(float dotViewSun) { return vec4(3.4028235e38); }\n";
+        computeIncidentRayTable();
 
         // Doing replacements instead of using uniforms is meant to
         //  1) Improve performance by statically avoiding branching
@@ -550,8 +839,10 @@ void computeScatteringDensityOrder2(const unsigned texIndex)
 
     setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE   ,0,"transmittanceTexture");
     setUniformTexture(*program,GL_TEXTURE_2D,TEX_DELTA_IRRADIANCE,1,"irradianceTexture");
+    setIncidentRayTableUniforms(*program);
 
     render3DTexLayers(*program, "Computing scattering density layers for radiation from the ground");
+    reportWork(kernelWork(Kernel::ScatteringDensity));
 
     if(opts.dbgSaveScatDensityOrder2FromGround)
     {
@@ -568,8 +859,18 @@ void computeScatteringDensityOrder2(const unsigned texIndex)
         std::cerr << indentOutput() << "Processing scatterer \""+scatterer.name.toStdString()+"\":\n";
         OutputIndentIncrease incr;
 
-        // Current phase function is updated in the single scattering computation while saving the rendering shader
-        computeSingleScattering(texIndex, scatterer);
+        if(saveSingleScattering)
+        {
+            // Current phase function is updated in the single scattering computation while saving the rendering shader
+            computeSingleScattering(texIndex, scatterer);
+        }
+        else
+        {
+            StageTimer timer("single scattering", -1, 1);
+            renderSingleScattering(texIndex, scatterer);
+            virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc()+
+                "vec4 currentPhaseFunction(float dotViewSun) { return phaseFunction_"+scatterer.name+"(dotViewSun); }\n";
+        }
 
         gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
 
@@ -584,9 +885,11 @@ void computeScatteringDensityOrder2(const unsigned texIndex)
         program->bind();
 
         setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,1,"firstScatteringTexture");
+        setIncidentRayTableUniforms(*program);
 
         gl.glEnable(GL_BLEND);
         render3DTexLayers(*program, "Computing scattering density layers");
+        reportWork(kernelWork(Kernel::ScatteringDensity));
 
         // Disables blending before returning
         computeIndirectIrradianceOrder1(texIndex, scattererIndex);
@@ -599,6 +902,7 @@ void computeScatteringDensityOrder2(const unsigned texIndex)
 void computeScatteringDensity(const unsigned scatteringOrder, const unsigned texIndex)
 {
     assert(scatteringOrder>2);
+    StageTimer timer("scattering density", -1, scatteringOrder);
 
     gl.glViewport(0, 0, atmo.scatTexWidth(), atmo.scatTexHeight());
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
@@ -608,7 +912,7 @@ void computeScatteringDensity(const unsigned scatteringOrder, const unsigned tex
                                                     .replace(QRegExp("\\bRADIATION_IS_FROM_GROUND_ONLY\\b"), "false")
                                                     .replace(QRegExp("\\bSCATTERING_ORDER\\b"), QString::number(scatteringOrder));
     // recompile the program
-    const std::unique_ptr<QOpenGLShaderProgram> program=compileShaderProgram(COMPUTE_SCATTERING_DENSITY_FILENAME,
+    const std::shared_ptr<QOpenGLShaderProgram> program=compileShaderProgram(COMPUTE_SCATTERING_DENSITY_FILENAME,
                                                                              "scattering density computation shader program",
                                                                              UseGeomShader{});
     program->bind();
@@ -616,15 +920,70 @@ void computeScatteringDensity(const unsigned scatteringOrder, const unsigned tex
     setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE   ,0,"transmittanceTexture");
     setUniformTexture(*program,GL_TEXTURE_2D,TEX_DELTA_IRRADIANCE,1,"irradianceTexture");
     setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,2,"multipleScatteringTexture");
+    setIncidentRayTableUniforms(*program);
 
     render3DTexLayers(*program, "Computing scattering density layers");
+    reportWork(kernelWork(Kernel::ScatteringDensity));
     saveScatteringDensity(scatteringOrder,texIndex);
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
 }
 
+// Wavelength sets are grouped starting from the first one computed, see opts.wavelengthSetsPerPass
+unsigned wavelengthSetSlot(const unsigned texIndex)
+{
+    return (texIndex-opts.firstWavelengthSet)%opts.wavelengthSetsPerPass;
+}
+
+// The geometry of the integral is shared by the wavelength sets, each of them is written to its own attachment
+void computeScatteringDensityForWavelengthSets(const unsigned scatteringOrder, std::vector<unsigned> const& texIndices)
+{
+    assert(scatteringOrder>2);
+    StageTimer timer("scattering density", -1, scatteringOrder);
+
+    virtualSourceFiles[COMPUTE_SCATTERING_DENSITY_FOR_WAVELENGTH_SETS_FILENAME]=makeScatteringDensityForWavelengthSetsSrc(texIndices);
+    const auto program=compileShaderProgram(COMPUTE_SCATTERING_DENSITY_FOR_WAVELENGTH_SETS_FILENAME,
+                                            "scattering density computation shader program for several wavelength sets",
+                                            UseGeomShader{});
+    program->bind();
+
+    gl.glViewport(0, 0, atmo.scatTexWidth(), atmo.scatTexHeight());
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
+    int unusedTextureUnitNum=0;
+    setUniformTexture(*program,GL_TEXTURE_2D,TEX_INCIDENT_RAY_TABLE,unusedTextureUnitNum++,"incidentRayTable");
+    std::vector<GLenum> drawBuffers;
+    for(unsigned i=0; i<texIndices.size(); ++i)
+    {
+        selectWavelengthSetSlot(wavelengthSetSlot(texIndices[i]));
+        const auto set="set"+std::to_string(i)+"_";
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0+i,textures[TEX_DELTA_SCATTERING_DENSITY],0);
+        drawBuffers.push_back(GL_COLOR_ATTACHMENT0+i);
+        setUniformTexture(*program,GL_TEXTURE_2D,TEX_INCIDENT_RAY_TRANSMITTANCE_TABLE,unusedTextureUnitNum++,
+                          (set+"incidentRayTransmittanceTable").c_str());
+        setUniformTexture(*program,GL_TEXTURE_2D,TEX_DELTA_IRRADIANCE,unusedTextureUnitNum++,(set+"irradianceTexture").c_str());
+        setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,unusedTextureUnitNum++,(set+"multipleScatteringTexture").c_str());
+    }
+    checkFramebufferStatus("framebuffer for scattering density of several wavelength sets");
+    setDrawBuffers(drawBuffers);
+
+    render3DTexLayers(*program, "Computing scattering density layers for "+std::to_string(texIndices.size())+" wavelength sets");
+    reportWork(texIndices.size()*kernelWork(Kernel::ScatteringDensity));
+
+    // Other passes using this framebuffer only write the first output
+    setDrawBuffers({GL_COLOR_ATTACHMENT0});
+    for(unsigned i=1; i<texIndices.size(); ++i)
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0+i,0,0);
+    for(const auto texIndex : texIndices)
+    {
+        selectWavelengthSetSlot(wavelengthSetSlot(texIndex));
+        saveScatteringDensity(scatteringOrder,texIndex);
+    }
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
 void computeIndirectIrradianceOrder1(const unsigned texIndex, const unsigned scattererIndex)
 {
     constexpr unsigned scatteringOrder=2;
+    StageTimer timer("indirect irradiance", -1, scatteringOrder);
 
     gl.glViewport(0, 0, atmo.irradianceTexW, atmo.irradianceTexH);
 
@@ -643,7 +1002,7 @@ void computeIndirectIrradianceOrder1(const unsigned texIndex, const unsigned sca
 
     virtualSourceFiles[COMPUTE_INDIRECT_IRRADIANCE_FILENAME]=getShaderSrc(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,IgnoreCache{})
                                                 .replace(QRegExp("\\bSCATTERING_ORDER\\b"), QString::number(scatteringOrder-1));
-    std::unique_ptr<QOpenGLShaderProgram> program=compileShaderProgram(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
+    std::shared_ptr<QOpenGLShaderProgram> program=compileShaderProgram(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
                                                                        "indirect irradiance computation shader program");
     program->bind();
     setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"firstScatteringTexture");
@@ -651,6 +1010,7 @@ void computeIndirectIrradianceOrder1(const unsigned texIndex, const unsigned sca
     std::cerr << indentOutput() << "Computing indirect irradiance... ";
     renderQuad();
     gl.glFinish();
+    reportWork(kernelWork(Kernel::IndirectIrradiance));
     std::cerr << "done\n";
 
     gl.glDisable(GL_BLEND);
@@ -661,16 +1021,21 @@ void computeIndirectIrradianceOrder1(const unsigned texIndex, const unsigned sca
 void computeIndirectIrradiance(const unsigned scatteringOrder, const unsigned texIndex)
 {
     assert(scatteringOrder>2);
+    StageTimer timer("indirect irradiance", -1, scatteringOrder);
     gl.glViewport(0, 0, atmo.irradianceTexW, atmo.irradianceTexH);
 
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_IRRADIANCE]);
+    // The textures of another wavelength set may be attached since the direct irradiance, see opts.wavelengthSetsPerPass
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_DELTA_IRRADIANCE],0);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,textures[TEX_IRRADIANCE],0);
+    checkFramebufferStatus("framebuffer for irradiance texture");
     gl.glBlendFunc(GL_ONE, GL_ONE);
     gl.glDisablei(GL_BLEND, 0); // Overwrite delta-irradiance-texture
     gl.glEnablei(GL_BLEND, 1); // Accumulate total irradiance
 
     virtualSourceFiles[COMPUTE_INDIRECT_IRRADIANCE_FILENAME]=getShaderSrc(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,IgnoreCache{})
                                                 .replace(QRegExp("\\bSCATTERING_ORDER\\b"), QString::number(scatteringOrder-1));
-    std::unique_ptr<QOpenGLShaderProgram> program=compileShaderProgram(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
+    std::shared_ptr<QOpenGLShaderProgram> program=compileShaderProgram(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
                                                                        "indirect irradiance computation shader program");
     program->bind();
     setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"multipleScatteringTexture");
@@ -678,6 +1043,7 @@ void computeIndirectIrradiance(const unsigned scatteringOrder, const unsigned te
     std::cerr << indentOutput() << "Computing indirect irradiance... ";
     renderQuad();
     gl.glFinish();
+    reportWork(kernelWork(Kernel::IndirectIrradiance));
     std::cerr << "done\n";
 
     gl.glDisable(GL_BLEND);
@@ -687,7 +1053,14 @@ void computeIndirectIrradiance(const unsigned scatteringOrder, const unsigned te
 
 void mergeSmoothSingleScatteringTexture()
 {
+    StageTimer timer("merge smooth single scattering");
+    auto& accumulator=*multipleScatteringAccumulator;
+    // Delta scattering and scattering density aren't needed anymore, so with the accumulators in host memory we use them
+    // for the single scattering data uploaded for sampling and for the merged data to be added to the accumulator.
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,
+                            accumulator.inHostMemory() ? textures[TEX_DELTA_SCATTERING_DENSITY] : accumulator.texture(),0);
+    checkFramebufferStatus("framebuffer for merging of single scattering data");
     for(const auto& scatterer : atmo.scatterers)
     {
         if(scatterer.phaseFunctionType!=PhaseFunctionType::Smooth)
@@ -699,66 +1072,192 @@ void mergeSmoothSingleScatteringTexture()
                                                 UseGeomShader{});
         program->bind();
         gl.glBlendFunc(GL_ONE, GL_ONE);
-        gl.glEnable(GL_BLEND);
-        setUniformTexture(*program,GL_TEXTURE_3D,accumulatedSingleScatteringTextures[scatterer.name],0,"tex");
+        if(accumulator.inHostMemory())
+            gl.glDisable(GL_BLEND);
+        else
+            gl.glEnable(GL_BLEND);
+        const auto singleScatteringTexture=singleScatteringAccumulators[scatterer.name]->textureForSampling(textures[TEX_DELTA_SCATTERING]);
+        setUniformTexture(*program,GL_TEXTURE_3D,singleScatteringTexture,0,"tex");
         render3DTexLayers(*program, "Blending single scattering data for scatterer \""+scatterer.name.toStdString()+
-                                    "\" into multiple scattering texture");
+                                    "\" into multiple scattering texture", accumulatorDomain());
+        if(accumulator.inHostMemory())
+        {
+            accumulator.addTexture(textures[TEX_DELTA_SCATTERING_DENSITY], glm::mat4(1), true,
+                                   "Adding merged single scattering layers to accumulator in host memory");
+        }
     }
     gl.glDisable(GL_BLEND);
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
 }
 
-void accumulateMultipleScattering(const unsigned scatteringOrder, const unsigned texIndex)
+glm::mat4 deltaScatteringToAccumulatorMatrix(const unsigned texIndex, glm::vec4 const& weights)
+{
+    const auto weightMatrix=glm::mat4(weights.x,0,0,0,
+                                      0,weights.y,0,0,
+                                      0,0,weights.z,0,
+                                      0,0,0,weights.w);
+    return opts.saveResultAsRadiance ? weightMatrix : radianceToLuminance(texIndex)*weightMatrix;
+}
+
+// The first order blended into the accumulator must overwrite what's left there from the previous wavelength set, unless it's to be summed with it
+bool multipleScatteringAccumulatorMustBlend(const unsigned scatteringOrder, const unsigned texIndex)
 {
-    // We didn't render to the accumulating texture when computing delta scattering to avoid holding
-    // more than two 4D textures in VRAM at once.
-    // Now it's time to do this by only holding the accumulator and delta scattering texture in VRAM.
+    return scatteringOrder>2 || (texIndex>opts.firstWavelengthSet && !opts.saveResultAsRadiance);
+}
+
+void blendDeltaScatteringIntoAccumulator(const unsigned texIndex, const bool blend, glm::vec4 const& weights)
+{
+    const auto matrix=deltaScatteringToAccumulatorMatrix(texIndex, weights);
+    auto& accumulator=*multipleScatteringAccumulator;
+    if(accumulator.inHostMemory())
+    {
+        accumulator.addTexture(textures[TEX_DELTA_SCATTERING], matrix, blend,
+                               "Adding multiple scattering layers to accumulator in host memory");
+        return;
+    }
+
     gl.glActiveTexture(GL_TEXTURE0);
     gl.glBlendFunc(GL_ONE, GL_ONE);
-    if(scatteringOrder>2 || (texIndex>0 && !opts.saveResultAsRadiance))
+    if(blend)
         gl.glEnable(GL_BLEND);
     else
         gl.glDisable(GL_BLEND);
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
-    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, textures[TEX_MULTIPLE_SCATTERING],0);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, accumulator.texture(),0);
     checkFramebufferStatus("framebuffer for accumulation of multiple scattering data");
 
     const auto program=compileShaderProgram("copy-scattering-texture.frag",
                                             "scattering texture copy-blend shader program",
                                             UseGeomShader{});
     program->bind();
-    if(!opts.saveResultAsRadiance)
-        program->setUniformValue("radianceToLuminance", toQMatrix(radianceToLuminance(texIndex)));
+    program->setUniformValue("radianceToLuminance", toQMatrix(matrix));
     setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"tex");
-    render3DTexLayers(*program, "Blending multiple scattering layers into accumulator texture");
+    render3DTexLayers(*program, "Blending multiple scattering layers into accumulator texture", accumulatorDomain());
     gl.glDisable(GL_BLEND);
 
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
+void accumulateMultipleScattering(const unsigned scatteringOrder, const unsigned texIndex)
+{
+    StageTimer timer("accumulate multiple scattering", -1, scatteringOrder);
+    // An accumulator in VRAM has been blended into by computeMultipleScatteringFromDensity() in the same pass
+    if(multipleScatteringAccumulator->inHostMemory())
+        blendDeltaScatteringIntoAccumulator(texIndex, multipleScatteringAccumulatorMustBlend(scatteringOrder, texIndex), glm::vec4(1));
 
     if(opts.dbgSaveAccumScattering)
     {
-        saveTexture(GL_TEXTURE_3D,textures[TEX_MULTIPLE_SCATTERING],
-                    "multiple scattering accumulator texture",
-                    atmo.textureOutputDir+"/multiple-scattering-to-order"+std::to_string(scatteringOrder)+"-wlset"+std::to_string(texIndex)+".f32",
-                    {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]});
+        multipleScatteringAccumulator->save("multiple scattering accumulator texture",
+                                            atmo.textureOutputDir+"/multiple-scattering-to-order"+std::to_string(scatteringOrder)+"-wlset"+std::to_string(texIndex)+".f32");
     }
-    if(scatteringOrder==atmo.scatteringOrdersToCompute && (texIndex+1==atmo.allWavelengths.size() || opts.saveResultAsRadiance))
+}
+
+void saveMultipleScattering(const unsigned texIndex)
+{
+    if(texIndex!=opts.lastWavelengthSet && !opts.saveResultAsRadiance)
+        return;
+
+    mergeSmoothSingleScatteringTexture();
+
+    const auto filename = opts.saveResultAsRadiance ?
+        atmo.textureOutputDir+"/multiple-scattering-wlset"+std::to_string(texIndex)+".f32" :
+        atmo.textureOutputDir+"/multiple-scattering"+accumulatorFileNameSuffix();
+    // Radiance textures are saved per wavelength set, so they are never merged
+    multipleScatteringAccumulator->saveForRendering("multiple scattering accumulator texture", filename,
+                                                    opts.saveResultAsRadiance ? opts.storagePrecision : opts.accumulatorOutputPrecision());
+}
+
+// Reduces TEX_DELTA_SCATTERING to the sums of its texels, summing rows on the GPU and the rest on the CPU
+glm::dvec4 deltaScatteringEnergy()
+{
+    StageTimer timer("delta scattering reduction");
+
+    const auto program=compileShaderProgram("sum-scattering-texture-rows.frag", "scattering texture row summation shader program");
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_SCATTERING_ROW_SUMS]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_SCATTERING_ROW_SUMS],0);
+    checkFramebufferStatus("framebuffer for scattering texture row sums");
+    program->bind();
+    setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"tex");
+    gl.glViewport(0, 0, atmo.scatTexHeight(), atmo.scatTexDepth());
+    renderQuad();
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+
+    std::vector<glm::vec4> rowSums(size_t(atmo.scatTexHeight())*atmo.scatTexDepth());
+    gl.glBindTexture(GL_TEXTURE_2D,textures[TEX_SCATTERING_ROW_SUMS]);
+    gl.glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, rowSums.data());
+    gl.glBindTexture(GL_TEXTURE_2D,0);
+    if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
-        mergeSmoothSingleScatteringTexture();
+        std::cerr << "GL error while reducing delta scattering texture: " << openglErrorString(err) << "\n";
+        throw MustQuit{};
+    }
+    reportBytesReadBack(rowSums.size()*sizeof rowSums[0]);
 
-        const auto filename = opts.saveResultAsRadiance ?
-            atmo.textureOutputDir+"/multiple-scattering-wlset"+std::to_string(texIndex)+".f32" :
-            atmo.textureOutputDir+"/multiple-scattering-xyzw.f32";
-        saveTexture(GL_TEXTURE_3D,textures[TEX_MULTIPLE_SCATTERING],
-                    "multiple scattering accumulator texture", filename,
-                    {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]});
+    glm::dvec4 sum(0);
+    for(const auto& rowSum : rowSums)
+        sum += glm::dvec4(rowSum);
+    return sum;
+}
+
+// Records the energy of the scattering order just computed, and returns true if it's negligible
+bool multipleScatteringConverged(const unsigned scatteringOrder)
+{
+    if(opts.convergenceTolerance<=0 || opts.dbgNoSaveTextures) return false;
+
+    deltaScatteringEnergies.push_back(deltaScatteringEnergy());
+    if(scatteringOrder<3) return false;
+
+    glm::dvec4 total(0);
+    for(const auto& energy : deltaScatteringEnergies)
+        total += energy;
+    // The worst of the wavelengths decides
+    double relativeDelta=0;
+    for(int i=0; i<4; ++i)
+        if(total[i]>0)
+            relativeDelta=std::max(relativeDelta, deltaScatteringEnergies.back()[i]/total[i]);
+    const bool converged = relativeDelta < opts.convergenceTolerance;
+    std::cerr << indentOutput() << "Relative contribution of scattering order " << scatteringOrder << ": " << relativeDelta
+              << (converged ? ", converged\n" : "\n");
+    return converged;
+}
+
+// Blends delta scattering scaled by q/(1-q), where q is the ratio of the contributions of the last two orders
+void extrapolateMultipleScatteringTail(const unsigned texIndex)
+{
+    const auto n=deltaScatteringEnergies.size();
+    if(n<2) return;
+    StageTimer timer("tail extrapolation");
+    glm::vec4 weights;
+    for(int i=0; i<4; ++i)
+    {
+        const double q = deltaScatteringEnergies[n-1][i] / deltaScatteringEnergies[n-2][i];
+        // A series that doesn't decay geometrically can't be summed this way
+        weights[i] = q>0 && q<1 ? q/(1-q) : 0;
     }
+    std::cerr << indentOutput() << "Extrapolating remaining scattering orders with weights " << toString(weights) << "\n";
+    blendDeltaScatteringIntoAccumulator(texIndex, true, weights);
 }
 
-void computeMultipleScatteringFromDensity(const unsigned scatteringOrder, const unsigned texIndex)
+// The domain may only be restricted for the last order, whose delta scattering isn't an input to anything else
+void computeMultipleScatteringFromDensity(const unsigned scatteringOrder, const unsigned texIndex,
+                                          const TexelDomain domain)
 {
+    StageTimer timer("multiple scattering", -1, scatteringOrder);
+    // Delta scattering is also blended into the accumulator, if it's in VRAM, saving a separate pass over both textures
+    const bool accumulate=!multipleScatteringAccumulator->inHostMemory();
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
     gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, textures[TEX_DELTA_SCATTERING],0);
+    if(accumulate)
+    {
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1, multipleScatteringAccumulator->texture(),0);
+        setDrawBuffers({GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1});
+        gl.glBlendFunc(GL_ONE, GL_ONE);
+        gl.glDisablei(GL_BLEND, 0);
+        if(multipleScatteringAccumulatorMustBlend(scatteringOrder, texIndex))
+            gl.glEnablei(GL_BLEND, 1);
+        else
+            gl.glDisablei(GL_BLEND, 1);
+    }
     checkFramebufferStatus("framebuffer for delta multiple scattering");
 
     gl.glViewport(0, 0, atmo.scatTexWidth(), atmo.scatTexHeight());
@@ -771,8 +1270,19 @@ void computeMultipleScatteringFromDensity(const unsigned scatteringOrder, const
 
         setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE,0,"transmittanceTexture");
         setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING_DENSITY,1,"scatteringDensityTexture");
+        program->setUniformValue("radianceToLuminance", toQMatrix(deltaScatteringToAccumulatorMatrix(texIndex, glm::vec4(1))));
 
-        render3DTexLayers(*program, "Computing multiple scattering layers");
+        render3DTexLayers(*program, accumulate ? "Computing multiple scattering layers and blending them into accumulator texture"
+                                               : "Computing multiple scattering layers", domain);
+        reportWork(kernelWork(Kernel::MultipleScattering));
+
+        if(accumulate)
+        {
+            // Other passes using this framebuffer don't write the second output
+            gl.glDisable(GL_BLEND);
+            setDrawBuffers({GL_COLOR_ATTACHMENT0});
+            gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1, 0,0);
+        }
 
         if(opts.dbgSaveDeltaScattering)
         {
@@ -783,30 +1293,164 @@ void computeMultipleScatteringFromDensity(const unsigned scatteringOrder, const
         }
     }
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
-    accumulateMultipleScattering(scatteringOrder, texIndex);
 }
 
-void computeMultipleScattering(const unsigned texIndex)
+// When scattering orders 1 and 2 are restored from a checkpoint, the virtual sources must still
+// be left in the state computeScatteringDensityOrder2() would have left them in.
+void setupSourcesAsAfterScatteringOrder2(const unsigned texIndex)
 {
-    // Due to interleaving of calculations of first scattering for each scatterer with the
-    // second-order scattering density and irradiance we have to do this iteration separately.
+    if(atmo.scatterers.empty())
     {
-        std::cerr << indentOutput() << "Working on scattering orders 1 and 2:\n";
+        virtualSourceFiles[DENSITIES_SHADER_FILENAME]=makeScattererDensityFunctionsSrc();
+        virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc()+
+            "vec4 currentPhaseFunction(float dotViewSun) { return vec4(3.4028235e38); }\n";
+        return;
+    }
+    const auto& scatterer=atmo.scatterers.back();
+    virtualSourceFiles[DENSITIES_SHADER_FILENAME]=makeScattererDensityFunctionsSrc()+
+                    "float scattererDensity(float alt) { return scattererNumberDensity_"+scatterer.name+"(alt); }\n"+
+                    "vec4 scatteringCrossSection() { return "+toString(scatterer.crossSection(atmo.allWavelengths[texIndex]))+"; }\n";
+    virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc()+
+        "vec4 currentPhaseFunction(float dotViewSun) { return phaseFunction_"+scatterer.name+"(dotViewSun); }\n";
+}
+
+// Delta scattering of the last order is only blended into the accumulator, unless its energy is needed for
+// the convergence check and tail extrapolation, or it's saved for debugging
+TexelDomain lastOrderDomain(const unsigned scatteringOrder)
+{
+    if(scatteringOrder<atmo.scatteringOrdersToCompute || opts.convergenceTolerance>0 || opts.dbgSaveDeltaScattering)
+        return TexelDomain::All;
+    return accumulatorDomain();
+}
+
+void finishMultipleScattering(const unsigned texIndex, const unsigned lastOrderComputed, const bool converged)
+{
+    if(converged)
+    {
+        if(lastOrderComputed<atmo.scatteringOrdersToCompute)
+            saveFinalIrradiance(texIndex);
+        if(opts.extrapolateTail)
+            extrapolateMultipleScatteringTail(texIndex);
+    }
+    reportScatteringOrdersComputed(texIndex, lastOrderComputed, converged);
+    saveMultipleScattering(texIndex);
+}
+
+// Makes the textures and the virtual sources those of the wavelength set after its scattering order 2
+void switchToWavelengthSet(const unsigned texIndex)
+{
+    selectWavelengthSetSlot(wavelengthSetSlot(texIndex));
+    setupWavelengthSetSources(texIndex);
+    setupSourcesAsAfterScatteringOrder2(texIndex);
+}
+
+/* Computes the scattering orders from 3 on for the wavelength sets whose orders 1 and 2 are done, sharing the scattering
+ * density pass between them. The rest of each order is computed for each set in turn. The sets that converge drop out.
+ * The sources are left as those of the last set.
+ */
+void computeHigherScatteringOrdersTogether(std::vector<unsigned> const& texIndices)
+{
+    std::vector<unsigned> setsInProgress=texIndices;
+    std::map<unsigned/*texIndex*/, unsigned> lastOrderComputed;
+    std::set<unsigned/*texIndex*/> convergedSets;
+    for(const auto texIndex : texIndices)
+        lastOrderComputed[texIndex]=2;
+    for(unsigned scatteringOrder=3; scatteringOrder<=atmo.scatteringOrdersToCompute && !setsInProgress.empty(); ++scatteringOrder)
+    {
+        std::cerr << indentOutput() << "Working on scattering order " << scatteringOrder << " of wavelength sets";
+        for(const auto texIndex : setsInProgress)
+            std::cerr << " " << texIndex+1;
+        std::cerr << ":\n";
         OutputIndentIncrease incr;
 
-        computeScatteringDensityOrder2(texIndex);
-        computeMultipleScatteringFromDensity(2,texIndex);
+        computeScatteringDensityForWavelengthSets(scatteringOrder, setsInProgress);
+        for(const auto texIndex : setsInProgress)
+        {
+            std::cerr << indentOutput() << "Wavelength set " << texIndex+1 << ":\n";
+            OutputIndentIncrease incr;
+            StageTimer timer("scattering order", texIndex, scatteringOrder);
+
+            switchToWavelengthSet(texIndex);
+            computeIndirectIrradiance(scatteringOrder,texIndex);
+            computeMultipleScatteringFromDensity(scatteringOrder,texIndex,lastOrderDomain(scatteringOrder));
+            accumulateMultipleScattering(scatteringOrder,texIndex);
+            lastOrderComputed[texIndex]=scatteringOrder;
+            if(multipleScatteringConverged(scatteringOrder))
+                convergedSets.insert(texIndex);
+        }
+        setsInProgress.erase(std::remove_if(setsInProgress.begin(), setsInProgress.end(),
+                                            [&convergedSets](const unsigned texIndex){ return convergedSets.count(texIndex)>0; }),
+                             setsInProgress.end());
+    }
+    for(const auto texIndex : texIndices)
+    {
+        switchToWavelengthSet(texIndex);
+        finishMultipleScattering(texIndex, lastOrderComputed[texIndex], convergedSets.count(texIndex)>0);
+    }
+}
+
+/* With opts.wavelengthSetsPerPass>1 only scattering orders 1 and 2 are computed here, and the set is added to
+ * wavelengthSetGroup. When the group is full or the last set is reached, the higher orders of all its sets
+ * are computed together and the group is cleared.
+ */
+void computeMultipleScattering(const unsigned texIndex, const unsigned scatteringOrdersDone, std::vector<unsigned>& wavelengthSetGroup)
+{
+    if(scatteringOrdersDone<2)
+    {
+        deltaScatteringEnergies.clear();
+        // Due to interleaving of calculations of first scattering for each scatterer with the
+        // second-order scattering density and irradiance we have to do this iteration separately.
+        {
+            std::cerr << indentOutput() << "Working on scattering orders 1 and 2:\n";
+            OutputIndentIncrease incr;
+            StageTimer timer("scattering order", -1, 2);
+
+            computeScatteringDensityOrder2(texIndex);
+            computeMultipleScatteringFromDensity(2,texIndex,lastOrderDomain(2));
+            accumulateMultipleScattering(2,texIndex);
+            multipleScatteringConverged(2);
+        }
+        // A checkpoint records the progress of a single set, so it can't be saved while other sets of the group are in progress
+        if(wavelengthSetGroup.empty())
+            saveCheckpoint({texIndex, 2});
+    }
+    else
+    {
+        setupSourcesAsAfterScatteringOrder2(texIndex);
+        computeIncidentRayTable();
     }
     saveEclipsedDoubleScatteringRenderingShader(texIndex);
-    for(unsigned scatteringOrder=3; scatteringOrder<=atmo.scatteringOrdersToCompute; ++scatteringOrder)
+    if(opts.wavelengthSetsPerPass>1)
     {
-        std::cerr << indentOutput() << "Working on scattering order " << scatteringOrder << ":\n";
-        OutputIndentIncrease incr;
+        wavelengthSetGroup.push_back(texIndex);
+        if(wavelengthSetGroup.size()==opts.wavelengthSetsPerPass || texIndex==opts.lastWavelengthSet)
+        {
+            computeHigherScatteringOrdersTogether(wavelengthSetGroup);
+            wavelengthSetGroup.clear();
+        }
+        return;
+    }
+    unsigned lastOrderComputed=std::max(2u, scatteringOrdersDone);
+    bool converged=false;
+    for(unsigned scatteringOrder=std::max(3u, scatteringOrdersDone+1); scatteringOrder<=atmo.scatteringOrdersToCompute; ++scatteringOrder)
+    {
+        {
+            std::cerr << indentOutput() << "Working on scattering order " << scatteringOrder << ":\n";
+            OutputIndentIncrease incr;
+            StageTimer timer("scattering order", -1, scatteringOrder);
 
-        computeScatteringDensity(scatteringOrder,texIndex);
-        computeIndirectIrradiance(scatteringOrder,texIndex);
-        computeMultipleScatteringFromDensity(scatteringOrder,texIndex);
+            computeScatteringDensity(scatteringOrder,texIndex);
+            computeIndirectIrradiance(scatteringOrder,texIndex);
+            computeMultipleScatteringFromDensity(scatteringOrder,texIndex,lastOrderDomain(scatteringOrder));
+            accumulateMultipleScattering(scatteringOrder,texIndex);
+            converged=multipleScatteringConverged(scatteringOrder);
+        }
+        lastOrderComputed=scatteringOrder;
+        // No checkpoint for the converged order: on resume it'll be recomputed and converge again
+        if(converged) break;
+        saveCheckpoint({texIndex, scatteringOrder});
     }
+    finishMultipleScattering(texIndex, lastOrderComputed, converged);
 }
 
 // XXX: keep in sync with the GLSL version in texture-coordinates.frag
@@ -824,7 +1468,16 @@ float unitRangeTexCoordToCosSZA(const float texCoord)
                     (2*atmo.earthRadius*distFromGroundToTopAtmoBorder));
 }
 
-std::unique_ptr<QOpenGLShaderProgram> saveEclipsedDoubleScatteringComputationShader(const unsigned texIndex)
+float unitRangeTexCoordToCameraAltitude(const float texCoord)
+{
+    // Using the same encoding for altitude as in scatteringTex4DCoordsToTexVars()
+    const float distToHorizon = texCoord*atmo.lengthOfHorizRayFromGroundToBorderOfAtmo;
+    // Rounding errors can result in altitude>max, breaking the code after this calculation, so we have to clamp.
+    // To avoid too many zeros that would make log interpolation problematic, we clamp the bottom value at 1 m. The same at the top.
+    return glm::clamp(std::sqrt(sqr(distToHorizon)+sqr(atmo.earthRadius))-atmo.earthRadius, 1.f, atmo.atmosphereHeight-1);
+}
+
+std::shared_ptr<QOpenGLShaderProgram> compileEclipsedDoubleScatteringComputationProgram(std::vector<std::pair<QString, QString>>*const sourcesToSave)
 {
     QString scatCoefDef="vec4 totalScatteringCoefficient=vec4(0);\n";
     for(const auto& scatterer : atmo.scatterers)
@@ -838,51 +1491,56 @@ std::unique_ptr<QOpenGLShaderProgram> saveEclipsedDoubleScatteringComputationSha
     virtualSourceFiles[SINGLE_SCATTERING_ECLIPSED_FILENAME]=getShaderSrc(SINGLE_SCATTERING_ECLIPSED_FILENAME,IgnoreCache{})
                                                     .replace(QRegExp("\\bCOMPUTE_TOTAL_SCATTERING_COEFFICIENT;"), scatCoefDef)
                                                     .replace(QRegExp("\\b(ALL_SCATTERERS_AT_ONCE_WITH_PHASE_FUNCTION)\\b"), "1 /*\\1*/");
+    return compileShaderProgram(COMPUTE_ECLIPSED_DOUBLE_SCATTERING_FILENAME,
+                                "eclipsed double scattering computation shader program",
+                                UseGeomShader{false}, sourcesToSave);
+}
+
+std::shared_ptr<QOpenGLShaderProgram> saveEclipsedDoubleScatteringComputationShader(const unsigned texIndex)
+{
     std::vector<std::pair<QString, QString>> sourcesToSave;
-    auto program=compileShaderProgram(COMPUTE_ECLIPSED_DOUBLE_SCATTERING_FILENAME,
-                                      "eclipsed double scattering computation shader program",
-                                      UseGeomShader{false}, &sourcesToSave);
+    auto program=compileEclipsedDoubleScatteringComputationProgram(&sourcesToSave);
     for(const auto& [filename, src] : sourcesToSave)
     {
         if(filename==viewDirFuncFileName) continue;
 
         const auto filePath = QString("%1/shaders/double-scattering-eclipsed/precomputation/%2/%3").arg(atmo.textureOutputDir.c_str())
                                     .arg(texIndex).arg(filename);
-        std::cerr << indentOutput() << "Saving shader \"" << filePath << "\"...";
-        QFile file(filePath);
-        if(!file.open(QFile::WriteOnly))
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        file.write(src.toUtf8());
-        file.flush();
-        if(file.error())
-        {
-            std::cerr << " failed: " << file.errorString().toStdString() << "\"\n";
-            throw MustQuit{};
-        }
-        std::cerr << "done\n";
+        saveShaderSource(filePath, src);
     }
     return program;
 }
 
-void computeEclipsedDoubleScattering(const unsigned texIndex)
+// Returns the task that finishes writing the texture
+TaskHandle computeEclipsedDoubleScattering(const unsigned texIndex)
 {
     const auto program=saveEclipsedDoubleScatteringComputationShader(texIndex);
 
-    if(opts.dbgNoEDSTextures) return;
-
-    std::cerr << indentOutput() << "Computing eclipsed double scattering... ";
-    const auto time0=std::chrono::steady_clock::now();
+    if(opts.dbgNoEDSTextures) return {};
 
     using namespace glm;
     using std::acos;
 
     const unsigned texSizeByViewAzimuth = atmo.eclipsedDoubleScatteringTextureSize[0];
     const unsigned texSizeByViewElevation = atmo.eclipsedDoubleScatteringTextureSize[1];
-    const unsigned texSizeBySZA = atmo.eclipsedDoubleScatteringTextureSize[2];
-    const unsigned texSizeByAltitude = atmo.eclipsedDoubleScatteringTextureSize[3];
+    const unsigned fullTexSizeBySZA = atmo.eclipsedDoubleScatteringTextureSize[2];
+    const unsigned fullTexSizeByAltitude = atmo.eclipsedDoubleScatteringTextureSize[3];
+    // Only the precomputed domain is computed and saved, the indices in the texture are relative to its start
+    const auto szaIndexRange=atmo.precomputedSZAIndexRange(fullTexSizeBySZA);
+    const auto altIndexRange=atmo.precomputedAltitudeIndexRange();
+    const unsigned texSizeBySZA = szaIndexRange[1]-szaIndexRange[0]+1;
+    const unsigned texSizeByAltitude = altIndexRange[1]-altIndexRange[0]+1;
+
+    // Each altitude slice is interpolated and appended to the file in background, while the next ones are sampled. The slices
+    // that are still in flight, including those of the previous wavelength set, are limited by the same memory limit as texture saves.
+    static std::deque<TaskHandle> pendingSliceWrites;
+    const size_t sliceByteSize=size_t(texSizeByViewAzimuth)*texSizeByViewElevation*texSizeBySZA*sizeof(vec4);
+    const size_t maxSlicesInFlight=std::max(size_t(1), (size_t(opts.saveQueueMemoryLimitMiB)<<20)/sliceByteSize);
+
+    StageTimer timer("eclipsed double scattering");
+    const auto path=eclipsedDoubleScatteringTexturePath(texIndex);
+    std::cerr << indentOutput() << "Computing eclipsed double scattering and saving it to \"" << path << "\"... ";
+    const auto time0=std::chrono::steady_clock::now();
 
     gl.glBindFramebuffer(GL_FRAMEBUFFER, fbos[FBO_ECLIPSED_DOUBLE_SCATTERING]);
     gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_ECLIPSED_DOUBLE_SCATTERING],0);
@@ -894,57 +1552,467 @@ void computeEclipsedDoubleScattering(const unsigned texIndex)
     EclipsedDoubleScatteringPrecomputer precomputer(*program, gl,
                                                     textures[TEX_ECLIPSED_DOUBLE_SCATTERING], unusedTextureUnitNum,
                                                     atmo, texSizeByViewAzimuth, texSizeByViewElevation, texSizeBySZA, texSizeByAltitude);
+    const auto interpolator=precomputer.interpolator();
+
+    const auto appendToFile=[path](const char* data, const size_t size, const bool truncate)
+    {
+        QFile out(QString::fromStdString(path));
+        if(!out.open(truncate ? QFile::WriteOnly : QFile::Append))
+            throw std::runtime_error("failed to open file: "+out.errorString().toStdString());
+        out.write(data, size);
+        out.close();
+        if(out.error())
+            throw std::runtime_error("failed to write file: "+out.errorString().toStdString());
+    };
+    std::vector<uint16_t> sizes;
+    for(const uint16_t size : {texSizeByViewAzimuth, texSizeByViewElevation, texSizeBySZA, texSizeByAltitude})
+        sizes.push_back(size);
+    const auto elementType=opts.storagePrecision;
+    const auto header=textureFileHeader(sizes, elementType);
+    // Each write depends on the previous one, so the slices are appended in order
+    auto lastWrite=runInBackground("writing header of \""+path+"\"", [appendToFile, header]
+    {
+        appendToFile(reinterpret_cast<const char*>(header.data()), header.size()*sizeof header[0], true);
+    });
 
 	gl.glBindVertexArray(vao);
-    for(unsigned szaIndex=0; szaIndex<texSizeBySZA; ++szaIndex)
+    for(unsigned altIndex=0; altIndex<texSizeByAltitude; ++altIndex)
     {
-        const double cosSunZenithAngle=unitRangeTexCoordToCosSZA(float(szaIndex)/(texSizeBySZA-1));
-        const double sunZenithAngle=acos(cosSunZenithAngle);
-        for(unsigned altIndex=0; altIndex<texSizeByAltitude; ++altIndex)
+        while(pendingSliceWrites.size()>=maxSlicesInFlight)
+        {
+            waitForTask(pendingSliceWrites.front());
+            pendingSliceWrites.pop_front();
+        }
+
+        const float cameraAltitude=unitRangeTexCoordToCameraAltitude(float(altIndexRange[0]+altIndex)/(fullTexSizeByAltitude-1));
+
+        std::vector<EclipsedDoubleScatteringPrecomputer::Samples> samples;
+        for(unsigned szaIndex=0; szaIndex<texSizeBySZA; ++szaIndex)
         {
             std::ostringstream ss;
-            ss << szaIndex*texSizeByAltitude+altIndex << " of " << texSizeBySZA*texSizeByAltitude << " samples done";
+            ss << altIndex*texSizeBySZA+szaIndex << " of " << texSizeBySZA*texSizeByAltitude << " samples done";
             std::cerr << ss.str();
 
-            // Using the same encoding for altitude as in scatteringTex4DCoordsToTexVars()
-            const float distToHorizon = float(altIndex)/(texSizeByAltitude-1)*atmo.lengthOfHorizRayFromGroundToBorderOfAtmo;
-            // Rounding errors can result in altitude>max, breaking the code after this calculation, so we have to clamp.
-            // To avoid too many zeros that would make log interpolation problematic, we clamp the bottom value at 1 m. The same at the top.
-            const float cameraAltitude=clamp(sqrt(sqr(distToHorizon)+sqr(atmo.earthRadius))-atmo.earthRadius, 1.f, atmo.atmosphereHeight-1);
-
-            precomputer.compute(altIndex, szaIndex, cameraAltitude, sunZenithAngle, sunZenithAngle, 0);
+            const double cosSunZenithAngle=unitRangeTexCoordToCosSZA(float(szaIndexRange[0]+szaIndex)/(fullTexSizeBySZA-1));
+            const double sunZenithAngle=acos(cosSunZenithAngle);
+            samples.emplace_back(precomputer.sample(altIndex, szaIndex, cameraAltitude, sunZenithAngle, sunZenithAngle, 0));
 
             // Clear previous status and reset cursor position
             const auto statusWidth=ss.tellp();
             std::cerr << std::string(statusWidth, '\b') << std::string(statusWidth, ' ')
                       << std::string(statusWidth, '\b');
         }
+        // Each task fills its own slice of the texture, so they can run concurrently
+        const auto interpolation=runInBackground("interpolating eclipsed double scattering",
+                                                 [interpolator, samples=std::move(samples)]
+                                                 {
+                                                     for(const auto& s : samples)
+                                                         interpolator->interpolate(s);
+                                                 });
+        lastWrite=runInBackground("writing eclipsed double scattering to \""+path+"\"", [interpolator, appendToFile, altIndex, elementType, path]
+        {
+            const auto slice=interpolator->takeAltitudeSlice(altIndex);
+            if(elementType==TextureElementType::Float16)
+            {
+                const auto halves=toHalfPrecision(&slice[0][0], slice.size()*4, path);
+                appendToFile(reinterpret_cast<const char*>(halves.data()), halves.size()*sizeof halves[0], false);
+            }
+            else
+            {
+                appendToFile(reinterpret_cast<const char*>(slice.data()), slice.size()*sizeof slice[0], false);
+            }
+        }, {interpolation, lastWrite});
+        pendingSliceWrites.push_back(lastWrite);
     }
 	gl.glBindVertexArray(0);
 
+    reportWork(kernelWork(Kernel::EclipsedDoubleScattering));
+    reportBytesWritten(header.size()*sizeof header[0] + texSizeByAltitude*sliceByteSize/sizeof(float)*textureElementSize(elementType));
     const auto time1=std::chrono::steady_clock::now();
-    std::cerr << "done in " << formatDeltaTime(time0, time1) << "\n";
+    std::cerr << "sampled in " << formatDeltaTime(time0, time1) << ", the rest is queued\n";
+    return lastWrite;
+}
+
+/* Tabulates the phase functions of the scatterers over the scattering angle, one row per scatterer. With
+ * prefiltering, each texel is the mean of the phase function over the angles it covers, so that sharp forward
+ * peaks aren't missed by the coarser sampling of the scattering integrals.
+ */
+void computePhaseFunctionLUT()
+{
+    constexpr int prefilterSubsamples=16;
+    const auto lutSize=opts.phaseFunctionLUTSize;
+
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_PHASE_FUNCTION_LUT]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_PHASE_FUNCTION_LUT],0);
+    checkFramebufferStatus("framebuffer for phase function LUT");
+    for(unsigned i=0; i<atmo.scatterers.size(); ++i)
+    {
+        virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc(ForceAnalyticPhaseFunctions{true})+
+            "vec4 currentPhaseFunction(float dotViewSun) { return phaseFunction_"+atmo.scatterers[i].name+"(dotViewSun); }\n";
+        const auto program=compileShaderProgram(COMPUTE_PHASE_FUNCTION_LUT_FILENAME, "phase function LUT computation shader program");
+        program->bind();
+        program->setUniformValue("lutSize", GLfloat(lutSize));
+        program->setUniformValue("subsampleCount", opts.prefilterPhaseFunctions ? prefilterSubsamples : 1);
+        gl.glViewport(0, i, lutSize, 1);
+        renderQuad();
+    }
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+    virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc();
+
+    gl.glActiveTexture(GL_TEXTURE0+PHASE_FUNCTION_TEXTURE_UNIT);
+    gl.glBindTexture(GL_TEXTURE_2D,textures[TEX_PHASE_FUNCTION_LUT]);
+    gl.glActiveTexture(GL_TEXTURE0);
+}
+
+bool phaseFunctionsTabulated()
+{
+    return opts.phaseFunctionLUTSize && !atmo.scatterers.empty();
+}
+
+// ShowMySky samples the same LUT in its rendering shaders
+void savePhaseFunctionLUT(const unsigned texIndex)
+{
+    saveTexture(GL_TEXTURE_2D,textures[TEX_PHASE_FUNCTION_LUT],"phase function texture",
+                phaseFunctionTexturePath(texIndex),
+                {int(opts.phaseFunctionLUTSize), int(atmo.scatterers.size())});
+}
+
+std::string gaussLegendreTablePath()
+{
+    return atmo.textureOutputDir+"/radial-quadrature-nodes.f32";
+}
+
+/* ShowMySky samples the same table in the saved shaders. It doesn't depend on wavelengths, so all the sets and
+ * shards share one file. Without an OpenGL context, in the shaders-only mode, it's written from host memory, like
+ * the accumulators kept there.
+ */
+void saveGaussLegendreTable()
+{
+    const auto path=gaussLegendreTablePath();
+    const auto inputHash=radialQuadratureInputHash();
+    if(outputIsUpToDate(path, inputHash))
+    {
+        std::cerr << indentOutput() << "Gauss-Legendre nodes are up to date\n";
+        return;
+    }
+    forgetOutputs({path});
+
+    const auto counts=gaussLegendreNodeCounts();
+    if(counts.back()>std::numeric_limits<uint16_t>::max())
+    {
+        std::cerr << "Too many radial integration points for the Gauss-Legendre rule: " << counts.back() << "\n";
+        throw MustQuit{};
+    }
+    const std::vector<GLsizei> sizes{counts.back(), GLsizei(counts.size())};
+    if(QOpenGLContext::currentContext())
+    {
+        saveTexture(GL_TEXTURE_2D,textures[TEX_GAUSS_LEGENDRE_NODES],"Gauss-Legendre nodes",path,sizes);
+    }
+    else
+    {
+        std::cerr << indentOutput() << "Saving Gauss-Legendre nodes to \"" << path << "\"... ";
+        const auto header=textureFileHeader({uint16_t(sizes[0]), uint16_t(sizes[1])}, TextureElementType::Float32);
+        const auto table=makeGaussLegendreTable();
+        runInBackground("writing Gauss-Legendre nodes to \""+path+"\"", [path, header, table]
+        {
+            QFile out(QString::fromStdString(path));
+            if(!out.open(QFile::WriteOnly))
+                throw std::runtime_error("failed to open file: "+out.errorString().toStdString());
+            out.write(reinterpret_cast<const char*>(header.data()), header.size()*sizeof header[0]);
+            out.write(reinterpret_cast<const char*>(table.data()), table.size()*sizeof table[0]);
+            out.close();
+            if(out.error())
+                throw std::runtime_error("failed to write file: "+out.errorString().toStdString());
+        });
+        reportBytesWritten(header.size()*sizeof header[0] + table.size()*sizeof table[0]);
+        std::cerr << "queued\n";
+    }
+    recordOutput(path, inputHash);
+}
+
+void setupWavelengthSetSources(const unsigned texIndex)
+{
+    initConstHeader(atmo.allWavelengths[texIndex]);
+    virtualSourceFiles[COMPUTE_TRANSMITTANCE_SHADER_FILENAME]=
+        makeTransmittanceComputeFunctionsSrc(atmo.allWavelengths[texIndex]);
+    virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc();
+    virtualSourceFiles[TOTAL_SCATTERING_COEFFICIENT_SHADER_FILENAME]=makeTotalScatteringCoefSrc();
+    virtualSourceFiles[RADIAL_QUADRATURE_SHADER_FILENAME]=makeRadialQuadratureSrc();
+    virtualHeaderFiles[RADIANCE_TO_LUMINANCE_HEADER_FILENAME]="const mat4 radianceToLuminance=" +
+                                                                toString(radianceToLuminance(texIndex)) + ";\n";
+    // The LUT doesn't depend on wavelengths, but the densities need the constants header
+    if(opts.numberDensityLUTSize && !numberDensityLUTReady && !opts.shadersOnly)
+        computeNumberDensityLUT();
+    // The phase functions are GLSL code, so the shaders-only mode has an OpenGL context for their LUT too
+    if(phaseFunctionsTabulated())
+        computePhaseFunctionLUT();
+}
+
+// Saves the same shaders as the full computation does, in the same order of changes to the virtual sources
+void saveShadersOnly()
+{
+    if(atmo.radialQuadrature==RadialQuadrature::GaussLegendre)
+        saveGaussLegendreTable();
+    for(unsigned texIndex=opts.firstWavelengthSet; texIndex<=opts.lastWavelengthSet; ++texIndex)
+    {
+        std::cerr << "Saving shaders for wavelength set " << texIndex+1 << " of " << atmo.allWavelengths.size() << ":\n";
+        OutputIndentIncrease incr;
+
+        setupWavelengthSetSources(texIndex);
+        if(phaseFunctionsTabulated())
+            savePhaseFunctionLUT(texIndex);
+        saveZeroOrderScatteringRenderingShader(texIndex);
+        saveEclipsedZeroOrderScatteringRenderingShader(texIndex);
+        for(const auto& scatterer : atmo.scatterers)
+        {
+            setupSingleScatteringSources(texIndex, scatterer);
+            saveSingleScatteringShaders(texIndex, scatterer);
+        }
+        setupSourcesAsAfterScatteringOrder2(texIndex);
+        saveEclipsedDoubleScatteringRenderingShader(texIndex);
+        if(opts.saveResultAsRadiance)
+            saveMultipleScatteringRenderingShader(texIndex);
+        saveEclipsedDoubleScatteringComputationShader(texIndex);
+    }
+    if(!opts.saveResultAsRadiance)
+        saveMultipleScatteringRenderingShader(-1);
+}
+
+// Scattering textures are accumulated over wavelength sets, so they can only be reused all at once
+QString scatteringInputHash(std::vector<InputHashes> const& inputHashes)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QString("wlsets %1-%2").arg(opts.firstWavelengthSet).arg(opts.lastWavelengthSet).toUtf8());
+    for(unsigned texIndex=opts.firstWavelengthSet; texIndex<=opts.lastWavelengthSet; ++texIndex)
+        hash.addData(inputHashes[texIndex].scattering.toUtf8());
+    return hash.result().toHex();
+}
+
+bool scatteringOutputsAreUpToDate(QString const& inputHash)
+{
+    // The user wants the debug textures, which are only saved during the computation
+    if(opts.dbgSaveGroundIrradiance || opts.dbgSaveScatDensityOrder2FromGround || opts.dbgSaveScatDensity ||
+       opts.dbgSaveDeltaScattering || opts.dbgSaveAccumScattering)
+        return false;
+
+    for(unsigned texIndex=opts.firstWavelengthSet; texIndex<=opts.lastWavelengthSet; ++texIndex)
+        for(const auto& path : scatteringOutputs(texIndex))
+            if(!outputIsUpToDate(path, inputHash))
+                return false;
+    for(const auto& path : scatteringAccumulatorOutputs())
+        if(!outputIsUpToDate(path, inputHash))
+            return false;
+    return true;
+}
+
+// Fills the scattering density texture with the density of the scattering orders from 2 on in the isotropic approximation
+void computePreviewScatteringDensity()
+{
+    StageTimer timer("preview multiple scattering");
+    {
+        const auto program=compileShaderProgram("compute-preview-multiple-scattering.frag",
+                                                "preview multiple scattering computation shader program");
+        gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_PREVIEW_MULTIPLE_SCATTERING]);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_PREVIEW_MULTIPLE_SCATTERING],0);
+        checkFramebufferStatus("framebuffer for preview multiple scattering");
+
+        program->bind();
+        setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE,0,"transmittanceTexture");
+
+        std::cerr << indentOutput() << "Computing preview multiple scattering... ";
+        gl.glViewport(0, 0, atmo.irradianceTexW, atmo.irradianceTexH);
+        renderQuad();
+        gl.glFinish();
+        reportWork(kernelWork(Kernel::PreviewMultipleScattering));
+        std::cerr << "done\n";
+    }
+
+    const auto program=compileShaderProgram("compute-preview-scattering-density.frag",
+                                            "preview scattering density computation shader program",
+                                            UseGeomShader{});
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_DELTA_SCATTERING_DENSITY],0);
+    checkFramebufferStatus("framebuffer for preview scattering density");
+
+    program->bind();
+    setUniformTexture(*program,GL_TEXTURE_2D,TEX_PREVIEW_MULTIPLE_SCATTERING,0,"previewMultipleScatteringTexture");
+
+    gl.glViewport(0, 0, atmo.scatTexWidth(), atmo.scatTexHeight());
+    render3DTexLayers(*program, "Computing preview scattering density layers");
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
+// Replaces computeMultipleScattering() in the preview mode: single scattering is computed as usual, while all
+// the higher orders are computed at once from the density of computePreviewScatteringDensity().
+void computePreviewMultipleScattering(const unsigned texIndex)
+{
+    {
+        std::cerr << indentOutput() << "Working on scattering order 1 and approximation of higher orders:\n";
+        OutputIndentIncrease incr;
+        StageTimer timer("scattering order", -1, 2);
+
+        for(unsigned scattererIndex=0; scattererIndex<atmo.scatterers.size(); ++scattererIndex)
+        {
+            const auto& scatterer=atmo.scatterers[scattererIndex];
+            std::cerr << indentOutput() << "Processing scatterer \""+scatterer.name.toStdString()+"\":\n";
+            OutputIndentIncrease incr;
+
+            computeSingleScattering(texIndex, scatterer);
+            computeIndirectIrradianceOrder1(texIndex, scattererIndex);
+        }
+        computePreviewScatteringDensity();
+        computeMultipleScatteringFromDensity(2,texIndex);
+        accumulateMultipleScattering(2,texIndex);
+        // Ground irradiance due to the approximated orders
+        computeIndirectIrradiance(3,texIndex);
+    }
+    saveEclipsedDoubleScatteringRenderingShader(texIndex);
+    saveFinalIrradiance(texIndex);
+    saveMultipleScattering(texIndex);
+}
 
-    const auto path=atmo.textureOutputDir+"/eclipsed-double-scattering-wlset"+std::to_string(texIndex)+".f32";
-    std::cerr << "Saving eclipsed double scattering texture to \"" << path << "\"... ";
-    QFile out(QString::fromStdString(path));
-    if(!out.open(QFile::WriteOnly))
+// Compares the orders from 2 on of the preview with those of the full computation. The full computation is what the
+// preview is meant to avoid, so both are redone on the reduced textures, and nothing is saved.
+/* The comparison runs on reduced textures with the debug outputs turned off. The options, the atmosphere parameters,
+ * the sources and the sizes of the textures of the main computation are restored afterwards.
+ */
+void estimatePreviewError()
+{
+    std::cerr << "Estimating the error of the preview on reduced textures:\n";
+    OutputIndentIncrease incr;
+    StageTimer timer("preview error estimate");
+
+    const auto mainOpts=opts;
+    const auto mainAtmo=atmo;
+    const auto mainSources=virtualSourceFiles;
+    opts.dbgSaveGroundIrradiance=false;
+    opts.dbgSaveScatDensityOrder2FromGround=false;
+    opts.dbgSaveScatDensity=false;
+    opts.dbgSaveDeltaScattering=false;
+    opts.dbgSaveAccumScattering=false;
+    reduceTextureSizes();
+    reinitTexturesAndFramebuffers();
+
+    const auto texelCount=size_t(atmo.scatTexWidth())*atmo.scatTexHeight()*atmo.scatTexDepth();
+    double maxDifference=0;
+    glm::dvec4 fullEnergy(0), previewEnergy(0);
+    for(unsigned texIndex=opts.firstWavelengthSet; texIndex<=opts.lastWavelengthSet; ++texIndex)
     {
-        std::cerr << "failed to open file: " << out.errorString().toStdString() << "\n";
+        std::cerr << indentOutput() << "Wavelength set " << texIndex+1 << " of " << atmo.allWavelengths.size() << ":\n";
+        OutputIndentIncrease incr;
+
+        setupWavelengthSetSources(texIndex);
+        renderTransmittance();
+        computeDirectGroundIrradiance(texIndex);
+        computeScatteringDensityOrder2(texIndex, false);
+        computeMultipleScatteringFromDensity(2,texIndex);
+        auto full=readTexture(GL_TEXTURE_3D, textures[TEX_DELTA_SCATTERING], texelCount);
+        for(unsigned scatteringOrder=3; scatteringOrder<=atmo.scatteringOrdersToCompute; ++scatteringOrder)
+        {
+            computeScatteringDensity(scatteringOrder,texIndex);
+            computeIndirectIrradiance(scatteringOrder,texIndex);
+            computeMultipleScatteringFromDensity(scatteringOrder,texIndex);
+            const auto delta=readTexture(GL_TEXTURE_3D, textures[TEX_DELTA_SCATTERING], texelCount);
+            for(size_t n=0; n<texelCount; ++n)
+                full[n]+=delta[n];
+        }
+
+        computePreviewScatteringDensity();
+        computeMultipleScatteringFromDensity(2,texIndex);
+        const auto preview=readTexture(GL_TEXTURE_3D, textures[TEX_DELTA_SCATTERING], texelCount);
+
+        maxDifference=std::max(maxDifference, maxRelativeDifference(preview, full));
+        for(size_t n=0; n<texelCount; ++n)
+        {
+            fullEnergy+=glm::dvec4(full[n]);
+            previewEnergy+=glm::dvec4(preview[n]);
+        }
+    }
+
+    double energyDifference=0;
+    for(int i=0; i<4; ++i)
+        if(fullEnergy[i]>0)
+            energyDifference=std::max(energyDifference, std::abs(previewEnergy[i]-fullEnergy[i])/fullEnergy[i]);
+    std::cerr << indentOutput() << "Preview error of scattering orders from 2 on against " << atmo.scatteringOrdersToCompute
+              << " computed orders: max relative difference " << maxDifference
+              << ", relative difference of the total " << energyDifference << "\n";
+    reportPreviewError(maxDifference, energyDifference);
+
+    opts=mainOpts;
+    atmo=mainAtmo;
+    virtualSourceFiles=mainSources;
+    reinitTexturesAndFramebuffers();
+}
+
+void prepareOutputDirectory()
+{
+    for(const auto& scatterer : atmo.scatterers)
+    {
+        for(unsigned texIndex=0; texIndex<atmo.allWavelengths.size(); ++texIndex)
+        {
+            createDirs(atmo.textureOutputDir+"/shaders/single-scattering-eclipsed/precomputation/"+
+                       std::to_string(texIndex)+"/"+scatterer.name.toStdString());
+            createDirs(atmo.textureOutputDir+"/shaders/single-scattering-eclipsed/"+singleScatteringRenderModeNames[SSRM_ON_THE_FLY]+"/"+
+                       std::to_string(texIndex)+"/"+scatterer.name.toStdString());
+            if(scatterer.phaseFunctionType!=PhaseFunctionType::Smooth)
+            {
+                createDirs(atmo.textureOutputDir+"/shaders/single-scattering/"+singleScatteringRenderModeNames[SSRM_ON_THE_FLY]+"/"+
+                           std::to_string(texIndex)+"/"+scatterer.name.toStdString());
+            }
+            if(scatterer.phaseFunctionType==PhaseFunctionType::General)
+            {
+                createDirs(atmo.textureOutputDir+"/shaders/single-scattering/"+singleScatteringRenderModeNames[SSRM_PRECOMPUTED]+"/"+
+                           std::to_string(texIndex)+"/"+scatterer.name.toStdString());
+                createDirs(atmo.textureOutputDir+"/shaders/single-scattering-eclipsed/"+singleScatteringRenderModeNames[SSRM_PRECOMPUTED]+"/"+
+                           std::to_string(texIndex)+"/"+scatterer.name.toStdString());
+            }
+        }
+        if(scatterer.phaseFunctionType==PhaseFunctionType::Achromatic)
+        {
+            createDirs(atmo.textureOutputDir+"/shaders/single-scattering/"+singleScatteringRenderModeNames[SSRM_PRECOMPUTED]+"/"+
+                       scatterer.name.toStdString());
+        }
+        if(scatterer.phaseFunctionType!=PhaseFunctionType::General)
+        {
+            createDirs(atmo.textureOutputDir+"/shaders/single-scattering-eclipsed/"+singleScatteringRenderModeNames[SSRM_PRECOMPUTED]+"/"+
+                       scatterer.name.toStdString());
+        }
+    }
+    for(unsigned texIndex=0; texIndex<atmo.allWavelengths.size(); ++texIndex)
+    {
+        createDirs(atmo.textureOutputDir+"/shaders/zero-order-scattering/"+std::to_string(texIndex));
+        createDirs(atmo.textureOutputDir+"/shaders/eclipsed-zero-order-scattering/"+std::to_string(texIndex));
+        createDirs(atmo.textureOutputDir+"/shaders/double-scattering-eclipsed/precomputed/"+std::to_string(texIndex));
+        createDirs(atmo.textureOutputDir+"/shaders/double-scattering-eclipsed/precomputation/"+std::to_string(texIndex));
+        createDirs(atmo.textureOutputDir+"/single-scattering/"+std::to_string(texIndex));
+    }
+    createDirs(atmo.textureOutputDir+"/shaders/multiple-scattering/");
+    if(opts.saveResultAsRadiance)
+        for(unsigned texIndex=0; texIndex<atmo.allWavelengths.size(); ++texIndex)
+            createDirs(atmo.textureOutputDir+"/shaders/multiple-scattering/"+std::to_string(texIndex));
+
+    std::cerr << "Writing parameters to output description file...";
+    const auto target=atmo.textureOutputDir+"/params.atmo";
+    QFile file(target.c_str());
+    if(!file.open(QFile::WriteOnly))
+    {
+        std::cerr << " FAILED to open \"" << target << "\": " << file.errorString() << "\n";
         throw MustQuit{};
     }
-    for(const uint16_t size : {atmo.eclipsedDoubleScatteringTextureSize[0],atmo.eclipsedDoubleScatteringTextureSize[1],
-                               atmo.eclipsedDoubleScatteringTextureSize[2],atmo.eclipsedDoubleScatteringTextureSize[3]})
-        out.write(reinterpret_cast<const char*>(&size), sizeof size);
-    const auto& texture=precomputer.texture();
-    out.write(reinterpret_cast<const char*>(texture.data()), texture.size()*sizeof texture[0]);
-    out.close();
-    if(out.error())
+    QTextStream out(&file);
+    if(opts.saveResultAsRadiance)
+        out << AtmosphereParameters::ALL_TEXTURES_ARE_RADIANCES_DIRECTIVE << "\n";
+    if(opts.dbgNoEDSTextures)
+        out << AtmosphereParameters::NO_ECLIPSED_DOUBLE_SCATTERING_TEXTURES_DIRECTIVE << "\n";
+    out << atmo.descriptionFileText;
+    out.flush();
+    file.close();
+    if(file.error())
     {
-        std::cerr << "failed to write file: " << out.errorString().toStdString() << "\n";
+        std::cerr << " FAILED to write to \"" << target << "\": " << file.errorString() << "\n";
         throw MustQuit{};
     }
-    std::cerr << "done\n";
+    std::cerr << " done\n";
 }
 
 int main(int argc, char** argv)
@@ -952,9 +2020,14 @@ int main(int argc, char** argv)
     [[maybe_unused]] UTF8Console utf8console;
 
     qInstallMessageHandler(qtMessageHandler);
-    QApplication app(argc, argv);
-    app.setApplicationName("CalcMySky");
-    app.setApplicationVersion(APP_VERSION);
+    // Without an OpenGL context we don't need a display, so can run on headless hosts
+    std::unique_ptr<QCoreApplication> app;
+    if(noOpenGLRequested(argc, argv))
+        app=std::make_unique<QCoreApplication>(argc, argv);
+    else
+        app=std::make_unique<QApplication>(argc, argv);
+    app->setApplicationName("CalcMySky");
+    app->setApplicationVersion(APP_VERSION);
 
     try
     {
@@ -966,74 +2039,26 @@ int main(int argc, char** argv)
 
         if(atmo.textureOutputDir.length() && atmo.textureOutputDir.back()=='/')
             atmo.textureOutputDir.pop_back(); // Make the paths a bit nicer (without double slashes)
-        for(const auto& scatterer : atmo.scatterers)
+        if(opts.estimateOnly)
         {
-            for(unsigned texIndex=0; texIndex<atmo.allWavelengths.size(); ++texIndex)
-            {
-                createDirs(atmo.textureOutputDir+"/shaders/single-scattering-eclipsed/precomputation/"+
-                           std::to_string(texIndex)+"/"+scatterer.name.toStdString());
-                createDirs(atmo.textureOutputDir+"/shaders/single-scattering-eclipsed/"+singleScatteringRenderModeNames[SSRM_ON_THE_FLY]+"/"+
-                           std::to_string(texIndex)+"/"+scatterer.name.toStdString());
-                if(scatterer.phaseFunctionType!=PhaseFunctionType::Smooth)
-                {
-                    createDirs(atmo.textureOutputDir+"/shaders/single-scattering/"+singleScatteringRenderModeNames[SSRM_ON_THE_FLY]+"/"+
-                               std::to_string(texIndex)+"/"+scatterer.name.toStdString());
-                }
-                if(scatterer.phaseFunctionType==PhaseFunctionType::General)
-                {
-                    createDirs(atmo.textureOutputDir+"/shaders/single-scattering/"+singleScatteringRenderModeNames[SSRM_PRECOMPUTED]+"/"+
-                               std::to_string(texIndex)+"/"+scatterer.name.toStdString());
-                    createDirs(atmo.textureOutputDir+"/shaders/single-scattering-eclipsed/"+singleScatteringRenderModeNames[SSRM_PRECOMPUTED]+"/"+
-                               std::to_string(texIndex)+"/"+scatterer.name.toStdString());
-                }
-            }
-            if(scatterer.phaseFunctionType==PhaseFunctionType::Achromatic)
-            {
-                createDirs(atmo.textureOutputDir+"/shaders/single-scattering/"+singleScatteringRenderModeNames[SSRM_PRECOMPUTED]+"/"+
-                           scatterer.name.toStdString());
-            }
-            if(scatterer.phaseFunctionType!=PhaseFunctionType::General)
-            {
-                createDirs(atmo.textureOutputDir+"/shaders/single-scattering-eclipsed/"+singleScatteringRenderModeNames[SSRM_PRECOMPUTED]+"/"+
-                           scatterer.name.toStdString());
-            }
+            printEstimate();
+            return 0;
         }
-        for(unsigned texIndex=0; texIndex<atmo.allWavelengths.size(); ++texIndex)
+        // Tuning doesn't write anything to the output directory
+        if(opts.tuningTolerance==0)
         {
-            createDirs(atmo.textureOutputDir+"/shaders/zero-order-scattering/"+std::to_string(texIndex));
-            createDirs(atmo.textureOutputDir+"/shaders/eclipsed-zero-order-scattering/"+std::to_string(texIndex));
-            createDirs(atmo.textureOutputDir+"/shaders/double-scattering-eclipsed/precomputed/"+std::to_string(texIndex));
-            createDirs(atmo.textureOutputDir+"/shaders/double-scattering-eclipsed/precomputation/"+std::to_string(texIndex));
-            createDirs(atmo.textureOutputDir+"/single-scattering/"+std::to_string(texIndex));
+            prepareOutputDirectory();
         }
-        createDirs(atmo.textureOutputDir+"/shaders/multiple-scattering/");
-        if(opts.saveResultAsRadiance)
-            for(unsigned texIndex=0; texIndex<atmo.allWavelengths.size(); ++texIndex)
-                createDirs(atmo.textureOutputDir+"/shaders/multiple-scattering/"+std::to_string(texIndex));
 
+        if(opts.shadersOnly && !phaseFunctionsTabulated())
         {
-            std::cerr << "Writing parameters to output description file...";
-            const auto target=atmo.textureOutputDir+"/params.atmo";
-            QFile file(target.c_str());
-            if(!file.open(QFile::WriteOnly))
-            {
-                std::cerr << " FAILED to open \"" << target << "\": " << file.errorString() << "\n";
-                throw MustQuit{};
-            }
-            QTextStream out(&file);
-            if(opts.saveResultAsRadiance)
-                out << AtmosphereParameters::ALL_TEXTURES_ARE_RADIANCES_DIRECTIVE << "\n";
-            if(opts.dbgNoEDSTextures)
-                out << AtmosphereParameters::NO_ECLIPSED_DOUBLE_SCATTERING_TEXTURES_DIRECTIVE << "\n";
-            out << atmo.descriptionFileText;
-            out.flush();
-            file.close();
-            if(file.error())
-            {
-                std::cerr << " FAILED to write to \"" << target << "\": " << file.errorString() << "\n";
-                throw MustQuit{};
-            }
-            std::cerr << " done\n";
+            BackgroundTasks backgroundTasks;
+            const auto timeBegin=std::chrono::steady_clock::now();
+            saveShadersOnly();
+            waitForBackgroundTasks();
+            const auto timeEnd=std::chrono::steady_clock::now();
+            std::cerr << "Finished in " << formatDeltaTime(timeBegin, timeEnd) << "\n";
+            return 0;
         }
 
         QSurfaceFormat format;
@@ -1073,52 +2098,159 @@ int main(int argc, char** argv)
             return 1;
         }
 
+        AsyncTextureSaving asyncTextureSaving;
+        BackgroundTasks backgroundTasks;
+        if(opts.shadersOnly)
+        {
+            initForPhaseFunctionLUT();
+            const auto timeBegin=std::chrono::steady_clock::now();
+            saveShadersOnly();
+            waitForBackgroundTasks();
+            finishTextureSaves();
+            const auto timeEnd=std::chrono::steady_clock::now();
+            std::cerr << "Finished in " << formatDeltaTime(timeBegin, timeEnd) << "\n";
+            return 0;
+        }
+        if(opts.tuningTolerance>0)
+        {
+            tuneIntegrationPoints();
+            return 0;
+        }
         init();
+        const auto checkpoint=restoreCheckpoint();
+
+        loadOutputHashes();
+        std::vector<InputHashes> inputHashes(atmo.allWavelengths.size());
+        for(unsigned texIndex=opts.firstWavelengthSet; texIndex<=opts.lastWavelengthSet; ++texIndex)
+            inputHashes[texIndex]=computeInputHashes(texIndex, radianceToLuminance(texIndex));
+        const auto scatteringHash=scatteringInputHash(inputHashes);
+        const bool resumed = checkpoint.wavelengthSetsDone>opts.firstWavelengthSet || checkpoint.scatteringOrdersDone>0;
+        const bool reuseScattering = !resumed && scatteringOutputsAreUpToDate(scatteringHash);
+        if(reuseScattering)
+        {
+            std::cerr << "Scattering textures in the output directory are up to date, only missing or outdated "
+                         "transmittance and eclipsed double scattering textures will be computed\n";
+        }
+        else
+        {
+            // The outputs of the wavelength sets done before the checkpoint aren't going to be overwritten
+            std::vector<std::string> outputsToOverwrite=scatteringAccumulatorOutputs();
+            for(unsigned texIndex=std::max(checkpoint.wavelengthSetsDone, opts.firstWavelengthSet); texIndex<=opts.lastWavelengthSet; ++texIndex)
+            {
+                const auto paths=scatteringOutputs(texIndex);
+                outputsToOverwrite.insert(outputsToOverwrite.end(), paths.begin(), paths.end());
+            }
+            forgetOutputs(outputsToOverwrite);
+        }
 
         const auto timeBegin=std::chrono::steady_clock::now();
 
-        for(unsigned texIndex=0;texIndex<atmo.allWavelengths.size();++texIndex)
+        if(atmo.radialQuadrature==RadialQuadrature::GaussLegendre)
+            saveGaussLegendreTable();
+        // Wavelength sets whose scattering orders from 3 on are waiting to be computed, see opts.wavelengthSetsPerPass
+        std::vector<unsigned> wavelengthSetGroup;
+        for(unsigned texIndex=std::max(checkpoint.wavelengthSetsDone, opts.firstWavelengthSet);texIndex<=opts.lastWavelengthSet;++texIndex)
         {
+            const auto scatteringOrdersDone = texIndex==checkpoint.wavelengthSetsDone ? checkpoint.scatteringOrdersDone : 0;
             std::cerr << "Working on wavelengths " << atmo.allWavelengths[texIndex][0] << ", "
                                                    << atmo.allWavelengths[texIndex][1] << ", "
                                                    << atmo.allWavelengths[texIndex][2] << ", "
                                                    << atmo.allWavelengths[texIndex][3] << " nm"
                          " (set " << texIndex+1 << " of " << atmo.allWavelengths.size() << "):\n";
             OutputIndentIncrease incr;
+            StageTimer timer("wavelength set", texIndex);
 
-            initConstHeader(atmo.allWavelengths[texIndex]);
-            virtualSourceFiles[COMPUTE_TRANSMITTANCE_SHADER_FILENAME]=
-                makeTransmittanceComputeFunctionsSrc(atmo.allWavelengths[texIndex]);
-            virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc();
-            virtualSourceFiles[TOTAL_SCATTERING_COEFFICIENT_SHADER_FILENAME]=makeTotalScatteringCoefSrc();
-            virtualHeaderFiles[RADIANCE_TO_LUMINANCE_HEADER_FILENAME]="const mat4 radianceToLuminance=" +
-                                                                        toString(radianceToLuminance(texIndex)) + ";\n";
-
-            saveZeroOrderScatteringRenderingShader(texIndex);
-            saveEclipsedZeroOrderScatteringRenderingShader(texIndex);
+            selectWavelengthSetSlot(wavelengthSetSlot(texIndex));
+            setupWavelengthSetSources(texIndex);
+            if(phaseFunctionsTabulated())
+                savePhaseFunctionLUT(texIndex);
 
+            const auto& hashes=inputHashes[texIndex];
+            const bool edsUpToDate=!opts.dbgNoEDSTextures &&
+                                   outputIsUpToDate(eclipsedDoubleScatteringTexturePath(texIndex), hashes.eclipsedDoubleScattering);
+            if(reuseScattering)
             {
-                std::cerr << indentOutput() << "Computing parts of scattering order 1:\n";
-                OutputIndentIncrease incr;
-
-                computeTransmittance(texIndex);
-                // We'll use ground irradiance to take into account the contribution of light scattered by the ground to the
-                // sky color. Irradiance will also be needed when we want to draw the ground itself.
-                computeDirectGroundIrradiance(texIndex);
+                setupSourcesAsAfterScatteringOrder2(texIndex);
+                if(edsUpToDate || opts.dbgNoEDSTextures)
+                {
+                    std::cerr << indentOutput() << "All the textures are up to date\n";
+                    continue;
+                }
+                computeOrLoadTransmittance(texIndex, hashes.transmittance);
             }
+            else
+            {
+                saveZeroOrderScatteringRenderingShader(texIndex);
+                saveEclipsedZeroOrderScatteringRenderingShader(texIndex);
 
-            computeMultipleScattering(texIndex);
-            if(opts.saveResultAsRadiance)
-                saveMultipleScatteringRenderingShader(texIndex);
+                {
+                    std::cerr << indentOutput() << "Computing parts of scattering order 1:\n";
+                    OutputIndentIncrease incr;
+
+                    computeOrLoadTransmittance(texIndex, hashes.transmittance);
+                    // We'll use ground irradiance to take into account the contribution of light scattered by the ground to the
+                    // sky color. Irradiance will also be needed when we want to draw the ground itself.
+                    if(!scatteringOrdersDone) // otherwise it's been restored from the checkpoint
+                        computeDirectGroundIrradiance(texIndex);
+                }
 
-            computeEclipsedDoubleScattering(texIndex);
+                if(opts.preview)
+                    computePreviewMultipleScattering(texIndex);
+                else
+                    computeMultipleScattering(texIndex, scatteringOrdersDone, wavelengthSetGroup);
+                if(opts.saveResultAsRadiance)
+                    saveMultipleScatteringRenderingShader(texIndex);
+                for(const auto& path : scatteringOutputs(texIndex))
+                    recordOutput(path, scatteringHash);
+            }
 
+            TaskHandle edsWritten;
+            if(edsUpToDate)
+            {
+                std::cerr << indentOutput() << "Eclipsed double scattering texture is up to date\n";
+            }
+            else
+            {
+                // The CPU-side part of this runs in background, overlapping with the next wavelength set
+                // unless the checkpoint below has to wait for it
+                const auto path=eclipsedDoubleScatteringTexturePath(texIndex);
+                forgetOutputs({path});
+                edsWritten=computeEclipsedDoubleScattering(texIndex);
+                if(!opts.dbgNoEDSTextures)
+                    recordOutput(path, hashes.eclipsedDoubleScattering);
+            }
+            // A resumed computation doesn't reuse the scattering textures, so there's nothing to checkpoint while reusing them.
+            // The sets of an unfinished group have their higher scattering orders still to be computed.
+            if(!reuseScattering && wavelengthSetGroup.empty())
+                saveCheckpoint({texIndex+1, 0}, {edsWritten});
         }
         if(!opts.saveResultAsRadiance)
             saveMultipleScatteringRenderingShader(-1);
 
+        if(!reuseScattering)
+        {
+            for(const auto& path : scatteringAccumulatorOutputs())
+                recordOutput(path, scatteringHash);
+        }
+
+        waitForBackgroundTasks();
+        finishTextureSaves();
+        reportHalfPrecisionErrors();
+        saveOutputHashes();
+        removeCheckpoint();
+
         const auto timeEnd=std::chrono::steady_clock::now();
+        // Not counted in the total time, but before the report, which includes the result
+        if(opts.preview)
+            estimatePreviewError();
+        writeReport(timeEnd-timeBegin);
         std::cerr << "Finished in " << formatDeltaTime(timeBegin, timeEnd) << "\n";
+        const auto& cacheStats=shaderCacheStats();
+        using Seconds=std::chrono::duration<double>;
+        std::cerr << "Shader cache: reused " << cacheStats.shaderHits << " of " << cacheStats.shaderHits+cacheStats.shaderMisses
+                  << " shaders and " << cacheStats.programHits << " of " << cacheStats.programHits+cacheStats.programMisses
+                  << " programs (" << cacheStats.programBinaryHits << " loaded from disk), saving about " << Seconds(cacheStats.timeSaved).count() << " s of "
+                  << Seconds(cacheStats.timeSpent).count() << " s spent compiling and linking\n";
     }
     catch(ParsingError const& ex)
     {
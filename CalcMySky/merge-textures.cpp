@@ -0,0 +1,147 @@
+#include "merge-textures.hpp"
+
+#include <memory>
+#include <iostream>
+#include <algorithm>
+#include <QRegularExpression>
+#include <QFile>
+#include <QDir>
+#include <glm/gtc/packing.hpp>
+
+#include "const.hpp"
+#include "../common/util.hpp"
+
+std::vector<uint16_t> partialTextureSizes(AtmosphereParameters const& atmo)
+{
+    const auto size=atmo.precomputedScatteringTextureSize();
+    return {uint16_t(size[0]), uint16_t(size[1]), uint16_t(size[2]), uint16_t(size[3])};
+}
+
+std::vector<PartialTexture> findPartialTextures(QString const& dirPath, QString const& baseName)
+{
+    const QRegularExpression pattern("^"+QRegularExpression::escape(baseName+PARTIAL_ACCUMULATOR_SUFFIX)+"([0-9]+)-([0-9]+)\\.f32$");
+    const QDir dir(dirPath);
+    std::vector<PartialTexture> partials;
+    for(const auto& fileName : dir.entryList(QDir::Files))
+    {
+        const auto match=pattern.match(fileName);
+        if(!match.hasMatch()) continue;
+        partials.push_back({match.captured(1).toUInt(), match.captured(2).toUInt(), dir.filePath(fileName)});
+    }
+    std::sort(partials.begin(), partials.end(), [](auto const& a, auto const& b)
+              { return a.firstWavelengthSet < b.firstWavelengthSet; });
+    return partials;
+}
+
+void checkCoverage(std::vector<PartialTexture> const& partials, QString const& baseName, const unsigned wavelengthSetCount)
+{
+    if(partials.empty())
+    {
+        std::cerr << "No partial textures found for " << baseName << "\n";
+        throw MustQuit{};
+    }
+    unsigned nextSet=0;
+    for(const auto& partial : partials)
+    {
+        if(partial.firstWavelengthSet!=nextSet || partial.lastWavelengthSet<partial.firstWavelengthSet)
+        {
+            std::cerr << "Partial textures for " << baseName << " don't cover wavelength sets contiguously: expected set "
+                      << nextSet << " to start at \"" << partial.path << "\"\n";
+            throw MustQuit{};
+        }
+        nextSet=partial.lastWavelengthSet+1;
+    }
+    if(nextSet!=wavelengthSetCount)
+    {
+        std::cerr << "Partial textures for " << baseName << " only cover wavelength sets 0-" << nextSet-1
+                  << " out of 0-" << wavelengthSetCount-1 << "\n";
+        throw MustQuit{};
+    }
+}
+
+void mergeTextures(std::vector<PartialTexture> const& partials, QString const& outPath, std::vector<uint16_t> const& sizes,
+                   const TextureElementType outputElementType)
+{
+    std::cerr << "Summing " << partials.size() << " partial textures into \"" << outPath << "\"... ";
+
+    size_t subpixelCount=4;
+    for(const auto s : sizes)
+        subpixelCount *= s;
+
+    std::vector<std::unique_ptr<QFile>> inputs;
+    for(const auto& partial : partials)
+    {
+        auto& in=*inputs.emplace_back(std::make_unique<QFile>(partial.path));
+        if(!in.open(QFile::ReadOnly))
+        {
+            std::cerr << "failed to open \"" << partial.path << "\": " << in.errorString() << "\n";
+            throw MustQuit{};
+        }
+        for(const auto expectedSize : sizes)
+        {
+            uint16_t s;
+            if(in.read(reinterpret_cast<char*>(&s), sizeof s) != sizeof s)
+            {
+                std::cerr << "failed to read header of \"" << partial.path << "\"\n";
+                throw MustQuit{};
+            }
+            if(s!=expectedSize)
+            {
+                std::cerr << "bad header in \"" << partial.path << "\": size " << s << " instead of " << expectedSize << "\n";
+                throw MustQuit{};
+            }
+        }
+        if(const auto dataSize=in.size()-qint64(sizes.size()*sizeof(uint16_t)); dataSize != qint64(subpixelCount*sizeof(float)))
+        {
+            std::cerr << "unexpected size of texture data in \"" << partial.path << "\"\n";
+            throw MustQuit{};
+        }
+    }
+
+    QFile out(outPath);
+    if(!out.open(QFile::WriteOnly))
+    {
+        std::cerr << "failed to open file: " << out.errorString() << "\n";
+        throw MustQuit{};
+    }
+    for(const auto s : textureFileHeader(sizes, outputElementType))
+        out.write(reinterpret_cast<const char*>(&s), sizeof s);
+
+    // Process the data in chunks to avoid holding whole 4D textures in memory
+    constexpr size_t chunkSize=1<<20;
+    std::vector<float> sum(chunkSize), partialData(chunkSize);
+    std::vector<uint16_t> halfSum(outputElementType==TextureElementType::Float16 ? chunkSize : 0);
+    for(size_t offset=0; offset<subpixelCount; offset+=chunkSize)
+    {
+        const auto count=std::min(chunkSize, subpixelCount-offset);
+        std::fill_n(sum.begin(), count, 0.f);
+        for(size_t i=0; i<inputs.size(); ++i)
+        {
+            const qint64 sizeToRead=count*sizeof partialData[0];
+            if(inputs[i]->read(reinterpret_cast<char*>(partialData.data()), sizeToRead) != sizeToRead)
+            {
+                std::cerr << "failed to read \"" << partials[i].path << "\": " << inputs[i]->errorString() << "\n";
+                throw MustQuit{};
+            }
+            for(size_t k=0; k<count; ++k)
+                sum[k] += partialData[k];
+        }
+        if(outputElementType==TextureElementType::Float16)
+        {
+            for(size_t k=0; k<count; ++k)
+                halfSum[k]=glm::packHalf1x16(sum[k]);
+            out.write(reinterpret_cast<const char*>(halfSum.data()), count*sizeof halfSum[0]);
+        }
+        else
+        {
+            out.write(reinterpret_cast<const char*>(sum.data()), count*sizeof sum[0]);
+        }
+    }
+    out.close();
+    if(out.error())
+    {
+        std::cerr << "failed to write file: " << out.errorString() << "\n";
+        throw MustQuit{};
+    }
+    std::cerr << "done\n";
+}
@@ -0,0 +1,27 @@
+#ifndef INCLUDE_ONCE_38E8DF5F_15C4_4F19_AEA0_E75A129A91AE
+#define INCLUDE_ONCE_38E8DF5F_15C4_4F19_AEA0_E75A129A91AE
+
+#include <vector>
+#include <cstdint>
+#include <QString>
+#include "../common/texture-file.hpp"
+#include "../common/AtmosphereParameters.hpp"
+
+// A texture saved by calcmysky with the --wlsets option, holding the sum over the given wavelength sets
+struct PartialTexture
+{
+    unsigned firstWavelengthSet, lastWavelengthSet;
+    QString path;
+};
+
+// Sizes from the headers of the partial textures, which are cropped to the precomputed domain of altitudes and Sun zenith angles
+std::vector<uint16_t> partialTextureSizes(AtmosphereParameters const& atmo);
+// Finds the partial textures of the texture baseName in dirPath, sorted by their first wavelength set
+std::vector<PartialTexture> findPartialTextures(QString const& dirPath, QString const& baseName);
+// Quits if the partial textures don't cover all the wavelength sets without gaps or overlaps
+void checkCoverage(std::vector<PartialTexture> const& partials, QString const& baseName, unsigned wavelengthSetCount);
+// Sums single-precision partial textures of the given sizes into outPath
+void mergeTextures(std::vector<PartialTexture> const& partials, QString const& outPath, std::vector<uint16_t> const& sizes,
+                   TextureElementType outputElementType);
+
+#endif
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+
+#include "config.h"
+#include "merge-textures.hpp"
+#include "../common/AtmosphereParameters.hpp"
+
+int main(int argc, char** argv)
+{
+    [[maybe_unused]] UTF8Console utf8console;
+
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("CalcMySky merge tool");
+    app.setApplicationVersion(APP_VERSION);
+
+    try
+    {
+        QCommandLineParser parser;
+        parser.setApplicationDescription("Sums partial XYZW accumulator textures, computed by calcmysky with the --wlsets option, "
+                                         "into the final textures");
+        parser.addHelpOption();
+        parser.addVersionOption();
+        const QCommandLineOption storagePrecisionOpt("storage-precision","Precision of the merged textures in bits per component, "
+                                                                       "16 or 32 (default: 32)","BITS");
+        parser.addOption(storagePrecisionOpt);
+        parser.addPositionalArgument("textures-dir", "Directory with the partial textures and params.atmo");
+        parser.process(app);
+
+        const auto posArgs=parser.positionalArguments();
+        if(posArgs.size()!=1)
+        {
+            parser.showHelp(1);
+        }
+        const auto dir=posArgs[0];
+
+        auto outputElementType=TextureElementType::Float32;
+        if(parser.isSet(storagePrecisionOpt))
+        {
+            bool ok=false;
+            const auto bits=parser.value(storagePrecisionOpt).toUInt(&ok);
+            if(!ok || (bits!=16 && bits!=32))
+            {
+                std::cerr << "Bad storage precision: " << parser.value(storagePrecisionOpt) << ", must be 16 or 32\n";
+                return 1;
+            }
+            outputElementType=TextureElementType(bits);
+        }
+
+        AtmosphereParameters atmo;
+        atmo.parse(QDir(dir).filePath("params.atmo"), AtmosphereParameters::SkipSpectra{true});
+        if(atmo.allTexturesAreRadiance)
+        {
+            std::cerr << "Textures in \"" << dir << "\" are radiances, which are saved per wavelength set. Nothing to merge.\n";
+            return 0;
+        }
+
+        // The partial textures only cover the precomputed domain, like the final ones
+        const auto sizes=partialTextureSizes(atmo);
+        const unsigned wavelengthSetCount=atmo.allWavelengths.size();
+
+        {
+            const QString baseName="multiple-scattering";
+            const auto partials=findPartialTextures(dir, baseName);
+            checkCoverage(partials, baseName, wavelengthSetCount);
+            mergeTextures(partials, QDir(dir).filePath(baseName+"-xyzw.f32"), sizes, outputElementType);
+        }
+        for(const auto& scatterer : atmo.scatterers)
+        {
+            // Smooth scatterers are already merged into multiple scattering, general ones are saved per wavelength set
+            if(scatterer.phaseFunctionType!=PhaseFunctionType::Achromatic)
+                continue;
+            const auto singleScatteringDir=QDir(dir).filePath("single-scattering");
+            const auto partials=findPartialTextures(singleScatteringDir, scatterer.name);
+            checkCoverage(partials, "single scattering by \""+scatterer.name+"\"", wavelengthSetCount);
+            mergeTextures(partials, QDir(singleScatteringDir).filePath(scatterer.name+"-xyzw.f32"), sizes, outputElementType);
+        }
+    }
+    catch(ParsingError const& ex)
+    {
+        std::cerr << ex.what() << "\n";
+        return 1;
+    }
+    catch(ShowMySky::Error const& ex)
+    {
+        std::cerr << QObject::tr("Error: %1\n").arg(ex.what());
+        return 1;
+    }
+    catch(MustQuit& ex)
+    {
+        return ex.exitCode;
+    }
+    catch(std::exception const& ex)
+    {
+        std::cerr << "Fatal error: " << QString::fromLocal8Bit(ex.what()) << '\n';
+        return 111;
+    }
+}
@@ -0,0 +1,222 @@
+#include "report.hpp"
+
+#include <map>
+#include <vector>
+#include <iostream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QSaveFile>
+
+#include "data.hpp"
+#include "util.hpp"
+#include "shaders.hpp"
+
+namespace
+{
+
+struct Stage
+{
+    std::string name;
+    int wavelengthSet;
+    int scatteringOrder;
+    unsigned depth;
+    size_t parent; // index in stages
+    GLuint queries[2]; // GPU timestamps at the beginning and the end
+    std::chrono::steady_clock::duration wallTime{};
+    size_t bytesReadBack=0;
+    size_t bytesWritten=0;
+    double work=0;
+};
+constexpr size_t noParent=-1;
+std::vector<Stage> stages;
+std::vector<size_t> activeStages;
+QJsonArray scatteringOrdersComputed;
+QJsonObject previewError;
+
+using Seconds=std::chrono::duration<double>;
+
+double gpuSeconds(Stage const& stage)
+{
+    GLuint64 begin=0, end=0;
+    gl.glGetQueryObjectui64v(stage.queries[0], GL_QUERY_RESULT, &begin);
+    gl.glGetQueryObjectui64v(stage.queries[1], GL_QUERY_RESULT, &end);
+    return 1e-9*(end-begin);
+}
+
+}
+
+StageTimer::StageTimer(std::string name, int wavelengthSet, int scatteringOrder)
+{
+    if(opts.reportPath.isEmpty()) return;
+
+    if(!activeStages.empty())
+    {
+        const auto& parent=stages[activeStages.back()];
+        if(wavelengthSet<0) wavelengthSet=parent.wavelengthSet;
+        if(scatteringOrder<0) scatteringOrder=parent.scatteringOrder;
+    }
+    const auto parent = activeStages.empty() ? noParent : activeStages.back();
+    auto& stage=stages.emplace_back(Stage{std::move(name), wavelengthSet, scatteringOrder, unsigned(activeStages.size()), parent, {}});
+    stageIndex=stages.size()-1;
+    activeStages.push_back(stageIndex);
+
+    gl.glGenQueries(2, stage.queries);
+    gl.glQueryCounter(stage.queries[0], GL_TIMESTAMP);
+    time0=std::chrono::steady_clock::now();
+}
+
+StageTimer::~StageTimer()
+{
+    if(stageIndex==noStage) return;
+
+    auto& stage=stages[stageIndex];
+    gl.glQueryCounter(stage.queries[1], GL_TIMESTAMP);
+    stage.wallTime=std::chrono::steady_clock::now()-time0;
+    activeStages.pop_back();
+}
+
+void reportBytesReadBack(const size_t bytes)
+{
+    if(!activeStages.empty())
+        stages[activeStages.back()].bytesReadBack += bytes;
+}
+
+void reportBytesWritten(const size_t bytes)
+{
+    if(!activeStages.empty())
+        stages[activeStages.back()].bytesWritten += bytes;
+}
+
+void reportWork(const double units)
+{
+    if(!activeStages.empty())
+        stages[activeStages.back()].work += units;
+}
+
+void reportScatteringOrdersComputed(const unsigned wavelengthSet, const unsigned scatteringOrders, const bool converged)
+{
+    if(opts.reportPath.isEmpty()) return;
+    scatteringOrdersComputed.append(QJsonObject{{"wavelengthSet", int(wavelengthSet)},
+                                                {"scatteringOrders", int(scatteringOrders)},
+                                                {"converged", converged}});
+}
+
+void reportPreviewError(const double maxRelativeDifference, const double totalRelativeDifference)
+{
+    if(opts.reportPath.isEmpty()) return;
+    previewError=QJsonObject{{"maxRelativeDifference", maxRelativeDifference},
+                             {"totalRelativeDifference", totalRelativeDifference}};
+}
+
+void writeReport(const std::chrono::steady_clock::duration totalWallTime)
+{
+    if(opts.reportPath.isEmpty()) return;
+
+    std::cerr << "Writing run report to \"" << opts.reportPath << "\"... ";
+
+    struct Totals
+    {
+        unsigned count=0;
+        double gpuTime=0, wallTime=0;
+        // Excluding the nested stages
+        double selfGpuTime=0, selfWallTime=0;
+        size_t bytesReadBack=0, bytesWritten=0;
+        double work=0;
+    };
+    std::map<std::string, Totals> totalsByName;
+
+    std::vector<double> gpuTimes, selfGpuTimes, selfWallTimes;
+    for(const auto& stage : stages)
+    {
+        gpuTimes.push_back(gpuSeconds(stage));
+        selfGpuTimes.push_back(gpuTimes.back());
+        selfWallTimes.push_back(Seconds(stage.wallTime).count());
+    }
+    for(size_t i=0; i<stages.size(); ++i)
+    {
+        if(const auto parent=stages[i].parent; parent!=noParent)
+        {
+            selfGpuTimes[parent] -= gpuTimes[i];
+            selfWallTimes[parent] -= Seconds(stages[i].wallTime).count();
+        }
+    }
+
+    QJsonArray stagesArray;
+    for(size_t i=0; i<stages.size(); ++i)
+    {
+        const auto& stage=stages[i];
+        const auto gpuTime=gpuTimes[i];
+        const auto wallTime=Seconds(stage.wallTime).count();
+        QJsonObject obj{{"name", QString::fromStdString(stage.name)},
+                        {"depth", int(stage.depth)},
+                        {"gpuTime", gpuTime},
+                        {"wallTime", wallTime},
+                        {"bytesReadBack", double(stage.bytesReadBack)},
+                        {"bytesWritten", double(stage.bytesWritten)}};
+        if(stage.work>0)
+            obj["work"]=stage.work;
+        if(stage.wavelengthSet>=0)
+            obj["wavelengthSet"]=stage.wavelengthSet;
+        if(stage.scatteringOrder>=0)
+            obj["scatteringOrder"]=stage.scatteringOrder;
+        stagesArray.append(obj);
+
+        auto& totals=totalsByName[stage.name];
+        ++totals.count;
+        totals.gpuTime+=gpuTime;
+        totals.wallTime+=wallTime;
+        totals.selfGpuTime+=selfGpuTimes[i];
+        totals.selfWallTime+=selfWallTimes[i];
+        totals.bytesReadBack+=stage.bytesReadBack;
+        totals.bytesWritten+=stage.bytesWritten;
+        totals.work+=stage.work;
+    }
+    for(auto& stage : stages)
+        gl.glDeleteQueries(2, stage.queries);
+    stages.clear();
+
+    QJsonObject totalsObject;
+    for(const auto& [name, totals] : totalsByName)
+    {
+        totalsObject[QString::fromStdString(name)]=QJsonObject{{"count", int(totals.count)},
+                                                               {"gpuTime", totals.gpuTime},
+                                                               {"wallTime", totals.wallTime},
+                                                               {"selfGpuTime", totals.selfGpuTime},
+                                                               {"selfWallTime", totals.selfWallTime},
+                                                               {"bytesReadBack", double(totals.bytesReadBack)},
+                                                               {"bytesWritten", double(totals.bytesWritten)},
+                                                               {"work", totals.work}};
+    }
+
+    const auto& cacheStats=shaderCacheStats();
+    const QJsonObject shaderCache{{"shaderHits", int(cacheStats.shaderHits)},
+                                  {"shaderMisses", int(cacheStats.shaderMisses)},
+                                  {"programHits", int(cacheStats.programHits)},
+                                  {"programMisses", int(cacheStats.programMisses)},
+                                  {"programBinaryHits", int(cacheStats.programBinaryHits)},
+                                  {"timeSpent", Seconds(cacheStats.timeSpent).count()},
+                                  {"timeSaved", Seconds(cacheStats.timeSaved).count()}};
+
+    const auto glString=[](GLenum name){ return QString(reinterpret_cast<const char*>(gl.glGetString(name))); };
+    QJsonObject report{{"glRenderer", glString(GL_RENDERER)},
+                       {"glVersion", glString(GL_VERSION)},
+                       {"wavelengthSets", QJsonArray{int(opts.firstWavelengthSet), int(opts.lastWavelengthSet)}},
+                       {"scatteringOrders", int(atmo.scatteringOrdersToCompute)},
+                       {"totalWallTime", Seconds(totalWallTime).count()},
+                       {"convergenceTolerance", opts.convergenceTolerance},
+                       {"scatteringOrdersComputed", scatteringOrdersComputed},
+                       {"shaderCache", shaderCache},
+                       {"totalsByStageName", totalsObject},
+                       {"stages", stagesArray}};
+    if(!previewError.isEmpty())
+        report["previewError"]=previewError;
+
+    QSaveFile file(opts.reportPath);
+    if(!file.open(QFile::WriteOnly) || file.write(QJsonDocument(report).toJson())<0 || !file.commit())
+    {
+        std::cerr << "failed to write file: " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    std::cerr << "done\n";
+}
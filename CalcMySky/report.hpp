@@ -0,0 +1,39 @@
+#ifndef INCLUDE_ONCE_1987DB5D_F518_4BFA_8718_AC6FA1536F71
+#define INCLUDE_ONCE_1987DB5D_F518_4BFA_8718_AC6FA1536F71
+
+#include <chrono>
+#include <string>
+
+/* Measures CPU wall time and GPU time of a stage of the computation for the run report. Does nothing
+ * unless the report was requested. Stages may be nested, so GPU time is measured by a pair of
+ * GL_TIMESTAMP queries rather than by GL_TIME_ELAPSED, which can't be nested. The results of the
+ * queries are only fetched when the report is written, so timing doesn't stall the pipeline.
+ *
+ * Negative wavelength set or scattering order means that it's inherited from the enclosing stage.
+ */
+class StageTimer
+{
+public:
+    explicit StageTimer(std::string name, int wavelengthSet=-1, int scatteringOrder=-1);
+    ~StageTimer();
+    StageTimer(StageTimer const&)=delete;
+    StageTimer& operator=(StageTimer const&)=delete;
+private:
+    static constexpr size_t noStage=-1;
+    size_t stageIndex=noStage;
+    std::chrono::steady_clock::time_point time0;
+};
+
+// These account the traffic to the innermost active stage
+void reportBytesReadBack(size_t bytes);
+void reportBytesWritten(size_t bytes);
+// Accounts the work done by a kernel, as modeled by kernelWork(), to the innermost active stage
+void reportWork(double units);
+
+void reportScatteringOrdersComputed(unsigned wavelengthSet, unsigned scatteringOrders, bool converged);
+// Differences of the preview from the full computation, as estimated on reduced textures
+void reportPreviewError(double maxRelativeDifference, double totalRelativeDifference);
+
+void writeReport(std::chrono::steady_clock::duration totalWallTime);
+
+#endif
@@ -0,0 +1,236 @@
+#include "scheduler.hpp"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <iostream>
+#include <condition_variable>
+
+#include "data.hpp"
+#include "util.hpp"
+
+struct BackgroundTask
+{
+    std::string name;
+    std::function<void()> func;
+    unsigned pendingDependencies=0;
+    std::vector<TaskHandle> dependents;
+    bool dependencyFailed=false;
+    // Set when the task has been run or skipped
+    bool finished=false;
+    bool failed=false;
+};
+
+namespace
+{
+
+class WorkerPool
+{
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable taskFinished;
+    std::deque<TaskHandle> readyTasks;
+    unsigned unfinishedTaskCount=0;
+    std::vector<std::string> errors;
+    bool stopping=false;
+    std::vector<std::thread> threads;
+
+    // Must be called with the mutex locked
+    void finish(BackgroundTask& task, const bool failed)
+    {
+        task.finished=true;
+        task.failed=failed;
+        task.func=nullptr;
+        --unfinishedTaskCount;
+        const auto dependents=std::move(task.dependents);
+        for(const auto& dependent : dependents)
+        {
+            if(failed)
+                dependent->dependencyFailed=true;
+            if(--dependent->pendingDependencies==0)
+                makeReady(dependent);
+        }
+    }
+
+    // Must be called with the mutex locked
+    void makeReady(TaskHandle const& task)
+    {
+        if(task->dependencyFailed)
+            finish(*task, true);
+        else
+            readyTasks.push_back(task);
+    }
+
+    void run()
+    {
+        for(;;)
+        {
+            TaskHandle task;
+            {
+                std::unique_lock lock(mutex);
+                workAvailable.wait(lock, [this]{ return stopping || !readyTasks.empty(); });
+                if(stopping) return;
+                task=readyTasks.front();
+                readyTasks.pop_front();
+            }
+
+            std::string error;
+            bool failed=true;
+            try
+            {
+                task->func();
+                failed=false;
+            }
+            catch(MustQuit const&)
+            {
+                // The message has already been printed
+            }
+            catch(std::exception const& ex)
+            {
+                error=ex.what();
+            }
+            catch(...)
+            {
+                error="unknown exception";
+            }
+
+            {
+                std::lock_guard lock(mutex);
+                if(failed)
+                    errors.push_back("Background task \""+task->name+"\" failed"+(error.empty() ? "" : ": "+error));
+                finish(*task, failed);
+            }
+            workAvailable.notify_all();
+            taskFinished.notify_all();
+        }
+    }
+
+    // Must be called with the mutex locked
+    void throwIfFailed()
+    {
+        if(errors.empty()) return;
+        for(const auto& error : errors)
+            std::cerr << error << "\n";
+        errors.clear();
+        throw MustQuit{};
+    }
+
+public:
+    explicit WorkerPool(const unsigned threadCount)
+    {
+        for(unsigned i=0; i<threadCount; ++i)
+            threads.emplace_back([this]{ run(); });
+    }
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping=true;
+        }
+        workAvailable.notify_all();
+        for(auto& thread : threads)
+            thread.join();
+    }
+
+    TaskHandle submit(std::string name, std::function<void()> func, std::vector<TaskHandle> const& dependencies)
+    {
+        auto task=std::make_shared<BackgroundTask>();
+        task->name=std::move(name);
+        task->func=std::move(func);
+        {
+            std::lock_guard lock(mutex);
+            ++unfinishedTaskCount;
+            for(const auto& dependency : dependencies)
+            {
+                if(!dependency) continue;
+                if(dependency->finished)
+                {
+                    if(dependency->failed)
+                        task->dependencyFailed=true;
+                    continue;
+                }
+                dependency->dependents.push_back(task);
+                ++task->pendingDependencies;
+            }
+            if(task->pendingDependencies==0)
+                makeReady(task);
+        }
+        workAvailable.notify_all();
+        return task;
+    }
+
+    void wait(TaskHandle const& task)
+    {
+        std::unique_lock lock(mutex);
+        taskFinished.wait(lock, [&task]{ return task->finished; });
+        if(task->failed)
+            throwIfFailed();
+    }
+
+    void waitForAll()
+    {
+        std::unique_lock lock(mutex);
+        taskFinished.wait(lock, [this]{ return unfinishedTaskCount==0; });
+        throwIfFailed();
+    }
+};
+
+std::unique_ptr<WorkerPool> pool;
+
+}
+
+BackgroundTasks::BackgroundTasks()
+{
+    const auto threadCount = opts.backgroundThreads ? opts.backgroundThreads : std::max(1u, std::thread::hardware_concurrency());
+    pool=std::make_unique<WorkerPool>(threadCount);
+}
+
+BackgroundTasks::~BackgroundTasks()
+{
+    // Tasks that haven't started are abandoned: we only get here before waitForBackgroundTasks() on error
+    pool.reset();
+}
+
+TaskHandle runInBackground(std::string name, std::function<void()> func, std::vector<TaskHandle> const& dependencies)
+{
+    if(pool)
+        return pool->submit(std::move(name), std::move(func), dependencies);
+
+    auto task=std::make_shared<BackgroundTask>();
+    task->name=std::move(name);
+    task->finished=true;
+    for(const auto& dependency : dependencies)
+    {
+        if(dependency && dependency->failed)
+        {
+            task->failed=true;
+            return task;
+        }
+    }
+    try
+    {
+        func();
+    }
+    catch(MustQuit const&)
+    {
+        throw;
+    }
+    catch(std::exception const& ex)
+    {
+        std::cerr << "Task \"" << task->name << "\" failed: " << ex.what() << "\n";
+        throw MustQuit{};
+    }
+    return task;
+}
+
+void waitForTask(TaskHandle const& task)
+{
+    if(pool && task)
+        pool->wait(task);
+}
+
+void waitForBackgroundTasks()
+{
+    if(pool)
+        pool->waitForAll();
+}
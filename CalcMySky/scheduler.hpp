@@ -0,0 +1,38 @@
+#ifndef INCLUDE_ONCE_4FCC75CD_A155_48EB_A0B6_435DE2BB01A6
+#define INCLUDE_ONCE_4FCC75CD_A155_48EB_A0B6_435DE2BB01A6
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+/* The GL context is only used by the main thread, which walks through the stages of the computation in the
+ * order of their data dependencies. CPU-side work that doesn't need the context (interpolation of eclipsed
+ * double scattering, writing of files) is run as tasks on a pool of worker threads, so that it overlaps with
+ * the GPU work of the following stages. A task starts when all its dependencies have finished; if any of them
+ * has failed, the task is skipped.
+ *
+ * An instance of BackgroundTasks must exist while tasks are being run. Without it the tasks are run
+ * synchronously.
+ */
+class BackgroundTasks
+{
+public:
+    BackgroundTasks();
+    ~BackgroundTasks();
+    BackgroundTasks(BackgroundTasks const&)=delete;
+    BackgroundTasks& operator=(BackgroundTasks const&)=delete;
+};
+
+struct BackgroundTask;
+using TaskHandle=std::shared_ptr<BackgroundTask>;
+
+/* Failures are reported by throwing an exception from func. Since the task may finish at any point of
+ * the main thread's output, the message is printed only when the task is waited for.
+ */
+TaskHandle runInBackground(std::string name, std::function<void()> func, std::vector<TaskHandle> const& dependencies={});
+// These quit if any of the tasks waited for has failed
+void waitForTask(TaskHandle const& task);
+void waitForBackgroundTasks();
+
+#endif
@@ -1,19 +1,127 @@
 #include "shaders.hpp"
 
 #include <set>
+#include <map>
+#include <cmath>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QTemporaryDir>
 #include <QApplication>
+#include <QProcess>
 #include <QFile>
 #include <QDir>
 
 #include "data.hpp"
 #include "util.hpp"
+#include "../common/ProgramBinaryCache.hpp"
+#include "../common/gauss-legendre.hpp"
 
 #include "config.h"
 
 QString withHeadersIncluded(QString src, QString const& filename);
 
+namespace
+{
+ShaderCacheStats cacheStats;
+
+struct CachedShader
+{
+    std::shared_ptr<QOpenGLShader> shader;
+    std::chrono::steady_clock::duration compileTime;
+};
+std::map<QByteArray/*source hash*/, CachedShader> shaderCache;
+
+struct CachedProgram
+{
+    std::shared_ptr<QOpenGLShaderProgram> program;
+    std::chrono::steady_clock::duration linkTime;
+};
+std::map<QByteArray/*hash of shader hashes*/, CachedProgram> programCache;
+
+QByteArray sourceHash(QOpenGLShader::ShaderType type, QString const& source)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(int(type)));
+    hash.addData(source.toUtf8());
+    return hash.result();
+}
+
+struct ExpandedSource
+{
+    QOpenGLShader::ShaderType type;
+    QString filename;
+    QString source;
+    QByteArray hash;
+};
+
+// Without an OpenGL context the sources can only be checked by an offline validator, if it's installed
+void validateProgramSources(std::vector<ExpandedSource> const& sources, QByteArray const& programHash, const char* description)
+{
+    static std::set<QByteArray> validatedPrograms;
+    if(!validatedPrograms.insert(programHash).second)
+        return;
+
+    static const auto validator=QStandardPaths::findExecutable("glslangValidator");
+    if(validator.isEmpty())
+    {
+        static bool warned=false;
+        if(!warned)
+            std::cerr << indentOutput() << "glslangValidator not found, shaders won't be checked for errors\n";
+        warned=true;
+        return;
+    }
+
+    QTemporaryDir dir;
+    if(!dir.isValid())
+    {
+        std::cerr << "Failed to create temporary directory to validate " << description << ": " << dir.errorString() << "\n";
+        throw MustQuit{};
+    }
+    // The stage is determined by glslangValidator from the file name extension
+    QStringList args{"-l"};
+    for(unsigned i=0; i<sources.size(); ++i)
+    {
+        const auto path=dir.filePath(QString("%1-%2").arg(i).arg(sources[i].filename));
+        QFile file(path);
+        if(!file.open(QFile::WriteOnly))
+        {
+            std::cerr << "Failed to open \"" << path << "\" to validate " << description << ": " << file.errorString() << "\n";
+            throw MustQuit{};
+        }
+        file.write(sources[i].source.toUtf8());
+        file.close();
+        if(file.error())
+        {
+            std::cerr << "Failed to write \"" << path << "\" to validate " << description << ": " << file.errorString() << "\n";
+            throw MustQuit{};
+        }
+        args << path;
+    }
+
+    QProcess process;
+    process.setProcessChannelMode(QProcess::MergedChannels);
+    process.start(validator, args);
+    if(!process.waitForFinished(60'000))
+    {
+        std::cerr << "Failed to run glslangValidator to validate " << description << ": " << process.errorString() << "\n";
+        throw MustQuit{};
+    }
+    if(process.exitStatus()!=QProcess::NormalExit || process.exitCode()!=0)
+    {
+        std::cerr << "Validation of " << description << " failed:\n" << QString(process.readAll()) << "\n";
+        throw MustQuit{};
+    }
+}
+}
+
+ShaderCacheStats const& shaderCacheStats()
+{
+    return cacheStats;
+}
+
 void initConstHeader(glm::vec4 const& wavelengths)
 {
     QString header=1+R"(
@@ -50,25 +158,41 @@ const int numTransmittanceIntegrationPoints=)" + toString(atmo.numTransmittanceI
     virtualHeaderFiles[CONSTANTS_HEADER_FILENAME]=header;
 }
 
+namespace
+{
+struct NumberDensityFunction
+{
+    QString name;
+    QString body;
+};
+// Number density functions of the scatterers and absorbers, in the order of their column densities
+std::vector<NumberDensityFunction> speciesNumberDensityFunctions()
+{
+    std::vector<NumberDensityFunction> functions;
+    for(auto const& scatterer : atmo.scatterers)
+        functions.push_back({"scattererNumberDensity_"+scatterer.name, scatterer.numberDensity});
+    for(auto const& absorber : atmo.absorbers)
+        functions.push_back({"absorberNumberDensity_"+absorber.name, absorber.numberDensity});
+    return functions;
+}
+
+QString numberDensityFunctionDefinition(NumberDensityFunction const& function)
+{
+    return "float "+function.name+"(float altitude)\n"
+           "{\n"
+           +function.body+
+           "}\n";
+}
+}
+
 QString makeDensitiesFunctions()
 {
     QString header;
     QString src;
-    for(auto const& scatterer : atmo.scatterers)
+    for(auto const& function : speciesNumberDensityFunctions())
     {
-        src += "float scattererNumberDensity_"+scatterer.name+"(float altitude)\n"
-               "{\n"
-               +scatterer.numberDensity+
-               "}\n";
-        header += "float scattererNumberDensity_"+scatterer.name+"(float altitude);\n";
-    }
-    for(auto const& absorber : atmo.absorbers)
-    {
-        src += "float absorberNumberDensity_"+absorber.name+"(float altitude)\n"
-               "{\n"
-               +absorber.numberDensity+
-               "}\n";
-        header += "float absorberNumberDensity_"+absorber.name+"(float altitude);\n";
+        src += numberDensityFunctionDefinition(function);
+        header += "float "+function.name+"(float altitude);\n";
     }
 
     header += "vec4 scatteringCrossSection();\n"
@@ -79,7 +203,70 @@ QString makeDensitiesFunctions()
     return src;
 }
 
-QString makeTransmittanceComputeFunctionsSrc(glm::vec4 const& wavelengths)
+namespace
+{
+// Replaces the analytic number density functions with lookups in the baked LUT, see computeNumberDensityLUT()
+QString withNumberDensityLUTs(QString src)
+{
+    const auto functions=speciesNumberDensityFunctions();
+    const auto lutSize=QString::number(opts.numberDensityLUTSize);
+    const auto groupCount=columnDensityGroupCount();
+    bool samplerDeclared=false;
+    for(unsigned i=0; i<functions.size(); ++i)
+    {
+        const auto definition=numberDensityFunctionDefinition(functions[i]);
+        const auto pos=src.indexOf(definition);
+        if(pos<0) continue;
+        QString lookup;
+        if(!samplerDeclared)
+        {
+            lookup += "uniform sampler2D numberDensityLUT;\n";
+            samplerDeclared=true;
+        }
+        lookup += "float "+functions[i].name+"(float altitude)\n"
+                  "{\n"
+                  "    const float u=clamp(altitude/atmosphereHeight, 0., 1.);\n"
+                  "    return texture(numberDensityLUT, vec2((u*("+lutSize+"-1)+0.5)/"+lutSize+", "
+                            +QString::number((i/4+0.5)/groupCount, 'g', 9)+"))["+QString::number(i%4)+"];\n"
+                  "}\n";
+        src.replace(pos, definition.size(), lookup);
+    }
+    return src;
+}
+
+// The LUTs stay bound to their own units, so only the samplers have to be set, keeping the current program intact
+void setLUTSamplers(QOpenGLShaderProgram& program)
+{
+    const auto densityLocation=program.uniformLocation("numberDensityLUT");
+    const auto phaseFunctionLocation=program.uniformLocation("phaseFunctionTexture");
+    const auto gaussLegendreLocation=program.uniformLocation("gaussLegendreNodesTexture");
+    if(densityLocation<0 && phaseFunctionLocation<0 && gaussLegendreLocation<0) return;
+    GLint currentProgram=0;
+    gl.glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+    program.bind();
+    if(densityLocation>=0)
+        program.setUniformValue(densityLocation, NUMBER_DENSITY_LUT_TEXTURE_UNIT);
+    if(phaseFunctionLocation>=0)
+        program.setUniformValue(phaseFunctionLocation, PHASE_FUNCTION_TEXTURE_UNIT);
+    if(gaussLegendreLocation>=0)
+        program.setUniformValue(gaussLegendreLocation, RADIAL_QUADRATURE_TEXTURE_UNIT);
+    gl.glUseProgram(currentProgram);
+}
+}
+
+unsigned columnDensityGroupCount()
+{
+    return std::max<unsigned>(1, (atmo.scatterers.size()+atmo.absorbers.size()+3)/4);
+}
+
+glm::ivec2 cumulativeColumnDensityTableSize()
+{
+    // Along the lines it's as dense as brute-force integration of the longest rays, and
+    // each row of the transmittance texture is crossed by several lines.
+    return {atmo.numTransmittanceIntegrationPoints, 2*atmo.transmittanceTexW};
+}
+
+QString makeColumnDensitiesComputeFunctionsSrc(const unsigned group)
 {
     const QString head=1+R"(
 #version 330
@@ -87,57 +274,71 @@ QString makeTransmittanceComputeFunctionsSrc(glm::vec4 const& wavelengths)
 
 #include "const.h.glsl"
 #include "common-functions.h.glsl"
+#include "radial-quadrature.h.glsl"
 )";
-    const QString opticalDepthFunctionTemplate=R"(
-vec4 opticalDepthToAtmosphereBorder_##agentSpecies(float altitude, float cosZenithAngle, vec4 crossSection)
+    const auto functions=speciesNumberDensityFunctions();
+    QString densitiesFunction="vec4 groupNumberDensities(float altitude)\n{\n    return vec4(";
+    for(unsigned i=0; i<4; ++i)
+    {
+        const auto index=group*4+i;
+        densitiesFunction += (i ? ", " : "") + (index<functions.size() ? functions[index].name+"(altitude)" : QString("0"));
+    }
+    densitiesFunction += ");\n}\n";
+
+    const QString computeFunction=R"(
+// Column densities of the species of the group along the ray to the atmosphere border. They don't depend on
+// wavelengths, so transmittance for all the wavelength sets is computed from them.
+// This assumes that ray doesn't intersect Earth.
+vec4 computeColumnDensitiesToAtmosphereBorder(float cosZenithAngle, float altitude)
 {
     const float integrInterval=distanceToAtmosphereBorder(cosZenithAngle, altitude);
 
-    const float R=earthRadius;
-    const float r1=R+altitude;
-    const float l=integrInterval;
+    const float r1=earthRadius+altitude;
     const float mu=cosZenithAngle;
-    /* From law of cosines: r₂²=r₁²+l²+2r₁lμ */
-    const float endAltitude=-R+sqrt(sqr(r1)+sqr(l)+2*r1*l*mu);
-
-    const float dl=integrInterval/(numTransmittanceIntegrationPoints-1);
-
-    /* Using trapezoid rule on a uniform grid: f0/2+f1+f2+...+f(N-2)+f(N-1)/2. */
-    float sum=(agent##NumberDensity_##agentSpecies(altitude)+
-               agent##NumberDensity_##agentSpecies(endAltitude))/2;
-    for(int n=1;n<numTransmittanceIntegrationPoints-1;++n)
+    vec4 sum=vec4(0);
+    for(int n=0;n<numTransmittanceIntegrationPoints;++n)
     {
-        const float dist=n*dl;
-        const float currAlt=-R+sqrt(sqr(r1)+sqr(dist)+2*r1*dist*mu);
-        sum+=agent##NumberDensity_##agentSpecies(currAlt);
+        const vec2 node=radialQuadratureNode(n, numTransmittanceIntegrationPoints, integrInterval, mu, altitude);
+        const float dist=node.x;
+        /* From law of cosines: r₂²=r₁²+l²+2r₁lμ */
+        const float currAlt=-earthRadius+sqrt(sqr(r1)+sqr(dist)+2*r1*dist*mu);
+        sum+=node.y*groupNumberDensities(currAlt);
     }
-    return sum*dl*crossSection;
+    return sum;
 }
 )";
-    QString opticalDepthFunctions;
-    QString computeFunction = R"(
-// This assumes that ray doesn't intersect Earth
-vec4 computeTransmittanceToAtmosphereBorder(float cosZenithAngle, float altitude)
+    return head+makeDensitiesFunctions()+densitiesFunction+computeFunction;
+}
+
+QString makeTransmittanceComputeFunctionsSrc(glm::vec4 const& wavelengths)
+{
+    QString src=1+R"(
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+// Each layer holds the column densities of a group of four species, see makeColumnDensitiesComputeFunctionsSrc()
+uniform sampler3D columnDensitiesTexture;
+
+vec4 computeTransmittanceToAtmosphereBorder(const ivec2 texel)
 {
-    const vec4 depth=
 )";
-    for(auto const& scatterer : atmo.scatterers)
+    for(unsigned group=0; group<columnDensityGroupCount(); ++group)
     {
-        opticalDepthFunctions += QString(opticalDepthFunctionTemplate).replace("##agentSpecies",scatterer.name).replace("agent##","scatterer");
-        computeFunction += "        +opticalDepthToAtmosphereBorder_"+scatterer.name+
-                             "(altitude,cosZenithAngle,"+toString(scatterer.crossSection(wavelengths))+")\n";
+        src += QString("    const vec4 columnDensities%1=texelFetch(columnDensitiesTexture, ivec3(texel,%1), 0);\n").arg(group);
     }
+    src += "    const vec4 depth=vec4(0)\n";
+    std::vector<glm::vec4> crossSections;
+    for(auto const& scatterer : atmo.scatterers)
+        crossSections.push_back(scatterer.crossSection(wavelengths));
     for(auto const& absorber : atmo.absorbers)
-    {
-        opticalDepthFunctions += QString(opticalDepthFunctionTemplate).replace("##agentSpecies",absorber.name).replace("agent##","absorber");
-        computeFunction += "        +opticalDepthToAtmosphereBorder_"+absorber.name+
-                             "(altitude,cosZenithAngle,"+toString(absorber.crossSection(wavelengths))+")\n";
-    }
-    computeFunction += R"(      ;
+        crossSections.push_back(absorber.crossSection(wavelengths));
+    for(unsigned i=0; i<crossSections.size(); ++i)
+        src += QString("        +%1*columnDensities%2[%3]\n").arg(toString(crossSections[i])).arg(i/4).arg(i%4);
+    src += R"(        ;
     return exp(-depth);
 }
 )";
-    return head+makeDensitiesFunctions()+opticalDepthFunctions+computeFunction;
+    return src;
 }
 
 QString makeScattererDensityFunctionsSrc()
@@ -151,7 +352,7 @@ QString makeScattererDensityFunctionsSrc()
     return head+makeDensitiesFunctions();
 }
 
-QString makePhaseFunctionsSrc()
+QString makePhaseFunctionsSrc(const ForceAnalyticPhaseFunctions forceAnalytic)
 {
     QString src = 1+R"(
 #version 330
@@ -160,13 +361,28 @@ QString makePhaseFunctionsSrc()
 #include "const.h.glsl"
 
 )";
+    const bool tabulated = opts.phaseFunctionLUTSize && !forceAnalytic;
+    if(tabulated)
+        src += "uniform sampler2D phaseFunctionTexture;\n";
     QString header;
-    for(auto const& scatterer : atmo.scatterers)
+    for(unsigned i=0; i<atmo.scatterers.size(); ++i)
     {
+        auto const& scatterer=atmo.scatterers[i];
         src += "vec4 phaseFunction_"+scatterer.name+"(float dotViewSun)\n"
-               "{\n"
-               +scatterer.phaseFunction+
-               "}\n";
+               "{\n";
+        if(tabulated)
+        {
+            // Uniform in scattering angle rather than in its cosine, to resolve forward peaks
+            const auto lutSize=QString::number(opts.phaseFunctionLUTSize);
+            src += "    const float u=acos(clamp(dotViewSun, -1., 1.))/PI;\n"
+                   "    return texture(phaseFunctionTexture, vec2((u*("+lutSize+"-1)+0.5)/"+lutSize+", "
+                            +QString::number((i+0.5)/atmo.scatterers.size(), 'g', 9)+"));\n";
+        }
+        else
+        {
+            src += scatterer.phaseFunction;
+        }
+        src += "}\n";
         header += "vec4 phaseFunction_"+scatterer.name+"(float dotViewSun);\n";
     }
     header+="vec4 currentPhaseFunction(float dotViewSun);\n";
@@ -195,11 +411,161 @@ vec4 totalScatteringCoefficient(float altitude, float dotViewInc)
                " * phaseFunction_"+scatterer.name+"(dotViewInc)\n";
     }
     src += "        ;\n}\n";
+    // Without the phase functions, for the isotropic approximation of the preview mode
+    src += "vec4 totalScatteringCoefficient(float altitude)\n{\n    return\n";
+    for(auto const& scatterer : atmo.scatterers)
+    {
+        src += "        + scatteringCrossSection_"+scatterer.name+
+               " * scattererNumberDensity_"+scatterer.name+"(altitude)\n";
+    }
+    src += "        ;\n}\n";
     virtualHeaderFiles[TOTAL_SCATTERING_COEFFICIENT_HEADER_FILENAME]=
-        "vec4 totalScatteringCoefficient(float altitude, float dotViewInc);\n";
+        "vec4 totalScatteringCoefficient(float altitude, float dotViewInc);\n"
+        "vec4 totalScatteringCoefficient(float altitude);\n";
+    return src;
+}
+
+QString makeScatteringDensityForWavelengthSetsSrc(std::vector<unsigned> const& texIndices)
+{
+    QString scattererFactors;
+    for(auto const& scatterer : atmo.scatterers)
+    {
+        scattererFactors += "        const vec4 scattererFactor_"+scatterer.name+
+                            " = scattererNumberDensity_"+scatterer.name+"(altitude)"
+                            " * phaseFunction_"+scatterer.name+"(dotViewInc);\n";
+    }
+
+    QString declarations, initialization, accumulation;
+    for(unsigned i=0; i<texIndices.size(); ++i)
+    {
+        const auto wavelengths=atmo.allWavelengths[texIndices[i]];
+        const auto set="set"+QString::number(i)+"_";
+        declarations += "uniform sampler2D "+set+"incidentRayTransmittanceTable;\n"
+                        "uniform sampler2D "+set+"irradianceTexture;\n"
+                        "uniform sampler3D "+set+"multipleScatteringTexture;\n"
+                        "layout(location="+QString::number(i)+") out vec4 "+set+"scatteringDensity;\n"
+                        "const vec4 "+set+"groundAlbedo="+toString(atmo.groundAlbedo[atmo.wavelengthsIndex(wavelengths)])+";\n";
+        QString totalScatteringCoefficient="vec4(0)";
+        for(auto const& scatterer : atmo.scatterers)
+        {
+            declarations += "const vec4 "+set+"scatteringCrossSection_"+scatterer.name+"="+toString(scatterer.crossSection(wavelengths))+";\n";
+            totalScatteringCoefficient += "\n                + "+set+"scatteringCrossSection_"+scatterer.name+" * scattererFactor_"+scatterer.name;
+        }
+        initialization += "    "+set+"scatteringDensity=vec4(0);\n";
+        accumulation += "        "+set+"scatteringDensity += dSolidAngle *\n"
+                        "            (texelFetch("+set+"incidentRayTransmittanceTable, tableCoords, 0)*"+set+"groundAlbedo*\n"
+                        "                texture("+set+"irradianceTexture, groundIrradianceCoords)*groundBRDF +\n"
+                        "             texture("+set+"multipleScatteringTexture, scatteringCoords.lower)*scatteringCoords.alphaLower +\n"
+                        "             texture("+set+"multipleScatteringTexture, scatteringCoords.upper)*scatteringCoords.alphaUpper) *\n"
+                        "            ("+totalScatteringCoefficient+");\n";
+    }
+    return getShaderSrc(COMPUTE_SCATTERING_DENSITY_FOR_WAVELENGTH_SETS_FILENAME,IgnoreCache{})
+                .replace(QRegExp("[ ]*\\bDECLARE_WAVELENGTH_SET_INPUTS_AND_OUTPUTS;\\n"), declarations)
+                .replace(QRegExp("[ ]*\\bINITIALIZE_SCATTERING_DENSITIES;\\n"), initialization)
+                .replace(QRegExp("[ ]*\\bCOMPUTE_SCATTERER_FACTORS;\\n"), scattererFactors)
+                .replace(QRegExp("[ ]*\\bACCUMULATE_SCATTERING_DENSITIES;\\n"), accumulation);
+}
+
+std::vector<int> gaussLegendreNodeCounts()
+{
+    // The end points of multiple scattering make its count one more than that of single scattering
+    const std::set<int> counts{atmo.numTransmittanceIntegrationPoints, atmo.radialIntegrationPoints, atmo.radialIntegrationPoints+1};
+    return {counts.begin(), counts.end()};
+}
+
+std::vector<glm::vec4> makeGaussLegendreTable()
+{
+    const auto counts=gaussLegendreNodeCounts();
+    const auto width=counts.back();
+    std::vector<glm::vec4> table(size_t(width)*counts.size(), glm::vec4(0));
+    for(size_t row=0; row<counts.size(); ++row)
+    {
+        const auto nodes=gaussLegendreNodes(counts[row]);
+        for(size_t i=0; i<nodes.size(); ++i)
+            table[row*width+i]=glm::vec4(nodes[i].x, nodes[i].weight, 0, 0);
+    }
+    return table;
+}
+
+QString makeRadialQuadratureSrc()
+{
+    QString src=1+R"(
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+
+)";
+    switch(atmo.radialQuadrature)
+    {
+    case RadialQuadrature::Trapezoid:
+        src += 1+R"(
+vec2 radialQuadratureNode(int n, int nodeCount, float rayLength, float cosZenithAngle, float altitude)
+{
+    const float dl=rayLength/(nodeCount-1);
+    return vec2(n*dl, n==0||n==nodeCount-1 ? 0.5*dl : dl);
+}
+)";
+        break;
+    case RadialQuadrature::GaussLegendre:
+    {
+        /* The rule is fixed by the node count, so the nodes are tabulated for the counts used by the integrals, one
+         * row per count, see makeGaussLegendreTable(). A shader can't fail at run time, so a count without a row gives
+         * NaN, which can't pass for a valid result like zero could.
+         */
+        const auto counts=gaussLegendreNodeCounts();
+        QString selection;
+        for(size_t row=0; row<counts.size(); ++row)
+            selection += "    if(nodeCount=="+QString::number(counts[row])+") row="+QString::number(row)+";\n";
+        src += "uniform sampler2D gaussLegendreNodesTexture;\n"
+               "vec2 radialQuadratureNode(int n, int nodeCount, float rayLength, float cosZenithAngle, float altitude)\n"
+               "{\n"
+               "    int row=-1;\n"
+               +selection+
+               "    if(row<0) return vec2(uintBitsToFloat(0x7fc00000u));\n"
+               "    return rayLength*texelFetch(gaussLegendreNodesTexture, ivec2(n,row), 0).xy;\n"
+               "}\n";
+        break;
+    }
+    case RadialQuadrature::Exponential:
+        src += "const float radialIntegrationScaleHeight="+toString(atmo.radialQuadratureScaleHeight)+";\n";
+        src += 1+R"(
+/* Trapezoid rule in t∈[0,1], with the distance dist(t) such that the density changes by the same factor at each
+ * step, provided that altitude changes linearly from the start of the ray to its end, and the density is
+ * exponential. Otherwise it's just a change of variable that keeps the integral intact.
+ */
+vec2 radialQuadratureNode(int n, int nodeCount, float rayLength, float cosZenithAngle, float altitude)
+{
+    const float r=earthRadius+altitude;
+    const float endAltitude=sqrt(sqr(rayLength)+sqr(r)+2*r*rayLength*cosZenithAngle)-earthRadius;
+    // Exponent of the density change along the whole ray, limited to keep exp() finite
+    const float kL=clamp((endAltitude-altitude)/radialIntegrationScaleHeight, -80., 80.);
+    const float t=float(n)/(nodeCount-1);
+    const float dt = n==0||n==nodeCount-1 ? 0.5/(nodeCount-1) : 1./(nodeCount-1);
+    if(abs(kL)<1e-3)
+        return vec2(t*rayLength, dt*rayLength);
+    const float k=kL/rayLength;
+    const float a=1-exp(-kL);
+    const float dist=-log(1-t*a)/k;
+    const float dDistDt=a/(k*(1-t*a));
+    return vec2(dist, dDistDt*dt);
+}
+)";
+        break;
+    }
     return src;
 }
 
+QString shaderFilePath(QString const& fileName)
+{
+    const auto appBinDir=QDir(qApp->applicationDirPath()+"/").canonicalPath();
+    if(appBinDir==QDir(INSTALL_BINDIR).canonicalPath())
+        return DATA_ROOT_DIR "shaders/" + fileName;
+    if(appBinDir==QDir(BUILD_BINDIR "CalcMySky/").canonicalPath())
+        return SOURCE_DIR "shaders/" + fileName;
+    return appBinDir + "/shaders/" + fileName;
+}
+
 QString getShaderSrc(QString const& fileName, IgnoreCache ignoreCache)
 {
     if(!ignoreCache)
@@ -210,29 +576,34 @@ QString getShaderSrc(QString const& fileName, IgnoreCache ignoreCache)
             return it->second;
     }
 
-    const auto appBinDir=QDir(qApp->applicationDirPath()+"/").canonicalPath();
-    QString filePath=appBinDir + "/shaders/" + fileName;
-    if(appBinDir==QDir(INSTALL_BINDIR).canonicalPath())
-    {
-        filePath=DATA_ROOT_DIR "shaders/" + fileName;
-    }
-    else if(appBinDir==QDir(BUILD_BINDIR "CalcMySky/").canonicalPath())
-    {
-        filePath=SOURCE_DIR "shaders/" + fileName;
-    }
+    // Shader files don't change during the run, so there's no need to read them more than once
+    static std::map<QString, QString> diskSources;
+    if(const auto it=diskSources.find(fileName); it!=diskSources.end())
+        return it->second;
+
+    const auto filePath=shaderFilePath(fileName);
     QFile file(filePath);
     if(!file.open(QIODevice::ReadOnly))
     {
         std::cerr << "Error opening shader file \"" << filePath.toStdString() << "\"\n";
         throw MustQuit{};
     }
-    return file.readAll();
+    return diskSources[fileName]=file.readAll();
 }
 
-std::unique_ptr<QOpenGLShader> compileShader(QOpenGLShader::ShaderType type, QString source, QString const& description)
+std::shared_ptr<QOpenGLShader> compileShaderFromExpandedSource(QOpenGLShader::ShaderType type, QString source,
+                                                               QByteArray const& hash, QString const& description)
 {
-    auto shader=std::make_unique<QOpenGLShader>(type);
-    source=withHeadersIncluded(source, description);
+    if(const auto it=shaderCache.find(hash); it!=shaderCache.end())
+    {
+        ++cacheStats.shaderHits;
+        cacheStats.timeSaved += it->second.compileTime;
+        return it->second.shader;
+    }
+    ++cacheStats.shaderMisses;
+
+    const auto time0=std::chrono::steady_clock::now();
+    auto shader=std::make_shared<QOpenGLShader>(type);
     if(!shader->compileSourceCode(source))
     {
         std::cerr << "Failed to compile " << description.toStdString() << ":\n"
@@ -259,12 +630,12 @@ std::unique_ptr<QOpenGLShader> compileShader(QOpenGLShader::ShaderType type, QSt
         std::cerr << "Warnings while compiling " << description.toStdString() << ":\n"
                   << shader->log().toStdString() << "\n";
     }
+    const auto compileTime=std::chrono::steady_clock::now()-time0;
+    cacheStats.timeSpent += compileTime;
+    shaderCache[hash]={shader, compileTime};
     return shader;
 }
 
-std::unique_ptr<QOpenGLShader> compileShader(QOpenGLShader::ShaderType type, QString const& filename)
-{ return compileShader(type, getShaderSrc(filename), filename); }
-
 QString withHeadersIncluded(QString src, QString const& filename)
 {
     QTextStream srcStream(&src);
@@ -315,21 +686,34 @@ std::set<QString> getShaderFileNamesToLinkWith(QString const& filename, int recu
         std::cerr << "Include recursion depth exceeded " << maxRecursionDepth << "\n";
         throw MustQuit{};
     }
+    // Parsing of the includes is cached by source text, since virtual sources change during the run
+    static std::map<QString/*source*/, std::vector<QString>> companionsCache;
+    const auto shaderSrc=getShaderSrc(filename);
+    auto companionsIt=companionsCache.find(shaderSrc);
+    if(companionsIt==companionsCache.end())
+    {
+        std::vector<QString> companions;
+        auto src=shaderSrc;
+        QTextStream srcStream(&src);
+        for(auto line=srcStream.readLine(); !line.isNull(); line=srcStream.readLine())
+        {
+            auto includePattern=QRegExp("^#include(?:_if\\s*\\(\\s*1\\s*(?:/\\*[^)]*\\*/)?\\))? \"([^\"]+)(\\.h\\.glsl)\"$");
+            if(!includePattern.exactMatch(line))
+                continue;
+            const auto includeFileBaseName=includePattern.cap(1);
+            const auto headerFileName=includeFileBaseName+includePattern.cap(2);
+            if(headerFileName == CONSTANTS_HEADER_FILENAME) // no companion source for constants header
+                continue;
+            if(headerFileName == RADIANCE_TO_LUMINANCE_HEADER_FILENAME) // no companion source for radiance-to-luminance conversion header
+                continue;
+            companions.push_back(includeFileBaseName+".frag");
+        }
+        companionsIt=companionsCache.emplace(shaderSrc, std::move(companions)).first;
+    }
+
     std::set<QString> filenames;
-    auto shaderSrc=getShaderSrc(filename);
-    QTextStream srcStream(&shaderSrc);
-    for(auto line=srcStream.readLine(); !line.isNull(); line=srcStream.readLine())
+    for(const auto& shaderFileNameToLinkWith : companionsIt->second)
     {
-        auto includePattern=QRegExp("^#include(?:_if\\s*\\(\\s*1\\s*(?:/\\*[^)]*\\*/)?\\))? \"([^\"]+)(\\.h\\.glsl)\"$");
-        if(!includePattern.exactMatch(line))
-            continue;
-        const auto includeFileBaseName=includePattern.cap(1);
-        const auto headerFileName=includeFileBaseName+includePattern.cap(2);
-        if(headerFileName == CONSTANTS_HEADER_FILENAME) // no companion source for constants header
-            continue;
-        if(headerFileName == RADIANCE_TO_LUMINANCE_HEADER_FILENAME) // no companion source for radiance-to-luminance conversion header
-            continue;
-        const auto shaderFileNameToLinkWith=includeFileBaseName+".frag";
         filenames.insert(shaderFileNameToLinkWith);
         if(shaderFileNameToLinkWith!=filename)
         {
@@ -340,39 +724,113 @@ std::set<QString> getShaderFileNamesToLinkWith(QString const& filename, int recu
     return filenames;
 }
 
-std::unique_ptr<QOpenGLShaderProgram> compileShaderProgram(QString const& mainSrcFileName,
+std::shared_ptr<QOpenGLShaderProgram> compileShaderProgram(QString const& mainSrcFileName,
                                                            const char* description, const UseGeomShader useGeomShader,
                                                            std::vector<std::pair<QString, QString>>* sourcesToSave)
 {
-    auto program=std::make_unique<QOpenGLShaderProgram>();
-
     auto shaderFileNames=getShaderFileNamesToLinkWith(mainSrcFileName);
     shaderFileNames.insert(mainSrcFileName);
 
-    std::vector<std::unique_ptr<QOpenGLShader>> shaders;
-    for(const auto filename : shaderFileNames)
+    // Saved shaders are used by ShowMySky, which doesn't have the LUT
+    const bool useNumberDensityLUT = numberDensityLUTReady && !sourcesToSave;
+    std::vector<ExpandedSource> sources;
+    const auto addSource=[&sources,useNumberDensityLUT](QOpenGLShader::ShaderType type, QString const& filename)
+    {
+        auto source=withHeadersIncluded(getShaderSrc(filename), filename);
+        if(useNumberDensityLUT)
+            source=withNumberDensityLUTs(std::move(source));
+        auto hash=sourceHash(type, source);
+        sources.push_back({type, filename, std::move(source), std::move(hash)});
+    };
+    for(const auto& filename : shaderFileNames)
     {
-        shaders.emplace_back(compileShader(QOpenGLShader::Fragment, filename));
-        program->addShader(shaders.back().get());
+        addSource(QOpenGLShader::Fragment, filename);
         if(sourcesToSave)
-            sourcesToSave->push_back({filename, withHeadersIncluded(getShaderSrc(filename), filename)});
+            sourcesToSave->push_back({filename, sources.back().source});
     }
-
-    shaders.emplace_back(compileShader(QOpenGLShader::Vertex, "shader.vert"));
-    program->addShader(shaders.back().get());
-
+    addSource(QOpenGLShader::Vertex, "shader.vert");
     if(useGeomShader)
+        addSource(QOpenGLShader::Geometry, "shader.geom");
+
+    QCryptographicHash programHash(QCryptographicHash::Sha1);
+    for(const auto& source : sources)
+        programHash.addData(source.hash);
+    const auto key=programHash.result();
+    // In the shaders-only mode only the phase function LUT program is linked, for which there's an OpenGL context
+    if(opts.shadersOnly && sourcesToSave)
+    {
+        validateProgramSources(sources, key, description);
+        return nullptr;
+    }
+    if(const auto it=programCache.find(key); it!=programCache.end())
+    {
+        ++cacheStats.programHits;
+        cacheStats.timeSaved += it->second.linkTime;
+        return it->second.program;
+    }
+    ++cacheStats.programMisses;
+
+    const auto time0=std::chrono::steady_clock::now();
+    auto program=std::make_shared<QOpenGLShaderProgram>();
+    if(!opts.noProgramBinaryCache && ProgramBinaryCache::load(*program, key))
     {
-        shaders.emplace_back(compileShader(QOpenGLShader::Geometry, "shader.geom"));
-        program->addShader(shaders.back().get());
+        ++cacheStats.programBinaryHits;
+        setLUTSamplers(*program);
+        const auto loadTime=std::chrono::steady_clock::now()-time0;
+        cacheStats.timeSpent += loadTime;
+        programCache[key]={program, loadTime};
+        return program;
     }
 
+    for(const auto& source : sources)
+        program->addShader(compileShaderFromExpandedSource(source.type, source.source, source.hash, source.filename).get());
+    if(!opts.noProgramBinaryCache)
+        ProgramBinaryCache::prepareForLink(*program);
+    const auto linkTime0=std::chrono::steady_clock::now();
     if(!program->link())
     {
         // Qt prints linking errors to stderr, so don't print them again
         std::cerr << "Failed to link " << description << "\n";
         throw MustQuit{};
     }
+    const auto linkTime=std::chrono::steady_clock::now()-linkTime0;
+    cacheStats.timeSpent += linkTime;
+    if(!opts.noProgramBinaryCache)
+        ProgramBinaryCache::save(*program, key);
+    setLUTSamplers(*program);
+    programCache[key]={program, linkTime};
     return program;
 }
 
+QByteArray shaderFilesHash(std::vector<QString> const& mainSrcFileNames)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    std::set<QString> visited;
+    std::vector<QString> toVisit(mainSrcFileNames.rbegin(), mainSrcFileNames.rend());
+    toVisit.insert(toVisit.begin(), {"shader.geom", "shader.vert"});
+    while(!toVisit.empty())
+    {
+        const auto fileName=toVisit.back();
+        toVisit.pop_back();
+        if(!visited.insert(fileName).second)
+            continue;
+        QFile file(shaderFilePath(fileName));
+        if(!file.open(QFile::ReadOnly))
+            continue; // generated source
+        const auto src=file.readAll();
+        hash.addData(fileName.toUtf8()+'\0');
+        hash.addData(src+'\0');
+
+        // Both disabled and enabled includes are followed, since the condition may depend on the caller
+        const QRegExp includePattern("^\\s*#include(?:_if\\s*\\([^)]*\\))? \"([^\"]+)\\.h\\.glsl\"");
+        for(const auto& line : QString(src).split('\n'))
+        {
+            if(!includePattern.exactMatch(line.trimmed()))
+                continue;
+            const auto baseName=includePattern.cap(1);
+            toVisit.push_back(baseName+".frag");
+            toVisit.push_back(baseName+".h.glsl");
+        }
+    }
+    return hash.result();
+}
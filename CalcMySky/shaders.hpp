@@ -1,7 +1,9 @@
 #ifndef INCLUDE_ONCE_2BE961E4_6CF8_4E2F_B5E5_DE8EEEE510F9
 #define INCLUDE_ONCE_2BE961E4_6CF8_4E2F_B5E5_DE8EEEE510F9
 
+#include <chrono>
 #include <memory>
+#include <vector>
 #include <QOpenGLShader>
 #include <glm/glm.hpp>
 #include "../common/util.hpp"
@@ -9,13 +11,43 @@
 DEFINE_EXPLICIT_BOOL(IgnoreCache);
 QString getShaderSrc(QString const& fileName, IgnoreCache ignoreCache=IgnoreCache{false});
 DEFINE_EXPLICIT_BOOL(UseGeomShader);
-std::unique_ptr<QOpenGLShaderProgram> compileShaderProgram(QString const& mainSrcFileName,
+// Programs are cached for the duration of the run, so the result may be shared with previous callers.
+// In shaders-only mode nothing is compiled: the sources are only validated, and the result is null.
+std::shared_ptr<QOpenGLShaderProgram> compileShaderProgram(QString const& mainSrcFileName,
                                                            const char* description,
                                                            UseGeomShader useGeomShader=UseGeomShader{false},
                                                            std::vector<std::pair<QString, QString>>* sourcesToSave=nullptr);
+struct ShaderCacheStats
+{
+    unsigned shaderHits=0, shaderMisses=0;
+    unsigned programHits=0, programMisses=0;
+    unsigned programBinaryHits=0; // programs loaded from the on-disk binary cache, counted in programMisses too
+    std::chrono::steady_clock::duration timeSpent{}; // compiling and linking
+    std::chrono::steady_clock::duration timeSaved{}; // estimated from the time spent on the cached items
+};
+ShaderCacheStats const& shaderCacheStats();
+/* Hash of the shader files on disk that programs with the given main sources are built from, following
+ * the includes and companion sources. Generated sources aren't included: they are determined by the
+ * parameters they are generated from.
+ */
+QByteArray shaderFilesHash(std::vector<QString> const& mainSrcFileNames);
 void initConstHeader(glm::vec4 const& wavelengths);
 QString makeScattererDensityFunctionsSrc();
+// Column densities of the scatterers and absorbers are computed in groups of four, one group per texture layer
+unsigned columnDensityGroupCount();
+// Samples along the lines of the rays by impact parameters, see cumulative-column-densities.frag
+glm::ivec2 cumulativeColumnDensityTableSize();
+QString makeColumnDensitiesComputeFunctionsSrc(unsigned group);
 QString makeTransmittanceComputeFunctionsSrc(glm::vec4 const& wavelengths);
 QString makeTotalScatteringCoefSrc();
-QString makePhaseFunctionsSrc();
+// Scattering density of the orders from 3 on for the given wavelength sets, each writing to its own output
+QString makeScatteringDensityForWavelengthSetsSrc(std::vector<unsigned> const& texIndices);
+QString makeRadialQuadratureSrc();
+// Sorted node counts of the radial integrals, which the Gauss-Legendre rule has tables for
+std::vector<int> gaussLegendreNodeCounts();
+// Nodes (x) and weights (y) on [0,1], one row per count of gaussLegendreNodeCounts(), as wide as the largest count
+std::vector<glm::vec4> makeGaussLegendreTable();
+// The bake of the phase function LUT needs the functions themselves, other callers get lookups if the LUT is enabled
+DEFINE_EXPLICIT_BOOL(ForceAnalyticPhaseFunctions);
+QString makePhaseFunctionsSrc(ForceAnalyticPhaseFunctions forceAnalytic=ForceAnalyticPhaseFunctions{false});
 #endif
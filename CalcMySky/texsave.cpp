@@ -0,0 +1,309 @@
+#include "texsave.hpp"
+
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <cassert>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <iostream>
+#include <condition_variable>
+#include <QFile>
+
+#include "data.hpp"
+#include "util.hpp"
+
+namespace
+{
+
+struct SaveJob
+{
+    std::string path;
+    std::vector<uint16_t> header;
+    TextureElementType elementType=TextureElementType::Float32; // what to write, the data read back are always single precision
+    bool append=false; // a continuation of the previous job for the same file
+    size_t byteSize=0;
+    GLuint pbo=0;
+    GLsync fence=nullptr; // non-null while the readback is in progress
+    const char* data=nullptr; // mapped PBO, set when the job is handed to the writer
+
+    // Guarded by the writer mutex
+    bool written=false;
+    std::string error;
+};
+
+class Writer
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::shared_ptr<SaveJob>> queue;
+    bool stopping=false;
+    std::thread thread;
+
+    static std::string write(SaveJob const& job)
+    {
+        QFile out(QString::fromStdString(job.path));
+        if(!out.open(job.append ? QFile::Append : QFile::WriteOnly))
+            return "failed to open file: "+out.errorString().toStdString();
+        out.write(reinterpret_cast<const char*>(job.header.data()), job.header.size()*sizeof job.header[0]);
+        if(job.elementType==TextureElementType::Float16)
+        {
+            const auto halves=toHalfPrecision(reinterpret_cast<const float*>(job.data), job.byteSize/sizeof(float), job.path);
+            out.write(reinterpret_cast<const char*>(halves.data()), halves.size()*sizeof halves[0]);
+        }
+        else
+        {
+            out.write(job.data, job.byteSize);
+        }
+        out.close();
+        if(out.error())
+            return "failed to write file: "+out.errorString().toStdString();
+        return {};
+    }
+
+    void run()
+    {
+        for(;;)
+        {
+            std::shared_ptr<SaveJob> job;
+            {
+                std::unique_lock lock(mutex);
+                cond.wait(lock, [this]{ return stopping || !queue.empty(); });
+                if(stopping) return;
+                job=queue.front();
+                queue.pop_front();
+            }
+            auto error=write(*job);
+            {
+                std::lock_guard lock(mutex);
+                job->error=std::move(error);
+                job->written=true;
+            }
+            cond.notify_all();
+        }
+    }
+
+public:
+    Writer() : thread([this]{ run(); }) {}
+    ~Writer()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping=true;
+        }
+        cond.notify_all();
+        thread.join();
+    }
+    void push(std::shared_ptr<SaveJob> const& job)
+    {
+        {
+            std::lock_guard lock(mutex);
+            queue.push_back(job);
+        }
+        cond.notify_all();
+    }
+    bool isWritten(SaveJob const& job)
+    {
+        std::lock_guard lock(mutex);
+        return job.written;
+    }
+    void waitUntilWritten(SaveJob const& job)
+    {
+        std::unique_lock lock(mutex);
+        cond.wait(lock, [&job]{ return job.written; });
+    }
+};
+
+std::unique_ptr<Writer> writer;
+GLuint readFBO=0;
+// Jobs in the order of submission. Accessed only from the GL thread.
+std::deque<std::shared_ptr<SaveJob>> jobs;
+size_t bytesInFlight=0;
+
+// Returns false if wait is false and the readback hasn't completed yet
+bool handToWriter(std::shared_ptr<SaveJob> const& jobPtr, const bool wait)
+{
+    auto& job=*jobPtr;
+    if(job.data) return true;
+
+    const GLuint64 timeout = wait ? 100'000'000 : 0; // ns
+    GLenum status;
+    while((status=gl.glClientWaitSync(job.fence, 0, timeout))==GL_TIMEOUT_EXPIRED)
+    {
+        if(!wait) return false;
+    }
+    if(status==GL_WAIT_FAILED)
+    {
+        std::cerr << "Failed to wait for texture readback into \"" << job.path << "\": " << openglErrorString(gl.glGetError()) << "\n";
+        throw MustQuit{};
+    }
+    gl.glDeleteSync(job.fence);
+    job.fence=nullptr;
+
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, job.pbo);
+    job.data=static_cast<const char*>(gl.glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, job.byteSize, GL_MAP_READ_BIT));
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if(!job.data)
+    {
+        std::cerr << "Failed to map pixel buffer for \"" << job.path << "\": " << openglErrorString(gl.glGetError()) << "\n";
+        throw MustQuit{};
+    }
+    writer->push(jobPtr);
+    return true;
+}
+
+void retireOldestJob()
+{
+    auto job=jobs.front();
+    handToWriter(job, true);
+    writer->waitUntilWritten(*job);
+
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo);
+    gl.glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    gl.glDeleteBuffers(1, &job->pbo);
+    bytesInFlight -= job->byteSize;
+    jobs.pop_front();
+
+    if(!job->error.empty())
+    {
+        std::cerr << "Failed to save texture to \"" << job->path << "\": " << job->error << "\n";
+        throw MustQuit{};
+    }
+}
+
+// Hands completed readbacks to the writer and releases the buffers of written textures, without blocking
+void pollJobs()
+{
+    for(const auto& job : jobs)
+        if(!handToWriter(job, false))
+            break;
+    while(!jobs.empty() && jobs.front()->data && writer->isWritten(*jobs.front()))
+        retireOldestJob();
+}
+
+// readPixels must read the data into the PIXEL_PACK_BUFFER, which is bound on its call
+void queueReadback(std::string const& path, std::vector<uint16_t> header, const TextureElementType elementType,
+                   const bool append, const size_t byteSize, std::function<void()> const& readPixels)
+{
+    pollJobs();
+
+    const size_t memoryLimit=size_t(opts.saveQueueMemoryLimitMiB)<<20;
+    // A block larger than the limit is still saved, but only after all the previous ones are done
+    while(!jobs.empty() && bytesInFlight+byteSize > memoryLimit)
+        retireOldestJob();
+
+    auto job=std::make_shared<SaveJob>();
+    job->path=path;
+    job->header=std::move(header);
+    job->elementType=elementType;
+    job->append=append;
+    job->byteSize=byteSize;
+
+    gl.glGenBuffers(1, &job->pbo);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo);
+    gl.glBufferData(GL_PIXEL_PACK_BUFFER, byteSize, nullptr, GL_STREAM_READ);
+    readPixels();
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
+    {
+        gl.glDeleteBuffers(1, &job->pbo);
+        std::cerr << "GL error in queueTextureSave() on texture readback: " << openglErrorString(err) << "\n";
+        throw MustQuit{};
+    }
+    job->fence=gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl.glFlush();
+
+    jobs.push_back(std::move(job));
+    bytesInFlight += byteSize;
+}
+
+}
+
+AsyncTextureSaving::AsyncTextureSaving()
+{
+    writer=std::make_unique<Writer>();
+    gl.glGenFramebuffers(1, &readFBO);
+}
+
+AsyncTextureSaving::~AsyncTextureSaving()
+{
+    // Jobs that are still queued are abandoned: we only get here before finishTextureSaves() on error
+    writer.reset();
+    jobs.clear();
+    bytesInFlight=0;
+    gl.glDeleteFramebuffers(1, &readFBO);
+    readFBO=0;
+}
+
+void queueTextureSave(const GLenum target, const GLuint texture, std::string const& path, std::vector<GLsizei> const& sizes,
+                      glm::ivec3 const& regionOffset, glm::ivec3 const& regionSize, const TextureElementType elementType)
+{
+    auto header=textureFileHeader(std::vector<uint16_t>(sizes.begin(), sizes.end()), elementType);
+    const GLsizei width=regionSize.x, height=regionSize.y, depth=regionSize.z;
+    const size_t layerByteSize=size_t(width)*height*4*sizeof(GLfloat);
+    if(target!=GL_TEXTURE_3D)
+    {
+        assert(regionOffset==glm::ivec3(0));
+        queueReadback(path, std::move(header), elementType, false, layerByteSize*depth,
+                      [target]{ gl.glGetTexImage(target, 0, GL_RGBA, GL_FLOAT, nullptr); });
+        return;
+    }
+
+    // A quarter of the limit per block lets the readback of the next blocks overlap with writing of the previous ones
+    const size_t blockByteSizeLimit=(size_t(opts.saveQueueMemoryLimitMiB)<<20)/4;
+    const GLsizei layersPerBlock=std::clamp<size_t>(blockByteSizeLimit/layerByteSize, 1, depth);
+
+    for(GLsizei firstLayer=0; firstLayer<depth; firstLayer+=layersPerBlock)
+    {
+        const auto layerCount=std::min(layersPerBlock, depth-firstLayer);
+        queueReadback(path, firstLayer==0 ? header : std::vector<uint16_t>{}, elementType, firstLayer!=0, layerCount*layerByteSize,
+                      [=]{ readTextureLayers(texture, regionOffset+glm::ivec3(0,0,firstLayer), {width,height}, layerCount); });
+    }
+}
+
+void readTextureLayers(const GLuint texture, glm::ivec3 const& regionOffset, glm::ivec2 const& regionSize, const GLsizei layerCount)
+{
+    const size_t layerByteSize=size_t(regionSize.x)*regionSize.y*4*sizeof(GLfloat);
+    GLint origReadFBO=0;
+    gl.glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &origReadFBO);
+    gl.glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+    for(GLsizei i=0; i<layerCount; ++i)
+    {
+        gl.glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, regionOffset.z+i);
+        gl.glReadPixels(regionOffset.x,regionOffset.y,regionSize.x,regionSize.y,GL_RGBA,GL_FLOAT,
+                        reinterpret_cast<void*>(i*layerByteSize));
+    }
+    gl.glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+    gl.glBindFramebuffer(GL_READ_FRAMEBUFFER, origReadFBO);
+}
+
+void finishTextureSaves()
+{
+    if(jobs.empty()) return;
+    std::cerr << indentOutput() << "Waiting for " << jobs.size() << " texture" << (jobs.size()==1 ? "" : "s") << " to be written... ";
+    while(!jobs.empty())
+        retireOldestJob();
+    std::cerr << "done\n";
+}
+
+void reportHalfPrecisionErrors()
+{
+    const auto errors=takeHalfPrecisionErrors();
+    if(errors.empty()) return;
+
+    std::cerr << indentOutput() << "Relative errors of textures saved in half precision:\n";
+    OutputIndentIncrease incr;
+    for(const auto& [path, error] : errors)
+    {
+        std::cerr << indentOutput() << "\"" << path << "\": max " << error.maxRelError
+                  << ", RMS " << std::sqrt(error.sumSqRelError/std::max(error.normalCount, size_t(1)));
+        if(error.underflowCount)
+            std::cerr << "; " << error.underflowCount << " of " << error.count << " values are below the normal range";
+        if(error.overflowCount)
+            std::cerr << "; " << error.overflowCount << " of " << error.count << " values OVERFLOWED to infinity";
+        std::cerr << "\n";
+    }
+}
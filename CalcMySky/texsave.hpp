@@ -0,0 +1,47 @@
+#ifndef INCLUDE_ONCE_D2F46CB8_742E_4A84_B433_3E8D3AB1D3B1
+#define INCLUDE_ONCE_D2F46CB8_742E_4A84_B433_3E8D3AB1D3B1
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <QOpenGLFunctions_3_3_Core>
+#include "half-precision.hpp"
+#include "../common/texture-file.hpp"
+
+/* Textures are read back asynchronously into pixel buffer objects, and the mapped buffers are written to
+ * files by a background thread. The amount of memory held by the queued textures is limited by
+ * opts.saveQueueMemoryLimitMiB: when it would be exceeded, the oldest saves are waited for. 3D textures
+ * are read back and appended to the file in blocks of layers, so the memory needed to save them doesn't
+ * depend on their depth.
+ *
+ * An instance of AsyncTextureSaving must exist while textures are being saved. It must be destroyed
+ * before the GL context, since the writer thread reads from the buffers owned by the context.
+ */
+class AsyncTextureSaving
+{
+public:
+    AsyncTextureSaving();
+    ~AsyncTextureSaving();
+    AsyncTextureSaving(AsyncTextureSaving const&)=delete;
+    AsyncTextureSaving& operator=(AsyncTextureSaving const&)=delete;
+};
+
+/* The texture must be bound to target on the active texture unit. The sizes are written to the file header.
+ * Only the region of size regionSize at regionOffset is saved. For targets other than GL_TEXTURE_3D the
+ * region must be the whole texture. The texels are read back in single precision and, if elementType is
+ * Float16, converted by the writer thread.
+ */
+void queueTextureSave(GLenum target, GLuint texture, std::string const& path, std::vector<GLsizei> const& sizes,
+                      glm::ivec3 const& regionOffset, glm::ivec3 const& regionSize, TextureElementType elementType);
+// Waits until all the queued textures are written, quits on write errors
+void finishTextureSaves();
+/* Reads layerCount layers of a 3D texture, starting from regionOffset.z, into the buffer bound to
+ * GL_PIXEL_PACK_BUFFER, one after another from its start. Only the rectangle of regionSize at regionOffset
+ * of each layer is read. The caller must fence the readback before mapping the buffer.
+ */
+void readTextureLayers(GLuint texture, glm::ivec3 const& regionOffset, glm::ivec2 const& regionSize, GLsizei layerCount);
+
+// Prints the rounding errors of the files converted since the previous call, compared to single precision
+void reportHalfPrecisionErrors();
+
+#endif
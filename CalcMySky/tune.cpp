@@ -0,0 +1,338 @@
+#include "tune.hpp"
+
+#include <cmath>
+#include <cassert>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <QFile>
+
+#include "data.hpp"
+#include "util.hpp"
+#include "glinit.hpp"
+#include "shaders.hpp"
+#include "computation.hpp"
+#include "../common/EclipsedDoubleScatteringPrecomputer.hpp"
+
+namespace
+{
+
+// Results of different kernels are compared separately, since their magnitudes may differ a lot
+using TuningSample=std::vector<std::vector<glm::vec4>>;
+
+double maxRelativeDifference(TuningSample const& sample, TuningSample const& reference)
+{
+    assert(sample.size()==reference.size());
+    double maxDiff=0;
+    for(size_t i=0; i<sample.size(); ++i)
+        maxDiff=std::max(maxDiff, ::maxRelativeDifference(sample[i], reference[i]));
+    return maxDiff;
+}
+
+std::vector<glm::vec4> sampleEclipsedDoubleScatteringForTuning()
+{
+    // XXX: keep in sync with initTexturesAndFramebuffers()
+    setupTexture(TEX_ECLIPSED_DOUBLE_SCATTERING, atmo.eclipseAngularIntegrationPoints, atmo.radialIntegrationPoints);
+    const auto program=compileEclipsedDoubleScatteringComputationProgram();
+
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, fbos[FBO_ECLIPSED_DOUBLE_SCATTERING]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_ECLIPSED_DOUBLE_SCATTERING],0);
+    checkFramebufferStatus("framebuffer for eclipsed double scattering");
+    program->bind();
+    int unusedTextureUnitNum=0;
+    setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE,unusedTextureUnitNum++,"transmittanceTexture");
+
+    const auto& size=atmo.eclipsedDoubleScatteringTextureSize;
+    std::vector<glm::vec4> texels;
+    {
+        EclipsedDoubleScatteringPrecomputer precomputer(*program, gl,
+                                                        textures[TEX_ECLIPSED_DOUBLE_SCATTERING], unusedTextureUnitNum,
+                                                        atmo, size[0], size[1], size[2], size[3]);
+        gl.glBindVertexArray(vao);
+        for(int altIndex=0; altIndex<size[3]; ++altIndex)
+        {
+            const float cameraAltitude=unitRangeTexCoordToCameraAltitude(float(altIndex)/(size[3]-1));
+            for(int szaIndex=0; szaIndex<size[2]; ++szaIndex)
+            {
+                const double sunZenithAngle=std::acos(unitRangeTexCoordToCosSZA(float(szaIndex)/(size[2]-1)));
+                precomputer.compute(altIndex, szaIndex, cameraAltitude, sunZenithAngle, sunZenithAngle, 0);
+            }
+            const auto& slice=precomputer.altitudeSlice(altIndex);
+            texels.insert(texels.end(), slice.begin(), slice.end());
+        }
+        gl.glBindVertexArray(0);
+    }
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+    return texels;
+}
+
+struct TuningResult
+{
+    const char* key; // as in the atmosphere description
+    unsigned configured, tuned;
+    double difference; // of the result with the tuned count from the reference
+};
+
+/* Lowers the count, starting from a reference several times the configured one, until the result of evaluate()
+ * differs from the reference one by more than the tolerance. The configured count is restored afterwards.
+ */
+template<typename Count, typename Evaluate>
+TuningResult tuneCount(const char*const key, Count& count, const Count minCount, Evaluate evaluate)
+{
+    constexpr Count referenceFactor=4;
+    constexpr double stepFactor=0.8;
+
+    const auto configured=count;
+    std::cerr << indentOutput() << "Tuning " << key << ", reference count " << configured*referenceFactor << ":\n";
+    OutputIndentIncrease incr;
+
+    count=configured*referenceFactor;
+    const auto reference=evaluate();
+    TuningResult result{key, unsigned(configured), unsigned(count), 0};
+    for(auto candidate=Count(count*stepFactor); candidate>=minCount; candidate=std::min(Count(candidate*stepFactor), Count(candidate-1)))
+    {
+        count=candidate;
+        const auto difference=maxRelativeDifference(evaluate(), reference);
+        std::cerr << indentOutput() << candidate << " points: max relative difference " << difference << "\n";
+        if(difference>opts.tuningTolerance) break;
+        result.tuned=candidate;
+        result.difference=difference;
+    }
+    count=configured;
+    return result;
+}
+
+/* For each radial quadrature rule, finds the smallest count at which the result is at least as close to the reference
+ * as that of the configured rule with the configured count. The reference is the configured rule with several times
+ * the configured count, as in tuneCount(). The error is assumed to decrease with the count.
+ */
+template<typename Evaluate>
+void compareRadialQuadratures(const char*const key, GLint& count, Evaluate evaluate)
+{
+    constexpr GLint referenceFactor=4;
+    const auto configured=count;
+    const auto configuredRule=atmo.radialQuadrature;
+
+    count=configured*referenceFactor;
+    const auto reference=evaluate();
+    count=configured;
+    const auto configuredDifference=maxRelativeDifference(evaluate(), reference);
+    std::cerr << indentOutput() << "Comparing radial integration rules for " << key << ", configured: " << toString(configuredRule)
+              << " with " << configured << " points, max relative difference " << configuredDifference << "\n";
+    OutputIndentIncrease incr;
+
+    for(const auto rule : {RadialQuadrature::Trapezoid, RadialQuadrature::GaussLegendre, RadialQuadrature::Exponential})
+    {
+        atmo.radialQuadrature=rule;
+        const auto accurateEnough=[&](const GLint candidate)
+        {
+            count=candidate;
+            const auto difference=maxRelativeDifference(evaluate(), reference);
+            std::cerr << indentOutput() << toString(rule) << ", " << candidate << " points: max relative difference " << difference << "\n";
+            return difference<=configuredDifference;
+        };
+        GLint low=2, high=configured*referenceFactor;
+        if(!accurateEnough(high))
+        {
+            std::cout << key << " for " << toString(rule) << " rule: more than " << high << "\n";
+            continue;
+        }
+        while(low<high)
+        {
+            const auto middle=(low+high)/2;
+            if(accurateEnough(middle))
+                high=middle;
+            else
+                low=middle+1;
+        }
+        std::cout << key << " for " << toString(rule) << " rule: " << high << "  # as accurate as "
+                  << configured << " points of the configured " << toString(configuredRule) << " rule\n";
+    }
+    atmo.radialQuadrature=configuredRule;
+    count=configured;
+}
+
+TuningSample forEachWavelengthSetForTuning(std::function<TuningSample(unsigned texIndex)> const& render)
+{
+    // The transmittance integration point count may have changed since the column densities were computed
+    columnDensitiesComputed=false;
+    // The same goes for the rows of the Gauss-Legendre nodes
+    if(atmo.radialQuadrature==RadialQuadrature::GaussLegendre)
+        initGaussLegendreTexture();
+    TuningSample sample;
+    for(unsigned texIndex=opts.firstWavelengthSet; texIndex<=opts.lastWavelengthSet; ++texIndex)
+    {
+        // The integration point counts are in the constants header, so it's regenerated for each count
+        setupWavelengthSetSources(texIndex);
+        const auto setSample=render(texIndex);
+        sample.resize(setSample.size());
+        for(size_t i=0; i<setSample.size(); ++i)
+            sample[i].insert(sample[i].end(), setSample[i].begin(), setSample[i].end());
+    }
+    return sample;
+}
+
+void writeTunedDescription(std::vector<TuningResult> const& results)
+{
+    auto lines=atmo.descriptionFileText.split('\n');
+    for(const auto& result : results)
+    {
+        bool found=false;
+        for(auto& line : lines)
+        {
+            const auto commentPos=line.indexOf('#');
+            const auto code = commentPos<0 ? line : line.left(commentPos);
+            const auto colonPos=code.indexOf(':');
+            if(colonPos<0 || code.left(colonPos).simplified().toLower()!=result.key)
+                continue;
+            line = code.left(colonPos+1)+" "+QString::number(result.tuned) + (commentPos<0 ? "" : " "+line.mid(commentPos));
+            found=true;
+        }
+        if(!found)
+        {
+            const auto pos = !lines.isEmpty() && lines.back().isEmpty() ? lines.size()-1 : lines.size();
+            lines.insert(pos, QString("%1: %2").arg(result.key).arg(result.tuned));
+        }
+    }
+
+    const auto path=opts.tunedDescriptionPath;
+    std::cerr << "Writing tuned atmosphere description to \"" << path << "\"...";
+    QFile file(path);
+    if(!file.open(QFile::WriteOnly))
+    {
+        std::cerr << " FAILED to open: " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    file.write(lines.join('\n').toUtf8());
+    file.close();
+    if(file.error())
+    {
+        std::cerr << " FAILED to write: " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    std::cerr << " done\n";
+}
+
+}
+
+void reduceTextureSizes()
+{
+    constexpr int factor=4;
+    const auto reduced=[](const int size, const int minSize) { return std::max(minSize, size/factor); };
+    atmo.transmittanceTexW=reduced(atmo.transmittanceTexW, 8);
+    atmo.transmittanceTexH=reduced(atmo.transmittanceTexH, 8);
+    atmo.irradianceTexW=reduced(atmo.irradianceTexW, 8);
+    atmo.irradianceTexH=reduced(atmo.irradianceTexH, 8);
+    auto& scatSize=atmo.scatteringTextureSize;
+    scatSize[0]=2*reduced(scatSize[0]/2, 2); // must be even
+    for(int i=1; i<4; ++i)
+        scatSize[i]=reduced(scatSize[i], 4);
+    // Each SZA and altitude sample of eclipsed double scattering is costly, so only a few are taken
+    auto& edsSize=atmo.eclipsedDoubleScatteringTextureSize;
+    edsSize[0]=reduced(edsSize[0], 4);
+    edsSize[1]=reduced(edsSize[1], 4);
+    edsSize[2]=4;
+    edsSize[3]=4;
+}
+
+// Each count is tuned separately, with the others at their configured values
+void tuneIntegrationPoints()
+{
+    // The programs compiled for each count aren't going to be reused
+    opts.noProgramBinaryCache=true;
+    reduceTextureSizes();
+    init();
+
+    std::cerr << "Tuning integration point counts to the relative tolerance of " << opts.tuningTolerance << "\n";
+    const auto scatteringTexelCount=size_t(atmo.scatTexWidth())*atmo.scatTexHeight()*atmo.scatTexDepth();
+    const auto irradianceTexelCount=size_t(atmo.irradianceTexW)*atmo.irradianceTexH;
+
+    const auto evaluateTransmittance=[]
+    {
+        return forEachWavelengthSetForTuning([](unsigned) -> TuningSample
+        {
+            renderTransmittance();
+            return {readTexture(GL_TEXTURE_2D, textures[TEX_TRANSMITTANCE], size_t(atmo.transmittanceTexW)*atmo.transmittanceTexH)};
+        });
+    };
+    const auto renderSingleScatteringForTuning=[scatteringTexelCount](const unsigned texIndex)
+    {
+        std::vector<glm::vec4> texels;
+        for(const auto& scatterer : atmo.scatterers)
+        {
+            setupSingleScatteringSources(texIndex, scatterer);
+            renderSingleScattering(texIndex, scatterer);
+            const auto scattererTexels=readTexture(GL_TEXTURE_3D, textures[TEX_DELTA_SCATTERING], scatteringTexelCount);
+            texels.insert(texels.end(), scattererTexels.begin(), scattererTexels.end());
+        }
+        return texels;
+    };
+    /* Besides single scattering, the radial integration point count is used by the multiple scattering kernel, which
+     * is represented by double scattering, and by eclipsed double scattering, whose intermediate texture has this many
+     * samples along each ray.
+     */
+    const auto evaluateRadialIntegration=[=]
+    {
+        return forEachWavelengthSetForTuning([=](const unsigned texIndex)
+        {
+            renderTransmittance();
+            TuningSample sample{renderSingleScatteringForTuning(texIndex)};
+            computeDirectGroundIrradiance(texIndex);
+            computeScatteringDensityOrder2(texIndex, false);
+            computeMultipleScatteringFromDensity(2, texIndex);
+            sample.push_back(readTexture(GL_TEXTURE_3D, textures[TEX_DELTA_SCATTERING], scatteringTexelCount));
+            if(!opts.dbgNoEDSTextures)
+            {
+                setupSourcesAsAfterScatteringOrder2(texIndex);
+                sample.push_back(sampleEclipsedDoubleScatteringForTuning());
+            }
+            return sample;
+        });
+    };
+    std::vector<TuningResult> results;
+    results.push_back(tuneCount("transmittance integration points", atmo.numTransmittanceIntegrationPoints, 2, evaluateTransmittance));
+    results.push_back(tuneCount("radial integration points", atmo.radialIntegrationPoints, 2, evaluateRadialIntegration));
+    // Both the scattering density and the indirect irradiance integrate over the sphere of directions
+    results.push_back(tuneCount("angular integration points", atmo.angularIntegrationPoints, 2, [=]
+    {
+        initIncidentRayTable();
+        return forEachWavelengthSetForTuning([=](const unsigned texIndex) -> TuningSample
+        {
+            renderTransmittance();
+            computeDirectGroundIrradiance(texIndex);
+            computeScatteringDensityOrder2(texIndex, false);
+            return {readTexture(GL_TEXTURE_3D, textures[TEX_DELTA_SCATTERING_DENSITY], scatteringTexelCount),
+                    readTexture(GL_TEXTURE_2D, textures[TEX_DELTA_IRRADIANCE], irradianceTexelCount)};
+        });
+    }));
+    if(!opts.dbgNoEDSTextures)
+    {
+        const auto evaluateEDS=[]
+        {
+            return forEachWavelengthSetForTuning([](const unsigned texIndex) -> TuningSample
+            {
+                renderTransmittance();
+                setupSourcesAsAfterScatteringOrder2(texIndex);
+                return {sampleEclipsedDoubleScatteringForTuning()};
+            });
+        };
+        results.push_back(tuneCount("angular integration points for eclipse", atmo.eclipseAngularIntegrationPoints, 2, evaluateEDS));
+        results.push_back(tuneCount("eclipsed double scattering number of azimuth pairs to sample",
+                                    atmo.eclipsedDoubleScatteringNumberOfAzimuthPairsToSample, 1u, evaluateEDS));
+        results.push_back(tuneCount("eclipsed double scattering number of elevation pairs to sample",
+                                    atmo.eclipsedDoubleScatteringNumberOfElevationPairsToSample, 1u, evaluateEDS));
+    }
+
+    for(const auto& result : results)
+    {
+        std::cout << result.key << ": " << result.tuned << "  # configured: " << result.configured
+                  << ", max relative difference from the reference: " << result.difference << "\n";
+    }
+
+    // The cumulative table doesn't use the radial quadrature rule
+    if(!opts.cumulativeTransmittance)
+        compareRadialQuadratures("transmittance integration points", atmo.numTransmittanceIntegrationPoints, evaluateTransmittance);
+    compareRadialQuadratures("radial integration points", atmo.radialIntegrationPoints, evaluateRadialIntegration);
+    if(!opts.tunedDescriptionPath.isEmpty())
+        writeTunedDescription(results);
+}
@@ -0,0 +1,12 @@
+#ifndef INCLUDE_ONCE_7412BE61_488D_4195_9028_E24AF8EC4442
+#define INCLUDE_ONCE_7412BE61_488D_4195_9028_E24AF8EC4442
+
+// Shrinks the textures, so that each tuning step or full computation for comparison with the preview takes
+// a small fraction of the time of the real computation
+void reduceTextureSizes();
+/* Finds the cheapest integration point counts that keep the results within the tolerance of the results with
+ * much larger counts, see --tune-integration. Initializes GL itself, on the reduced textures.
+ */
+void tuneIntegrationPoints();
+
+#endif
@@ -1,12 +1,18 @@
 #include "util.hpp"
 
+#include <cmath>
 #include <memory>
+#include <limits>
+#include <cassert>
 #include <cstring>
+#include <algorithm>
 #include <iostream>
 #include <filesystem>
 #include <QFile>
 
 #include "data.hpp"
+#include "texsave.hpp"
+#include "report.hpp"
 
 void createDirs(std::string const& path)
 {
@@ -26,6 +32,13 @@ void renderQuad()
 	gl.glBindVertexArray(0);
 }
 
+void renderQuad(const GLsizei instanceCount)
+{
+	gl.glBindVertexArray(vao);
+	gl.glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceCount);
+	gl.glBindVertexArray(0);
+}
+
 void qtMessageHandler(const QtMsgType type, QMessageLogContext const&, QString const& message)
 {
     switch(type)
@@ -52,8 +65,10 @@ void qtMessageHandler(const QtMsgType type, QMessageLogContext const&, QString c
     }
 }
 
-void saveTexture(const GLenum target, const GLuint texture, const std::string_view name,
-                 const std::string_view path, std::vector<GLsizei> const& sizes)
+// Empty regionSize means the whole texture
+static void saveTextureRegion(const GLenum target, const GLuint texture, const std::string_view name,
+                              const std::string_view path, std::vector<GLsizei> const& sizes,
+                              const glm::ivec3 regionOffset, glm::ivec3 regionSize, const TextureElementType elementType)
 {
     if(opts.dbgNoSaveTextures)
     {
@@ -61,6 +76,7 @@ void saveTexture(const GLenum target, const GLuint texture, const std::string_vi
         return;
     }
 
+    StageTimer timer("save texture");
     std::cerr << indentOutput() << "Saving " << name << " to \"" << path << "\"... ";
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
@@ -83,6 +99,14 @@ void saveTexture(const GLenum target, const GLuint texture, const std::string_vi
         throw MustQuit{};
     }
 
+    if(regionSize==glm::ivec3(0))
+        regionSize=glm::ivec3(w,h,d);
+    if(glm::any(glm::greaterThan(regionOffset+regionSize, glm::ivec3(w,h,d))))
+    {
+        std::cerr << "internal inconsistency detected: region to save doesn't fit in the texture\n";
+        throw MustQuit{};
+    }
+
     size_t pixelCount=1;
     for(const size_t s : sizes)
         pixelCount *= s;
@@ -90,7 +114,7 @@ void saveTexture(const GLenum target, const GLuint texture, const std::string_vi
     // Sanity check
     if(!sizes.empty())
     {
-        const auto physicalSize = size_t(w)*h*d;
+        const auto physicalSize = size_t(regionSize.x)*regionSize.y*regionSize.z;
         if(physicalSize!=pixelCount)
         {
             std::cerr << "internal inconsistency detected: texture logical size " << pixelCount << " doesn't match physical size " << physicalSize << "\n";
@@ -98,28 +122,102 @@ void saveTexture(const GLenum target, const GLuint texture, const std::string_vi
         }
     }
 
-    const auto subpixelCount = 4*pixelCount;
-    const std::unique_ptr<GLfloat[]> subpixels(new GLfloat[subpixelCount]);
-    gl.glGetTexImage(target, 0, GL_RGBA, GL_FLOAT, subpixels.get());
+    queueTextureSave(target, texture, std::string(path), sizes, regionOffset, regionSize, elementType);
+    reportBytesReadBack(4*pixelCount*sizeof(GLfloat));
+    reportBytesWritten(textureFileHeader(std::vector<uint16_t>(sizes.begin(), sizes.end()), elementType).size()*sizeof(uint16_t)
+                       + 4*pixelCount*textureElementSize(elementType));
+    std::cerr << "queued\n";
+}
+
+void saveTexture(const GLenum target, const GLuint texture, const std::string_view name,
+                 const std::string_view path, std::vector<GLsizei> const& sizes, const TextureElementType elementType)
+{
+    saveTextureRegion(target, texture, name, path, sizes, glm::ivec3(0), glm::ivec3(0), elementType);
+}
+
+ScatteringTextureRegion precomputedScatteringTextureRegion()
+{
+    const auto altRange=atmo.precomputedAltitudeIndexRange();
+    const auto szaRange=atmo.precomputedSZAIndexRange(atmo.scatteringTextureSize[2]);
+    const auto sizes=atmo.precomputedScatteringTextureSize();
+    // SZA and dot(view,sun) are combined into the second coordinate of the 3D texture, with dot(view,sun) varying faster
+    const auto rowsPerSZA=atmo.scatteringTextureSize[1];
+    return {{sizes[0], sizes[1], sizes[2], sizes[3]},
+            glm::ivec3(0, szaRange[0]*rowsPerSZA, altRange[0]),
+            glm::ivec3(atmo.scatTexWidth(), sizes[2]*rowsPerSZA, sizes[3])};
+}
+
+void saveScatteringTexture(const GLuint texture, const std::string_view name, const std::string_view path,
+                           const TextureElementType elementType)
+{
+    const auto region=precomputedScatteringTextureRegion();
+    saveTextureRegion(GL_TEXTURE_3D, texture, name, path, region.sizes, region.offset, region.size, elementType);
+}
+
+void loadTexture(const GLenum target, const GLuint texture, const std::string_view name,
+                 const std::string_view path, std::vector<GLsizei> const& sizes)
+{
+    std::cerr << indentOutput() << "Loading " << name << " from \"" << path << "\"... ";
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
-        std::cerr << "GL error in saveTexture() after glGetTexImage() call: " << openglErrorString(err) << "\n";
+        std::cerr << "GL error on entry to loadTexture(): " << openglErrorString(err) << "\n";
         throw MustQuit{};
     }
 
-    QFile out(QByteArray::fromRawData(path.data(), path.size()));
-    if(!out.open(QFile::WriteOnly))
+    gl.glActiveTexture(GL_TEXTURE0);
+    gl.glBindTexture(target,texture);
+    int w=1,h=1,d=1;
+    gl.glGetTexLevelParameteriv(target,0,GL_TEXTURE_WIDTH,&w);
+    if(target==GL_TEXTURE_2D || target==GL_TEXTURE_3D)
+        gl.glGetTexLevelParameteriv(target,0,GL_TEXTURE_HEIGHT,&h);
+    if(target==GL_TEXTURE_3D)
+        gl.glGetTexLevelParameteriv(target,0,GL_TEXTURE_DEPTH,&d);
+
+    size_t pixelCount=1;
+    for(const size_t s : sizes)
+        pixelCount *= s;
+    if(const auto physicalSize = size_t(w)*h*d; physicalSize!=pixelCount)
     {
-        std::cerr << "failed to open file: " << out.errorString().toStdString() << "\n";
+        std::cerr << "internal inconsistency detected: texture logical size " << pixelCount << " doesn't match physical size " << physicalSize << "\n";
         throw MustQuit{};
     }
-    for(const uint16_t s : sizes)
-        out.write(reinterpret_cast<const char*>(&s), sizeof s);
-    out.write(reinterpret_cast<const char*>(subpixels.get()), subpixelCount*sizeof subpixels[0]);
-    out.close();
-    if(out.error())
+
+    QFile in(QByteArray::fromRawData(path.data(), path.size()));
+    if(!in.open(QFile::ReadOnly))
     {
-        std::cerr << "failed to write file: " << out.errorString().toStdString() << "\n";
+        std::cerr << "failed to open file: " << in.errorString().toStdString() << "\n";
+        throw MustQuit{};
+    }
+    for(const uint16_t expectedSize : sizes)
+    {
+        uint16_t s;
+        if(in.read(reinterpret_cast<char*>(&s), sizeof s) != sizeof s)
+        {
+            std::cerr << "failed to read header: " << in.errorString().toStdString() << "\n";
+            throw MustQuit{};
+        }
+        if(s!=expectedSize)
+        {
+            std::cerr << "unexpected texture size in the header: " << s << " instead of " << expectedSize << "\n";
+            throw MustQuit{};
+        }
+    }
+    const auto subpixelCount = 4*pixelCount;
+    const std::unique_ptr<GLfloat[]> subpixels(new GLfloat[subpixelCount]);
+    const qint64 sizeToRead=subpixelCount*sizeof subpixels[0];
+    if(in.read(reinterpret_cast<char*>(subpixels.get()), sizeToRead) != sizeToRead)
+    {
+        std::cerr << "failed to read texture data: " << (in.error() ? in.errorString().toStdString() : "file is too short") << "\n";
+        throw MustQuit{};
+    }
+
+    if(target==GL_TEXTURE_3D)
+        gl.glTexSubImage3D(target,0,0,0,0,w,h,d,GL_RGBA,GL_FLOAT,subpixels.get());
+    else
+        gl.glTexSubImage2D(target,0,0,0,w,h,GL_RGBA,GL_FLOAT,subpixels.get());
+    if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
+    {
+        std::cerr << "GL error in loadTexture() after uploading texture data: " << openglErrorString(err) << "\n";
         throw MustQuit{};
     }
     std::cerr << "done\n";
@@ -141,7 +239,7 @@ void setupTexture(TextureId id, const GLsizei width, const GLsizei height)
         throw MustQuit{};
     }
 }
-void setupTexture(const GLuint texture, const GLsizei width, const GLsizei height, const GLsizei depth)
+void setupTexture(const GLuint texture, const GLsizei width, const GLsizei height, const GLsizei depth, const GLenum internalFormat)
 {
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
@@ -149,7 +247,7 @@ void setupTexture(const GLuint texture, const GLsizei width, const GLsizei heigh
         throw MustQuit{};
     }
     gl.glBindTexture(GL_TEXTURE_3D,texture);
-    gl.glTexImage3D(GL_TEXTURE_3D,0,GL_RGBA32F,width,height,depth,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+    gl.glTexImage3D(GL_TEXTURE_3D,0,internalFormat,width,height,depth,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
     gl.glBindTexture(GL_TEXTURE_3D,0);
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
@@ -157,8 +255,8 @@ void setupTexture(const GLuint texture, const GLsizei width, const GLsizei heigh
         throw MustQuit{};
     }
 }
-void setupTexture(TextureId id, const GLsizei width, const GLsizei height, const GLsizei depth)
-{ setupTexture(textures[id],width,height,depth); }
+void setupTexture(TextureId id, const GLsizei width, const GLsizei height, const GLsizei depth, const GLenum internalFormat)
+{ setupTexture(textures[id],width,height,depth,internalFormat); }
 
 // ------------------------------------ KHR_debug support ----------------------------------------
 std::string sourceToString(const GLenum source)
@@ -240,3 +338,41 @@ void setupDebugPrintCallback(QOpenGLContext& context)
     glDebugMessageControl(GL_DONT_CARE,GL_DONT_CARE,GL_DONT_CARE,0,NULL,GL_TRUE);
     gl.glEnable(GL_DEBUG_OUTPUT);
 }
+
+std::vector<glm::vec4> readTexture(const GLenum target, const GLuint texture, const size_t texelCount)
+{
+    std::vector<glm::vec4> texels(texelCount);
+    gl.glBindTexture(target,texture);
+    gl.glGetTexImage(target, 0, GL_RGBA, GL_FLOAT, texels.data());
+    gl.glBindTexture(target,0);
+    if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
+    {
+        std::cerr << "GL error while reading back texture: " << openglErrorString(err) << "\n";
+        throw MustQuit{};
+    }
+    return texels;
+}
+
+double maxRelativeDifference(std::vector<glm::vec4> const& texels, std::vector<glm::vec4> const& reference)
+{
+    assert(texels.size()==reference.size());
+    constexpr double dimFraction=1e-4;
+    float maxReference=0;
+    for(const auto& texel : reference)
+        for(int i=0; i<4; ++i)
+            maxReference=std::max(maxReference, std::abs(texel[i]));
+    const double floor=std::max(dimFraction*maxReference, double(std::numeric_limits<float>::min()));
+
+    double maxDiff=0;
+    for(size_t n=0; n<texels.size(); ++n)
+    {
+        for(int i=0; i<4; ++i)
+        {
+            const double diff=std::abs(double(texels[n][i])-reference[n][i]) / std::max(double(std::abs(reference[n][i])), floor);
+            if(std::isnan(diff))
+                return std::numeric_limits<double>::infinity();
+            maxDiff=std::max(maxDiff, diff);
+        }
+    }
+    return maxDiff;
+}
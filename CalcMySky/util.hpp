@@ -33,8 +33,8 @@ inline QString toString(glm::mat4 const& m) { return QString("mat4(%1,%2,%3,%4,
 inline QMatrix4x4 toQMatrix(glm::mat4 const& m) { return QMatrix4x4(&m[0][0]).transposed(); }
 void setupDebugPrintCallback(QOpenGLContext& context);
 void setupTexture(TextureId id, GLsizei width, GLsizei height);
-void setupTexture(TextureId id, GLsizei width, GLsizei height, GLsizei depth);
-void setupTexture(GLuint tex, GLsizei width, GLsizei height, GLsizei depth);
+void setupTexture(TextureId id, GLsizei width, GLsizei height, GLsizei depth, GLenum internalFormat=GL_RGBA32F);
+void setupTexture(GLuint tex, GLsizei width, GLsizei height, GLsizei depth, GLenum internalFormat=GL_RGBA32F);
 inline void setUniformTexture(QOpenGLShaderProgram& program, GLenum target, GLuint texture, GLint sampler, const char* uniformName)
 {
     gl.glActiveTexture(GL_TEXTURE0+sampler);
@@ -50,11 +50,28 @@ inline void setDrawBuffers(std::vector<GLenum> const& bufs)
 }
 
 void renderQuad();
+void renderQuad(GLsizei instanceCount);
 inline void checkFramebufferStatus(const char*const fboDescription) { return checkFramebufferStatus(gl, fboDescription); }
 void qtMessageHandler(const QtMsgType type, QMessageLogContext const&, QString const& message);
 void saveTexture(GLenum target, GLuint texture, std::string_view name, std::string_view path,
+                 std::vector<GLsizei> const& sizes, TextureElementType elementType=TextureElementType::Float32);
+// The part of a 4D scattering texture that covers the precomputed domain of altitudes and Sun zenith angles
+struct ScatteringTextureRegion
+{
+    std::vector<GLsizei> sizes; // 4D sizes for the file header
+    glm::ivec3 offset, size;    // the region of the 3D texture
+};
+ScatteringTextureRegion precomputedScatteringTextureRegion();
+// Saves only the precomputed region of a 4D scattering texture
+void saveScatteringTexture(GLuint texture, std::string_view name, std::string_view path, TextureElementType elementType);
+void loadTexture(GLenum target, GLuint texture, std::string_view name, std::string_view path,
                  std::vector<GLsizei> const& sizes);
 void createDirs(std::string const& path);
+std::vector<glm::vec4> readTexture(GLenum target, GLuint texture, size_t texelCount);
+// Maximum difference of texel components from the reference, relative to the reference value. Components much
+// dimmer than the brightest one are compared relative to a fraction of it instead, so that e.g. the deep shadow
+// of the Earth doesn't dominate the error.
+double maxRelativeDifference(std::vector<glm::vec4> const& texels, std::vector<glm::vec4> const& reference);
 
 class OutputIndentIncrease
 {
@@ -7,6 +7,7 @@
 #include <cstring>
 #include <cassert>
 #include <iterator>
+#include <algorithm>
 #include <iostream>
 #include <filesystem>
 #include <QFile>
@@ -16,6 +17,7 @@
 #include "util.hpp"
 #include "../common/const.hpp"
 #include "../common/util.hpp"
+#include "../common/texture-file.hpp"
 #include "../common/EclipsedDoubleScatteringPrecomputer.hpp"
 #include "api/Settings.hpp"
 
@@ -29,6 +31,33 @@ GLsizei scatTexWidth(glm::ivec4 sizes) { return sizes[0]; }
 GLsizei scatTexHeight(glm::ivec4 sizes) { return sizes[1]*sizes[2]; }
 GLsizei scatTexDepth(glm::ivec4 sizes) { return sizes[3]; }
 
+// Returns the type of texel components, see common/texture-file.hpp for the format
+TextureElementType readTextureFileHeader(QFile& file, QString const& path, uint16_t*const sizes, const int dimensionCount)
+{
+    const auto readValue=[&file,&path](uint16_t& value)
+    {
+        if(file.read(reinterpret_cast<char*>(&value), sizeof value) != sizeof value)
+        {
+            throw DataLoadError{QObject::tr("Failed to read header from file \"%1\": %2")
+                                .arg(path).arg(file.errorString())};
+        }
+    };
+    const auto type=parseTextureFileHeader(readValue, sizes, dimensionCount);
+    if(!isSupportedTextureElementType(type))
+        throw DataLoadError{QObject::tr("Unsupported type of texel components in file \"%1\": %2").arg(path).arg(type)};
+    return TextureElementType(type);
+}
+
+GLenum textureInternalFormat(const TextureElementType type)
+{
+    return type==TextureElementType::Float16 ? GL_RGBA16F : GL_RGBA32F;
+}
+
+GLenum texturePixelType(const TextureElementType type)
+{
+    return type==TextureElementType::Float16 ? GL_HALF_FLOAT : GL_FLOAT;
+}
+
 auto newTex(QOpenGLTexture::Target target)
 {
     return std::make_unique<QOpenGLTexture>(target);
@@ -72,10 +101,22 @@ public:
 
 }
 
+// Fractional index of the altitude layer in the 4D textures, which may contain only the precomputed range of altitudes
+double AtmosphereRenderer::altitudeLayerIndex(const float altitudeCoord) const
+{
+    return altitudeCoord*(params_.scatteringTextureSize[3]-1) - params_.precomputedAltitudeIndexRange()[0];
+}
+
+QVector2D AtmosphereRenderer::scatteringTextureSZAIndexRange() const
+{
+    const auto range=params_.precomputedSZAIndexRange(params_.scatteringTextureSize[2]);
+    return QVector2D(range[0], range[1]);
+}
+
 void AtmosphereRenderer::updateAltitudeTexCoords(const float altitudeCoord, double* floorAltIndexOut)
 {
-    const auto altTexIndex = altitudeCoord==1 ? numAltIntervalsIn4DTexture_-1 : altitudeCoord*numAltIntervalsIn4DTexture_;
-    const auto floorAltIndex = std::floor(altTexIndex);
+    const auto altTexIndex = altitudeLayerIndex(altitudeCoord);
+    const auto floorAltIndex = std::clamp(std::floor(altTexIndex), 0., numAltIntervalsIn4DTexture_-1.);
     const auto fractAltIndex = altTexIndex-floorAltIndex;
 
     staticAltitudeTexCoord_ = unitRangeToTexCoord(fractAltIndex, 2);
@@ -85,8 +126,8 @@ void AtmosphereRenderer::updateAltitudeTexCoords(const float altitudeCoord, doub
 
 void AtmosphereRenderer::updateEclipsedAltitudeTexCoords(const float altitudeCoord, double* floorAltIndexOut)
 {
-    const auto altTexIndex = altitudeCoord==1 ? numAltIntervalsInEclipsed4DTexture_-1 : altitudeCoord*numAltIntervalsInEclipsed4DTexture_;
-    const auto floorAltIndex = std::floor(altTexIndex);
+    const auto altTexIndex = altitudeLayerIndex(altitudeCoord);
+    const auto floorAltIndex = std::clamp(std::floor(altTexIndex), 0., numAltIntervalsInEclipsed4DTexture_-1.);
     const auto fractAltIndex = altTexIndex-floorAltIndex;
 
     eclipsedDoubleScatteringAltitudeAlphaUpper_ = fractAltIndex;
@@ -94,6 +135,19 @@ void AtmosphereRenderer::updateEclipsedAltitudeTexCoords(const float altitudeCoo
     if(floorAltIndexOut) *floorAltIndexOut=floorAltIndex;
 }
 
+void AtmosphereRenderer::checkPrecomputedDomain(QString const& path, const unsigned sizeBySZA, const unsigned sizeByAltitude,
+                                                const unsigned fullSizeBySZA) const
+{
+    const auto szaRange=params_.precomputedSZAIndexRange(fullSizeBySZA);
+    const auto altRange=params_.precomputedAltitudeIndexRange();
+    if(sizeBySZA!=unsigned(szaRange[1]-szaRange[0]+1) || sizeByAltitude!=unsigned(altRange[1]-altRange[0]+1))
+    {
+        throw DataLoadError{tr("Dimensions of texture \"%1\" don't match the precomputed domain of altitudes and sun zenith angles "
+                               "in atmosphere description: expected %2 SZA points and %3 altitude points, got %4 and %5")
+                            .arg(path).arg(szaRange[1]-szaRange[0]+1).arg(altRange[1]-altRange[0]+1).arg(sizeBySZA).arg(sizeByAltitude)};
+    }
+}
+
 void AtmosphereRenderer::loadTexture4D(QString const& path, const float altitudeCoord)
 {
     auto log=qDebug().nospace();
@@ -109,44 +163,40 @@ void AtmosphereRenderer::loadTexture4D(QString const& path, const float altitude
         throw DataLoadError{tr("Failed to open file \"%1\": %2").arg(path).arg(file.errorString())};
 
     uint16_t sizes[4];
-    {
-        const qint64 sizeToRead=sizeof sizes;
-        if(file.read(reinterpret_cast<char*>(sizes), sizeToRead) != sizeToRead)
-        {
-            throw DataLoadError{tr("Failed to read header from file \"%1\": %2")
-                                .arg(path).arg(file.errorString())};
-        }
-    }
+    const auto elementType=readTextureFileHeader(file, path, sizes, 4);
+    const auto elementSize=textureElementSize(elementType);
     log << "dimensions from header: " << sizes[0] << "×" << sizes[1] << "×" << sizes[2] << "×" << sizes[3] << "... ";
 
-    if(const qint64 expectedFileSize = sizeof(GLfloat)*4*uint64_t(sizes[0])*sizes[1]*sizes[2]*sizes[3] + file.pos();
+    if(const qint64 expectedFileSize = elementSize*4*uint64_t(sizes[0])*sizes[1]*sizes[2]*sizes[3] + file.pos();
        expectedFileSize != file.size())
     {
         throw DataLoadError{tr("Size of file \"%1\" (%2 bytes) doesn't match image dimensions %3×%4×%5×%6 from file header.\nThe expected size is %7 bytes.")
                             .arg(path).arg(file.size()).arg(sizes[0]).arg(sizes[1]).arg(sizes[2]).arg(sizes[3]).arg(expectedFileSize)};
     }
 
+    checkPrecomputedDomain(path, sizes[2], sizes[3], params_.scatteringTextureSize[2]);
     numAltIntervalsIn4DTexture_ = sizes[3]-1;
     double floorAltIndex;
     updateAltitudeTexCoords(altitudeCoord, &floorAltIndex);
 
-    loadedAltitudeURTexCoordRange_[0] = floorAltIndex/numAltIntervalsIn4DTexture_;
-    loadedAltitudeURTexCoordRange_[1] = (floorAltIndex+1)/numAltIntervalsIn4DTexture_;
+    const auto firstAltIndex = params_.precomputedAltitudeIndexRange()[0];
+    loadedAltitudeURTexCoordRange_[0] = (firstAltIndex+floorAltIndex)/(params_.scatteringTextureSize[3]-1);
+    loadedAltitudeURTexCoordRange_[1] = (firstAltIndex+floorAltIndex+1)/(params_.scatteringTextureSize[3]-1);
 
     const auto subpixelReadOffset = 4*uint64_t(sizes[0])*sizes[1]*sizes[2]*uint64_t(floorAltIndex);
     sizes[3]=2;
     const auto subpixelCountToRead = 4*uint64_t(sizes[0])*sizes[1]*sizes[2]*sizes[3];
 
-    const std::unique_ptr<GLfloat[]> subpixels(new GLfloat[subpixelCountToRead]);
+    const std::unique_ptr<char[]> subpixels(new char[subpixelCountToRead*elementSize]);
     {
-        const qint64 offset=file.pos()+subpixelReadOffset*sizeof subpixels[0];
+        const qint64 offset=file.pos()+subpixelReadOffset*elementSize;
         log << "skipping to offset " << offset << "... ";
         if(!file.seek(offset))
         {
             throw DataLoadError{tr("Failed to seek to offset %1 in file \"%2\": %3")
                                 .arg(offset).arg(path).arg(file.errorString())};
         }
-        const qint64 sizeToRead=subpixelCountToRead*sizeof subpixels[0];
+        const qint64 sizeToRead=subpixelCountToRead*elementSize;
         const auto actuallyRead=file.read(reinterpret_cast<char*>(subpixels.get()), sizeToRead);
         if(actuallyRead != sizeToRead)
         {
@@ -156,8 +206,8 @@ void AtmosphereRenderer::loadTexture4D(QString const& path, const float altitude
         }
     }
     const glm::ivec4 size(sizes[0],sizes[1],sizes[2],sizes[3]);
-    gl.glTexImage3D(GL_TEXTURE_3D,0,GL_RGBA32F,scatTexWidth(size),scatTexHeight(size),scatTexDepth(size),
-                    0,GL_RGBA,GL_FLOAT,subpixels.get());
+    gl.glTexImage3D(GL_TEXTURE_3D,0,textureInternalFormat(elementType),scatTexWidth(size),scatTexHeight(size),scatTexDepth(size),
+                    0,GL_RGBA,texturePixelType(elementType),subpixels.get());
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
         throw DataLoadError{tr("GL error in loadTexture4D(\"%1\") after glTexImage3D() call: %2")
@@ -183,17 +233,11 @@ void AtmosphereRenderer::load4DTexAltitudeSlicePair(QString const& path, QOpenGL
         throw DataLoadError{tr("Failed to open file \"%1\": %2").arg(path).arg(file.errorString())};
 
     uint16_t sizes[4];
-    {
-        const qint64 sizeToRead=sizeof sizes;
-        if(file.read(reinterpret_cast<char*>(sizes), sizeToRead) != sizeToRead)
-        {
-            throw DataLoadError{tr("Failed to read header from file \"%1\": %2")
-                                .arg(path).arg(file.errorString())};
-        }
-    }
+    const auto elementType=readTextureFileHeader(file, path, sizes, 4);
+    const auto elementSize=textureElementSize(elementType);
     log << "dimensions from header: " << sizes[0] << "×" << sizes[1] << "×" << sizes[2] << "×" << sizes[3] << "... ";
 
-    if(const qint64 expectedFileSize = sizeof(GLfloat)*4*uint64_t(sizes[0])*sizes[1]*sizes[2]*sizes[3] + file.pos();
+    if(const qint64 expectedFileSize = elementSize*4*uint64_t(sizes[0])*sizes[1]*sizes[2]*sizes[3] + file.pos();
        expectedFileSize != file.size())
     {
         throw DataLoadError{tr("Size of file \"%1\" (%2 bytes) doesn't match image dimensions %3×%4×%5×%6"
@@ -206,27 +250,29 @@ void AtmosphereRenderer::load4DTexAltitudeSlicePair(QString const& path, QOpenGL
                                                                                     .arg(expectedFileSize)};
     }
 
+    checkPrecomputedDomain(path, sizes[2], sizes[3], params_.eclipsedDoubleScatteringTextureSize[2]);
     numAltIntervalsInEclipsed4DTexture_ = sizes[3]-1;
     double floorAltIndex;
     updateEclipsedAltitudeTexCoords(altitudeCoord, &floorAltIndex);
-    loadedEclipsedDoubleScatteringAltitudeURTexCoordRange_[0] = floorAltIndex/numAltIntervalsInEclipsed4DTexture_;
-    loadedEclipsedDoubleScatteringAltitudeURTexCoordRange_[1] = (floorAltIndex+1)/numAltIntervalsInEclipsed4DTexture_;
+    const auto firstAltIndex = params_.precomputedAltitudeIndexRange()[0];
+    loadedEclipsedDoubleScatteringAltitudeURTexCoordRange_[0] = (firstAltIndex+floorAltIndex)/(params_.eclipsedDoubleScatteringTextureSize[3]-1);
+    loadedEclipsedDoubleScatteringAltitudeURTexCoordRange_[1] = (firstAltIndex+floorAltIndex+1)/(params_.eclipsedDoubleScatteringTextureSize[3]-1);
 
     const auto subpixelReadOffset = 4*uint64_t(sizes[0])*sizes[1]*sizes[2]*uint64_t(floorAltIndex);
     const auto subpixelsInSingleTexSlice = 4*uint64_t(sizes[0])*sizes[1]*sizes[2];
     sizes[3]=2;
     const auto subpixelCountToRead = subpixelsInSingleTexSlice*sizes[3];
 
-    const std::unique_ptr<GLfloat[]> subpixels(new GLfloat[subpixelCountToRead]);
+    const std::unique_ptr<char[]> subpixels(new char[subpixelCountToRead*elementSize]);
     {
-        const qint64 offset=file.pos()+subpixelReadOffset*sizeof subpixels[0];
+        const qint64 offset=file.pos()+subpixelReadOffset*elementSize;
         log << "skipping to offset " << offset << "... ";
         if(!file.seek(offset))
         {
             throw DataLoadError{tr("Failed to seek to offset %1 in file \"%2\": %3")
                                 .arg(offset).arg(path).arg(file.errorString())};
         }
-        const qint64 sizeToRead=subpixelCountToRead*sizeof subpixels[0];
+        const qint64 sizeToRead=subpixelCountToRead*elementSize;
         const auto actuallyRead=file.read(reinterpret_cast<char*>(subpixels.get()), sizeToRead);
         if(actuallyRead != sizeToRead)
         {
@@ -240,14 +286,16 @@ void AtmosphereRenderer::load4DTexAltitudeSlicePair(QString const& path, QOpenGL
         }
     }
     texLower.bind();
-    gl.glTexImage3D(GL_TEXTURE_3D,0,GL_RGBA32F,sizes[0],sizes[1],sizes[2],0,GL_RGBA,GL_FLOAT,&subpixels[0]);
+    gl.glTexImage3D(GL_TEXTURE_3D,0,textureInternalFormat(elementType),sizes[0],sizes[1],sizes[2],0,
+                    GL_RGBA,texturePixelType(elementType),&subpixels[0]);
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
         throw DataLoadError{tr("GL error in load4DTexAltitudeSlicePair(\"%1\") after first glTexImage3D() call: %2")
                             .arg(path).arg(openglErrorString(err).c_str())};
     }
     texUpper.bind();
-    gl.glTexImage3D(GL_TEXTURE_3D,0,GL_RGBA32F,sizes[0],sizes[1],sizes[2],0,GL_RGBA,GL_FLOAT,&subpixels[subpixelsInSingleTexSlice]);
+    gl.glTexImage3D(GL_TEXTURE_3D,0,textureInternalFormat(elementType),sizes[0],sizes[1],sizes[2],0,
+                    GL_RGBA,texturePixelType(elementType),&subpixels[subpixelsInSingleTexSlice*elementSize]);
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
         throw DataLoadError{tr("GL error in load4DTexAltitudeSlicePair(\"%1\") after second glTexImage3D() call: %2")
@@ -272,27 +320,21 @@ glm::ivec2 AtmosphereRenderer::loadTexture2D(QString const& path)
         throw DataLoadError{tr("Failed to open file \"%1\": %2").arg(path).arg(file.errorString())};
 
     uint16_t sizes[2];
-    {
-        const qint64 sizeToRead=sizeof sizes;
-        if(file.read(reinterpret_cast<char*>(sizes), sizeToRead) != sizeToRead)
-        {
-            throw DataLoadError{tr("Failed to read header from file \"%1\": %2")
-                                .arg(path).arg(file.errorString())};
-        }
-    }
+    const auto elementType=readTextureFileHeader(file, path, sizes, 2);
+    const auto elementSize=textureElementSize(elementType);
     const auto subpixelCount = 4*uint64_t(sizes[0])*sizes[1];
     log << "dimensions from header: " << sizes[0] << "×" << sizes[1] << "... ";
 
-    if(const qint64 expectedFileSize = subpixelCount*sizeof(GLfloat)+file.pos();
+    if(const qint64 expectedFileSize = subpixelCount*elementSize+file.pos();
        expectedFileSize != file.size())
     {
         throw DataLoadError{tr("Size of file \"%1\" (%2 bytes) doesn't match image dimensions %3×%4 from file header.\nThe expected size is %5 bytes.")
                             .arg(path).arg(file.size()).arg(sizes[0]).arg(sizes[1]).arg(expectedFileSize)};
     }
 
-    const std::unique_ptr<GLfloat[]> subpixels(new GLfloat[subpixelCount]);
+    const std::unique_ptr<char[]> subpixels(new char[subpixelCount*elementSize]);
     {
-        const qint64 sizeToRead=subpixelCount*sizeof subpixels[0];
+        const qint64 sizeToRead=subpixelCount*elementSize;
         const auto actuallyRead=file.read(reinterpret_cast<char*>(subpixels.get()), sizeToRead);
         if(actuallyRead != sizeToRead)
         {
@@ -301,7 +343,8 @@ glm::ivec2 AtmosphereRenderer::loadTexture2D(QString const& path)
             throw DataLoadError{error};
         }
     }
-    gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,sizes[0],sizes[1],0,GL_RGBA,GL_FLOAT,subpixels.get());
+    gl.glTexImage2D(GL_TEXTURE_2D,0,textureInternalFormat(elementType),sizes[0],sizes[1],0,
+                    GL_RGBA,texturePixelType(elementType),subpixels.get());
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
         throw DataLoadError{tr("GL error in loadTexture2D(\"%1\") after glTexImage2D() call: %2")
@@ -351,6 +394,39 @@ void AtmosphereRenderer::loadTextures(const CountStepsOnly countStepsOnly)
         tick(++loadingStepsDone_);
     }
 
+    const bool havePhaseFunctionTextures=QFile::exists(QString("%1/phase-functions-wlset0.f32").arg(pathToData_));
+    for(unsigned wlSetIndex=0; havePhaseFunctionTextures && wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
+    {
+        if(countStepsOnly)
+        {
+            ++totalLoadingStepsToDo_;
+            continue;
+        }
+
+        auto& tex=*phaseFunctionTextures_.emplace_back(newTex(QOpenGLTexture::Target2D));
+        tex.setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+        tex.setWrapMode(QOpenGLTexture::ClampToEdge);
+        tex.bind();
+        loadTexture2D(QString("%1/phase-functions-wlset%2.f32").arg(pathToData_).arg(wlSetIndex));
+        tick(++loadingStepsDone_);
+    }
+
+    if(const auto path=QString("%1/radial-quadrature-nodes.f32").arg(pathToData_); QFile::exists(path))
+    {
+        if(countStepsOnly)
+        {
+            ++totalLoadingStepsToDo_;
+        }
+        else
+        {
+            radialQuadratureTexture_=newTex(QOpenGLTexture::Target2D);
+            radialQuadratureTexture_->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+            radialQuadratureTexture_->bind();
+            loadTexture2D(path);
+            tick(++loadingStepsDone_);
+        }
+    }
+
     reloadScatteringTextures(countStepsOnly);
 
     assert(gl.glGetError()==GL_NO_ERROR);
@@ -361,7 +437,10 @@ double AtmosphereRenderer::altitudeUnitRangeTexCoord() const
     const auto h = tools_->altitude();
     const auto H = params_.atmosphereHeight;
     const auto R = params_.earthRadius;
-    return std::sqrt(h*(h+2*R) / ( H*(H+2*R) ));
+    const auto coord = std::sqrt(h*(h+2*R) / ( H*(H+2*R) ));
+    // Outside of the precomputed domain the nearest precomputed altitude is used, so we needn't reload the textures there
+    const auto altIndexRange = glm::dvec2(params_.precomputedAltitudeIndexRange()) / (params_.scatteringTextureSize[3]-1.);
+    return std::clamp(coord, altIndexRange[0], altIndexRange[1]);
 }
 
 void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStepsOnly)
@@ -551,14 +630,15 @@ void AtmosphereRenderer::loadShaders(const CountStepsOnly countStepsOnly)
                                                                                        .arg(scatterer.name);
                     qDebug().nospace() << "Loading shaders from " << scatDir << "...";
                     auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+                    ShaderSources sources;
 
                     for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                        addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+                        addShaderFile(sources,QOpenGLShader::Fragment,shaderFile.path());
 
                     program.addShader(&viewDirFragShader);
                     program.addShader(&viewDirVertShader);
 
-                    link(program, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+                    link(program, sources, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
                     tick(++loadingStepsDone_);
                 }
             }
@@ -575,13 +655,14 @@ void AtmosphereRenderer::loadShaders(const CountStepsOnly countStepsOnly)
                                                                                 .arg(scatterer.name);
                 qDebug().nospace() << "Loading shaders from " << scatDir << "...";
                 auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+                ShaderSources sources;
                 for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                    addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+                    addShaderFile(sources,QOpenGLShader::Fragment,shaderFile.path());
 
                 program.addShader(&viewDirFragShader);
                 program.addShader(&viewDirVertShader);
 
-                link(program, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+                link(program, sources, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
                 tick(++loadingStepsDone_);
             }
         }
@@ -611,14 +692,15 @@ void AtmosphereRenderer::loadShaders(const CountStepsOnly countStepsOnly)
                                                                                                 .arg(scatterer.name);
                     qDebug().nospace() << "Loading shaders from " << scatDir << "...";
                     auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+                    ShaderSources sources;
 
                     for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                        addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+                        addShaderFile(sources,QOpenGLShader::Fragment,shaderFile.path());
 
                     program.addShader(&viewDirFragShader);
                     program.addShader(&viewDirVertShader);
 
-                    link(program, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+                    link(program, sources, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
                     tick(++loadingStepsDone_);
                 }
             }
@@ -635,14 +717,15 @@ void AtmosphereRenderer::loadShaders(const CountStepsOnly countStepsOnly)
                                                                                             .arg(scatterer.name);
                 qDebug().nospace() << "Loading shaders from " << scatDir << "...";
                 auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+                ShaderSources sources;
 
                 for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                    addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+                    addShaderFile(sources,QOpenGLShader::Fragment,shaderFile.path());
 
                 program.addShader(&viewDirFragShader);
                 program.addShader(&viewDirVertShader);
 
-                link(program, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+                link(program, sources, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
                 tick(++loadingStepsDone_);
             }
         }
@@ -688,13 +771,14 @@ void main()
                                                                                                     .arg(scatterer.name);
             qDebug().nospace() << "Loading shaders from " << scatDir << "...";
             auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+            ShaderSources sources;
 
             for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+                addShaderFile(sources,QOpenGLShader::Fragment,shaderFile.path());
 
             program.addShader(&precomputationProgramsVertShader);
 
-            link(program, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+            link(program, sources, tr("shader program for scatterer \"%1\"").arg(scatterer.name));
             tick(++loadingStepsDone_);
         }
     }
@@ -712,14 +796,15 @@ void main()
         const auto scatDir=QString("%1/shaders/double-scattering-eclipsed/precomputed/%2").arg(pathToData_).arg(wlSetIndex);
         qDebug().nospace() << "Loading shaders from " << scatDir << "...";
         auto& program=*eclipsedDoubleScatteringPrecomputedPrograms_.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+        ShaderSources sources;
 
         for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-            addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+            addShaderFile(sources,QOpenGLShader::Fragment,shaderFile.path());
 
         program.addShader(&viewDirFragShader);
         program.addShader(&viewDirVertShader);
 
-        link(program, tr("precomputed eclipsed double scattering shader program"));
+        link(program, sources, tr("precomputed eclipsed double scattering shader program"));
         tick(++loadingStepsDone_);
     }
 
@@ -736,13 +821,14 @@ void main()
         const auto scatDir=QString("%1/shaders/double-scattering-eclipsed/precomputation/%2").arg(pathToData_).arg(wlSetIndex);
         qDebug().nospace() << "Loading shaders from " << scatDir << "...";
         auto& program=*eclipsedDoubleScatteringPrecomputationPrograms_.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+        ShaderSources sources;
 
         for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-            addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+            addShaderFile(sources,QOpenGLShader::Fragment,shaderFile.path());
 
         program.addShader(&precomputationProgramsVertShader);
 
-        link(program, tr("on-the-fly eclipsed double scattering shader program"));
+        link(program, sources, tr("on-the-fly eclipsed double scattering shader program"));
         tick(++loadingStepsDone_);
     }
 
@@ -758,13 +844,14 @@ void main()
             }
 
             auto& program=*multipleScatteringPrograms_.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+            ShaderSources sources;
             const auto wlDir=QString("%1/shaders/multiple-scattering/%2").arg(pathToData_).arg(wlSetIndex);
             qDebug().nospace() << "Loading shaders from " << wlDir << "...";
             for(const auto& shaderFile : fs::directory_iterator(fs::u8path(wlDir.toStdString())))
-                addShaderFile(program, QOpenGLShader::Fragment, shaderFile.path());
+                addShaderFile(sources, QOpenGLShader::Fragment, shaderFile.path());
             program.addShader(&viewDirFragShader);
             program.addShader(&viewDirVertShader);
-            link(program, tr("multiple scattering shader program"));
+            link(program, sources, tr("multiple scattering shader program"));
             tick(++loadingStepsDone_);
         }
     }
@@ -777,13 +864,14 @@ void main()
         else
         {
             auto& program=*multipleScatteringPrograms_.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+            ShaderSources sources;
             const auto wlDir=pathToData_+"/shaders/multiple-scattering/";
             qDebug().nospace() << "Loading shaders from " << wlDir << "...";
             for(const auto& shaderFile : fs::directory_iterator(fs::u8path(wlDir.toStdString())))
-                addShaderFile(program, QOpenGLShader::Fragment, shaderFile.path());
+                addShaderFile(sources, QOpenGLShader::Fragment, shaderFile.path());
             program.addShader(&viewDirFragShader);
             program.addShader(&viewDirVertShader);
-            link(program, tr("multiple scattering shader program"));
+            link(program, sources, tr("multiple scattering shader program"));
             tick(++loadingStepsDone_);
         }
     }
@@ -798,13 +886,14 @@ void main()
         }
 
         auto& program=*zeroOrderScatteringPrograms_.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+        ShaderSources sources;
         const auto wlDir=QString("%1/shaders/zero-order-scattering/%2").arg(pathToData_).arg(wlSetIndex);
         qDebug().nospace() << "Loading shaders from " << wlDir << "...";
         for(const auto& shaderFile : fs::directory_iterator(fs::u8path(wlDir.toStdString())))
-            addShaderFile(program, QOpenGLShader::Fragment, shaderFile.path());
+            addShaderFile(sources, QOpenGLShader::Fragment, shaderFile.path());
         program.addShader(&viewDirFragShader);
         program.addShader(&viewDirVertShader);
-        link(program, tr("zero-order scattering shader program"));
+        link(program, sources, tr("zero-order scattering shader program"));
         tick(++loadingStepsDone_);
     }
 
@@ -818,13 +907,14 @@ void main()
         }
 
         auto& program=*eclipsedZeroOrderScatteringPrograms_.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+        ShaderSources sources;
         const auto wlDir=QString("%1/shaders/eclipsed-zero-order-scattering/%2").arg(pathToData_).arg(wlSetIndex);
         qDebug().nospace() << "Loading shaders from " << wlDir << "...";
         for(const auto& shaderFile : fs::directory_iterator(fs::u8path(wlDir.toStdString())))
-            addShaderFile(program, QOpenGLShader::Fragment, shaderFile.path());
+            addShaderFile(sources, QOpenGLShader::Fragment, shaderFile.path());
         program.addShader(&viewDirFragShader);
         program.addShader(&viewDirVertShader);
-        link(program, tr("eclipsed zero-order scattering shader program"));
+        link(program, sources, tr("eclipsed zero-order scattering shader program"));
         tick(++loadingStepsDone_);
     }
 
@@ -836,9 +926,10 @@ void main()
     {
         viewDirectionGetterProgram_=std::make_unique<QOpenGLShaderProgram>();
         auto& program=*viewDirectionGetterProgram_;
+        ShaderSources sources;
         program.addShader(&viewDirFragShader);
         program.addShader(&viewDirVertShader);
-        addShaderCode(program, QOpenGLShader::Fragment, tr("fragment shader for view direction getter"), 1+R"(
+        addShaderCode(sources, QOpenGLShader::Fragment, tr("fragment shader for view direction getter"), 1+R"(
 #version 330
 
 in vec3 position;
@@ -850,7 +941,7 @@ void main()
     viewDir=calcViewDir();
 }
 )");
-        link(program, tr("view direction getter shader program"));
+        link(program, sources, tr("view direction getter shader program"));
         tick(++loadingStepsDone_);
     }
 }
@@ -1035,6 +1126,7 @@ void AtmosphereRenderer::precomputeEclipsedSingleScattering()
         {
             auto& prog=*programs[wlSetIndex];
             prog.bind();
+            bindLookupTables(prog, wlSetIndex);
             prog.setUniformValue("altitude", float(tools_->altitude()));
             prog.setUniformValue("moonAngularRadius", float(moonAngularRadius()));
             prog.setUniformValue("moonPositionRelativeToSunAzimuth", toQVector(moonPositionRelativeToSunAzimuth()));
@@ -1081,6 +1173,7 @@ void AtmosphereRenderer::renderSingleScattering()
 
                     auto& prog=*eclipsedSingleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex];
                     prog.bind();
+                    bindLookupTables(prog, wlSetIndex);
                     prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
                     prog.setUniformValue("moonAngularRadius", float(moonAngularRadius()));
                     prog.setUniformValue("moonPosition", toQVector(moonPosition()));
@@ -1103,6 +1196,7 @@ void AtmosphereRenderer::renderSingleScattering()
 
                     auto& prog=*singleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex];
                     prog.bind();
+                    bindLookupTables(prog, wlSetIndex);
                     prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
                     prog.setUniformValue("sunDirection", toQVector(sunDirection()));
                     transmittanceTextures_[wlSetIndex]->bind(0);
@@ -1123,6 +1217,7 @@ void AtmosphereRenderer::renderSingleScattering()
 
                     auto& prog=*eclipsedSingleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex];
                     prog.bind();
+                    bindLookupTables(prog, wlSetIndex);
                     prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
                     prog.setUniformValue("sunDirection", toQVector(sunDirection()));
                     {
@@ -1146,6 +1241,7 @@ void AtmosphereRenderer::renderSingleScattering()
 
                     auto& prog=*singleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex];
                     prog.bind();
+                    bindLookupTables(prog, wlSetIndex);
                     prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
                     prog.setUniformValue("sunDirection", toQVector(sunDirection()));
                     {
@@ -1156,6 +1252,7 @@ void AtmosphereRenderer::renderSingleScattering()
                         tex.bind(0);
                         prog.setUniformValue("scatteringTexture", 0);
                         prog.setUniformValue("staticAltitudeTexCoord", staticAltitudeTexCoord_);
+                        prog.setUniformValue("scatteringTextureSZAIndexRange", scatteringTextureSZAIndexRange());
                     }
 
                     drawSurface(prog);
@@ -1166,6 +1263,7 @@ void AtmosphereRenderer::renderSingleScattering()
         {
             auto& prog=*singleScatteringPrograms_[renderMode]->at(scatterer.name).front();
             prog.bind();
+            bindLookupTables(prog, 0);
             prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
             prog.setUniformValue("sunDirection", toQVector(sunDirection()));
             {
@@ -1177,6 +1275,7 @@ void AtmosphereRenderer::renderSingleScattering()
             }
             prog.setUniformValue("scatteringTexture", 0);
             prog.setUniformValue("staticAltitudeTexCoord", staticAltitudeTexCoord_);
+            prog.setUniformValue("scatteringTextureSZAIndexRange", scatteringTextureSZAIndexRange());
 
             drawSurface(prog);
         }
@@ -1184,6 +1283,7 @@ void AtmosphereRenderer::renderSingleScattering()
         {
             auto& prog=*eclipsedSingleScatteringPrograms_[renderMode]->at(scatterer.name).front();
             prog.bind();
+            bindLookupTables(prog, 0);
             prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
             prog.setUniformValue("sunDirection", toQVector(sunDirection()));
             {
@@ -1211,6 +1311,7 @@ void AtmosphereRenderer::precomputeEclipsedDoubleScattering()
     {
         auto& prog=*eclipsedDoubleScatteringPrecomputationPrograms_[wlSetIndex];
         prog.bind();
+        bindLookupTables(prog, wlSetIndex);
         int unusedTextureUnitNum=0;
         transmittanceTextures_[wlSetIndex]->bind(unusedTextureUnitNum);
         prog.setUniformValue("transmittanceTexture", unusedTextureUnitNum++);
@@ -1224,7 +1325,7 @@ void AtmosphereRenderer::precomputeEclipsedDoubleScattering()
         eclipsedDoubleScatteringPrecomputationTargetTextures_[wlSetIndex]->bind();
         gl.glTexImage3D(GL_TEXTURE_3D,0,GL_RGBA32F,
                         params_.eclipsedDoubleScatteringTextureSize[0], params_.eclipsedDoubleScatteringTextureSize[1], 1,
-                        0,GL_RGBA,GL_FLOAT,precomputer.texture().data());
+                        0,GL_RGBA,GL_FLOAT,precomputer.altitudeSlice(0).data());
     }
     gl.glBindVertexArray(0);
     gl.glBindFramebuffer(GL_FRAMEBUFFER,luminanceRadianceFBO_);
@@ -1262,6 +1363,7 @@ void AtmosphereRenderer::renderMultipleScattering()
                 prog.setUniformValue("eclipsedDoubleScatteringAltitudeAlphaUpper", 0.f);
                 prog.setUniformValue("eclipsedDoubleScatteringTextureSize", QVector3D(params_.eclipsedDoubleScatteringTextureSize[0],
                                                                                       params_.eclipsedDoubleScatteringTextureSize[1], 1));
+                prog.setUniformValue("eclipsedDoubleScatteringSZAIndexRange", QVector2D(0, 0));
             }
             else
             {
@@ -1281,6 +1383,8 @@ void AtmosphereRenderer::renderMultipleScattering()
 
                 prog.setUniformValue("eclipsedDoubleScatteringAltitudeAlphaUpper", eclipsedDoubleScatteringAltitudeAlphaUpper_);
                 prog.setUniformValue("eclipsedDoubleScatteringTextureSize", toQVector(glm::vec3(params_.eclipsedDoubleScatteringTextureSize)));
+                const auto szaRange=params_.precomputedSZAIndexRange(params_.eclipsedDoubleScatteringTextureSize[2]);
+                prog.setUniformValue("eclipsedDoubleScatteringSZAIndexRange", QVector2D(szaRange[0], szaRange[1]));
             }
             drawSurface(prog);
         }
@@ -1300,6 +1404,7 @@ void AtmosphereRenderer::renderMultipleScattering()
             tex.bind(0);
             prog.setUniformValue("scatteringTexture", 0);
             prog.setUniformValue("staticAltitudeTexCoord", staticAltitudeTexCoord_);
+            prog.setUniformValue("scatteringTextureSZAIndexRange", scatteringTextureSZAIndexRange());
             drawSurface(prog);
         }
         else
@@ -1320,6 +1425,7 @@ void AtmosphereRenderer::renderMultipleScattering()
                 tex.bind(0);
                 prog.setUniformValue("scatteringTexture", 0);
                 prog.setUniformValue("staticAltitudeTexCoord", staticAltitudeTexCoord_);
+                prog.setUniformValue("scatteringTextureSZAIndexRange", scatteringTextureSZAIndexRange());
                 drawSurface(prog);
             }
         }
@@ -1489,6 +1595,7 @@ void AtmosphereRenderer::loadData(QByteArray viewDirVertShaderSrc, QByteArray vi
     loadShaders(CountStepsOnly{false});
     loadTextures(CountStepsOnly{false});
     reportLoadingFinished();
+    checkLookupTables();
 
     setupRenderTarget();
     setupBuffers();
@@ -1553,6 +1660,51 @@ void AtmosphereRenderer::drawSurface(QOpenGLShaderProgram& prog)
     drawSurfaceCallback(prog);
 }
 
+void AtmosphereRenderer::bindLookupTables(QOpenGLShaderProgram& prog, const unsigned wlSetIndex)
+{
+    if(const auto location=prog.uniformLocation("phaseFunctionTexture"); location>=0 && !phaseFunctionTextures_.empty())
+    {
+        phaseFunctionTextures_[wlSetIndex]->bind(PHASE_FUNCTION_TEXTURE_UNIT, QOpenGLTexture::ResetTextureUnit);
+        prog.setUniformValue(location, PHASE_FUNCTION_TEXTURE_UNIT);
+    }
+    if(const auto location=prog.uniformLocation("gaussLegendreNodesTexture"); location>=0 && radialQuadratureTexture_)
+    {
+        radialQuadratureTexture_->bind(RADIAL_QUADRATURE_TEXTURE_UNIT, QOpenGLTexture::ResetTextureUnit);
+        prog.setUniformValue(location, RADIAL_QUADRATURE_TEXTURE_UNIT);
+    }
+}
+
+/* The shaders sample the phase function tables if CalcMySky was run with --phase-function-lut, and the table of
+ * the radial quadrature nodes if the atmosphere description
+ * has "radial integration rule: gauss-legendre"
+ */
+void AtmosphereRenderer::checkLookupTables() const
+{
+    const auto check=[this](std::vector<ShaderProgPtr> const& programs)
+    {
+        for(const auto& program : programs)
+        {
+            if(!program) continue;
+            if(phaseFunctionTextures_.empty() && program->uniformLocation("phaseFunctionTexture")>=0)
+                throw DataLoadError{QObject::tr("Shaders sample phase function tables, but the files \"phase-functions-wlset*.f32\" "
+                                                "weren't found")};
+            if(!radialQuadratureTexture_ && program->uniformLocation("gaussLegendreNodesTexture")>=0)
+                throw DataLoadError{QObject::tr("Shaders sample the nodes of the radial quadrature, but the file "
+                                                "\"radial-quadrature-nodes.f32\" wasn't found")};
+        }
+    };
+    for(const auto* programs : {&zeroOrderScatteringPrograms_, &eclipsedZeroOrderScatteringPrograms_, &multipleScatteringPrograms_,
+                                &eclipsedDoubleScatteringPrecomputedPrograms_, &eclipsedDoubleScatteringPrecomputationPrograms_})
+        check(*programs);
+    for(const auto* programMaps : {&singleScatteringPrograms_, &eclipsedSingleScatteringPrograms_})
+        for(const auto& programsPerScatterer : *programMaps)
+            for(const auto& [scattererName, programs] : *programsPerScatterer)
+                check(programs);
+    if(eclipsedSingleScatteringPrecomputationPrograms_)
+        for(const auto& [scattererName, programs] : *eclipsedSingleScatteringPrecomputationPrograms_)
+            check(programs);
+}
+
 void AtmosphereRenderer::resizeEvent(const int width, const int height)
 {
     OGL_TRACE();
@@ -1594,4 +1746,5 @@ void AtmosphereRenderer::reloadShaders()
     loadingStepsDone_=0;
     loadShaders(CountStepsOnly{false});
     reportLoadingFinished();
+    checkLookupTables();
 }
@@ -67,6 +67,10 @@ private: // variables
     std::vector<TexturePtr> multipleScatteringTextures_;
     std::vector<TexturePtr> transmittanceTextures_;
     std::vector<TexturePtr> irradianceTextures_;
+    // Empty unless CalcMySky has tabulated the phase functions
+    std::vector<TexturePtr> phaseFunctionTextures_;
+    // Null unless CalcMySky has used the Gauss-Legendre radial quadrature
+    TexturePtr radialQuadratureTexture_;
     std::vector<GLuint> radianceRenderBuffers_;
     GLuint viewDirectionRenderBuffer_=0;
     // Indexed as singleScatteringTextures_[scattererName][wavelengthSetIndex]
@@ -111,8 +115,12 @@ private: // methods
     void tick(int loadingStepsDone);
     void reportLoadingFinished();
     void drawSurface(QOpenGLShaderProgram& prog);
+    void bindLookupTables(QOpenGLShaderProgram& prog, unsigned wlSetIndex);
+    void checkLookupTables() const;
 
     double altitudeUnitRangeTexCoord() const;
+    double altitudeLayerIndex(float altitudeCoord) const;
+    QVector2D scatteringTextureSZAIndexRange() const;
     double moonAngularRadius() const;
     double cameraMoonDistance() const;
     glm::dvec3 sunDirection() const;
@@ -120,6 +128,7 @@ private: // methods
     glm::dvec3 moonPositionRelativeToSunAzimuth() const;
     glm::dvec3 cameraPosition() const;
     glm::ivec2 loadTexture2D(QString const& path);
+    void checkPrecomputedDomain(QString const& path, unsigned sizeBySZA, unsigned sizeByAltitude, unsigned fullSizeBySZA) const;
     void loadTexture4D(QString const& path, float altitudeCoord);
     void load4DTexAltitudeSlicePair(QString const& path, QOpenGLTexture& texLower, QOpenGLTexture& texUpper, float altitudeCoord);
     void updateAltitudeTexCoords(float altitudeCoord, double* floorAltIndex = nullptr);
@@ -129,7 +129,8 @@ void GLWidget::initializeGL()
         setupBuffers();
 
         luminanceToScreenRGB_=std::make_unique<QOpenGLShaderProgram>();
-        addShaderCode(*luminanceToScreenRGB_, QOpenGLShader::Fragment, tr("luminanceToScreenRGB fragment shader"), 1+R"(
+        ShaderSources luminanceToScreenRGBSources;
+        addShaderCode(luminanceToScreenRGBSources, QOpenGLShader::Fragment, tr("luminanceToScreenRGB fragment shader"), 1+R"(
 #version 330
 uniform float exposure;
 uniform sampler2D luminanceXYZW;
@@ -172,7 +173,7 @@ void main()
     color=vec4(dither(srgb),1);
 }
 )");
-        addShaderCode(*luminanceToScreenRGB_, QOpenGLShader::Vertex, tr("luminanceToScreenRGB vertex shader"), 1+R"(
+        addShaderCode(luminanceToScreenRGBSources, QOpenGLShader::Vertex, tr("luminanceToScreenRGB vertex shader"), 1+R"(
 #version 330
 in vec3 vertex;
 out vec2 texCoord;
@@ -182,7 +183,7 @@ void main()
     gl_Position=vec4(vertex,1);
 }
 )");
-        link(*luminanceToScreenRGB_, tr("luminanceToScreenRGB shader program"));
+        link(*luminanceToScreenRGB_, luminanceToScreenRGBSources, tr("luminanceToScreenRGB shader program"));
 
         static constexpr const char* viewDirVertShaderSrc=1+R"(
 #version 330
@@ -1,5 +1,7 @@
 #include "util.hpp"
 #include "../common/util.hpp"
+#include "../common/ProgramBinaryCache.hpp"
+#include <QCryptographicHash>
 #include <QFile>
 
 QByteArray readFullFile(QString const& filename)
@@ -13,15 +15,30 @@ QByteArray readFullFile(QString const& filename)
     return data;
 }
 
-void addShaderCode(QOpenGLShaderProgram& program, const QOpenGLShader::ShaderType type,
-                   QString const& description, QByteArray sourceCode)
+void link(QOpenGLShaderProgram& program, ShaderSources const& sources, QString const& description)
 {
-    if(!program.addShaderFromSourceCode(type, sourceCode))
-        throw DataLoadError{QObject::tr("Failed to compile %1:\n%2").arg(description).arg(program.log())};
-}
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for(const auto shader : program.shaders())
+    {
+        hash.addData(QByteArray::number(int(shader->shaderType())));
+        hash.addData(shader->sourceCode());
+    }
+    for(const auto& source : sources)
+    {
+        hash.addData(QByteArray::number(int(source.type)));
+        hash.addData(source.code);
+    }
+    const auto sourcesHash=hash.result();
+    if(ProgramBinaryCache::load(program, sourcesHash))
+        return;
 
-void link(QOpenGLShaderProgram& program, QString const& description)
-{
+    for(const auto& source : sources)
+    {
+        if(!program.addShaderFromSourceCode(source.type, source.code))
+            throw DataLoadError{QObject::tr("Failed to compile %1:\n%2").arg(source.description).arg(program.log())};
+    }
+    ProgramBinaryCache::prepareForLink(program);
     if(!program.link())
         throw DataLoadError{QObject::tr("Failed to link %1:\n%2").arg(description).arg(program.log())};
+    ProgramBinaryCache::save(program, sourcesHash);
 }
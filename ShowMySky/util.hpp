@@ -1,17 +1,30 @@
 #ifndef INCLUDE_ONCE_BCBE8DB3_A1E2_40C1_8E09_1DA9FE40B65D
 #define INCLUDE_ONCE_BCBE8DB3_A1E2_40C1_8E09_1DA9FE40B65D
 
+#include <vector>
 #include <filesystem>
 #include <QOpenGLShaderProgram>
 #include <QString>
 
 QByteArray readFullFile(QString const& filename);
-void addShaderCode(QOpenGLShaderProgram& program, QOpenGLShader::ShaderType type,
-                   QString const& description, QByteArray sourceCode);
-inline void addShaderFile(QOpenGLShaderProgram& program, QOpenGLShader::ShaderType type, QString const& filename)
-{ addShaderCode(program, type, QObject::tr("shader file \"%1\"").arg(filename), readFullFile(filename)); }
-inline void addShaderFile(QOpenGLShaderProgram& program, QOpenGLShader::ShaderType type, std::filesystem::path const& filename)
-{ addShaderFile(program, type, QString::fromStdString(filename.u8string())); }
-void link(QOpenGLShaderProgram& program, QString const& description);
+
+// Sources of the shaders of a program. They are only compiled by link() if the program isn't in the binary cache.
+struct ShaderSource
+{
+    QOpenGLShader::ShaderType type;
+    QString description;
+    QByteArray code;
+};
+using ShaderSources=std::vector<ShaderSource>;
+
+inline void addShaderCode(ShaderSources& sources, QOpenGLShader::ShaderType type,
+                          QString const& description, QByteArray sourceCode)
+{ sources.push_back({type, description, std::move(sourceCode)}); }
+inline void addShaderFile(ShaderSources& sources, QOpenGLShader::ShaderType type, QString const& filename)
+{ addShaderCode(sources, type, QObject::tr("shader file \"%1\"").arg(filename), readFullFile(filename)); }
+inline void addShaderFile(ShaderSources& sources, QOpenGLShader::ShaderType type, std::filesystem::path const& filename)
+{ addShaderFile(sources, type, QString::fromStdString(filename.u8string())); }
+// The shaders already attached to the program, if any, are linked too
+void link(QOpenGLShaderProgram& program, ShaderSources const& sources, QString const& description);
 
 #endif
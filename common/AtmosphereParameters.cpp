@@ -1,5 +1,6 @@
 #include "AtmosphereParameters.hpp"
 #include <optional>
+#include <algorithm>
 #include <QDebug>
 #include "Spectrum.hpp"
 #include "const.hpp"
@@ -93,6 +94,19 @@ struct AreaQuantity : Quantity
     QString basicUnit() const override { return "m^2"; }
 };
 
+struct AngleQuantity : Quantity
+{
+    std::string name() const override { return "angle"; }
+    std::map<QString, double> units() const override
+    {
+        return {
+                {"rad",1},
+                {"deg",M_PI/180},
+               };
+    }
+    QString basicUnit() const override { return "rad"; }
+};
+
 struct DimensionlessQuantity {};
 
 double getQuantity(QString const& value, const double min, const double max, DimensionlessQuantity const&,
@@ -373,6 +387,21 @@ AtmosphereParameters::Absorber parseAbsorber(AtmosphereParameters const& atmo, c
     return description;
 }
 
+glm::ivec2 indexRangeCovering(const double unitRangeMin, const double unitRangeMax, const int texSize)
+{
+    const int indexMax=texSize-1;
+    glm::ivec2 range(std::clamp(int(std::floor(unitRangeMin*indexMax)), 0, indexMax),
+                     std::clamp(int(std::ceil (unitRangeMax*indexMax)), 0, indexMax));
+    if(range[0]==range[1])
+    {
+        if(range[1]<indexMax)
+            ++range[1];
+        else if(range[0]>0)
+            --range[0];
+    }
+    return range;
+}
+
 }
 
 void AtmosphereParameters::parse(QString const& atmoDescrFileName, const SkipSpectra skipSpectra)
@@ -422,6 +451,10 @@ void AtmosphereParameters::parse(QString const& atmoDescrFileName, const SkipSpe
             numTransmittanceIntegrationPoints=getUInt(value,1,INT_MAX, atmoDescrFileName, lineNumber);
         else if(key=="radial integration points")
             radialIntegrationPoints=getUInt(value,1,INT_MAX, atmoDescrFileName, lineNumber);
+        else if(key=="radial integration rule")
+            radialQuadrature=parseRadialQuadrature(value, atmoDescrFileName, lineNumber);
+        else if(key=="radial integration scale height")
+            radialQuadratureScaleHeight=getQuantity(value,1,1e6,LengthQuantity{},atmoDescrFileName,lineNumber);
         else if(key=="angular integration points")
             angularIntegrationPoints=getUInt(value,1,INT_MAX, atmoDescrFileName, lineNumber);
         else if(key=="angular integration points for eclipse")
@@ -492,6 +525,14 @@ void AtmosphereParameters::parse(QString const& atmoDescrFileName, const SkipSpe
             absorbers.emplace_back(parseAbsorber(*this, skipSpectra, stream, absorberDescriptionKey.cap(1), atmoDescrFileName,++lineNumber));
         else if(key=="scattering orders")
             scatteringOrdersToCompute=getQuantity(value,1,100, DimensionlessQuantity{},atmoDescrFileName,lineNumber);
+        else if(key=="minimum precomputed altitude")
+            minPrecomputedAltitude=getQuantity(value,0,1e6,LengthQuantity{},atmoDescrFileName,lineNumber);
+        else if(key=="maximum precomputed altitude")
+            maxPrecomputedAltitude=getQuantity(value,0,1e6,LengthQuantity{},atmoDescrFileName,lineNumber);
+        else if(key=="minimum precomputed sun zenith angle")
+            minPrecomputedSunZenithAngle=getQuantity(value,0,M_PI,AngleQuantity{},atmoDescrFileName,lineNumber);
+        else if(key=="maximum precomputed sun zenith angle")
+            maxPrecomputedSunZenithAngle=getQuantity(value,0,M_PI,AngleQuantity{},atmoDescrFileName,lineNumber);
         else if(key=="ground albedo")
         {
             if(!skipSpectra)
@@ -504,6 +545,19 @@ void AtmosphereParameters::parse(QString const& atmoDescrFileName, const SkipSpe
 
     lengthOfHorizRayFromGroundToBorderOfAtmo=std::sqrt(atmosphereHeight*(atmosphereHeight+2*earthRadius));
 
+    if(std::isnan(maxPrecomputedAltitude))
+        maxPrecomputedAltitude=atmosphereHeight;
+    if(minPrecomputedAltitude>maxPrecomputedAltitude || maxPrecomputedAltitude>atmosphereHeight)
+    {
+        throw DataLoadError{QString("Precomputed altitude range [%1, %2] m must be a nonempty part of [0, %3] m")
+                                .arg(minPrecomputedAltitude).arg(maxPrecomputedAltitude).arg(atmosphereHeight)};
+    }
+    if(minPrecomputedSunZenithAngle>maxPrecomputedSunZenithAngle)
+    {
+        throw DataLoadError{QString("Minimum precomputed sun zenith angle %1 rad is greater than the maximum %2 rad")
+                                .arg(minPrecomputedSunZenithAngle).arg(maxPrecomputedSunZenithAngle)};
+    }
+
     if(!stream.atEnd())
     {
         throw ParsingError{atmoDescrFileName,lineNumber, "error: failed to read file"};
@@ -522,3 +576,42 @@ void AtmosphereParameters::parse(QString const& atmoDescrFileName, const SkipSpe
         groundAlbedo=std::vector<glm::vec4>(allWavelengths.size(), glm::vec4(1));
     }
 }
+
+double AtmosphereParameters::altitudeToUnitRangeTexCoord(const double altitude) const
+{
+    const auto distToHorizon=std::sqrt(sqr(altitude)+2*altitude*earthRadius);
+    return distToHorizon/lengthOfHorizRayFromGroundToBorderOfAtmo;
+}
+
+double AtmosphereParameters::cosSZAToUnitRangeTexCoord(const double cosSZA) const
+{
+    const double R=earthRadius;
+    const double distFromGroundToTopAtmoBorder=std::sqrt(std::max(0., sqr(R+atmosphereHeight)-sqr(R)*(1-sqr(cosSZA))))-R*cosSZA;
+    const double distMin=atmosphereHeight;
+    const double distMax=lengthOfHorizRayFromGroundToBorderOfAtmo;
+    const double a=(distFromGroundToTopAtmoBorder-distMin)/(distMax-distMin);
+    const double A=earthRadius/(distMax-distMin);
+    return std::max(0.,1-a/A)/(a+1);
+}
+
+glm::ivec2 AtmosphereParameters::precomputedAltitudeIndexRange() const
+{
+    return indexRangeCovering(altitudeToUnitRangeTexCoord(minPrecomputedAltitude),
+                              altitudeToUnitRangeTexCoord(maxPrecomputedAltitude),
+                              scatteringTextureSize[3]);
+}
+
+glm::ivec2 AtmosphereParameters::precomputedSZAIndexRange(const int texSizeBySZA) const
+{
+    // The texture coordinate decreases with the zenith angle
+    return indexRangeCovering(cosSZAToUnitRangeTexCoord(std::cos(maxPrecomputedSunZenithAngle)),
+                              cosSZAToUnitRangeTexCoord(std::cos(minPrecomputedSunZenithAngle)),
+                              texSizeBySZA);
+}
+
+glm::ivec4 AtmosphereParameters::precomputedScatteringTextureSize() const
+{
+    const auto szaRange=precomputedSZAIndexRange(scatteringTextureSize[2]);
+    const auto altRange=precomputedAltitudeIndexRange();
+    return {scatteringTextureSize[0], scatteringTextureSize[1], szaRange[1]-szaRange[0]+1, altRange[1]-altRange[0]+1};
+}
@@ -75,6 +75,10 @@ struct AtmosphereParameters
     unsigned scatteringOrdersToCompute;
     GLint numTransmittanceIntegrationPoints;
     GLint radialIntegrationPoints;
+    // Applies to the radial integrals of transmittance, single and multiple scattering
+    RadialQuadrature radialQuadrature=RadialQuadrature::Trapezoid;
+    // Density scale height assumed by the exponential rule
+    GLfloat radialQuadratureScaleHeight=8000;
     GLint angularIntegrationPoints;
     GLint eclipseAngularIntegrationPoints;
     GLfloat earthRadius;
@@ -84,6 +88,12 @@ struct AtmosphereParameters
     GLfloat sunAngularRadius; // calculated from earthSunDistance
     float lengthOfHorizRayFromGroundToBorderOfAtmo; // calculated from atmosphereHeight and earthRadius
     // moonAngularRadius is calculated from earthMoonDistance and other parameters on the fly, so isn't kept here
+    // The part of the domain of the 4D textures that is saved to disk. Intermediate textures still cover the
+    // whole domain, since multiple scattering at any point depends on scattering from all the atmosphere.
+    GLfloat minPrecomputedAltitude=0;
+    GLfloat maxPrecomputedAltitude=NAN; // atmosphereHeight if not specified
+    double minPrecomputedSunZenithAngle=0;
+    double maxPrecomputedSunZenithAngle=M_PI;
     std::vector<glm::vec4> groundAlbedo;
     std::vector<Scatterer> scatterers;
     std::vector<Absorber> absorbers;
@@ -99,6 +109,17 @@ struct AtmosphereParameters
     auto scatTexWidth()  const { return GLsizei(scatteringTextureSize[0]); }
     auto scatTexHeight() const { return GLsizei(scatteringTextureSize[1]*scatteringTextureSize[2]); }
     auto scatTexDepth()  const { return GLsizei(scatteringTextureSize[3]); }
+    // XXX: keep in sync with the GLSL versions in texture-coordinates.frag
+    double altitudeToUnitRangeTexCoord(double altitude) const;
+    double cosSZAToUnitRangeTexCoord(double cosSZA) const;
+    /* Ranges of indices [first, last] of the points along the altitude and Sun zenith angle dimensions of a 4D
+     * texture that cover the precomputed domain. There are at least two points in each range, so that they can
+     * be interpolated between. Altitude size is the same for all the 4D textures.
+     */
+    glm::ivec2 precomputedAltitudeIndexRange() const;
+    glm::ivec2 precomputedSZAIndexRange(int texSizeBySZA) const;
+    // Sizes of the 4D scattering textures as saved to disk, cropped to the precomputed domain
+    glm::ivec4 precomputedScatteringTextureSize() const;
     unsigned wavelengthsIndex(glm::vec4 const& wavelengths) const
     {
         const auto it=std::find(allWavelengths.begin(), allWavelengths.end(), wavelengths);
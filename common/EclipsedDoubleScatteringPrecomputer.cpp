@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <chrono>
+#include <tuple>
 
 #include <glm/gtx/transform.hpp>
 
@@ -88,8 +89,8 @@ std::pair<std::vector<float>/*above horizon*/,std::vector<float>/*below horizon*
 }
 
 // XXX: keep in sync with the GLSL version in texture-coordinates.{frag,h.glsl}
-std::pair<float,bool> EclipsedDoubleScatteringPrecomputer::eclipseTexCoordsToTexVars_cosVZA_VRIG(const float vzaTexCoordInUnitRange,
-                                                                                                 const float altitude) const
+std::pair<float,bool> EclipsedDoubleScatteringPrecomputer::Interpolator::eclipseTexCoordsToTexVars_cosVZA_VRIG(const float vzaTexCoordInUnitRange,
+                                                                                                               const float altitude) const
 {
     using namespace std;
 
@@ -133,11 +134,9 @@ EclipsedDoubleScatteringPrecomputer::
     , texSizeByViewAzimuth(texSizeByViewAzimuth)
     , texSizeByViewElevation(texSizeByViewElevation)
     , texSizeBySZA(texSizeBySZA)
-    , texSizeByAltitude(texSizeByAltitude)
     , texW(atmo.eclipseAngularIntegrationPoints)
     , texH(atmo.radialIntegrationPoints)
-    , texture_(texSizeByViewAzimuth*texSizeByViewElevation*texSizeBySZA*texSizeByAltitude)
-    , fourierIntermediate(texSizeByViewAzimuth)
+    , interpolator_(std::make_shared<Interpolator>(atmo, texSizeByViewAzimuth, texSizeByViewElevation, texSizeBySZA, texSizeByAltitude))
 {
     // XXX: keep in sync with its use in GLSL computeDoubleScatteringEclipsedDensitySample() and C++ initTexturesAndFramebuffers()
 
@@ -146,16 +145,6 @@ EclipsedDoubleScatteringPrecomputer::
     origViewportWidth=viewport[2];
     origViewportHeight=viewport[3];
     gl.glViewport(0,0, texW,texH);
-
-    const auto nAzimuthPairsToSample=atmo.eclipsedDoubleScatteringNumberOfAzimuthPairsToSample;
-    const auto nElevationPairsToSample=atmo.eclipsedDoubleScatteringNumberOfElevationPairsToSample;
-    for(auto& s : samplesAboveHorizon)
-        s.resize(4*nElevationPairsToSample*nAzimuthPairsToSample);
-    for(auto& s : samplesBelowHorizon)
-        s.resize(4*nElevationPairsToSample*nAzimuthPairsToSample);
-
-    for(auto& r : radianceInterpolatedOverElevations)
-        r.resize(texSizeByViewElevation*2*nAzimuthPairsToSample);
 }
 
 EclipsedDoubleScatteringPrecomputer::~EclipsedDoubleScatteringPrecomputer()
@@ -163,9 +152,21 @@ EclipsedDoubleScatteringPrecomputer::~EclipsedDoubleScatteringPrecomputer()
     gl.glViewport(0,0, origViewportWidth,origViewportHeight);
 }
 
-void EclipsedDoubleScatteringPrecomputer::compute(const unsigned altIndex, const unsigned szaIndex,
-                                                  const double cameraAltitude, const double sunZenithAngle,
-                                                  const double moonZenithAngle, const double moonAzimuthRelativeToSun)
+EclipsedDoubleScatteringPrecomputer::Interpolator::Interpolator(AtmosphereParameters const& atmo,
+                                                                const unsigned texSizeByViewAzimuth,
+                                                                const unsigned texSizeByViewElevation,
+                                                                const unsigned texSizeBySZA, const unsigned texSizeByAltitude)
+    : atmo(atmo)
+    , texSizeByViewAzimuth(texSizeByViewAzimuth)
+    , texSizeByViewElevation(texSizeByViewElevation)
+    , texSizeBySZA(texSizeBySZA)
+    , altitudeSlices_(texSizeByAltitude)
+{
+}
+
+auto EclipsedDoubleScatteringPrecomputer::sample(const unsigned altIndex, const unsigned szaIndex,
+                                                 const double cameraAltitude, const double sunZenithAngle,
+                                                 const double moonZenithAngle, const double moonAzimuthRelativeToSun) -> Samples
 {
     using namespace glm;
     using std::sin;
@@ -198,9 +199,19 @@ void EclipsedDoubleScatteringPrecomputer::compute(const unsigned altIndex, const
 
     // These elevations span from forward horizon to backward horizon. This is to
     // use spline interpolation to compute the value at the zenith.
-    const auto [elevationsAboveHorizon, elevationsBelowHorizon]=generateElevationsForEclipsedDoubleScattering(cameraAltitude);
+    Samples samples;
+    samples.altIndex=altIndex;
+    samples.szaIndex=szaIndex;
+    samples.cameraAltitude=cameraAltitude;
+    std::tie(samples.elevationsAboveHorizon, samples.elevationsBelowHorizon)=generateElevationsForEclipsedDoubleScattering(cameraAltitude);
+    const auto& elevationsAboveHorizon=samples.elevationsAboveHorizon;
+    const auto& elevationsBelowHorizon=samples.elevationsBelowHorizon;
+    for(auto& s : samples.aboveHorizon)
+        s.resize(4*nElevationPairsToSample*nAzimuthPairsToSample);
+    for(auto& s : samples.belowHorizon)
+        s.resize(4*nElevationPairsToSample*nAzimuthPairsToSample);
 
-    const auto azimuths=[this, nAzimuthPairsToSample]
+    const auto azimuths=[nAzimuthPairsToSample]
     {
         const auto step=M_PI/nAzimuthPairsToSample;
         std::vector<float> azimuths;
@@ -226,7 +237,7 @@ void EclipsedDoubleScatteringPrecomputer::compute(const unsigned altIndex, const
             // Extracting the pixel containing the sum - the integral over the view direction and scattering directions
             const auto integral=sumTexels(gl, intermediateTextureName, texW, texH, GL_TEXTURE0+intermediateTextureTexUnitNum);
             for(unsigned i=0; i<VEC_ELEM_COUNT; ++i)
-                samplesAboveHorizon[i][azimIndex*elevCount+elevIndex]=vec2(elev, log(integral[i]));
+                samples.aboveHorizon[i][azimIndex*elevCount+elevIndex]=vec2(elev, log(integral[i]));
         }
         for(unsigned elevIndex=0; elevIndex<elevCount; ++elevIndex)
         {
@@ -238,23 +249,38 @@ void EclipsedDoubleScatteringPrecomputer::compute(const unsigned altIndex, const
             // Extracting the pixel containing the sum - the integral over the view direction and scattering directions
             const auto integral=sumTexels(gl, intermediateTextureName, texW, texH, GL_TEXTURE0+intermediateTextureTexUnitNum);
             for(unsigned i=0; i<VEC_ELEM_COUNT; ++i)
-                samplesBelowHorizon[i][azimIndex*elevCount+elevIndex]=vec2(elev, log(integral[i]));
+                samples.belowHorizon[i][azimIndex*elevCount+elevIndex]=vec2(elev, log(integral[i]));
         }
     }
+    return samples;
+}
+
+void EclipsedDoubleScatteringPrecomputer::Interpolator::interpolate(Samples const& samples)
+{
+    using namespace glm;
+    using std::asin;
+
+    const auto nAzimuthPairsToSample=atmo.eclipsedDoubleScatteringNumberOfAzimuthPairsToSample;
+    const auto& elevationsAboveHorizon=samples.elevationsAboveHorizon;
+    const auto& elevationsBelowHorizon=samples.elevationsBelowHorizon;
+    const auto elevCount=elevationsAboveHorizon.size();
 
     // 2. Interpolate the samples over the circles of elevations using second order spline interpolation
+    std::vector<float> radianceInterpolatedOverElevations[VEC_ELEM_COUNT];
+    for(auto& r : radianceInterpolatedOverElevations)
+        r.resize(texSizeByViewElevation*2*nAzimuthPairsToSample);
     for(unsigned azimIndex=0; azimIndex<nAzimuthPairsToSample; ++azimIndex)
     {
         SplineOrder2InterpolationFunction<float,vec2> intFuncsAboveHorizon[VEC_ELEM_COUNT];
         for(unsigned i=0; i<VEC_ELEM_COUNT; ++i)
-            intFuncsAboveHorizon[i]=splineInterpolationOrder2(&samplesAboveHorizon[i][azimIndex*elevCount], elevCount);
+            intFuncsAboveHorizon[i]=splineInterpolationOrder2(&samples.aboveHorizon[i][azimIndex*elevCount], elevCount);
         SplineOrder2InterpolationFunction<float,vec2> intFuncsBelowHorizon[VEC_ELEM_COUNT];
         for(unsigned i=0; i<VEC_ELEM_COUNT; ++i)
-            intFuncsBelowHorizon[i]=splineInterpolationOrder2(&samplesBelowHorizon[i][azimIndex*elevCount], elevCount);
+            intFuncsBelowHorizon[i]=splineInterpolationOrder2(&samples.belowHorizon[i][azimIndex*elevCount], elevCount);
         for(unsigned texElevIndex=0; texElevIndex<texSizeByViewElevation; ++texElevIndex)
         {
             const auto [cosVZA, viewRayIntersectsGround]=
-                eclipseTexCoordsToTexVars_cosVZA_VRIG(float(texElevIndex)/(texSizeByViewElevation-1), cameraAltitude);
+                eclipseTexCoordsToTexVars_cosVZA_VRIG(float(texElevIndex)/(texSizeByViewElevation-1), samples.cameraAltitude);
             const auto& intFuncs=viewRayIntersectsGround ? intFuncsBelowHorizon : intFuncsAboveHorizon;
             const double elevMin = (viewRayIntersectsGround ? elevationsBelowHorizon : elevationsAboveHorizon).front();
             const double elevMax = (viewRayIntersectsGround ? elevationsBelowHorizon : elevationsAboveHorizon).back();
@@ -274,19 +300,22 @@ void EclipsedDoubleScatteringPrecomputer::compute(const unsigned altIndex, const
     }
 
     // 3. Interpolate the resulting interpolations over azimuths using Fourier interpolation and save into the final texture
+    auto& slice=altitudeSlices_[samples.altIndex];
+    if(slice.empty())
+        slice.resize(texSizeByViewAzimuth*texSizeByViewElevation*texSizeBySZA);
+    std::vector<std::complex<float>> fourierIntermediate(texSizeByViewAzimuth);
     std::vector<float> interpolated[VEC_ELEM_COUNT];
     for(auto& in : interpolated)
         in.resize(texSizeByViewAzimuth);
     for(unsigned texElevIndex=0; texElevIndex<texSizeByViewElevation; ++texElevIndex)
     {
         const auto indexInPrevStepArray = texElevIndex*2*nAzimuthPairsToSample;
-        const auto indexOfLineInTexture = texSizeByViewAzimuth*(texSizeByViewElevation*(texSizeBySZA*altIndex + szaIndex) +
-                                                                texElevIndex);
+        const auto indexOfLineInSlice = texSizeByViewAzimuth*(texSizeByViewElevation*samples.szaIndex + texElevIndex);
         for(unsigned i=0; i<VEC_ELEM_COUNT; ++i)
             fourierInterpolate(&radianceInterpolatedOverElevations[i][indexInPrevStepArray], 2*nAzimuthPairsToSample,
                                fourierIntermediate.data(),
                                interpolated[i].data(), texSizeByViewAzimuth);
         for(unsigned i=0; i<texSizeByViewAzimuth; ++i)
-            texture_[indexOfLineInTexture+i] = vec4(interpolated[0][i],interpolated[1][i],interpolated[2][i],interpolated[3][i]);
+            slice[indexOfLineInSlice+i] = vec4(interpolated[0][i],interpolated[1][i],interpolated[2][i],interpolated[3][i]);
     }
 }
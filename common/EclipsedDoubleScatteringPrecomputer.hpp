@@ -1,6 +1,7 @@
 #ifndef INCLUDE_ONCE_9100E17F_B7DD_4CC0_8D2F_9DBB66C7D23D
 #define INCLUDE_ONCE_9100E17F_B7DD_4CC0_8D2F_9DBB66C7D23D
 
+#include <memory>
 #include <vector>
 #include <utility>
 #include <complex>
@@ -10,6 +11,48 @@
 
 class EclipsedDoubleScatteringPrecomputer
 {
+public:
+    static constexpr unsigned VEC_ELEM_COUNT=4; // number of components in the partial radiance vector
+
+    // Samples of radiance on a coarse grid of view directions for one altitude and Sun zenith angle
+    struct Samples
+    {
+        unsigned altIndex, szaIndex;
+        double cameraAltitude;
+        std::vector<float> elevationsAboveHorizon, elevationsBelowHorizon;
+        // One container per vec4 component. The separation into above-horizon and below-horizon parts is because at some
+        // altitudes there's a jump (or simply rapid change) in radiance at the horizon, so spline interpolation would misbehave
+        // near this point if done without separation.
+        std::vector<glm::vec2> aboveHorizon[VEC_ELEM_COUNT];
+        std::vector<glm::vec2> belowHorizon[VEC_ELEM_COUNT];
+    };
+
+    /* Interpolates the samples into the output texture. This doesn't use OpenGL, so it can be done in
+     * another thread, and samples for different altitudes may be interpolated concurrently.
+     *
+     * Altitude is the slowest-varying coordinate of the texture, so the texture is kept as separate slices
+     * for each altitude. A slice is allocated on the first interpolation into it, and can be taken away
+     * (e.g. to be written to a file) as soon as it's complete, so that the whole texture needn't be in memory.
+     */
+    class Interpolator
+    {
+        AtmosphereParameters const& atmo;
+        const unsigned texSizeByViewAzimuth;
+        const unsigned texSizeByViewElevation;
+        const unsigned texSizeBySZA;
+        std::vector<std::vector<glm::vec4>> altitudeSlices_;
+
+        std::pair<float,bool> eclipseTexCoordsToTexVars_cosVZA_VRIG(float vzaTexCoordInUnitRange, float altitude) const;
+    public:
+        Interpolator(AtmosphereParameters const& atmo,
+                     unsigned texSizeByViewAzimuth, unsigned texSizeByViewElevation,
+                     unsigned texSizeBySZA, unsigned texSizeByAltitude);
+        void interpolate(Samples const& samples);
+        std::vector<glm::vec4> const& altitudeSlice(unsigned altIndex) const { return altitudeSlices_[altIndex]; }
+        std::vector<glm::vec4> takeAltitudeSlice(unsigned altIndex) { return std::move(altitudeSlices_[altIndex]); }
+    };
+
+private:
     QOpenGLShaderProgram& program;
     QOpenGLFunctions_3_3_Core& gl;
     AtmosphereParameters const& atmo;
@@ -18,26 +61,13 @@ class EclipsedDoubleScatteringPrecomputer
     const unsigned texSizeByViewAzimuth;
     const unsigned texSizeByViewElevation;
     const unsigned texSizeBySZA;
-    const unsigned texSizeByAltitude;
 
     const double texW, texH; // size of the intermediate texture we are rendering to
-    std::vector<glm::vec4> texture_; // output 4D texture data
-    std::vector<std::complex<float>> fourierIntermediate;
-
-    static constexpr unsigned VEC_ELEM_COUNT=4; // number of components in the partial radiance vector
-    // The samples of radiance, one container per vec4 component. These containers are re-used for different altitudes and Sun elevations.
-    // The separation into above-horizon and below-horizon parts is because at some altitudes there's a jump (or simply rapid change) in
-    // radiance at the horizon, so spline interpolation would misbehave near this point if done without separation.
-    std::vector<glm::vec2> samplesAboveHorizon[VEC_ELEM_COUNT];
-    std::vector<glm::vec2> samplesBelowHorizon[VEC_ELEM_COUNT];
-    // The samples of radiance interpolated over view elevations but not yet over view azimuths, one container per vec4 component.
-    // These containers are re-used for different altitudes and Sun elevations.
-    std::vector<float> radianceInterpolatedOverElevations[VEC_ELEM_COUNT];
+    std::shared_ptr<Interpolator> interpolator_;
 
     GLint origViewportWidth, origViewportHeight;
 
     float cosZenithAngleOfHorizon(const float altitude) const;
-    std::pair<float,bool> eclipseTexCoordsToTexVars_cosVZA_VRIG(float vzaTexCoordInUnitRange, float altitude) const;
     std::pair<std::vector<float>/*above horizon*/,std::vector<float>/*below horizon*/>
         generateElevationsForEclipsedDoubleScattering(float cameraAltitude) const;
 public:
@@ -53,9 +83,14 @@ public:
                                         unsigned texSizeByViewAzimuth, unsigned texSizeByViewElevation,
                                         unsigned texSizeBySZA, unsigned texSizeByAltitude);
     ~EclipsedDoubleScatteringPrecomputer();
+    Samples sample(unsigned altIndex, unsigned szaIndex, double cameraAltitude, double sunZenithAngle,
+                   double moonZenithAngle, double moonAzimuthRelativeToSun);
     void compute(unsigned altIndex, unsigned szaIndex, double cameraAltitude, double sunZenithAngle,
-                 double moonZenithAngle, double moonAzimuthRelativeToSun);
-    std::vector<glm::vec4> const& texture() const { return texture_; }
+                 double moonZenithAngle, double moonAzimuthRelativeToSun)
+    { interpolator_->interpolate(sample(altIndex, szaIndex, cameraAltitude, sunZenithAngle, moonZenithAngle, moonAzimuthRelativeToSun)); }
+    // The interpolator may outlive the precomputer, e.g. to finish the interpolation in another thread
+    std::shared_ptr<Interpolator> const& interpolator() const { return interpolator_; }
+    std::vector<glm::vec4> const& altitudeSlice(unsigned altIndex) const { return interpolator_->altitudeSlice(altIndex); }
 };
 
 #endif
@@ -0,0 +1,174 @@
+#include "ProgramBinaryCache.hpp"
+#include <cstring>
+#include <filesystem>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+#include <qopenglext.h>
+
+namespace ProgramBinaryCache
+{
+
+namespace
+{
+
+struct BinaryFunctions
+{
+    PFNGLGETPROGRAMBINARYPROC glGetProgramBinary=nullptr;
+    PFNGLPROGRAMBINARYPROC glProgramBinary=nullptr;
+    PFNGLPROGRAMPARAMETERIPROC glProgramParameteri=nullptr;
+    bool supported() const { return glGetProgramBinary && glProgramBinary && glProgramParameteri; }
+};
+
+BinaryFunctions getFunctions(QOpenGLContext& context)
+{
+    BinaryFunctions funcs;
+    const auto version=context.format().version();
+    if(version < qMakePair(4,1) && !context.hasExtension("GL_ARB_get_program_binary"))
+        return funcs;
+
+    GLint formatCount=0;
+    context.functions()->glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    if(formatCount<=0)
+        return funcs;
+
+    funcs.glGetProgramBinary=reinterpret_cast<PFNGLGETPROGRAMBINARYPROC>(context.getProcAddress("glGetProgramBinary"));
+    funcs.glProgramBinary=reinterpret_cast<PFNGLPROGRAMBINARYPROC>(context.getProcAddress("glProgramBinary"));
+    funcs.glProgramParameteri=reinterpret_cast<PFNGLPROGRAMPARAMETERIPROC>(context.getProcAddress("glProgramParameteri"));
+    return funcs;
+}
+
+constexpr qint64 maxCacheSize=256ll<<20;
+
+QString cacheDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)+"/CalcMySky/program-binaries";
+}
+
+QString cacheFilePath(QOpenGLContext& context, QByteArray const& sourcesHash)
+{
+    const auto gl=context.functions();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(sourcesHash);
+    for(const auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+    {
+        hash.addData(reinterpret_cast<const char*>(gl->glGetString(name)));
+        hash.addData("\n", 1);
+    }
+    return cacheDir()+"/"+hash.result().toHex()+".bin";
+}
+
+// Modification time of a binary is the time it was last used
+void markAsUsed(QString const& path)
+{
+    std::error_code err;
+    std::filesystem::last_write_time(std::filesystem::u8path(path.toStdString()), std::filesystem::file_time_type::clock::now(), err);
+}
+
+void evictLeastRecentlyUsed()
+{
+    const auto files=QDir(cacheDir()).entryInfoList({"*.bin"}, QDir::Files, QDir::Time);
+    qint64 totalSize=0;
+    for(const auto& file : files)
+    {
+        totalSize += file.size();
+        if(totalSize > maxCacheSize)
+            QFile::remove(file.filePath());
+    }
+}
+
+}
+
+bool load(QOpenGLShaderProgram& program, QByteArray const& sourcesHash)
+{
+    const auto context=QOpenGLContext::currentContext();
+    if(!context) return false;
+    const auto funcs=getFunctions(*context);
+    if(!funcs.supported()) return false;
+
+    const auto path=cacheFilePath(*context, sourcesHash);
+    QFile file(path);
+    if(!file.open(QFile::ReadOnly))
+        return false;
+    const auto data=file.readAll();
+    file.close();
+    GLenum format;
+    if(data.size() <= int(sizeof format))
+    {
+        QFile::remove(path);
+        return false;
+    }
+    std::memcpy(&format, data.data(), sizeof format);
+
+    const auto gl=context->functions();
+    const auto programId=program.programId();
+    if(!programId) return false;
+    funcs.glProgramBinary(programId, format, data.data()+sizeof format, data.size()-sizeof format);
+    GLint linked=GL_FALSE;
+    gl->glGetProgramiv(programId, GL_LINK_STATUS, &linked);
+    if(!linked)
+    {
+        // Stale binary, e.g. after a driver update that didn't change GL_VERSION
+        while(gl->glGetError()!=GL_NO_ERROR);
+        QFile::remove(path);
+        return false;
+    }
+    markAsUsed(path);
+    // With no shaders attached, QOpenGLShaderProgram::link() only checks link status
+    program.removeAllShaders();
+    return program.link();
+}
+
+void prepareForLink(QOpenGLShaderProgram& program)
+{
+    const auto context=QOpenGLContext::currentContext();
+    if(!context) return;
+    const auto funcs=getFunctions(*context);
+    if(!funcs.supported()) return;
+    // Without this hint drivers aren't required to make the binary retrievable
+    funcs.glProgramParameteri(program.programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void save(QOpenGLShaderProgram& program, QByteArray const& sourcesHash)
+{
+    const auto context=QOpenGLContext::currentContext();
+    if(!context) return;
+    const auto funcs=getFunctions(*context);
+    if(!funcs.supported()) return;
+
+    const auto gl=context->functions();
+    const auto programId=program.programId();
+    GLint length=0;
+    gl->glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length<=0) return;
+
+    GLenum format=0;
+    QByteArray data(sizeof format + length, '\0');
+    GLsizei lengthReturned=0;
+    funcs.glGetProgramBinary(programId, length, &lengthReturned, &format, data.data()+sizeof format);
+    if(lengthReturned<=0)
+    {
+        while(gl->glGetError()!=GL_NO_ERROR);
+        return;
+    }
+    std::memcpy(data.data(), &format, sizeof format);
+    data.resize(sizeof format + lengthReturned);
+
+    const auto path=cacheFilePath(*context, sourcesHash);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if(!file.open(QFile::WriteOnly) || file.write(data)!=data.size() || !file.commit())
+    {
+        qWarning().nospace() << "Failed to save program binary to " << path << ": " << file.errorString();
+        return;
+    }
+    evictLeastRecentlyUsed();
+}
+
+}
@@ -0,0 +1,24 @@
+#ifndef INCLUDE_ONCE_62201EE1_0805_4B50_9CD2_400B9665914A
+#define INCLUDE_ONCE_62201EE1_0805_4B50_9CD2_400B9665914A
+
+#include <QByteArray>
+#include <QOpenGLShaderProgram>
+
+/* On-disk cache of linked program binaries, shared by CalcMySky and ShowMySky. The key is the hash of
+ * all the sources of the program, combined with GL_VENDOR, GL_RENDERER and GL_VERSION of the current
+ * context. If the driver doesn't support program binaries or rejects a cached one, the loading function
+ * simply returns false, and the caller is expected to compile and link the program as usual. The cache
+ * is limited in size, the least recently used binaries are removed when it grows over the limit.
+ */
+namespace ProgramBinaryCache
+{
+
+// On success removes all shaders from the program and leaves it linked
+bool load(QOpenGLShaderProgram& program, QByteArray const& sourcesHash);
+// Must be called before linking a program that's going to be saved
+void prepareForLink(QOpenGLShaderProgram& program);
+void save(QOpenGLShaderProgram& program, QByteArray const& sourcesHash);
+
+}
+
+#endif
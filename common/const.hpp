@@ -7,4 +7,9 @@ constexpr double AU=astronomicalUnit;
 constexpr double sunRadius=696350e3; /* m */
 constexpr auto moonRadius=1737.1e3; /* m */
 
+// Tabulated phase functions are bound to this unit both in CalcMySky and in ShowMySky
+constexpr int PHASE_FUNCTION_TEXTURE_UNIT=14;
+// Same for the nodes of the Gauss-Legendre radial quadrature
+constexpr int RADIAL_QUADRATURE_TEXTURE_UNIT=13;
+
 #endif
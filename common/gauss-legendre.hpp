@@ -0,0 +1,43 @@
+#ifndef INCLUDE_ONCE_F2588661_888F_4F80_AF70_26B459E0D698
+#define INCLUDE_ONCE_F2588661_888F_4F80_AF70_26B459E0D698
+
+#define _USE_MATH_DEFINES // for MSVC to define M_PI
+#include <cmath>
+#include <vector>
+
+struct GaussLegendreNode
+{
+    double x, weight;
+};
+
+// Nodes of the Gauss-Legendre rule on [0,1], in ascending order. The weights sum to 1.
+inline std::vector<GaussLegendreNode> gaussLegendreNodes(const int count)
+{
+    std::vector<GaussLegendreNode> nodes(count);
+    for(int i=0; i<(count+1)/2; ++i)
+    {
+        // Newton's method for the i-th root of the Legendre polynomial, starting from its asymptotic estimate
+        double x=std::cos(M_PI*(i+0.75)/(count+0.5));
+        double derivative=1;
+        for(int iteration=0; iteration<100; ++iteration)
+        {
+            double p=x, pPrev=1;
+            for(int k=2; k<=count; ++k)
+            {
+                const double pNext=((2*k-1)*x*p-(k-1)*pPrev)/k;
+                pPrev=p;
+                p=pNext;
+            }
+            derivative = count==1 ? 1 : count*(x*p-pPrev)/(x*x-1);
+            const double dx=p/derivative;
+            x-=dx;
+            if(std::abs(dx)<1e-15) break;
+        }
+        const double weight=1/((1-x*x)*derivative*derivative);
+        nodes[i]={(1-x)/2, weight};
+        nodes[count-1-i]={(1+x)/2, weight};
+    }
+    return nodes;
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef INCLUDE_ONCE_B54901E9_1343_4285_B60A_8C7C01838BCB
+#define INCLUDE_ONCE_B54901E9_1343_4285_B60A_8C7C01838BCB
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/* A texture file starts with a header of uint16_t sizes of the texture along each of its dimensions, their
+ * number being implied by the kind of the texture. RGBA texels follow, the first dimension varying fastest.
+ *
+ * No size can be zero, so a zero in place of the first size marks an extended header, where the next
+ * uint16_t is the type of the texel components, and the sizes follow it. Without the mark the components
+ * are 32-bit floats, and such files are still written with the plain header, so that older readers can
+ * load them.
+ */
+
+constexpr uint16_t TEXTURE_FILE_EXTENDED_HEADER_MARK=0;
+
+enum class TextureElementType : uint16_t
+{
+    Float32=32,
+    Float16=16,
+};
+
+inline size_t textureElementSize(const TextureElementType type)
+{
+    return type==TextureElementType::Float16 ? 2 : 4;
+}
+
+inline std::vector<uint16_t> textureFileHeader(std::vector<uint16_t> const& sizes, const TextureElementType type)
+{
+    if(type==TextureElementType::Float32)
+        return sizes;
+    std::vector<uint16_t> header{TEXTURE_FILE_EXTENDED_HEADER_MARK, uint16_t(type)};
+    header.insert(header.end(), sizes.begin(), sizes.end());
+    return header;
+}
+
+inline bool isSupportedTextureElementType(const uint16_t type)
+{
+    return type==uint16_t(TextureElementType::Float32) || type==uint16_t(TextureElementType::Float16);
+}
+
+/* Reads the header of a texture with dimensionCount dimensions, calling readValue(uint16_t&) for each of its
+ * values. Returns the code of the type of texel components, which may be unsupported by this reader.
+ */
+template<typename ReadValue>
+uint16_t parseTextureFileHeader(ReadValue const& readValue, uint16_t*const sizes, const int dimensionCount)
+{
+    uint16_t type=uint16_t(TextureElementType::Float32);
+    readValue(sizes[0]);
+    if(sizes[0]==TEXTURE_FILE_EXTENDED_HEADER_MARK)
+    {
+        readValue(type);
+        readValue(sizes[0]);
+    }
+    for(int i=1; i<dimensionCount; ++i)
+        readValue(sizes[i]);
+    return type;
+}
+
+#endif
@@ -1,11 +1,8 @@
 #ifndef INCLUDE_ONCE_DEB2337F_9F23_4272_A108_A1F407876313
 #define INCLUDE_ONCE_DEB2337F_9F23_4272_A108_A1F407876313
 
-template<typename T>
-std::string formatDeltaTime(const std::chrono::time_point<T> timeBegin, const std::chrono::time_point<T> timeEnd)
+inline std::string formatDuration(const double secondsTaken)
 {
-    const auto microsecTaken=std::chrono::duration_cast<std::chrono::microseconds>(timeEnd-timeBegin).count();
-    const auto secondsTaken=1e-6*microsecTaken;
     std::ostringstream ss;
     if(secondsTaken<60)
     {
@@ -32,4 +29,11 @@ std::string formatDeltaTime(const std::chrono::time_point<T> timeBegin, const st
     return ss.str();
 }
 
+template<typename T>
+std::string formatDeltaTime(const std::chrono::time_point<T> timeBegin, const std::chrono::time_point<T> timeEnd)
+{
+    const auto microsecTaken=std::chrono::duration_cast<std::chrono::microseconds>(timeEnd-timeBegin).count();
+    return formatDuration(1e-6*microsecTaken);
+}
+
 #endif
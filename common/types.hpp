@@ -32,6 +32,32 @@ inline PhaseFunctionType parsePhaseFunctionType(QString const& type, QString con
     throw ParsingError(filename, lineNumber, QObject::tr("bad phase function type %1").arg(type));
 }
 
+enum class RadialQuadrature
+{
+    Trapezoid,     //!< Uniform steps along the ray
+    GaussLegendre, //!< Gauss-Legendre nodes over the whole ray
+    Exponential,   //!< Uniform steps in a coordinate in which the density changes by the same factor at each step
+};
+
+inline QString toString(RadialQuadrature rule)
+{
+    switch(rule)
+    {
+    case RadialQuadrature::Trapezoid:     return "trapezoid";
+    case RadialQuadrature::GaussLegendre: return "gauss-legendre";
+    case RadialQuadrature::Exponential:   return "exponential";
+    }
+    return QString("bad rule %1").arg(static_cast<int>(rule));
+}
+
+inline RadialQuadrature parseRadialQuadrature(QString const& rule, QString const& filename, const int lineNumber)
+{
+    if(rule=="trapezoid")      return RadialQuadrature::Trapezoid;
+    if(rule=="gauss-legendre") return RadialQuadrature::GaussLegendre;
+    if(rule=="exponential")    return RadialQuadrature::Exponential;
+    throw ParsingError(filename, lineNumber, QObject::tr("bad radial integration rule %1").arg(rule));
+}
+
 enum SingleScatteringRenderMode
 {
     SSRM_ON_THE_FLY,
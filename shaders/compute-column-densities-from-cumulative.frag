@@ -0,0 +1,40 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+#include "common-functions.h.glsl"
+#include "texture-coordinates.h.glsl"
+#include "cumulative-column-densities.h.glsl"
+
+in vec3 position;
+out vec4 columnDensities;
+
+uniform sampler3D cumulativeColumnDensitiesTexture;
+uniform int group;
+
+vec4 cumulativeColumnDensities(const float impactParameter, const float dist)
+{
+    const vec3 size=vec3(textureSize(cumulativeColumnDensitiesTexture, 0));
+    const vec2 coords=vec2(distanceToCumulativeTableColumn(impactParameter, dist),
+                           impactParameterToCumulativeTableRow(impactParameter));
+    return texture(cumulativeColumnDensitiesTexture, vec3((coords*(size.xy-1)+0.5)/size.xy, (group+0.5)/size.z));
+}
+
+// This assumes that ray doesn't intersect Earth
+void main()
+{
+    const vec2 texCoord=0.5*position.xy+vec2(0.5);
+    const TransmittanceTexVars vars=transmittanceTexCoordToTexVars(texCoord);
+    const float r=earthRadius+vars.altitude;
+    const float mu=vars.cosViewZenithAngle;
+    const float impactParameter=min(r*safeSqrt(1-sqr(mu)), earthRadius+atmosphereHeight);
+    // Distance from the point of the closest approach along the line, negative if the ray passes through it
+    const float dist=r*mu;
+
+    // Any distance beyond the border is clamped to the last column
+    const vec4 toBorder=cumulativeColumnDensities(impactParameter, earthRadius+atmosphereHeight);
+    if(dist>=0)
+        columnDensities=toBorder-cumulativeColumnDensities(impactParameter, dist);
+    else
+        columnDensities=toBorder+cumulativeColumnDensities(impactParameter, -dist);
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDE_ONCE_5C1B7E2A_93D4_4F0B_A6E8_2D7F41C09B35
+#define INCLUDE_ONCE_5C1B7E2A_93D4_4F0B_A6E8_2D7F41C09B35
+vec4 computeColumnDensitiesToAtmosphereBorder(float cosZenithAngle, float altitude);
+// Number densities of the species of the group at the given altitude
+vec4 groupNumberDensities(float altitude);
+#endif
@@ -0,0 +1,37 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+#include "cumulative-column-densities.h.glsl"
+#include "compute-column-densities-functions.h.glsl"
+
+uniform vec2 tableSize;
+out vec4 segmentColumnDensities;
+
+float altitudeOnLine(const float impactParameter, const float dist)
+{
+    return sqrt(sqr(impactParameter)+sqr(dist))-earthRadius;
+}
+
+// Column densities between this table entry and the previous one in the row. The prefix sums over the
+// rows are then done on the CPU.
+void main()
+{
+    const ivec2 texel=ivec2(gl_FragCoord.xy);
+    if(texel.x==0)
+    {
+        segmentColumnDensities=vec4(0);
+        return;
+    }
+    const float p=cumulativeTableRowToImpactParameter(float(texel.y)/(tableSize.y-1));
+    const float dist0=cumulativeTableColumnToDistance(p, float(texel.x-1)/(tableSize.x-1));
+    const float dist1=cumulativeTableColumnToDistance(p, float(texel.x)/(tableSize.x-1));
+
+    const int subdivisions=4;
+    const float dl=(dist1-dist0)/subdivisions;
+    /* Using trapezoid rule on a uniform grid: f0/2+f1+f2+...+f(N-2)+f(N-1)/2. */
+    vec4 sum=(groupNumberDensities(altitudeOnLine(p, dist0))+groupNumberDensities(altitudeOnLine(p, dist1)))/2;
+    for(int n=1; n<subdivisions; ++n)
+        sum+=groupNumberDensities(altitudeOnLine(p, dist0+n*dl));
+    segmentColumnDensities=sum*dl;
+}
@@ -0,0 +1,42 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+#include "common-functions.h.glsl"
+#include "texture-coordinates.h.glsl"
+#include "texture-sampling-functions.h.glsl"
+
+// The incident rays of the scattering density integral for each altitude layer of the scattering texture,
+// the layers following each other. The rows of the table wrap around at this width.
+uniform int tableWidth;
+layout(location=0) out vec4 incidentRay;
+layout(location=1) out vec4 transmittanceToGround;
+
+void main()
+{
+    const int index=int(gl_FragCoord.y)*tableWidth+int(gl_FragCoord.x);
+    const int altitudeLayer=index/angularIntegrationPoints;
+    const int directionIndex=index%angularIntegrationPoints;
+    if(altitudeLayer>=int(scatteringTextureSize[3]))
+    {
+        // Padding of the last row
+        incidentRay=vec4(0);
+        transmittanceToGround=vec4(0);
+        return;
+    }
+
+    const float altitude=scatteringTexIndicesToTexVars(vec3(0,0,altitudeLayer)).altitude;
+    const vec3 incDir=sphereIntegrationSampleDir(directionIndex, angularIntegrationPoints);
+    if(rayIntersectsGround(incDir.z, altitude))
+    {
+        const float distToGround=distanceToGround(incDir.z, altitude);
+        incidentRay=vec4(incDir, distToGround);
+        transmittanceToGround=transmittance(incDir.z, altitude, distToGround, true);
+    }
+    else
+    {
+        // Negative distance marks the rays that don't hit the ground
+        incidentRay=vec4(incDir, -1);
+        transmittanceToGround=vec4(0);
+    }
+}
@@ -5,13 +5,18 @@
 #include "multiple-scattering.h.glsl"
 #include "texture-coordinates.h.glsl"
 
-uniform int layer;
+flat in int layer;
 
-out vec4 scatteringTextureOutput;
+layout(location=0) out vec4 scatteringTextureOutput;
+// Blended into the accumulator in the same pass, if it's attached
+layout(location=1) out vec4 accumulatorOutput;
+
+uniform mat4 radianceToLuminance=mat4(1);
 
 void main()
 {
     const ScatteringTexVars vars=scatteringTexIndicesToTexVars(vec3(gl_FragCoord.xy-vec2(0.5),layer));
     scatteringTextureOutput=computeMultipleScattering(vars.cosSunZenithAngle,vars.cosViewZenithAngle,vars.dotViewSun,
                                                       vars.altitude,vars.viewRayIntersectsGround);
+    accumulatorOutput=radianceToLuminance*scatteringTextureOutput;
 }
@@ -0,0 +1,17 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+
+uniform float lutSize;
+// In units of the LUT texel, 0.5 to sample midway between the entries for the error check
+uniform float sampleOffset;
+out vec4 numberDensities;
+
+#include "compute-column-densities-functions.h.glsl"
+
+void main()
+{
+    const float altitude=atmosphereHeight*(gl_FragCoord.x-0.5+sampleOffset)/(lutSize-1);
+    numberDensities=groupNumberDensities(altitude);
+}
@@ -0,0 +1,35 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+#include "phase-functions.h.glsl"
+
+uniform float lutSize;
+// Number of samples averaged over the angles covered by the texel, 1 to sample only at the texel center
+uniform int subsampleCount;
+out vec4 phaseFunction;
+
+void main()
+{
+    const float dTheta=PI/(lutSize-1);
+    const float centerTheta=(gl_FragCoord.x-0.5)*dTheta;
+    if(subsampleCount==1)
+    {
+        phaseFunction=currentPhaseFunction(cos(centerTheta));
+        return;
+    }
+
+    // Weighting by solid angle keeps the integral of the phase function over the sphere
+    const float thetaMin=max(centerTheta-dTheta/2, 0.);
+    const float thetaMax=min(centerTheta+dTheta/2, PI);
+    vec4 sum=vec4(0);
+    float weightSum=0;
+    for(int n=0; n<subsampleCount; ++n)
+    {
+        const float theta=thetaMin+(n+0.5)*(thetaMax-thetaMin)/subsampleCount;
+        const float weight=sin(theta);
+        sum+=weight*currentPhaseFunction(cos(theta));
+        weightSum+=weight;
+    }
+    phaseFunction=sum/weightSum;
+}
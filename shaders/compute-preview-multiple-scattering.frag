@@ -0,0 +1,70 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+#include "common-functions.h.glsl"
+#include "direct-irradiance.h.glsl"
+#include "texture-coordinates.h.glsl"
+#include "texture-sampling-functions.h.glsl"
+#include "total-scattering-coefficient.h.glsl"
+
+in vec3 position;
+out vec4 multipleScatteringOutput;
+
+/* Radiance of the scattering orders from 2 on, per unit scattering coefficient, in the approximation of
+ * S. Hillaire, "A Scalable and Production Ready Sky and Atmosphere Rendering Technique" (2020): scattering of
+ * orders 2 and higher is isotropic, and the radiance reaching the point is the same as if all the points of the
+ * atmosphere around it were lit the same way. Then the second order is scaled by the sum of the geometric series
+ * 1+f+f^2+..., where f is the fraction of isotropically scattered light that is scattered back to the point.
+ */
+vec4 computePreviewMultipleScattering(const float cosSunZenithAngle, const float altitude)
+{
+    const vec3 zenith=vec3(0,0,1);
+    const vec3 sunDir=vec3(safeSqrt(1-sqr(cosSunZenithAngle)), 0, cosSunZenithAngle);
+    const float r=earthRadius+altitude;
+    const float isotropicPhaseFunction=1/(4*PI);
+    const float dSolidAngle=sphereIntegrationSolidAngleDifferential(angularIntegrationPoints);
+
+    vec4 secondOrderRadiance=vec4(0);
+    vec4 transferFraction=vec4(0);
+    for(int k=0; k<angularIntegrationPoints; ++k)
+    {
+        const vec3 incDir=sphereIntegrationSampleDir(k, angularIntegrationPoints);
+        const bool incRayIntersectsGround=rayIntersectsGround(incDir.z, altitude);
+        const float dotIncSun=dot(incDir, sunDir);
+        const float rayLength=distanceToNearestAtmosphereBoundary(incDir.z, altitude, incRayIntersectsGround);
+        const float dl=rayLength/radialIntegrationPoints;
+
+        vec4 firstOrderRadiance=vec4(0);
+        vec4 transfer=vec4(0);
+        for(int n=0; n<=radialIntegrationPoints; ++n)
+        {
+            const float dist=n*dl;
+            const float altAtDist=clampAltitude(sqrt(sqr(dist)+sqr(r)+2*r*dist*incDir.z)-earthRadius);
+            const float cosSZAatDist=clampCosine((r*cosSunZenithAngle+dist*dotIncSun)/(earthRadius+altAtDist));
+            const vec4 xmittance=transmittance(incDir.z, altitude, dist, incRayIntersectsGround);
+            const vec4 sunIrradiance=solarIrradianceAtTOA*transmittanceToAtmosphereBorder(cosSZAatDist, altAtDist)
+                                                         *sunVisibility(cosSZAatDist, altAtDist);
+            const float weight = n==0||n==radialIntegrationPoints ? 0.5 : 1; // weight by trapezoidal rule
+            firstOrderRadiance += weight*dl*xmittance*sunIrradiance*totalScatteringCoefficient(altAtDist, dotIncSun);
+            transfer += weight*dl*xmittance*totalScatteringCoefficient(altAtDist);
+        }
+        if(incRayIntersectsGround)
+        {
+            const vec3 groundNormal=normalize(zenith*r+incDir*rayLength);
+            const vec4 groundIrradiance=computeDirectGroundIrradiance(dot(groundNormal, sunDir), 0);
+            const float groundBRDF = 1/PI; // Assuming Lambertian BRDF, which is constant
+            firstOrderRadiance += transmittance(incDir.z, altitude, rayLength, true)*groundAlbedo*groundIrradiance*groundBRDF;
+        }
+        secondOrderRadiance += dSolidAngle*isotropicPhaseFunction*firstOrderRadiance;
+        transferFraction += dSolidAngle*isotropicPhaseFunction*transfer;
+    }
+    return secondOrderRadiance/(1-min(transferFraction, vec4(0.999)));
+}
+
+void main()
+{
+    const vec2 texCoord=0.5*position.xy+vec2(0.5);
+    const IrradianceTexVars vars=irradianceTexCoordToTexVars(texCoord);
+    multipleScatteringOutput=computePreviewMultipleScattering(vars.cosSunZenithAngle, vars.altitude);
+}
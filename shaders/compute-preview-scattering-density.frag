@@ -0,0 +1,20 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+#include "texture-coordinates.h.glsl"
+#include "total-scattering-coefficient.h.glsl"
+
+flat in int layer;
+
+// Computed by compute-preview-multiple-scattering.frag, in the same parametrization as the irradiance texture
+uniform sampler2D previewMultipleScatteringTexture;
+
+out vec4 scatteringDensity;
+
+void main()
+{
+    const ScatteringTexVars vars=scatteringTexIndicesToTexVars(vec3(gl_FragCoord.xy-vec2(0.5),layer));
+    const vec2 texCoord=irradianceTexVarsToTexCoord(vars.cosSunZenithAngle, vars.altitude);
+    scatteringDensity=totalScatteringCoefficient(vars.altitude)*texture(previewMultipleScatteringTexture, texCoord);
+}
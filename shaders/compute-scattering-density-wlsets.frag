@@ -0,0 +1,62 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+#include "densities.h.glsl"
+#include "phase-functions.h.glsl"
+#include "common-functions.h.glsl"
+#include "texture-coordinates.h.glsl"
+
+/* Scattering density of the orders from 3 on for several wavelength sets in one pass. The incident rays and the
+ * coordinates at which the textures are sampled don't depend on wavelengths, so they are computed once, and only
+ * the spectral factors and the samples of the textures of each set are repeated. The declarations and the
+ * statements of each set are generated by CalcMySky in place of the upper-case placeholders, the set with index i
+ * having prefix set<i>_ and writing to the output at location i.
+ *
+ * XXX: keep in sync with computeScatteringDensity() in multiple-scattering.frag
+ */
+
+uniform sampler2D incidentRayTable;
+DECLARE_WAVELENGTH_SET_INPUTS_AND_OUTPUTS;
+
+flat in int layer;
+
+void main()
+{
+    const ScatteringTexVars vars=scatteringTexIndicesToTexVars(vec3(gl_FragCoord.xy-vec2(0.5),layer));
+    const float cosSunZenithAngle=vars.cosSunZenithAngle;
+    const float altitude=vars.altitude;
+
+    const vec3 zenith=vec3(0,0,1);
+    const vec3 viewDir=vec3(sqrt(1-sqr(vars.cosViewZenithAngle)), 0, vars.cosViewZenithAngle);
+    const float sunDirX = viewDir.x==0 ? 0 : (vars.dotViewSun - vars.cosViewZenithAngle*cosSunZenithAngle)/viewDir.x;
+    const float sunDirY = sqrt(max(1-sqr(sunDirX)-sqr(cosSunZenithAngle), 0));
+    const vec3 sunDir=vec3(sunDirX, sunDirY, cosSunZenithAngle);
+
+    const float dSolidAngle = sphereIntegrationSolidAngleDifferential(angularIntegrationPoints);
+    const int tableWidth=textureSize(incidentRayTable,0).x;
+    const float groundBRDF = 1/PI; // Assuming Lambertian BRDF, which is constant
+
+    INITIALIZE_SCATTERING_DENSITIES;
+    for(int k=0; k<angularIntegrationPoints; ++k)
+    {
+        const int tableIndex=layer*angularIntegrationPoints+k;
+        const ivec2 tableCoords=ivec2(tableIndex%tableWidth, tableIndex/tableWidth);
+        const vec4 incidentRay=texelFetch(incidentRayTable, tableCoords, 0);
+
+        // Direction to the source of incident ray
+        const vec3 incDir = incidentRay.xyz;
+        const bool incRayIntersectsGround = incidentRay.w>=0;
+        const float distToGround = max(incidentRay.w, 0.);
+
+        // Normal to ground at the point where incident light originates on the ground, with current incDir
+        const vec3 groundNormal = normalize(zenith*(earthRadius+altitude)+incDir*distToGround);
+        const vec2 groundIrradianceCoords=irradianceTexVarsToTexCoord(dot(groundNormal, sunDir), 0);
+        const TexCoordPair scatteringCoords=texVarsToScatteringTexCoords(cosSunZenithAngle, incDir.z, dot(incDir,sunDir),
+                                                                         altitude, incRayIntersectsGround);
+        const float dotViewInc = dot(viewDir, incDir);
+        COMPUTE_SCATTERER_FACTORS;
+
+        ACCUMULATE_SCATTERING_DENSITIES;
+    }
+}
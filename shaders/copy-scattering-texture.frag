@@ -1,7 +1,7 @@
 #version 330
 #extension GL_ARB_shading_language_420pack : require
 
-uniform int layer;
+flat in int layer;
 uniform sampler3D tex;
 out vec4 copy;
 
@@ -0,0 +1,56 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+#include "const.h.glsl"
+#include "common-functions.h.glsl"
+
+/* The table of cumulative column densities is indexed by the impact parameter of a ray, i.e. the distance of
+ * its line from the center of the Earth, and by the distance along the ray from its start, which is either
+ * the point of the closest approach to the center or, for the lines crossing the Earth, the ground.
+ * All the rays of the transmittance texture are segments of these lines, so the column density of each of them
+ * is a difference of two table entries.
+ *
+ * Half of the rows is for the lines crossing the Earth, parametrized by the zenith angle at the ground, and half
+ * for the lines passing above it, parametrized by the altitude of the closest approach. Both are denser near the
+ * horizon, as are the columns near the start of the lines, where the density of the atmosphere changes fastest.
+ */
+
+// Coordinates in [0,1] map to the centers of the first and last texels
+float cumulativeTableRowToImpactParameter(const float row)
+{
+    if(row<0.5)
+    {
+        const float cosZenithAngleAtGround=sqr(1-2*row);
+        return earthRadius*safeSqrt(1-sqr(cosZenithAngleAtGround));
+    }
+    return earthRadius+atmosphereHeight*sqr(2*row-1);
+}
+
+float impactParameterToCumulativeTableRow(const float impactParameter)
+{
+    if(impactParameter<earthRadius)
+    {
+        const float cosZenithAngleAtGround=safeSqrt(1-sqr(impactParameter/earthRadius));
+        return (1-sqrt(cosZenithAngleAtGround))/2;
+    }
+    return (1+sqrt(min((impactParameter-earthRadius)/atmosphereHeight, 1.)))/2;
+}
+
+// Distances along the line from the point of the closest approach to its start and to the atmosphere border
+vec2 cumulativeTableLineRange(const float impactParameter)
+{
+    return vec2(safeSqrt(sqr(earthRadius)-sqr(impactParameter)),
+                safeSqrt(sqr(earthRadius+atmosphereHeight)-sqr(impactParameter)));
+}
+
+float cumulativeTableColumnToDistance(const float impactParameter, const float column)
+{
+    const vec2 range=cumulativeTableLineRange(impactParameter);
+    return range.x+(range.y-range.x)*sqr(column);
+}
+
+float distanceToCumulativeTableColumn(const float impactParameter, const float dist)
+{
+    const vec2 range=cumulativeTableLineRange(impactParameter);
+    return sqrt(clamp((dist-range.x)/max(range.y-range.x, 1.), 0., 1.));
+}
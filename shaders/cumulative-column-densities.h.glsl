@@ -0,0 +1,7 @@
+#ifndef INCLUDE_ONCE_E3A8C5D1_7B42_4F96_9D0E_61C4B2F8A7D3
+#define INCLUDE_ONCE_E3A8C5D1_7B42_4F96_9D0E_61C4B2F8A7D3
+float cumulativeTableRowToImpactParameter(const float row);
+float impactParameterToCumulativeTableRow(const float impactParameter);
+float cumulativeTableColumnToDistance(const float impactParameter, const float column);
+float distanceToCumulativeTableColumn(const float impactParameter, const float dist);
+#endif
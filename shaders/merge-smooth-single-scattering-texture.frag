@@ -4,7 +4,7 @@
 #include "phase-functions.h.glsl"
 #include "texture-coordinates.h.glsl"
 
-uniform int layer;
+flat in int layer;
 uniform sampler3D tex;
 out vec4 result;
 
@@ -6,11 +6,17 @@
 #include "texture-coordinates.h.glsl"
 #include "texture-sampling-functions.h.glsl"
 #include "total-scattering-coefficient.h.glsl"
+#include "radial-quadrature.h.glsl"
 
 uniform sampler3D scatteringDensityTexture;
+// Incident rays for each altitude layer, precomputed by compute-incident-ray-table.frag, since they are the same
+// for all the texels of the layer: directions with distances to the ground, and transmittances to the ground.
+uniform sampler2D incidentRayTable;
+uniform sampler2D incidentRayTransmittanceTable;
 
 vec4 computeScatteringDensity(const float cosSunZenithAngle, const float cosViewZenithAngle, const float dotViewSun,
-                              const float altitude, const int scatteringOrder, const bool radiationIsFromGroundOnly)
+                              const float altitude, const int altitudeLayer, const int scatteringOrder,
+                              const bool radiationIsFromGroundOnly)
 {
     const vec3 zenith=vec3(0,0,1);
     const vec3 viewDir=vec3(sqrt(1-sqr(cosViewZenithAngle)), 0, cosViewZenithAngle);
@@ -26,25 +32,21 @@ vec4 computeScatteringDensity(const float cosSunZenithAngle, const float cosView
     //       sampling them here.
 
     const float dSolidAngle = sphereIntegrationSolidAngleDifferential(angularIntegrationPoints);
+    const int tableWidth=textureSize(incidentRayTable,0).x;
 
     vec4 scatteringDensity = vec4(0);
     // Iterate over all incident directions
     for(int k=0; k<angularIntegrationPoints; ++k)
     {
-        // Direction to the source of incident ray
-        const vec3 incDir = sphereIntegrationSampleDir(k, angularIntegrationPoints);
-        const float cosIncZenithAngle=incDir.z;
-
-        const bool incRayIntersectsGround=rayIntersectsGround(cosIncZenithAngle, altitude);
+        const int tableIndex=altitudeLayer*angularIntegrationPoints+k;
+        const ivec2 tableCoords=ivec2(tableIndex%tableWidth, tableIndex/tableWidth);
+        const vec4 incidentRay=texelFetch(incidentRayTable, tableCoords, 0);
 
-        float distToGround=0;
-        vec4 transmittanceToGround=vec4(0);
-        if(incRayIntersectsGround)
-        {
-            distToGround = distanceToGround(cosIncZenithAngle, altitude);
-            transmittanceToGround = transmittance(cosIncZenithAngle, altitude, distToGround,
-                                                  incRayIntersectsGround);
-        }
+        // Direction to the source of incident ray
+        const vec3 incDir = incidentRay.xyz;
+        const bool incRayIntersectsGround = incidentRay.w>=0;
+        const float distToGround = max(incidentRay.w, 0.);
+        const vec4 transmittanceToGround = texelFetch(incidentRayTransmittanceTable, tableCoords, 0);
 
         vec4 incidentRadiance = vec4(0);
         // Only for scatteringOrder==2 we consider radiation from ground in a separate run
@@ -78,12 +80,14 @@ vec4 computeMultipleScattering(const float cosSunZenithAngle, const float cosVie
                                const float altitude, const bool viewRayIntersectsGround)
 {
     const float r=earthRadius+altitude;
-    const float dl = distanceToNearestAtmosphereBoundary(cosViewZenithAngle, altitude, viewRayIntersectsGround) /
-                                                  radialIntegrationPoints;
+    const float rayLength=distanceToNearestAtmosphereBoundary(cosViewZenithAngle, altitude, viewRayIntersectsGround);
+    // The end points make it one more than the number of steps
+    const int nodeCount=radialIntegrationPoints+1;
     vec4 radiance=vec4(0);
-    for(int n=0; n <= radialIntegrationPoints; ++n)
+    for(int n=0; n < nodeCount; ++n)
     {
-        const float dist=n*dl;
+        const vec2 node=radialQuadratureNode(n, nodeCount, rayLength, cosViewZenithAngle, altitude);
+        const float dist=node.x;
         // Clamping only guards against rounding errors here, we don't try to handle here the case when the
         // endpoint of the view ray intentionally appears in outer space.
         const float altAtDist=clampAltitude(sqrt(sqr(dist)+sqr(r)+2*r*dist*cosViewZenithAngle)-earthRadius);
@@ -93,8 +97,7 @@ vec4 computeMultipleScattering(const float cosSunZenithAngle, const float cosVie
         const vec4 scDensity=sample4DTexture(scatteringDensityTexture, cosSZAatDist, cosVZAatDist,
                                              dotViewSun, altAtDist, viewRayIntersectsGround);
         const vec4 xmittance=transmittance(cosViewZenithAngle, altitude, dist, viewRayIntersectsGround);
-        const float weight = n==0||n==radialIntegrationPoints ? 0.5 : 1; // weight by trapezoidal rule
-        radiance += scDensity*xmittance*weight*dl;
+        radiance += scDensity*xmittance*node.y;
     }
     return radiance;
 }
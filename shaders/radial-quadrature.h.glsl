@@ -0,0 +1,6 @@
+#ifndef INCLUDE_ONCE_E4A0C9D3_7B1F_4E62_9F85_0C3B6A2D51F7
+#define INCLUDE_ONCE_E4A0C9D3_7B1F_4E62_9F85_0C3B6A2D51F7
+// Distance along the ray (x) and weight (y) of node n of the radial quadrature rule with nodeCount nodes. The
+// ray starts at the given altitude and has the given length, so that the nodes can follow the density.
+vec2 radialQuadratureNode(int n, int nodeCount, float rayLength, float cosZenithAngle, float altitude);
+#endif
@@ -5,6 +5,7 @@
 #include "densities.h.glsl"
 #include "common-functions.h.glsl"
 #include "texture-sampling-functions.h.glsl"
+#include "radial-quadrature.h.glsl"
 #include_if(ALL_SCATTERERS_AT_ONCE_WITH_PHASE_FUNCTION) "phase-functions.h.glsl"
 
 float cosZenithAngle(vec3 origin, vec3 direction)
@@ -50,26 +51,16 @@ vec4 computeSingleScatteringEclipsed(const vec3 camera, const vec3 viewDir, cons
     const float integrInterval=distanceToNearestAtmosphereBoundary(cosViewZenithAngle, altitude,
                                                                    viewRayIntersectsGround);
 
-    // Using trapezoid rule on a uniform grid: f0/2+f1+f2+...+f(N-2)+f(N-1)/2.
-    // Initializing with sum of values at endpoints, with weight of 0.5
-    const vec4 end1=computeSingleScatteringIntegrandEclipsed(cosSunZenithAngle, cosViewZenithAngle, dotViewSun,
-                                                             altitude, 0, viewRayIntersectsGround,
-                                                             camera, sunDir, moonPos);
-    const vec4 end2=computeSingleScatteringIntegrandEclipsed(cosSunZenithAngle, cosViewZenithAngle, dotViewSun,
-                                                             altitude, integrInterval, viewRayIntersectsGround,
-                                                             camera+viewDir*integrInterval, sunDir, moonPos);
-    vec4 spectrum=(end1+end2)*0.5;
-
-    const float dl=integrInterval/(radialIntegrationPoints-1);
-    for(int n=1; n<radialIntegrationPoints-1; ++n)
+    vec4 spectrum=vec4(0);
+    for(int n=0; n<radialIntegrationPoints; ++n)
     {
-        const float dist=n*dl;
-        spectrum += computeSingleScatteringIntegrandEclipsed(cosSunZenithAngle, cosViewZenithAngle, dotViewSun,
-                                                             altitude, dist, viewRayIntersectsGround,
-                                                             camera+viewDir*dist, sunDir, moonPos);
+        const vec2 node=radialQuadratureNode(n, radialIntegrationPoints, integrInterval, cosViewZenithAngle, altitude);
+        spectrum += node.y*computeSingleScatteringIntegrandEclipsed(cosSunZenithAngle, cosViewZenithAngle, dotViewSun,
+                                                                    altitude, node.x, viewRayIntersectsGround,
+                                                                    camera+viewDir*node.x, sunDir, moonPos);
     }
 
-    spectrum *= dl*solarIrradianceAtTOA
+    spectrum *= solarIrradianceAtTOA
 #if ALL_SCATTERERS_AT_ONCE_WITH_PHASE_FUNCTION
                                 // the multiplier is already included
 #else
@@ -5,6 +5,7 @@
 #include "densities.h.glsl"
 #include "common-functions.h.glsl"
 #include "single-scattering.h.glsl"
+#include "radial-quadrature.h.glsl"
 #include "texture-sampling-functions.h.glsl"
 
 // This function omits phase function and solar irradiance: these are to be applied somewhere in the calling code.
@@ -33,21 +34,13 @@ vec4 computeSingleScattering(const float cosSunZenithAngle, const float cosViewZ
     const float integrInterval=distanceToNearestAtmosphereBoundary(cosViewZenithAngle, altitude,
                                                                    viewRayIntersectsGround);
 
-    // Using trapezoid rule on a uniform grid: f0/2+f1+f2+...+f(N-2)+f(N-1)/2.
-    // Initializing with sum of values at endpoints, with weight of 0.5
-    const vec4 end1=computeSingleScatteringIntegrand(cosSunZenithAngle, cosViewZenithAngle, dotViewSun,
-                                                     altitude, 0, viewRayIntersectsGround);
-    const vec4 end2=computeSingleScatteringIntegrand(cosSunZenithAngle, cosViewZenithAngle, dotViewSun,
-                                                     altitude, integrInterval, viewRayIntersectsGround);
-    vec4 spectrum=(end1+end2)*0.5;
-
-    const float dl=integrInterval/(radialIntegrationPoints-1);
-    for(int n=1; n<radialIntegrationPoints-1; ++n)
+    vec4 spectrum=vec4(0);
+    for(int n=0; n<radialIntegrationPoints; ++n)
     {
-        const float dist=n*dl;
-        spectrum += computeSingleScatteringIntegrand(cosSunZenithAngle, cosViewZenithAngle, dotViewSun,
-                                                     altitude, dist, viewRayIntersectsGround);
+        const vec2 node=radialQuadratureNode(n, radialIntegrationPoints, integrInterval, cosViewZenithAngle, altitude);
+        spectrum += node.y*computeSingleScatteringIntegrand(cosSunZenithAngle, cosViewZenithAngle, dotViewSun,
+                                                            altitude, node.x, viewRayIntersectsGround);
     }
-    spectrum *= dl*solarIrradianceAtTOA*scatteringCrossSection();
+    spectrum *= solarIrradianceAtTOA*scatteringCrossSection();
     return spectrum;
 }
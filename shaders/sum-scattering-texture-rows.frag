@@ -0,0 +1,15 @@
+#version 330
+#extension GL_ARB_shading_language_420pack : require
+
+uniform sampler3D tex;
+out vec4 rowSum;
+
+// Sums the texels of each row of the 3D texture, so that only a small 2D texture needs to be read back
+void main()
+{
+    const ivec2 rowCoords=ivec2(gl_FragCoord.xy);
+    const int width=textureSize(tex,0).x;
+    rowSum=vec4(0);
+    for(int x=0; x<width; ++x)
+        rowSum+=texelFetch(tex, ivec3(x,rowCoords), 0);
+}
@@ -11,6 +11,10 @@ uniform sampler2D transmittanceTexture;
 uniform float staticAltitudeTexCoord=-1;
 uniform float eclipsedDoubleScatteringAltitudeAlphaUpper;
 uniform vec3 eclipsedDoubleScatteringTextureSize;
+// Ranges [first, last] of SZA indices present in the sampled 4D textures, which may cover only a part of the
+// SZA range (see precomputedSZAIndexRange() in AtmosphereParameters)
+uniform vec2 scatteringTextureSZAIndexRange=vec2(0, scatteringTextureSize[2]-1);
+uniform vec2 eclipsedDoubleScatteringSZAIndexRange;
 
 struct Scattering4DCoords
 {
@@ -20,14 +24,6 @@ struct Scattering4DCoords
     float altitude;
     bool viewRayIntersectsGround;
 };
-struct TexCoordPair
-{
-    vec3 lower;
-    float alphaLower;
-    vec3 upper;
-    float alphaUpper;
-};
-
 struct EclipseScattering2DCoords
 {
     float azimuth;
@@ -50,6 +46,13 @@ vec2 unitRangeToTexCoord(const vec2 u, const float texSize)
                 unitRangeToTexCoord(u.t,texSize));
 }
 
+// Fractional index into a dimension of a texture that only has the points [indexRange[0], indexRange[1]] out of
+// fullTexSize points, clamped to the points present
+float unitRangeToIndexInRange(const float u, const float fullTexSize, const vec2 indexRange)
+{
+    return clamp(u*(fullTexSize-1)-indexRange[0], 0., indexRange[1]-indexRange[0]);
+}
+
 TransmittanceTexVars transmittanceTexCoordToTexVars(const vec2 texCoord)
 {
     const float distToHorizon=LENGTH_OF_HORIZ_RAY_FROM_GROUND_TO_BORDER_OF_ATMO *
@@ -189,8 +192,8 @@ TexCoordPair scattering4DCoordsToTexCoords(const Scattering4DCoords coords)
 
     // Width and height of the 2D subspace of the 4D texture - the subspace spanned by
     // the texture coordinates we combine into a single sampler3D coordinate.
-    const float texW=scatteringTextureSize[1], texH=scatteringTextureSize[2];
-    const float cosSZAIndex=coords.cosSunZenithAngle*(texH-1);
+    const float texW=scatteringTextureSize[1], texH=scatteringTextureSZAIndexRange[1]-scatteringTextureSZAIndexRange[0]+1;
+    const float cosSZAIndex=unitRangeToIndexInRange(coords.cosSunZenithAngle, scatteringTextureSize[2], scatteringTextureSZAIndexRange);
     const vec2 combiCoordUnitRange=vec2(floor(cosSZAIndex)*texW+coords.dotViewSun*(texW-1),
                                         ceil (cosSZAIndex)*texW+coords.dotViewSun*(texW-1)) / (texW*texH-1);
     const vec2 combinedCoord=unitRangeToTexCoord(combiCoordUnitRange, texW*texH);
@@ -390,7 +393,9 @@ vec4 sampleEclipseDoubleScattering4DTexture(sampler3D texLower, sampler3D texUpp
 {
     const vec2 coords2d=eclipseTexVarsToTexCoords(azimuthRelativeToSun, cosViewZenithAngle, altitude, viewRayIntersectsGround,
                                                   eclipsedDoubleScatteringTextureSize.st);
-    const float cosSZACoord=unitRangeToTexCoord(cosSZAToUnitRangeTexCoord(cosSunZenithAngle), eclipsedDoubleScatteringTextureSize[2]);
+    const float cosSZAIndex=unitRangeToIndexInRange(cosSZAToUnitRangeTexCoord(cosSunZenithAngle), eclipsedDoubleScatteringTextureSize[2],
+                                                    eclipsedDoubleScatteringSZAIndexRange);
+    const float cosSZACoord=(cosSZAIndex+0.5)/(eclipsedDoubleScatteringSZAIndexRange[1]-eclipsedDoubleScatteringSZAIndexRange[0]+1);
     const vec3 texCoords=vec3(coords2d, cosSZACoord);
 
     const vec4 upper=texture(texUpper, texCoords);
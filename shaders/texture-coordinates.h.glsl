@@ -27,6 +27,17 @@ struct ScatteringTexVars
     bool viewRayIntersectsGround;
 };
 ScatteringTexVars scatteringTexIndicesToTexVars(const vec3 texIndices);
+// A sample of a 4D texture is interpolated between two samples of the 3D texture it's stored in
+struct TexCoordPair
+{
+    vec3 lower;
+    float alphaLower;
+    vec3 upper;
+    float alphaUpper;
+};
+TexCoordPair texVarsToScatteringTexCoords(const float cosSunZenithAngle, const float cosViewZenithAngle,
+                                          const float dotViewSun, const float altitude,
+                                          const bool viewRayIntersectsGround);
 vec4 sample4DTexture(const sampler3D tex, const float cosSunZenithAngle, const float cosViewZenithAngle,
                      const float dotViewSun, const float altitude, const bool viewRayIntersectsGround);
 
@@ -0,0 +1,50 @@
+#include <cmath>
+#include <iostream>
+#include "../common/gauss-legendre.hpp"
+
+constexpr double integralRelativeTolerance=1e-12;
+#define FAIL(details) { std::cerr << __FILE__ << ":" << __LINE__  << ": test failed: " << details << "\n"; return 1; }
+
+int main()
+{
+    for(int count=1; count<=64; ++count)
+    {
+        const auto nodes=gaussLegendreNodes(count);
+        if(int(nodes.size())!=count)
+            FAIL("got " << nodes.size() << " nodes instead of " << count);
+        for(int i=0; i<count; ++i)
+        {
+            if(!(nodes[i].x>0 && nodes[i].x<1))
+                FAIL("node #" << i << " of the " << count << "-point rule is outside of (0,1): " << nodes[i].x);
+            if(i>0 && !(nodes[i].x>nodes[i-1].x))
+                FAIL("nodes #" << i-1 << " and #" << i << " of the " << count << "-point rule aren't in ascending order");
+            if(!(nodes[i].weight>0))
+                FAIL("weight #" << i << " of the " << count << "-point rule isn't positive: " << nodes[i].weight);
+        }
+
+        // The n-point rule must integrate exactly all the polynomials of degree up to 2n-1,
+        // and the integral of x^degree on [0,1] is 1/(degree+1). Degree 0 checks that the weights sum to 1.
+        for(int degree=0; degree<=2*count-1; ++degree)
+        {
+            double integral=0;
+            for(const auto& node : nodes)
+                integral += node.weight*std::pow(node.x, degree);
+            const double reference=1./(degree+1);
+            if(std::abs(integral-reference)/reference > integralRelativeTolerance)
+            {
+                FAIL("the " << count << "-point rule gives " << integral << " instead of " << reference
+                     << " for the integral of x^" << degree);
+            }
+        }
+
+        // The rule isn't exact for degree 2n, otherwise the checks above would be too weak to catch a wrong rule.
+        // The error quickly falls below the tolerance as the count grows, so only the small counts are checked.
+        if(count>8) continue;
+        double integral=0;
+        for(const auto& node : nodes)
+            integral += node.weight*std::pow(node.x, 2*count);
+        const double reference=1./(2*count+1);
+        if(std::abs(integral-reference)/reference <= integralRelativeTolerance)
+            FAIL("the " << count << "-point rule is unexpectedly exact for x^" << 2*count);
+    }
+}
@@ -0,0 +1,99 @@
+#include "../CalcMySky/half-precision.hpp"
+#include "../common/texture-file.hpp"
+#include <cmath>
+#include <limits>
+#include <iostream>
+#include <glm/gtc/packing.hpp>
+
+// Half precision has 11 significant bits, so rounding to nearest gives at most half of the unit in the last place
+constexpr double halfPrecisionRelativeTolerance=1./2048;
+#define FAIL(details) { std::cerr << __FILE__ << ":" << __LINE__  << ": test failed: " << details << "\n"; return 1; }
+
+int main()
+{
+    const std::string path="test.f16";
+    const std::vector<uint16_t> sizes{3,2};
+    const std::vector<float> texels{1, 0.5, 0.25, 1,
+                                    3.14159265f, -2.71828183f, 1e-3f, 65504,
+                                    0, -0., 1e-6f, 1e5f, // zeros, subnormal and overflowing values
+                                    std::numeric_limits<float>::infinity(), 123.456f, 7.89e-4f, 1,
+                                    0.1f, 0.2f, 0.3f, 0.4f,
+                                    1e4f, 2e-2f, 3e-3f, 4e-4f};
+    const size_t overflowingIndex=11, subnormalIndex=10;
+
+    // Write the file to memory as CalcMySky does
+    std::vector<uint16_t> file=textureFileHeader(sizes, TextureElementType::Float16);
+    const auto halves=toHalfPrecision(texels.data(), texels.size(), path);
+    if(halves.size()!=texels.size())
+        FAIL("converted " << halves.size() << " values instead of " << texels.size());
+    file.insert(file.end(), halves.begin(), halves.end());
+
+    // Read it back as ShowMySky does
+    size_t pos=0;
+    const auto readValue=[&file,&pos](uint16_t& value) { value=pos<file.size() ? file[pos] : 0; ++pos; };
+    uint16_t readSizes[2];
+    const auto type=parseTextureFileHeader(readValue, readSizes, 2);
+    if(type!=uint16_t(TextureElementType::Float16))
+        FAIL("read type of texel components " << type << " instead of " << uint16_t(TextureElementType::Float16));
+    if(readSizes[0]!=sizes[0] || readSizes[1]!=sizes[1])
+        FAIL("read sizes " << readSizes[0] << "x" << readSizes[1] << " instead of " << sizes[0] << "x" << sizes[1]);
+    if(file.size()-pos != size_t(sizes[0])*sizes[1]*4)
+        FAIL("header length mismatch: " << file.size()-pos << " values remain after the header");
+
+    for(size_t i=0; i<texels.size(); ++i)
+    {
+        const float x=texels[i];
+        const float y=glm::unpackHalf1x16(file[pos+i]);
+        if(i==overflowingIndex || std::isinf(x))
+        {
+            if(!std::isinf(y) || std::signbit(x)!=std::signbit(y))
+                FAIL("value #" << i << " " << x << " was read back as " << y << " instead of infinity of the same sign");
+        }
+        else if(i==subnormalIndex)
+        {
+            if(std::abs(y-x) > 6e-8)
+                FAIL("subnormal value #" << i << " " << x << " was read back as " << y);
+        }
+        else if(x==0)
+        {
+            if(y!=0 || std::signbit(x)!=std::signbit(y))
+                FAIL("zero #" << i << " was read back as " << y);
+        }
+        else if(std::abs(double(y)-x)/std::abs(x) > halfPrecisionRelativeTolerance)
+        {
+            FAIL("value #" << i << " " << x << " was read back as " << y);
+        }
+    }
+
+    const auto errors=takeHalfPrecisionErrors();
+    if(errors.size()!=1 || errors.count(path)!=1)
+        FAIL("unexpected set of converted files in the statistics");
+    const auto& error=errors.at(path);
+    if(error.count!=texels.size())
+        FAIL("statistics have " << error.count << " values instead of " << texels.size());
+    if(error.overflowCount!=1)
+        FAIL("statistics have " << error.overflowCount << " overflowed values instead of 1");
+    if(error.underflowCount!=1)
+        FAIL("statistics have " << error.underflowCount << " underflowed values instead of 1");
+    // The infinite input is not counted in any category, the zeros are below the normal range
+    if(error.normalCount!=texels.size()-5)
+        FAIL("statistics have " << error.normalCount << " values in the normal range instead of " << texels.size()-5);
+    if(error.maxRelError > halfPrecisionRelativeTolerance)
+        FAIL("maximum relative error in the statistics is " << error.maxRelError);
+    if(!takeHalfPrecisionErrors().empty())
+        FAIL("statistics weren't cleared after being taken");
+
+    // Single-precision files must keep the plain header to stay readable by older versions of ShowMySky
+    if(textureFileHeader(sizes, TextureElementType::Float32)!=sizes)
+        FAIL("header of a single-precision texture differs from the plain sizes");
+    pos=0;
+    file=sizes;
+    if(parseTextureFileHeader(readValue, readSizes, 2)!=uint16_t(TextureElementType::Float32) ||
+       readSizes[0]!=sizes[0] || readSizes[1]!=sizes[1] || pos!=sizes.size())
+        FAIL("plain header wasn't read as a single-precision one");
+
+    file={TEXTURE_FILE_EXTENDED_HEADER_MARK, 8, 3, 2};
+    pos=0;
+    if(isSupportedTextureElementType(parseTextureFileHeader(readValue, readSizes, 2)))
+        FAIL("unknown type of texel components was accepted");
+}
@@ -0,0 +1,198 @@
+#include <cmath>
+#include <vector>
+#include <cstring>
+#include <iterator>
+#include <iostream>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QDir>
+#include <glm/gtc/packing.hpp>
+#include "../CalcMySky/const.hpp"
+#include "../CalcMySky/merge-textures.hpp"
+#include "../common/util.hpp"
+#include "../common/AtmosphereParameters.hpp"
+
+// Single-precision sums of a few terms of similar magnitudes
+constexpr double sumRelativeTolerance=1e-6;
+// Half precision has 11 significant bits
+constexpr double halfPrecisionRelativeTolerance=1./2048;
+#define FAIL(details) { std::cerr << __FILE__ << ":" << __LINE__  << ": test failed: " << details << "\n"; return 1; }
+
+bool writePartial(QString const& path, std::vector<uint16_t> const& sizes, std::vector<float> const& data)
+{
+    QFile file(path);
+    if(!file.open(QFile::WriteOnly)) return false;
+    const auto header=textureFileHeader(sizes, TextureElementType::Float32);
+    file.write(reinterpret_cast<const char*>(header.data()), header.size()*sizeof header[0]);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size()*sizeof data[0]);
+    file.close();
+    return !file.error();
+}
+
+float partialValue(const unsigned partialIndex, const size_t subpixelIndex)
+{
+    return 1+0.5f*partialIndex+std::sin(0.001f*subpixelIndex*(partialIndex+1));
+}
+
+int writePartials(QString const& dirPath, QString const& baseName, const unsigned (&wavelengthSetRanges)[3][2],
+                  std::vector<uint16_t> const& sizes)
+{
+    size_t subpixelCount=4;
+    for(const auto s : sizes)
+        subpixelCount *= s;
+    for(unsigned i=0; i<std::size(wavelengthSetRanges); ++i)
+    {
+        std::vector<float> data(subpixelCount);
+        for(size_t k=0; k<subpixelCount; ++k)
+            data[k]=partialValue(i,k);
+        const auto fileName=QString("%1%2%3-%4.f32").arg(baseName).arg(PARTIAL_ACCUMULATOR_SUFFIX)
+                                                    .arg(wavelengthSetRanges[i][0]).arg(wavelengthSetRanges[i][1]);
+        if(!writePartial(QDir(dirPath).filePath(fileName), sizes, data))
+            FAIL("failed to write partial texture " << fileName);
+    }
+    return 0;
+}
+
+int checkMerge(std::vector<PartialTexture> const& partials, QString const& outPath, std::vector<uint16_t> const& sizes)
+{
+    size_t subpixelCount=4;
+    for(const auto s : sizes)
+        subpixelCount *= s;
+
+    for(const auto elementType : {TextureElementType::Float32, TextureElementType::Float16})
+    {
+        mergeTextures(partials, outPath, sizes, elementType);
+
+        QFile file(outPath);
+        if(!file.open(QFile::ReadOnly))
+            FAIL("failed to open the merged texture");
+        const auto bytes=file.readAll();
+        size_t pos=0;
+        const auto readValue=[&bytes,&pos](uint16_t& value)
+        {
+            value=0;
+            if(pos+sizeof value<=size_t(bytes.size()))
+                std::memcpy(&value, bytes.data()+pos, sizeof value);
+            pos+=sizeof value;
+        };
+        uint16_t readSizes[4];
+        if(parseTextureFileHeader(readValue, readSizes, 4)!=uint16_t(elementType))
+            FAIL("merged texture has wrong type of texel components");
+        for(unsigned i=0; i<sizes.size(); ++i)
+            if(readSizes[i]!=sizes[i])
+                FAIL("merged texture has size " << readSizes[i] << " instead of " << sizes[i] << " in dimension " << i);
+        const auto elementSize=textureElementSize(elementType);
+        if(size_t(bytes.size())-pos != subpixelCount*elementSize)
+            FAIL("merged texture has " << size_t(bytes.size())-pos << " bytes of data instead of " << subpixelCount*elementSize);
+
+        const auto tolerance = elementType==TextureElementType::Float16 ? halfPrecisionRelativeTolerance : sumRelativeTolerance;
+        for(size_t k=0; k<subpixelCount; ++k)
+        {
+            double reference=0;
+            for(unsigned i=0; i<partials.size(); ++i)
+                reference += partialValue(i,k);
+
+            float value;
+            if(elementType==TextureElementType::Float16)
+            {
+                uint16_t half;
+                std::memcpy(&half, bytes.data()+pos+k*sizeof half, sizeof half);
+                value=glm::unpackHalf1x16(half);
+            }
+            else
+            {
+                std::memcpy(&value, bytes.data()+pos+k*sizeof value, sizeof value);
+            }
+            if(std::abs(value-reference)/reference > tolerance)
+                FAIL("merged subpixel #" << k << " is " << value << " instead of " << reference);
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    QTemporaryDir dir;
+    if(!dir.isValid())
+        FAIL("failed to create a temporary directory");
+
+    // More subpixels than in one chunk of the merge, so that the chunks are tested too
+    const std::vector<uint16_t> sizes{128,32,16,5};
+
+    const QString baseName="multiple-scattering";
+    const unsigned wavelengthSetRanges[3][2]={{0,1},{2,2},{3,6}};
+    const unsigned wavelengthSetCount=7;
+    const unsigned partialCount=std::size(wavelengthSetRanges);
+    if(const auto ret=writePartials(dir.path(), baseName, wavelengthSetRanges, sizes))
+        return ret;
+    // Must not be taken for a partial texture of the same name
+    if(!writePartial(QDir(dir.path()).filePath(baseName+"-xyzw.f32"), sizes, {}))
+        FAIL("failed to write a decoy texture");
+
+    const auto partials=findPartialTextures(dir.path(), baseName);
+    if(partials.size()!=partialCount)
+        FAIL("found " << partials.size() << " partial textures instead of " << partialCount);
+    for(unsigned i=0; i<partialCount; ++i)
+    {
+        if(partials[i].firstWavelengthSet!=wavelengthSetRanges[i][0] || partials[i].lastWavelengthSet!=wavelengthSetRanges[i][1])
+        {
+            FAIL("partial texture #" << i << " covers wavelength sets " << partials[i].firstWavelengthSet << "-"
+                 << partials[i].lastWavelengthSet << " instead of " << wavelengthSetRanges[i][0] << "-" << wavelengthSetRanges[i][1]);
+        }
+    }
+
+    try
+    {
+        checkCoverage(partials, baseName, wavelengthSetCount);
+    }
+    catch(MustQuit const&)
+    {
+        FAIL("contiguous partial textures were rejected");
+    }
+    for(const auto& badPartials : {std::vector<PartialTexture>{partials[0], partials[2]},
+                                   std::vector<PartialTexture>{partials[1], partials[2]},
+                                   std::vector<PartialTexture>{partials[0], partials[1]}})
+    {
+        bool rejected=false;
+        try { checkCoverage(badPartials, baseName, wavelengthSetCount); }
+        catch(MustQuit const&) { rejected=true; }
+        if(!rejected)
+            FAIL("partial textures that don't cover all the wavelength sets contiguously were accepted");
+    }
+
+    if(const auto ret=checkMerge(partials, QDir(dir.path()).filePath("merged.f32"), sizes))
+        return ret;
+
+    // With the precomputed domain restricted, calcmysky saves only the part of the accumulators that covers it
+    AtmosphereParameters atmo;
+    atmo.earthRadius=6371e3;
+    atmo.atmosphereHeight=120e3;
+    atmo.lengthOfHorizRayFromGroundToBorderOfAtmo=std::sqrt(atmo.atmosphereHeight*(atmo.atmosphereHeight+2*atmo.earthRadius));
+    atmo.scatteringTextureSize=glm::ivec4(16,8,32,24);
+    atmo.minPrecomputedAltitude=0;
+    atmo.maxPrecomputedAltitude=10e3;
+    atmo.minPrecomputedSunZenithAngle=0;
+    atmo.maxPrecomputedSunZenithAngle=M_PI/3;
+    const auto croppedSizes=partialTextureSizes(atmo);
+    if(croppedSizes.size()!=4 || croppedSizes[0]!=16 || croppedSizes[1]!=8 ||
+       croppedSizes[2]<2 || croppedSizes[2]>=32 || croppedSizes[3]<2 || croppedSizes[3]>=24)
+    {
+        FAIL("sizes of partial textures for a restricted precomputed domain aren't cropped: " << croppedSizes[0] << "x"
+             << croppedSizes[1] << "x" << croppedSizes[2] << "x" << croppedSizes[3]);
+    }
+
+    const auto croppedDirPath=QDir(dir.path()).filePath("cropped");
+    if(!QDir(dir.path()).mkdir("cropped"))
+        FAIL("failed to create a directory for cropped textures");
+    if(const auto ret=writePartials(croppedDirPath, baseName, wavelengthSetRanges, croppedSizes))
+        return ret;
+    if(const auto ret=checkMerge(findPartialTextures(croppedDirPath, baseName), QDir(croppedDirPath).filePath("merged.f32"), croppedSizes))
+        return ret;
+
+    // Partial textures of the whole domain don't match a restricted one
+    bool rejected=false;
+    try { mergeTextures(partials, QDir(croppedDirPath).filePath("merged.f32"), croppedSizes, TextureElementType::Float32); }
+    catch(MustQuit const&) { rejected=true; }
+    if(!rejected)
+        FAIL("partial textures of the whole domain were merged as cropped ones");
+}